@@ -0,0 +1,82 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/alloc_profiler.h"
+
+#include <algorithm>
+#include <vector>
+
+thread_local uint64_t AllocProfiler::total_ = 0;
+thread_local bool AllocProfiler::enabled_ = false;
+thread_local int AllocProfiler::line_ = 0;
+thread_local std::map<int, std::array<AllocProfiler::Counter, AllocProfiler::KIND_COUNT>> *AllocProfiler::lines_ =
+    nullptr;
+
+static const char *kind_names[] = {
+    "environment",
+    "variable",
+    "closure",
+    "bound method",
+    "instance",
+    "string",
+    "arguments",
+    "array",
+};
+
+void AllocProfiler::attribute(Kind kind, size_t bytes) {
+    if (lines_ == nullptr) {
+        lines_ = new std::map<int, std::array<Counter, KIND_COUNT>>();
+    }
+    Counter &counter = (*lines_)[line_][kind];
+    counter.count++;
+    counter.bytes += bytes;
+}
+
+void AllocProfiler::report(std::ostream &os, size_t top) {
+    if (lines_ == nullptr) {
+        os << "alloc profile: no allocations" << std::endl;
+        return;
+    }
+
+    std::array<Counter, KIND_COUNT> kinds{};
+    std::vector<std::pair<int, Counter>> lines;
+    for (const auto &item : *lines_) {
+        Counter line_total;
+        for (int kind = 0; kind < KIND_COUNT; kind++) {
+            kinds[kind].count += item.second[kind].count;
+            kinds[kind].bytes += item.second[kind].bytes;
+            line_total.count += item.second[kind].count;
+            line_total.bytes += item.second[kind].bytes;
+        }
+        lines.emplace_back(item.first, line_total);
+    }
+
+    os << "alloc profile: allocations and bytes by kind" << std::endl;
+    for (int kind = 0; kind < KIND_COUNT; kind++) {
+        if (kinds[kind].count > 0) {
+            os << "    " << kind_names[kind] << ": " << kinds[kind].count << " allocs, " << kinds[kind].bytes
+               << " bytes" << std::endl;
+        }
+    }
+
+    std::sort(lines.begin(), lines.end(), [](const auto &a, const auto &b) {
+        return a.second.count > b.second.count || (a.second.count == b.second.count && a.first < b.first);
+    });
+    if (lines.size() > top) {
+        lines.resize(top);
+    }
+    os << "alloc profile: allocations by line" << std::endl;
+    for (const auto &line : lines) {
+        os << "line " << line.first << ": " << line.second.count << " allocs, " << line.second.bytes << " bytes (";
+        const auto &counters = lines_->at(line.first);
+        const char *separator = "";
+        for (int kind = 0; kind < KIND_COUNT; kind++) {
+            if (counters[kind].count > 0) {
+                os << separator << kind_names[kind] << " " << counters[kind].count;
+                separator = ", ";
+            }
+        }
+        os << ")" << std::endl;
+    }
+}
@@ -0,0 +1,81 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+
+/*
+ * Counts the heap allocations the interpreter makes on behalf of a script.
+ * The running total is always kept, it backs the allocations() builtin that
+ * tests use to check a loop has reached an allocation-free steady state. With
+ * --alloc-profile on, every allocation is also attributed to its object kind
+ * and to the source line the interpreter was evaluating when it happened.
+ */
+class AllocProfiler {
+ public:
+    enum Kind {
+        ENVIRONMENT,
+        VARIABLE,
+        CLOSURE,
+        BOUND_METHOD,
+        INSTANCE,
+        STRING,
+        ARGUMENTS,
+        ARRAY,
+        KIND_COUNT,
+    };
+
+    static void record(Kind kind, size_t bytes) {
+        total_++;
+        if (enabled_) {
+            attribute(kind, bytes);
+        }
+    }
+
+    static uint64_t total() {
+        return total_;
+    }
+
+    static void enable() {
+        enabled_ = true;
+    }
+
+    static bool enabled() {
+        return enabled_;
+    }
+
+    // attributes allocations to the line of the innermost node being evaluated
+    class LineScope {
+     public:
+        explicit LineScope(int line) : previous_(line_) {
+            line_ = line;
+        }
+        ~LineScope() {
+            line_ = previous_;
+        }
+
+     private:
+        int previous_;
+    };
+
+    static void report(std::ostream &os, size_t top);
+
+ private:
+    struct Counter {
+        uint64_t count{0};
+        uint64_t bytes{0};
+    };
+
+    static void attribute(Kind kind, size_t bytes);
+
+    static thread_local uint64_t total_;
+    static thread_local bool enabled_;
+    static thread_local int line_;
+    static thread_local std::map<int, std::array<Counter, KIND_COUNT>> *lines_;
+};
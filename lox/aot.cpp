@@ -0,0 +1,144 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/aot.h"
+
+#include <ostream>
+#include <utility>
+
+#include "lox/exception.h"
+#include "lox/lox.h"
+
+namespace aot {
+
+Interpreter *interpreter = nullptr;
+
+namespace {
+
+// a call a body returned in tail position, made once the body's frame is gone
+struct TailCall {
+    Callable::ptr callee;
+    std::vector<Value> arguments;
+    int line{0};
+};
+
+thread_local TailCall pending;
+
+// makes the tail calls result leaves pending, each in place of the frame of the one before
+Value finish(Interpreter *interpreter, Value result) {
+    while (pending.callee) {
+        Callable::ptr callee = std::move(pending.callee);
+        std::vector<Value> arguments = std::move(pending.arguments);
+        interpreter->call_stack().replace(callee, pending.line);
+        if (auto *function = dynamic_cast<Function *>(callee.get())) {
+            result = function->run(arguments);
+        } else {
+            result = static_cast<Method *>(callee.get())->run(arguments);
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+Value Function::call(Interpreter *interpreter, const std::vector<Value> &arguments) {
+    return finish(interpreter, body_(arguments));
+}
+
+Value Method::call(Interpreter *interpreter, const std::vector<Value> &arguments) {
+    return finish(interpreter, (*body_)(self_, arguments));
+}
+
+LoxFunction::ptr Method::make(const std::string &name, int arity, int line, Body body) {
+    std::vector<Token::ptr> params;
+    for (int i = 0; i < arity; i++) {
+        params.push_back(token(Token::IDENTIFIER, "_" + std::to_string(i), line));
+    }
+    auto declaration = std::make_shared<stmt::Function>(token(Token::IDENTIFIER, name, line), params, nullptr);
+    return std::make_shared<Method>(std::move(declaration), std::make_shared<const Body>(std::move(body)), nullptr);
+}
+
+Value call(const Token::ptr &paren, std::vector<Value> values) {
+    Value callee = std::move(values.front());
+    values.erase(values.begin());
+    return interpreter->invoke(paren, interpreter->to_callable(callee, paren, values.size()), values);
+}
+
+Value tail_call(const Token::ptr &paren, std::vector<Value> values) {
+    Value callee = std::move(values.front());
+    values.erase(values.begin());
+    Callable::ptr callable = interpreter->to_callable(callee, paren, values.size());
+    // classes and natives don't recurse through the script, they are called as usual
+    if (dynamic_cast<Function *>(callable.get()) == nullptr && dynamic_cast<Method *>(callable.get()) == nullptr) {
+        return interpreter->invoke(paren, callable, values);
+    }
+    pending = {std::move(callable), std::move(values), paren->line};
+    return Value();
+}
+
+Value set(const Token::ptr &name, const Operands &operands) {
+    auto *instance = operands.left.get_if<LoxInstance::ptr>();
+    if (instance == nullptr) {
+        throw RuntimeError(name, "Only instances have fields.");
+    }
+    (*instance)->set(name, operands.right);
+    return operands.right;
+}
+
+Value super_method(const Token::ptr &method, const Value &superclass, const LoxInstance::ptr &self) {
+    LoxFunction::ptr found = superclass.as<LoxClass::ptr>()->find_method(method->lexeme);
+    if (found == nullptr) {
+        throw RuntimeError(method, "Undefined property '" + method->lexeme + "'.");
+    }
+    return found->bind(self);
+}
+
+Value global(const Token::ptr &name) {
+    return interpreter->globals()->get(name);
+}
+
+Value assign_global(const Token::ptr &name, const Value &value) {
+    interpreter->globals()->assign(name, value);
+    return value;
+}
+
+void print(const Value &value) {
+    *interpreter->output() << value.str() << std::endl;
+}
+
+void check_superclass(const Token::ptr &name, const Value &superclass) {
+    if (!superclass.is<LoxClass::ptr>()) {
+        throw RuntimeError(name, "Superclass must be a class.");
+    }
+}
+
+Value make_class(const std::string &name, const Value &superclass,
+                 std::unordered_map<std::string, LoxFunction::ptr> methods) {
+    LoxClass::ptr super;
+    if (superclass.is<LoxClass::ptr>()) {
+        super = superclass.as<LoxClass::ptr>();
+    }
+    return std::make_shared<LoxClass>(name, super, std::move(methods));
+}
+
+int main(Value (*script)(const std::vector<Value> &)) {
+    Interpreter runtime;
+    interpreter = &runtime;
+    Lox::Error error;
+    int exit_code = 0;
+    try {
+        runtime.call(std::make_shared<Function>("script", 0, script), {});
+    } catch (const RuntimeError &e) {
+        error = {e.what(), e.token->line, e.backtrace};
+    } catch (const ExitException &e) {
+        exit_code = e.code;
+    } catch (const std::exception &e) {
+        error = {e.what(), 0, {}};
+    }
+    Lox::report(error);
+    interpreter = nullptr;
+    return exit_code;
+}
+
+} // namespace aot
@@ -0,0 +1,135 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lox/callable.h"
+#include "lox/function.h"
+#include "lox/instance.h"
+#include "lox/interpreter.h"
+#include "lox/klass.h"
+#include "lox/token.h"
+#include "lox/value.h"
+
+/*
+ * The runtime C++ written by --emit-cpp links against, see CppEmitter. The
+ * generated code keeps its variables in C++ locals and statics and calls in
+ * here for everything the tree walker would do the same way: an Interpreter
+ * still provides the builtins, the output stream, the call stack with its
+ * depth limit and backtraces, and the semantics of operators on boxed
+ * values. Functions are C++ lambdas behind Callable, methods lambdas behind
+ * LoxFunction so that LoxClass and LoxInstance treat them like any other.
+ */
+namespace aot {
+
+// the interpreter of the running program, set by main()
+extern Interpreter *interpreter;
+
+// a function declared by the script
+class Function : public Callable {
+ public:
+    using Body = std::function<Value(const std::vector<Value> &)>;
+
+    Function(std::string name, int arity, Body body)
+        : name_(std::move(name)), arity_(arity), body_(std::move(body)) {}
+
+    std::string name() const override {
+        return name_;
+    }
+
+    int arity() const override {
+        return arity_;
+    }
+
+    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override;
+
+    // one activation, it may end with a pending tail call
+    Value run(const std::vector<Value> &arguments) const {
+        return body_(arguments);
+    }
+
+ private:
+    std::string name_;
+    int arity_;
+    Body body_;
+};
+
+// a method declared by the script, bound to its instance the way LoxFunction::bind binds
+class Method : public LoxFunction {
+ public:
+    using Body = std::function<Value(const LoxInstance::ptr &, const std::vector<Value> &)>;
+
+    Method(std::shared_ptr<stmt::Function> declaration, std::shared_ptr<const Body> body, LoxInstance::ptr self)
+        : LoxFunction(declaration.get(), nullptr), declaration_(std::move(declaration)), body_(std::move(body)),
+          self_(std::move(self)) {}
+
+    // the declaration has no body, only what LoxClass and backtraces read: the name, the arity and the line
+    static LoxFunction::ptr make(const std::string &name, int arity, int line, Body body);
+
+    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override;
+
+    // one activation, it may end with a pending tail call
+    Value run(const std::vector<Value> &arguments) const {
+        return (*body_)(self_, arguments);
+    }
+
+    LoxFunction::ptr bind(LoxInstance::ptr instance) override {
+        return std::make_shared<Method>(declaration_, body_, std::move(instance));
+    }
+
+ private:
+    std::shared_ptr<stmt::Function> declaration_;
+    std::shared_ptr<const Body> body_;
+    LoxInstance::ptr self_;
+};
+
+// both operands of a binary operator, braced so the left one is evaluated first
+struct Operands {
+    Value left;
+    Value right;
+};
+
+inline Token::ptr token(Token::Kind kind, const std::string &lexeme, int line) {
+    return std::make_shared<Token>(kind, lexeme, line);
+}
+
+inline Value binary(const Token::ptr &op, const Operands &operands) {
+    return interpreter->binary(op, operands.left, operands.right);
+}
+
+// calls values[0] with the rest of values as its arguments
+Value call(const Token::ptr &paren, std::vector<Value> values);
+
+// return values[0](values[1], ...): a function or method of the script is left pending and called by the call() the
+// returning body was run from, in place of its frame, so tail recursion runs in constant space
+Value tail_call(const Token::ptr &paren, std::vector<Value> values);
+
+// object.name = value
+Value set(const Token::ptr &name, const Operands &operands);
+
+// super.method bound to self
+Value super_method(const Token::ptr &method, const Value &superclass, const LoxInstance::ptr &self);
+
+// a global the script doesn't declare, one of the builtins
+Value global(const Token::ptr &name);
+
+Value assign_global(const Token::ptr &name, const Value &value);
+
+void print(const Value &value);
+
+void check_superclass(const Token::ptr &name, const Value &superclass);
+
+Value make_class(const std::string &name, const Value &superclass,
+                 std::unordered_map<std::string, LoxFunction::ptr> methods);
+
+// runs the script's top level on the interpreter's stack and reports errors like the lox command does
+int main(Value (*script)(const std::vector<Value> &));
+
+} // namespace aot
@@ -0,0 +1,295 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/assembler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+Assembler::Label Assembler::new_label() {
+    labels_.push_back(-1);
+    return labels_.size() - 1;
+}
+
+void Assembler::bind(Label label) {
+    labels_[label] = static_cast<int64_t>(code_.size());
+}
+
+void Assembler::push(Reg reg) {
+    if (reg >= R8) {
+        byte(0x41);
+    }
+    byte(0x50 + (reg & 7));
+}
+
+void Assembler::pop(Reg reg) {
+    if (reg >= R8) {
+        byte(0x41);
+    }
+    byte(0x58 + (reg & 7));
+}
+
+void Assembler::ret() {
+    byte(0xC3);
+}
+
+void Assembler::call(Reg reg) {
+    rex(false, 0, reg);
+    byte(0xFF);
+    byte(0xC0 | (2 << 3) | (reg & 7));
+}
+
+void Assembler::jmp(Label label) {
+    byte(0xE9);
+    fixups_.emplace_back(code_.size(), label);
+    u32(0);
+}
+
+void Assembler::jcc(Condition condition, Label label) {
+    byte(0x0F);
+    byte(0x80 + condition);
+    fixups_.emplace_back(code_.size(), label);
+    u32(0);
+}
+
+void Assembler::mov(Reg dst, Reg src) {
+    rex(true, src, dst);
+    byte(0x89);
+    byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void Assembler::mov(Reg dst, Mem src) {
+    rex(true, dst, src.base);
+    byte(0x8B);
+    modrm_mem(dst, src);
+}
+
+void Assembler::mov(Mem dst, Reg src) {
+    rex(true, src, dst.base);
+    byte(0x89);
+    modrm_mem(src, dst);
+}
+
+void Assembler::mov_imm64(Reg dst, uint64_t imm) {
+    rex(true, 0, dst);
+    byte(0xB8 + (dst & 7));
+    for (int i = 0; i < 8; i++) {
+        byte(static_cast<uint8_t>(imm >> (8 * i)));
+    }
+}
+
+void Assembler::mov_imm32(Reg dst, uint32_t imm) {
+    rex(false, 0, dst);
+    byte(0xB8 + (dst & 7));
+    u32(imm);
+}
+
+void Assembler::movzx_byte(Reg dst, Mem src) {
+    rex(false, dst, src.base);
+    byte(0x0F);
+    byte(0xB6);
+    modrm_mem(dst, src);
+}
+
+void Assembler::movzx_byte(Reg dst, Reg src) {
+    // a REX prefix makes encodings 4-7 mean spl..dil instead of ah..bh
+    rex(false, dst, src, src >= RSP);
+    byte(0x0F);
+    byte(0xB6);
+    byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+}
+
+void Assembler::mov_byte(Mem dst, uint8_t imm) {
+    rex(false, 0, dst.base);
+    byte(0xC6);
+    modrm_mem(0, dst);
+    byte(imm);
+}
+
+void Assembler::mov_byte(Mem dst, Reg src) {
+    rex(false, src, dst.base, src >= RSP);
+    byte(0x88);
+    modrm_mem(src, dst);
+}
+
+void Assembler::cmp_byte(Mem dst, uint8_t imm) {
+    rex(false, 0, dst.base);
+    byte(0x80);
+    modrm_mem(7, dst);
+    byte(imm);
+}
+
+void Assembler::cmp_imm(Reg reg, int8_t imm) {
+    rex(false, 0, reg);
+    byte(0x83);
+    byte(0xC0 | (7 << 3) | (reg & 7));
+    byte(static_cast<uint8_t>(imm));
+}
+
+void Assembler::cmp_qword_imm(Mem mem, int8_t imm) {
+    rex(true, 0, mem.base);
+    byte(0x83);
+    modrm_mem(7, mem);
+    byte(static_cast<uint8_t>(imm));
+}
+
+void Assembler::cmp(Reg a, Mem b) {
+    rex(true, a, b.base);
+    byte(0x3B);
+    modrm_mem(a, b);
+}
+
+void Assembler::add_imm(Reg reg, int8_t imm) {
+    rex(true, 0, reg);
+    byte(0x83);
+    byte(0xC0 | (reg & 7));
+    byte(static_cast<uint8_t>(imm));
+}
+
+void Assembler::test(Reg a, Reg b) {
+    rex(false, b, a);
+    byte(0x85);
+    byte(0xC0 | ((b & 7) << 3) | (a & 7));
+}
+
+void Assembler::xor_(Reg dst, Reg src) {
+    rex(false, src, dst);
+    byte(0x31);
+    byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void Assembler::and_byte(Reg dst, Reg src) {
+    rex(false, src, dst, src >= RSP || dst >= RSP);
+    byte(0x20);
+    byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void Assembler::or_byte(Reg dst, Reg src) {
+    rex(false, src, dst, src >= RSP || dst >= RSP);
+    byte(0x08);
+    byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void Assembler::setcc(Condition condition, Reg dst) {
+    rex(false, 0, dst, dst >= RSP);
+    byte(0x0F);
+    byte(0x90 + condition);
+    byte(0xC0 | (dst & 7));
+}
+
+void Assembler::btc_sign(Reg reg) {
+    rex(true, 0, reg);
+    byte(0x0F);
+    byte(0xBA);
+    byte(0xC0 | (7 << 3) | (reg & 7));
+    byte(63);
+}
+
+void Assembler::movsd(Xmm dst, Mem src) {
+    byte(0xF2);
+    rex(false, dst, src.base);
+    byte(0x0F);
+    byte(0x10);
+    modrm_mem(dst, src);
+}
+
+void Assembler::movsd(Mem dst, Xmm src) {
+    byte(0xF2);
+    rex(false, src, dst.base);
+    byte(0x0F);
+    byte(0x11);
+    modrm_mem(src, dst);
+}
+
+void Assembler::sse(SseOp op, Xmm dst, Mem src) {
+    byte(0xF2);
+    rex(false, dst, src.base);
+    byte(0x0F);
+    byte(op);
+    modrm_mem(dst, src);
+}
+
+void Assembler::ucomisd(Xmm a, Mem b) {
+    byte(0x66);
+    rex(false, a, b.base);
+    byte(0x0F);
+    byte(0x2E);
+    modrm_mem(a, b);
+}
+
+std::vector<uint8_t> Assembler::finish() {
+    for (const auto &[at, label] : fixups_) {
+        if (labels_[label] < 0) {
+            throw std::logic_error("jump to an unbound label");
+        }
+        auto rel = static_cast<int32_t>(labels_[label] - static_cast<int64_t>(at + 4));
+        std::memcpy(&code_[at], &rel, sizeof(rel));
+    }
+    return code_;
+}
+
+void Assembler::byte(uint8_t b) {
+    code_.push_back(b);
+}
+
+void Assembler::u32(uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        byte(static_cast<uint8_t>(v >> (8 * i)));
+    }
+}
+
+void Assembler::rex(bool wide, int reg, int base, bool force) {
+    uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+    if (prefix != 0x40 || force) {
+        byte(prefix);
+    }
+}
+
+void Assembler::modrm_mem(int reg, Mem mem) {
+    // mod 10: [base + disp32]; rsp and r12 as a base can only be encoded through a SIB byte
+    byte(0x80 | ((reg & 7) << 3) | (mem.base & 7));
+    if ((mem.base & 7) == RSP) {
+        byte(0x24);
+    }
+    u32(static_cast<uint32_t>(mem.disp));
+}
+
+CodeRegion::CodeRegion(const std::vector<uint8_t> &code) : code_size_(code.size()) {
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    mapped_ = (code.size() + page - 1) / page * page;
+    void *memory = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    std::memcpy(memory, code.data(), code.size());
+    if (::mprotect(memory, mapped_, PROT_READ | PROT_EXEC) != 0) {
+        ::munmap(memory, mapped_);
+        throw std::runtime_error("can't make JIT code executable");
+    }
+    memory_ = memory;
+}
+
+CodeRegion::~CodeRegion() {
+    ::munmap(memory_, mapped_);
+}
+
+void write_perf_map(const void *start, size_t size, const std::string &name) {
+    // isolates compile on their own threads but share the process's map
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    static FILE *file = [] {
+        char path[64];
+        std::snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(::getpid()));
+        return std::fopen(path, "a");
+    }();
+    if (file != nullptr) {
+        std::fprintf(file, "%lx %zx %s\n", reinterpret_cast<unsigned long>(start), size, name.c_str());
+        std::fflush(file);
+    }
+}
@@ -0,0 +1,115 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Just enough of an x86-64 encoder for the JIT: 64-bit moves between
+ * registers and [base + disp32] memory, byte loads and stores, scalar double
+ * arithmetic, compares, setcc and jumps to labels that may be bound later.
+ * Every memory operand takes the disp32 form, which keeps the encoding
+ * uniform at the cost of a few bytes per instruction.
+ */
+class Assembler {
+ public:
+    enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+    enum Xmm { XMM0, XMM1 };
+    enum Condition { O, NO, B, AE, E, NE, BE, A, S, NS, P, NP, L, GE, LE, G };
+    enum SseOp { ADD = 0x58, MUL = 0x59, SUB = 0x5C, DIV = 0x5E };
+
+    struct Mem {
+        Reg base;
+        int32_t disp;
+    };
+
+    using Label = size_t;
+
+    Label new_label();
+    // the next instruction is the label's target
+    void bind(Label label);
+
+    void push(Reg reg);
+    void pop(Reg reg);
+    void ret();
+    void call(Reg reg);
+    void jmp(Label label);
+    void jcc(Condition condition, Label label);
+
+    void mov(Reg dst, Reg src);
+    void mov(Reg dst, Mem src);
+    void mov(Mem dst, Reg src);
+    void mov_imm64(Reg dst, uint64_t imm);
+    // 32-bit immediate, zero-extended into the whole register
+    void mov_imm32(Reg dst, uint32_t imm);
+    void movzx_byte(Reg dst, Mem src);
+    void movzx_byte(Reg dst, Reg src);
+    void mov_byte(Mem dst, uint8_t imm);
+    void mov_byte(Mem dst, Reg src);
+    void cmp_byte(Mem dst, uint8_t imm);
+    void cmp_imm(Reg reg, int8_t imm);
+    void cmp_qword_imm(Mem mem, int8_t imm);
+    void cmp(Reg a, Mem b);
+    void add_imm(Reg reg, int8_t imm);
+    void test(Reg a, Reg b);
+    void xor_(Reg dst, Reg src);
+    void and_byte(Reg dst, Reg src);
+    void or_byte(Reg dst, Reg src);
+    void setcc(Condition condition, Reg dst);
+    // flips bit 63, the sign of a double held in a general register
+    void btc_sign(Reg reg);
+
+    void movsd(Xmm dst, Mem src);
+    void movsd(Mem dst, Xmm src);
+    void sse(SseOp op, Xmm dst, Mem src);
+    void ucomisd(Xmm a, Mem b);
+
+    // the machine code with every jump resolved; all labels used must be bound
+    std::vector<uint8_t> finish();
+
+ private:
+    void byte(uint8_t b);
+    void u32(uint32_t v);
+    void rex(bool wide, int reg, int base, bool force = false);
+    void modrm_mem(int reg, Mem mem);
+
+    std::vector<uint8_t> code_;
+    // label offsets, -1 until bound
+    std::vector<int64_t> labels_;
+    // rel32 fields to patch: where they are and which label they jump to
+    std::vector<std::pair<size_t, Label>> fixups_;
+};
+
+/*
+ * Machine code copied into its own mapping and made executable. The pages
+ * are never writable and executable at the same time.
+ */
+class CodeRegion {
+ public:
+    explicit CodeRegion(const std::vector<uint8_t> &code);
+    ~CodeRegion();
+
+    CodeRegion(const CodeRegion &) = delete;
+    CodeRegion &operator=(const CodeRegion &) = delete;
+
+    const void *entry() const {
+        return memory_;
+    }
+
+    size_t size() const {
+        return code_size_;
+    }
+
+ private:
+    void *memory_{nullptr};
+    size_t mapped_{0};
+    size_t code_size_{0};
+};
+
+// appends symbols for generated code to /tmp/perf-<pid>.map, which perf reads to name JIT frames
+void write_perf_map(const void *start, size_t size, const std::string &name);
@@ -2,99 +2,178 @@
 // Created by wy on 29.5.23.
 //
 
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
 #include <ctime>
 #include <string>
 #include <sys/time.h>
 #include <vector>
 
-#include "lox/callable.h"
+#include "lox/alloc_profiler.h"
+#include "lox/channel.h"
+#include "lox/exception.h"
+#include "lox/float64_array.h"
 #include "lox/interpreter.h"
+#include "lox/isolate.h"
+#include "lox/simd.h"
 #include "lox/value.h"
 
-class Clock : public Callable {
- public:
-    std::string name() const override {
-        return "now";
-    }
-    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override {
-        timeval tv;
-        gettimeofday(&tv, nullptr);
-        uint64_t us = tv.tv_sec * 1000000 + tv.tv_usec;
-        return static_cast<double>(us);
-    }
-    int arity() const override {
-        return 0;
+template <> struct native::TypeName<Float64Array::ptr> {
+    static const char *get() {
+        return "Float64Array";
     }
 };
 
-class Assert : public Callable {
- public:
-    std::string name() const override {
-        return "assert";
-    }
-    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override {
-        if (!arguments[0]) {
-            throw std::runtime_error("assert failed");
-        }
-        return nullptr;
-    }
-    int arity() const override {
-        return 1;
+template <> struct native::TypeName<Channel::ptr> {
+    static const char *get() {
+        return "Channel";
     }
 };
 
-class Str : public Callable {
- public:
-    std::string name() const override {
-        return "str";
-    }
-    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override {
-        return arguments[0].str();
-    }
-    int arity() const override {
-        return 1;
+template <> struct native::TypeName<Task::ptr> {
+    static const char *get() {
+        return "Task";
     }
 };
 
-class Getc : public Callable {
-public:
-    std::string name() const override {
-        return "getc";
-    }
-    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override {
-        return (double)getchar();
-    }
-    int arity() const override {
-        return 0;
-    }
-};
+inline double clock_us() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    uint64_t us = tv.tv_sec * 1000000 + tv.tv_usec;
+    return static_cast<double>(us);
+}
 
-class Chr : public Callable {
-public:
-    std::string name() const override {
-        return "chr";
-    }
-    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override {
-        char c = static_cast<char>(arguments[0].as<double>());
-        std::string s {c};
-        return s;
-    }
-    int arity() const override {
-        return 1;
-    }
-};
+inline size_t checked_index(const char *func, const Float64Array::ptr &array, double index) {
+    if (index < 0 || index >= static_cast<double>(array->size()) ||
+        index != static_cast<double>(static_cast<size_t>(index))) {
+        throw std::runtime_error(std::string(func) + "() index " + Value(index).str() + " out of range [0, " +
+                                 std::to_string(array->size()) + ")");
+    }
+    return static_cast<size_t>(index);
+}
 
-class Exit : public Callable {
-public:
-    std::string name() const override {
-        return "exit";
+inline const Float64Array::ptr &check_mutable(const char *func, const Float64Array::ptr &array) {
+    if (array->frozen()) {
+        throw std::runtime_error(std::string(func) + "() of a frozen array");
     }
-    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override {
-        int n = static_cast<int>(arguments[0].as<double>());
-        exit(n);
-        return nullptr;
+    return array;
+}
+
+inline void check_same_size(const char *func, const Float64Array::ptr &a, const Float64Array::ptr &b) {
+    if (a->size() != b->size()) {
+        throw std::runtime_error(std::string(func) + "() arrays differ in length");
     }
-    int arity() const override {
-        return 1;
+}
+
+inline void check_not_empty(const char *func, const Float64Array::ptr &array) {
+    if (array->size() == 0) {
+        throw std::runtime_error(std::string(func) + "() of an empty array");
     }
-};
+}
+
+inline void register_builtins(Interpreter *interpreter) {
+    interpreter->define_native("clock", clock_us);
+    interpreter->define_native("assert", [](const Value &condition) {
+        if (!condition) {
+            throw std::runtime_error("assert failed");
+        }
+    });
+    interpreter->define_native("str", [](const Value &value) {
+        return value.str();
+    });
+    interpreter->define_native("getc", []() {
+        return static_cast<double>(getchar());
+    });
+    interpreter->define_native("chr", [](double code) {
+        return std::string{static_cast<char>(code)};
+    });
+    interpreter->define_native("exit", [](int code) {
+        throw ExitException(code);
+    });
+    // heap allocations made by the interpreter so far, lets a script assert a loop body allocates nothing
+    interpreter->define_native("allocations", []() {
+        return static_cast<double>(AllocProfiler::total());
+    });
+
+    interpreter->define_native("Float64Array", [](size_t size) {
+        return std::make_shared<Float64Array>(size);
+    });
+    interpreter->define_native("f64_len", [](const Float64Array::ptr &array) {
+        return array->size();
+    });
+    interpreter->define_native("f64_get", [](const Float64Array::ptr &array, double index) {
+        return array->data()[checked_index("f64_get", array, index)];
+    });
+    interpreter->define_native("f64_set", [](const Float64Array::ptr &array, double index, double value) {
+        check_mutable("f64_set", array)->data()[checked_index("f64_set", array, index)] = value;
+        return value;
+    });
+    interpreter->define_native("f64_fill", [](const Float64Array::ptr &array, double value) {
+        check_mutable("f64_fill", array);
+        // a store, not an affine map: x * 0 + value is NaN for an infinite or NaN x
+        std::fill(array->data(), array->data() + array->size(), value);
+        return array;
+    });
+    interpreter->define_native("f64_sum", [](const Float64Array::ptr &array) {
+        return simd::sum(array->data(), array->size());
+    });
+    interpreter->define_native("f64_dot", [](const Float64Array::ptr &a, const Float64Array::ptr &b) {
+        check_same_size("f64_dot", a, b);
+        return simd::dot(a->data(), b->data(), a->size());
+    });
+    interpreter->define_native("f64_scale", [](const Float64Array::ptr &array, double factor) {
+        check_mutable("f64_scale", array);
+        simd::scale(array->data(), array->size(), factor);
+        return array;
+    });
+    interpreter->define_native("f64_add", [](const Float64Array::ptr &dst, const Float64Array::ptr &src) {
+        check_same_size("f64_add", check_mutable("f64_add", dst), src);
+        simd::add(dst->data(), src->data(), dst->size());
+        return dst;
+    });
+    interpreter->define_native("f64_min", [](const Float64Array::ptr &array) {
+        check_not_empty("f64_min", array);
+        return simd::min(array->data(), array->size());
+    });
+    interpreter->define_native("f64_max", [](const Float64Array::ptr &array) {
+        check_not_empty("f64_max", array);
+        return simd::max(array->data(), array->size());
+    });
+    interpreter->define_native("f64_map_affine", [](const Float64Array::ptr &array, double mul, double add) {
+        check_mutable("f64_map_affine", array);
+        simd::map_affine(array->data(), array->size(), mul, add);
+        return array;
+    });
+    interpreter->define_native("f64_prefix_sum", [](const Float64Array::ptr &array) {
+        check_mutable("f64_prefix_sum", array);
+        simd::prefix_sum(array->data(), array->size());
+        return array;
+    });
+    // a frozen array can't change anymore and is shared, not copied, when it is sent to another isolate
+    interpreter->define_native("f64_freeze", [](const Float64Array::ptr &array) {
+        array->freeze();
+        return array;
+    });
+
+    interpreter->globals()->define("spawn", Callable::ptr(std::make_shared<Spawn>()));
+    interpreter->define_native("join", [interpreter](const Task::ptr &task) {
+        return task->join(interpreter->output());
+    });
+    interpreter->define_native("Channel", [](size_t capacity) {
+        return std::make_shared<Channel>(capacity);
+    });
+    interpreter->define_native("send", [](const Channel::ptr &channel, const Value &value) {
+        channel->send(transfer(value));
+    });
+    // the next value, nil once the channel is closed and drained
+    interpreter->define_native("recv", [](const Channel::ptr &channel) {
+        Value value;
+        channel->recv(&value);
+        return value;
+    });
+    interpreter->define_native("close", [](const Channel::ptr &channel) {
+        channel->close();
+    });
+}
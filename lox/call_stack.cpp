@@ -0,0 +1,23 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/call_stack.h"
+
+std::vector<StackFrame> CallStack::capture() const {
+    std::vector<StackFrame> frames;
+    frames.reserve(frames_.size());
+    for (auto it = frames_.rbegin(); it != frames_.rend(); ++it) {
+        frames.push_back({it->callee->name(), it->line});
+    }
+    return frames;
+}
+
+void CallStack::overflow(const Token::ptr &where) const {
+    if (frames_.size() >= max_depth_) {
+        throw RuntimeError(where, "stack overflow: more than " + std::to_string(max_depth_) +
+                                      " nested calls, raise the limit with --max-depth");
+    }
+    throw RuntimeError(where, "stack overflow: the native stack is exhausted after " +
+                                  std::to_string(frames_.size()) + " nested calls");
+}
@@ -0,0 +1,114 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "lox/callable.h"
+#include "lox/exception.h"
+#include "lox/token.h"
+
+/*
+ * The Lox calls an interpreter has in progress, innermost last. A frame is
+ * the callee and the line it was called from, nothing is copied, so keeping
+ * the stack costs a push and a pop per call. It bounds recursion twice: by a
+ * configurable number of frames, and by the native stack the interpreter runs
+ * on, so a deep recursion ends in a RuntimeError rather than a crash. capture()
+ * turns the frames into a backtrace. The frames only describe the calls: their
+ * locals and where they resume live in the native frames of the tree-walker,
+ * so a call can't be suspended or resumed from here, coroutines would need an
+ * interpreter that keeps that state on the heap.
+ */
+class CallStack {
+ public:
+    static constexpr size_t kDefaultMaxDepth = 10000;
+
+    struct Frame {
+        Callable *callee;
+        int line;
+        // a callee the frame was handed by a tail call: its caller no longer holds it, the frame does until it is
+        // popped, so an error a backtrace is captured for after unwinding still finds it
+        Callable::ptr tail_callee;
+    };
+
+    void set_max_depth(size_t max_depth) {
+        max_depth_ = max_depth;
+    }
+
+    size_t max_depth() const {
+        return max_depth_;
+    }
+
+    // the lowest native stack address calls may reach, nullptr when unknown
+    void set_native_limit(const char *limit) {
+        native_limit_ = limit;
+    }
+
+    const char *native_limit() const {
+        return native_limit_;
+    }
+
+    // throws RuntimeError at `where` when the call would go too deep
+    void push(Callable *callee, const Token::ptr &where) {
+        if (frames_.size() >= max_depth_ ||
+            static_cast<const char *>(__builtin_frame_address(0)) < native_limit_) {
+            overflow(where);
+        }
+        frames_.push_back({callee, where->line, nullptr});
+    }
+
+    void pop() {
+        frames_.pop_back();
+    }
+
+    // a tail call takes over the frame of the call it returns from
+    void replace(Callable::ptr callee, int line) {
+        if (!frames_.empty()) {
+            frames_.back() = {callee.get(), line, std::move(callee)};
+        }
+    }
+
+    size_t depth() const {
+        return frames_.size();
+    }
+
+    // the line the innermost call was made from, 0 outside of any
+    int line() const {
+        return frames_.empty() ? 0 : frames_.back().line;
+    }
+
+    void clear() {
+        frames_.clear();
+    }
+
+    // the frames as a backtrace, innermost first
+    std::vector<StackFrame> capture() const;
+
+    // pushes a frame for the lifetime of one call, exceptions included
+    class Scope {
+     public:
+        Scope(CallStack *stack, Callable *callee, const Token::ptr &where) : stack_(stack) {
+            stack_->push(callee, where);
+        }
+        ~Scope() {
+            stack_->pop();
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+     private:
+        CallStack *stack_;
+    };
+
+ private:
+    [[noreturn]] void overflow(const Token::ptr &where) const;
+
+    std::vector<Frame> frames_;
+    size_t max_depth_{kDefaultMaxDepth};
+    const char *native_limit_{nullptr};
+};
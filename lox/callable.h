@@ -17,6 +17,7 @@ class Callable {
     using ptr = std::shared_ptr<Callable>;
 
     virtual std::string name() const = 0;
+    // number of arguments, or -1 for a callable that takes any number
     virtual int arity() const = 0;
     virtual Value call(Interpreter *interpreter, const std::vector<Value> &arguments) = 0;
 
@@ -0,0 +1,147 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/capi.h"
+
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include "lox/lox.h"
+
+namespace {
+
+class CallbackBuffer : public std::streambuf {
+ public:
+    CallbackBuffer(lox_write_fn write, void *user_data) : write_(write), user_data_(user_data) {}
+
+ protected:
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        write_(s, static_cast<size_t>(n), user_data_);
+        return n;
+    }
+
+    int_type overflow(int_type ch) override {
+        if (ch != traits_type::eof()) {
+            char c = traits_type::to_char_type(ch);
+            write_(&c, 1, user_data_);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+ private:
+    lox_write_fn write_;
+    void *user_data_;
+};
+
+} // namespace
+
+struct lox_vm {
+    Lox lox;
+    Lox::Result result;
+    std::string result_string;
+    std::unique_ptr<CallbackBuffer> buffer;
+    std::unique_ptr<std::ostream> output;
+};
+
+struct lox_program {
+    Program::ptr program;
+};
+
+lox_vm *lox_vm_new(void) {
+    return new lox_vm();
+}
+
+void lox_vm_free(lox_vm *vm) {
+    delete vm;
+}
+
+void lox_vm_reset(lox_vm *vm) {
+    vm->lox.reset();
+    vm->result = {};
+}
+
+void lox_vm_set_output(lox_vm *vm, lox_write_fn write, void *user_data) {
+    vm->buffer = std::make_unique<CallbackBuffer>(write, user_data);
+    vm->output = std::make_unique<std::ostream>(vm->buffer.get());
+    vm->lox.set_output(vm->output.get());
+}
+
+lox_program *lox_compile(lox_vm *vm, const char *source, size_t length) {
+    vm->result = {};
+    Program::ptr program = Lox::compile(std::string(source, length), &vm->result.error);
+    if (!program) {
+        vm->result.ok = false;
+        return nullptr;
+    }
+    return new lox_program{program};
+}
+
+void lox_program_free(lox_program *program) {
+    delete program;
+}
+
+void lox_set_nil(lox_vm *vm, const char *name) {
+    vm->lox.set_global(name, nullptr);
+}
+
+void lox_set_bool(lox_vm *vm, const char *name, int value) {
+    vm->lox.set_global(name, value != 0);
+}
+
+void lox_set_number(lox_vm *vm, const char *name, double value) {
+    vm->lox.set_global(name, value);
+}
+
+void lox_set_string(lox_vm *vm, const char *name, const char *value) {
+    vm->lox.set_global(name, std::string(value));
+}
+
+int lox_run(lox_vm *vm, const lox_program *program) {
+    vm->result = vm->lox.run(program->program);
+    return vm->result.ok ? 0 : 1;
+}
+
+lox_type lox_result_type(const lox_vm *vm) {
+    const Value &value = vm->result.value;
+    if (value.is<std::nullptr_t>()) {
+        return LOX_NIL;
+    }
+    if (value.is<bool>()) {
+        return LOX_BOOL;
+    }
+    if (value.is<double>()) {
+        return LOX_NUMBER;
+    }
+    if (value.is<std::string>()) {
+        return LOX_STRING;
+    }
+    return LOX_OBJECT;
+}
+
+int lox_result_bool(const lox_vm *vm) {
+    return static_cast<bool>(vm->result.value) ? 1 : 0;
+}
+
+double lox_result_number(const lox_vm *vm) {
+    return vm->result.value.is<double>() ? vm->result.value.as<double>() : 0;
+}
+
+const char *lox_result_string(lox_vm *vm) {
+    vm->result_string = vm->result.value.str();
+    return vm->result_string.c_str();
+}
+
+const char *lox_error_message(const lox_vm *vm) {
+    return vm->result.error.message.c_str();
+}
+
+int lox_error_line(const lox_vm *vm) {
+    return vm->result.error.line;
+}
+
+int lox_exit_code(const lox_vm *vm) {
+    return vm->result.exit_code;
+}
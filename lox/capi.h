@@ -0,0 +1,67 @@
+/*
+ * C interface of liblox.
+ *
+ * A lox_vm is one interpreter with its own globals. A lox_program is a
+ * compiled script; it is immutable and may be run any number of times, on any
+ * vm. Strings returned by the API stay valid until the next call that runs,
+ * resets or frees the vm they came from.
+ */
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lox_vm lox_vm;
+typedef struct lox_program lox_program;
+
+typedef enum {
+    LOX_NIL,
+    LOX_BOOL,
+    LOX_NUMBER,
+    LOX_STRING,
+    LOX_OBJECT,
+} lox_type;
+
+typedef void (*lox_write_fn)(const char *data, size_t size, void *user_data);
+
+lox_vm *lox_vm_new(void);
+void lox_vm_free(lox_vm *vm);
+
+/* forgets every global defined by scripts or by the host, the builtins remain */
+void lox_vm_reset(lox_vm *vm);
+
+/* sends the output of print statements to write instead of stdout */
+void lox_vm_set_output(lox_vm *vm, lox_write_fn write, void *user_data);
+
+/* returns NULL on a compile error, see lox_error_message() */
+lox_program *lox_compile(lox_vm *vm, const char *source, size_t length);
+void lox_program_free(lox_program *program);
+
+/* globals for the scripts run afterwards */
+void lox_set_nil(lox_vm *vm, const char *name);
+void lox_set_bool(lox_vm *vm, const char *name, int value);
+void lox_set_number(lox_vm *vm, const char *name, double value);
+void lox_set_string(lox_vm *vm, const char *name, const char *value);
+
+/* returns 0 on success and 1 on a runtime error */
+int lox_run(lox_vm *vm, const lox_program *program);
+
+/* value of the last top-level expression statement of the last run */
+lox_type lox_result_type(const lox_vm *vm);
+int lox_result_bool(const lox_vm *vm);
+double lox_result_number(const lox_vm *vm);
+/* the result printed as Lox prints it, for any type */
+const char *lox_result_string(lox_vm *vm);
+
+const char *lox_error_message(const lox_vm *vm);
+/* 0 when the error is not tied to a source line */
+int lox_error_line(const lox_vm *vm);
+/* the argument of exit() when the last run called it, -1 otherwise */
+int lox_exit_code(const lox_vm *vm);
+
+#ifdef __cplusplus
+}
+#endif
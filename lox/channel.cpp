@@ -0,0 +1,128 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/channel.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include "lox/alloc_profiler.h"
+
+namespace {
+
+// spins briefly, then yields the core, then naps so a long wait does not burn a core
+class Backoff {
+ public:
+    void wait() {
+        if (rounds_ < 64) {
+            rounds_++;
+        } else if (rounds_ < 1024) {
+            rounds_++;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+ private:
+    int rounds_{0};
+};
+
+size_t round_up_to_power_of_two(size_t n) {
+    size_t power = 1;
+    while (power < n) {
+        power <<= 1;
+    }
+    return power;
+}
+
+} // namespace
+
+Channel::Channel(size_t capacity) : cells_(round_up_to_power_of_two(capacity == 0 ? 1 : capacity)) {
+    mask_ = cells_.size() - 1;
+    for (size_t i = 0; i < cells_.size(); i++) {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    AllocProfiler::record(AllocProfiler::ARRAY, cells_.size() * sizeof(Cell));
+}
+
+bool Channel::try_send(Value &value) {
+    size_t word = send_position_.load(std::memory_order_relaxed);
+    size_t position;
+    Cell *cell;
+    for (;;) {
+        if (word & kClosed) {
+            return false;
+        }
+        position = word >> 1;
+        cell = &cells_[position & mask_];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<std::ptrdiff_t>(sequence - position);
+        if (diff == 0) {
+            // fails when a close set the low bit in the meantime, the value then stays with the sender
+            if (send_position_.compare_exchange_weak(word, word + 2, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the slot still holds the value from one lap ago: full
+            return false;
+        } else {
+            word = send_position_.load(std::memory_order_relaxed);
+        }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool Channel::try_recv(Value *value) {
+    size_t position = recv_position_.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+        cell = &cells_[position & mask_];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+        if (diff == 0) {
+            if (recv_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // nothing has been sent into the slot yet: empty
+            return false;
+        } else {
+            position = recv_position_.load(std::memory_order_relaxed);
+        }
+    }
+    *value = std::move(cell->value);
+    cell->value = nullptr;
+    cell->sequence.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+void Channel::send(Value value) {
+    Backoff backoff;
+    while (!try_send(value)) {
+        if (closed()) {
+            throw std::runtime_error("send() on a closed channel");
+        }
+        backoff.wait();
+    }
+}
+
+bool Channel::recv(Value *value) {
+    Backoff backoff;
+    for (;;) {
+        if (try_recv(value)) {
+            return true;
+        }
+        // once closed, the send position is final: the channel is drained when the receivers reach it, until then
+        // a sender that claimed a slot before the close is still filling it
+        size_t word = send_position_.load(std::memory_order_acquire);
+        if ((word & kClosed) && recv_position_.load(std::memory_order_relaxed) == word >> 1) {
+            return false;
+        }
+        backoff.wait();
+    }
+}
@@ -0,0 +1,74 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lox/value.h"
+
+/*
+ * A bounded multi-producer multi-consumer queue of values that isolates use to
+ * talk to each other. Slots form a ring, each guarded by a sequence number, so
+ * send and receive claim a slot with one compare-and-swap and never take a
+ * lock (Vyukov's bounded MPMC queue). Senders wait while the ring is full and
+ * receivers while it is empty; a closed channel still drains what it holds.
+ * The closed flag is the low bit of the send position, so a send claims its
+ * slot either before the close or not at all. Only values that passed
+ * transfer() may be put in.
+ */
+class Channel {
+ public:
+    using ptr = std::shared_ptr<Channel>;
+
+    // the capacity is rounded up to a power of two
+    explicit Channel(size_t capacity);
+
+    Channel(const Channel &) = delete;
+    Channel &operator=(const Channel &) = delete;
+
+    // false when the channel is full or closed, the value is only moved from on success
+    bool try_send(Value &value);
+    bool try_recv(Value *value);
+
+    // blocks while the channel is full, throws std::runtime_error once it is closed
+    void send(Value value);
+    // blocks while the channel is empty, returns false when it is closed and drained
+    bool recv(Value *value);
+
+    void close() {
+        send_position_.fetch_or(kClosed, std::memory_order_acq_rel);
+    }
+
+    bool closed() const {
+        return (send_position_.load(std::memory_order_acquire) & kClosed) != 0;
+    }
+
+    size_t capacity() const {
+        return mask_ + 1;
+    }
+
+    std::string str() const {
+        return "Channel(" + std::to_string(capacity()) + ")";
+    }
+
+ private:
+    // the low bit of send_position_, positions count in steps of two above it
+    static constexpr size_t kClosed = 1;
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Value value;
+    };
+
+    std::vector<Cell> cells_;
+    size_t mask_;
+    // producers and consumers each get a cache line
+    alignas(64) std::atomic<size_t> send_position_{0};
+    alignas(64) std::atomic<size_t> recv_position_{0};
+};
@@ -0,0 +1,2270 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/closure_compiler.h"
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "lox/environment.h"
+#include "lox/exception.h"
+#include "lox/function.h"
+#include "lox/instance.h"
+#include "lox/interpreter.h"
+#include "lox/klass.h"
+#include "lox/profiler.h"
+#include "lox/ssa.h"
+#include "lox/tracer.h"
+
+namespace {
+
+enum class Flow { NORMAL, BREAK, RETURN, TAIL_CALL };
+
+class CompiledFunction;
+
+// a call in tail position, made by the function's caller once the function's frame is gone
+struct TailCall {
+    std::shared_ptr<CompiledFunction> callee;
+    std::vector<Value> arguments;
+    int line{0};
+};
+
+// one activation of a function, or of the top level
+struct Frame {
+    Interpreter *interpreter;
+    Value *slots;
+    // the unboxed slots of locals type inference proved to only ever hold numbers
+    double *numbers;
+    std::shared_ptr<Value> *cells;
+    const std::shared_ptr<Value> *captures;
+    Value result;
+    TailCall *tail;
+};
+
+using Eval = std::function<Value(Frame &)>;
+using Exec = std::function<Flow(Frame &)>;
+using NumberEval = std::function<double(Frame &)>;
+using Test = std::function<bool(Frame &)>;
+// where a variable lives, for a use that only knows once it runs
+using Place = std::function<Value *(Frame &)>;
+
+// where a closure being created finds a variable it captures: a cell of the running function or one of its captures
+struct CaptureSource {
+    bool cell;
+    size_t index;
+};
+
+// what running a function declaration takes, shared by all its closures
+struct Code {
+    size_t slots{0};
+    size_t numbers{0};
+    size_t cells{0};
+    // where each parameter goes, a slot or a cell when a nested function captures it
+    std::vector<CaptureSource> params;
+    // the capture `this` is bound to, -1 when the method doesn't use it
+    int self{-1};
+    Exec body;
+};
+
+class CompiledFunction : public LoxFunction {
+ public:
+    using ptr = std::shared_ptr<CompiledFunction>;
+
+    // frames up to this size live on the native stack
+    static constexpr size_t kInlineSlots = 8;
+
+    CompiledFunction(stmt::Function *declaration, std::shared_ptr<const Code> code,
+                     std::vector<std::shared_ptr<Value>> captures)
+        : LoxFunction(declaration, nullptr), code_(std::move(code)), captures_(std::move(captures)) {}
+
+    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override {
+        TailCall tail;
+        Value result = run(interpreter, arguments, &tail);
+        while (tail.callee) {
+            ptr callee = std::move(tail.callee);
+            std::vector<Value> callee_arguments = std::move(tail.arguments);
+            interpreter->call_stack().replace(callee, tail.line);
+            result = callee->run(interpreter, callee_arguments, &tail);
+        }
+        return result;
+    }
+
+    LoxFunction::ptr bind(LoxInstance::ptr instance) override {
+        std::vector<std::shared_ptr<Value>> captures = captures_;
+        if (code_->self >= 0) {
+            captures[code_->self] = std::make_shared<Value>(std::move(instance));
+        }
+        return std::make_shared<CompiledFunction>(declaration(), code_, std::move(captures));
+    }
+
+ private:
+    // one activation; a call the body ends with in tail position is left in *tail for call() to make
+    Value run(Interpreter *interpreter, const std::vector<Value> &arguments, TailCall *tail) const {
+        const Token::ptr &name = declaration()->name;
+        ShadowFrame shadow(name->lexeme.c_str(), interpreter->call_stack().line());
+        Tracer::Scope trace(name->lexeme.c_str(), "call", name->line);
+        const Code &code = *code_;
+        Value inline_slots[kInlineSlots];
+        double inline_numbers[kInlineSlots];
+        std::shared_ptr<Value> inline_cells[kInlineSlots];
+        std::vector<Value> more_slots;
+        std::vector<double> more_numbers;
+        std::vector<std::shared_ptr<Value>> more_cells;
+        Value *slots = inline_slots;
+        double *numbers = inline_numbers;
+        std::shared_ptr<Value> *cells = inline_cells;
+        if (code.slots > kInlineSlots) {
+            more_slots.resize(code.slots);
+            slots = more_slots.data();
+        }
+        if (code.numbers > kInlineSlots) {
+            more_numbers.resize(code.numbers);
+            numbers = more_numbers.data();
+        }
+        if (code.cells > kInlineSlots) {
+            more_cells.resize(code.cells);
+            cells = more_cells.data();
+        }
+        for (size_t i = 0; i < code.params.size(); i++) {
+            if (code.params[i].cell) {
+                cells[code.params[i].index] = std::make_shared<Value>(arguments[i]);
+            } else {
+                slots[code.params[i].index] = arguments[i];
+            }
+        }
+        Frame frame{interpreter, slots, numbers, cells, captures_.data(), Value(), tail};
+        return code.body(frame) == Flow::RETURN ? std::move(frame.result) : Value();
+    }
+
+    std::shared_ptr<const Code> code_;
+    std::vector<std::shared_ptr<Value>> captures_;
+};
+
+// a global or builtin, looked up by name the first time and cached
+struct Global {
+    Global(Token::ptr name, Environment::ptr top) : name(std::move(name)), top(std::move(top)) {}
+
+    Value &get() {
+        // a builtin is only found as long as the top level hasn't declared a global of its name since
+        if (value == nullptr || (builtin && top->size() != top_size)) {
+            value = top->lookup(name->lexeme);
+            if (value == nullptr) {
+                throw RuntimeError(name, "Undefined variable '" + name->lexeme + "'.");
+            }
+            builtin = !top->contains(name->lexeme);
+            top_size = top->size();
+        }
+        return *value;
+    }
+
+    Token::ptr name;
+    Environment::ptr top;
+    Value *value{nullptr};
+    bool builtin{false};
+    size_t top_size{0};
+};
+
+// where a lowered SSA instruction finds an operand: a register, a constant folded into the closure, or the closure
+// computing an instruction at its only use
+struct Operand {
+    enum Kind { SLOT, NUMBER, CONSTANT, EVAL, NUMBER_EVAL };
+
+    Kind kind{CONSTANT};
+    size_t index{0};
+    Value constant;
+    double number{0};
+    Eval eval;
+    NumberEval number_eval;
+
+    Value value(Frame &frame) const {
+        switch (kind) {
+        case SLOT:
+            return frame.slots[index];
+        case NUMBER:
+            return Value(frame.numbers[index]);
+        case EVAL:
+            return eval(frame);
+        case NUMBER_EVAL:
+            return Value(number_eval(frame));
+        default:
+            return constant;
+        }
+    }
+
+    // the value without copying it out of its slot, anything else is made in scratch
+    const Value &read(Frame &frame, Value &scratch) const {
+        if (kind == SLOT) {
+            return frame.slots[index];
+        }
+        if (kind == CONSTANT) {
+            return constant;
+        }
+        scratch = value(frame);
+        return scratch;
+    }
+
+    // of an operand proved to be a number
+    double as_number(Frame &frame) const {
+        switch (kind) {
+        case NUMBER:
+            return frame.numbers[index];
+        case NUMBER_EVAL:
+            return number_eval(frame);
+        default:
+            return number;
+        }
+    }
+
+    bool same_register(const Operand &other) const {
+        return (kind == SLOT || kind == NUMBER) && kind == other.kind && index == other.index;
+    }
+};
+
+/*
+ * Runs the SSA form of a function on its frame. A value used once, right
+ * where the instructions after it have been computed for the same use, is
+ * computed by the closure of that use, so what the builder made of an
+ * expression runs as a tree of closures again. Every other value gets a
+ * register, an unboxed one for a number and a Value slot otherwise, with the
+ * parameters in the first slots; values never live at the same time share
+ * one. Such an instruction becomes a closure writing its register, a block
+ * the list of them plus an exit that copies what the phis of the next block
+ * take on that edge and picks the block.
+ */
+class Lowering {
+ public:
+    Lowering(const ssa::Function &function, Environment::ptr top) : function_(function), top_(std::move(top)) {}
+
+    Exec lower(Code &code) {
+        count_uses();
+        find_inlined();
+        compute_liveness();
+        allocate();
+        auto blocks = std::make_shared<std::vector<LoweredBlock>>();
+        for (const ssa::Block *block : function_.blocks()) {
+            LoweredBlock lowered;
+            for (const ssa::Instr *instr : block->instrs) {
+                if (instr->op != ssa::Op::CONST && instr->op != ssa::Op::PARAM && !fused(instr)) {
+                    lower(instr, lowered.steps);
+                }
+            }
+            lowered.exit = exit(block);
+            blocks->push_back(std::move(lowered));
+        }
+        code.slots = slots_ + 1;
+        code.numbers = numbers_ + 1;
+        code.cells = 0;
+        code.params.clear();
+        for (size_t i = 0; i < function_.params(); i++) {
+            code.params.push_back({false, i});
+        }
+        return [blocks](Frame &frame) {
+            size_t current = 0;
+            for (;;) {
+                const LoweredBlock &block = (*blocks)[current];
+                for (const Step &step : block.steps) {
+                    step(frame);
+                }
+                int next = block.exit(frame);
+                if (next < 0) {
+                    return next == kReturn ? Flow::RETURN : Flow::TAIL_CALL;
+                }
+                current = static_cast<size_t>(next);
+            }
+        };
+    }
+
+ private:
+    using Step = std::function<void(Frame &)>;
+    // the next block, or kReturn or kTailCall
+    using Exit = std::function<int(Frame &)>;
+
+    static constexpr int kReturn = -1;
+    static constexpr int kTailCall = -2;
+
+    struct LoweredBlock {
+        std::vector<Step> steps;
+        Exit exit;
+    };
+
+    struct Move {
+        Operand from;
+        bool number;
+        size_t to;
+    };
+
+    void count_uses() {
+        for (const ssa::Block *block : function_.blocks()) {
+            for (const auto *list : {&block->phis, &block->instrs}) {
+                for (const ssa::Instr *instr : *list) {
+                    for (const ssa::Instr *arg : instr->args) {
+                        uses_[arg]++;
+                    }
+                }
+            }
+            for (const ssa::Instr *operand : block->operands) {
+                uses_[operand]++;
+            }
+        }
+    }
+
+    // the values computed at their use: a block is replayed as the builder emitted it, operands before the
+    // operation, and a value used once is taken by its user when everything emitted after it has been as well;
+    // anything in between that isn't keeps it in its register, so nothing runs in another order than before
+    void find_inlined() {
+        for (const ssa::Block *block : function_.blocks()) {
+            std::vector<const ssa::Instr *> pending;
+            auto take = [&](const std::vector<ssa::Instr *> &args) {
+                for (auto arg = args.rbegin(); arg != args.rend(); ++arg) {
+                    if ((*arg)->op == ssa::Op::CONST) {
+                        continue;
+                    }
+                    if (pending.empty() || pending.back() != *arg) {
+                        break;
+                    }
+                    inlined_.insert(*arg);
+                    pending.pop_back();
+                }
+            };
+            for (const ssa::Instr *instr : block->instrs) {
+                if (instr->op == ssa::Op::CONST) {
+                    continue;
+                }
+                take(instr->args);
+                if (instr->op != ssa::Op::PARAM && uses_[instr] == 1) {
+                    pending.push_back(instr);
+                } else {
+                    pending.clear();
+                }
+            }
+            take(block->operands);
+        }
+    }
+
+    // a comparison computed by the branch it decides
+    bool fused(const ssa::Instr *instr) const {
+        const ssa::Block *block = instr->block;
+        return block->exit == ssa::Block::BRANCH && block->operands[0] == instr && inlined_.count(instr) != 0 &&
+               comparison(instr);
+    }
+
+    // the values live into and out of every block; what a phi takes on an edge is live out of the predecessor
+    void compute_liveness() {
+        const auto &blocks = function_.blocks();
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (auto block = blocks.rbegin(); block != blocks.rend(); ++block) {
+                std::unordered_set<const ssa::Instr *> out;
+                for (const ssa::Block *target : (*block)->targets) {
+                    if (target == nullptr) {
+                        continue;
+                    }
+                    for (const ssa::Instr *value : live_in_[target]) {
+                        out.insert(value);
+                    }
+                    size_t edge = std::find(target->preds.begin(), target->preds.end(), *block) - target->preds.begin();
+                    for (const ssa::Instr *phi : target->phis) {
+                        if (phi->args[edge]->op != ssa::Op::CONST) {
+                            out.insert(phi->args[edge]);
+                        }
+                    }
+                }
+                std::unordered_set<const ssa::Instr *> in = out;
+                for (const ssa::Instr *operand : (*block)->operands) {
+                    if (operand->op != ssa::Op::CONST) {
+                        in.insert(operand);
+                    }
+                }
+                for (auto instr = (*block)->instrs.rbegin(); instr != (*block)->instrs.rend(); ++instr) {
+                    in.erase(*instr);
+                    for (const ssa::Instr *arg : (*instr)->args) {
+                        if (arg->op != ssa::Op::CONST) {
+                            in.insert(arg);
+                        }
+                    }
+                }
+                for (const ssa::Instr *phi : (*block)->phis) {
+                    in.erase(phi);
+                }
+                if (in != live_in_[*block] || out != live_out_[*block]) {
+                    live_in_[*block] = std::move(in);
+                    live_out_[*block] = std::move(out);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // registers for every value something uses that isn't computed at its use, shared by values that are never live
+    // at the same time; the rest write the scratch registers past them
+    void allocate() {
+        // values are defined before the blocks they are used in, in reverse postorder; a block starts with the
+        // registers of what is live into it taken, and a value gives its register back after its last use
+        busy_[0].assign(function_.params(), false);
+        for (const ssa::Block *block : function_.blocks()) {
+            for (auto &busy : busy_) {
+                std::fill(busy.begin(), busy.end(), false);
+            }
+            for (const ssa::Instr *value : live_in_[block]) {
+                busy_[value->number][registers_.at(value)] = true;
+            }
+            std::unordered_set<const ssa::Instr *> kept = live_out_[block];
+            kept.insert(block->operands.begin(), block->operands.end());
+            std::unordered_map<const ssa::Instr *, size_t> last;
+            for (size_t i = 0; i < block->instrs.size(); i++) {
+                for (const ssa::Instr *arg : block->instrs[i]->args) {
+                    last[arg] = i;
+                }
+            }
+            auto release = [&](const ssa::Instr *value) {
+                if (kept.count(value) == 0 && registers_.count(value) != 0) {
+                    busy_[value->number][registers_[value]] = false;
+                }
+            };
+            for (const ssa::Instr *phi : block->phis) {
+                if (uses_[phi] > 0) {
+                    registers_[phi] = take(phi->number);
+                }
+            }
+            for (const ssa::Instr *instr : block->instrs) {
+                if (instr->op == ssa::Op::PARAM) {
+                    registers_[instr] = instr->index;
+                    busy_[0][instr->index] = true;
+                }
+            }
+            for (const ssa::Instr *phi : block->phis) {
+                if (last.count(phi) == 0) {
+                    release(phi);
+                }
+            }
+            // an instruction reads its operands before it writes its result, a dying operand's register is free for it;
+            // nothing takes a register between an inlined instruction and its use, its operands may die where it is
+            for (size_t i = 0; i < block->instrs.size(); i++) {
+                const ssa::Instr *instr = block->instrs[i];
+                if (instr->op == ssa::Op::CONST) {
+                    continue;
+                }
+                if (instr->op != ssa::Op::PARAM) {
+                    for (const ssa::Instr *arg : instr->args) {
+                        if (last.at(arg) == i) {
+                            release(arg);
+                        }
+                    }
+                }
+                if (instr->op != ssa::Op::PARAM && uses_[instr] > 0 && inlined_.count(instr) == 0) {
+                    registers_[instr] = take(instr->number);
+                }
+                if (last.count(instr) == 0) {
+                    release(instr);
+                }
+            }
+        }
+        slots_ = busy_[0].size();
+        numbers_ = busy_[1].size();
+    }
+
+    // the lowest free register of the kind
+    size_t take(bool number) {
+        std::vector<bool> &busy = busy_[number];
+        size_t index = std::find(busy.begin(), busy.end(), false) - busy.begin();
+        if (index == busy.size()) {
+            busy.push_back(false);
+        }
+        busy[index] = true;
+        return index;
+    }
+
+    static bool comparison(const ssa::Instr *instr) {
+        switch (instr->op) {
+        case ssa::Op::LESS:
+        case ssa::Op::LESS_EQUAL:
+        case ssa::Op::GREATER:
+        case ssa::Op::GREATER_EQUAL:
+        case ssa::Op::EQUAL:
+        case ssa::Op::NOT_EQUAL:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool number_comparison(const ssa::Instr *instr) {
+        return comparison(instr) && instr->args[0]->number && instr->args[1]->number;
+    }
+
+    Operand operand(const ssa::Instr *instr) const {
+        Operand operand;
+        if (instr->op == ssa::Op::CONST) {
+            operand.constant = instr->constant;
+            if (auto *number = instr->constant.get_if<double>()) {
+                operand.number = *number;
+            }
+            return operand;
+        }
+        auto computed = computed_.find(instr);
+        if (computed != computed_.end()) {
+            return computed->second;
+        }
+        operand.kind = instr->number ? Operand::NUMBER : Operand::SLOT;
+        operand.index = registers_.at(instr);
+        return operand;
+    }
+
+    // where instr writes its result
+    size_t destination(const ssa::Instr *instr) const {
+        auto found = registers_.find(instr);
+        if (found != registers_.end()) {
+            return found->second;
+        }
+        return instr->number ? numbers_ : slots_;
+    }
+
+    // instr computed by compute, a double for a number and a Value otherwise: by its use when it is inlined, by a
+    // step writing its register when it isn't
+    template <typename F> void define(const ssa::Instr *instr, F compute, std::vector<Step> &steps) {
+        constexpr bool number = std::is_same<decltype(compute(std::declval<Frame &>())), double>::value;
+        if (inlined_.count(instr) != 0) {
+            Operand &operand = computed_[instr];
+            if constexpr (number) {
+                operand.kind = Operand::NUMBER_EVAL;
+                operand.number_eval = compute;
+            } else {
+                operand.kind = Operand::EVAL;
+                operand.eval = compute;
+            }
+            return;
+        }
+        size_t to = destination(instr);
+        if constexpr (number) {
+            steps.push_back([compute, to](Frame &frame) {
+                frame.numbers[to] = compute(frame);
+            });
+        } else {
+            steps.push_back([compute, to](Frame &frame) {
+                frame.slots[to] = compute(frame);
+            });
+        }
+    }
+
+    template <typename F>
+    void number_binary(const ssa::Instr *instr, const Operand &a, const Operand &b, F fn, std::vector<Step> &steps) {
+        if (a.kind == Operand::NUMBER && b.kind == Operand::NUMBER) {
+            define(instr, [x = a.index, y = b.index, fn](Frame &frame) {
+                return fn(frame.numbers[x], frame.numbers[y]);
+            }, steps);
+        } else if (a.kind == Operand::NUMBER && b.kind == Operand::CONSTANT) {
+            define(instr, [x = a.index, y = b.number, fn](Frame &frame) {
+                return fn(frame.numbers[x], y);
+            }, steps);
+        } else if (a.kind == Operand::CONSTANT && b.kind == Operand::NUMBER) {
+            define(instr, [x = a.number, y = b.index, fn](Frame &frame) {
+                return fn(x, frame.numbers[y]);
+            }, steps);
+        } else {
+            define(instr, [a, b, fn](Frame &frame) {
+                double x = a.as_number(frame);
+                return fn(x, b.as_number(frame));
+            }, steps);
+        }
+    }
+
+    template <typename F>
+    void value_binary(const ssa::Instr *instr, const Operand &a, const Operand &b, F fn, std::vector<Step> &steps) {
+        define(instr, [a, b, op = instr->token, fn](Frame &frame) {
+            Value left_scratch;
+            Value right_scratch;
+            const Value &left = a.read(frame, left_scratch);
+            const Value &right = b.read(frame, right_scratch);
+            try {
+                return fn(left, right);
+            } catch (const std::exception &e) {
+                throw RuntimeError(op, e.what());
+            }
+        }, steps);
+    }
+
+    template <typename F> static Test number_test(const Operand &a, const Operand &b, F fn) {
+        if (a.kind == Operand::NUMBER && b.kind == Operand::NUMBER) {
+            return [x = a.index, y = b.index, fn](Frame &frame) {
+                return fn(frame.numbers[x], frame.numbers[y]);
+            };
+        }
+        if (a.kind == Operand::NUMBER && b.kind == Operand::CONSTANT) {
+            return [x = a.index, y = b.number, fn](Frame &frame) {
+                return fn(frame.numbers[x], y);
+            };
+        }
+        return [a, b, fn](Frame &frame) {
+            double x = a.as_number(frame);
+            return fn(x, b.as_number(frame));
+        };
+    }
+
+    template <typename F> static Test value_test(const Operand &a, const Operand &b, Token::ptr op, F fn) {
+        return [a, b, op, fn](Frame &frame) {
+            Value left_scratch;
+            Value right_scratch;
+            const Value &left = a.read(frame, left_scratch);
+            const Value &right = b.read(frame, right_scratch);
+            try {
+                return static_cast<bool>(fn(left, right));
+            } catch (const std::exception &e) {
+                throw RuntimeError(op, e.what());
+            }
+        };
+    }
+
+    static Test compare(const ssa::Instr *instr, const Operand &a, const Operand &b) {
+        if (!number_comparison(instr)) {
+            return compare_values(instr, a, b);
+        }
+        switch (instr->op) {
+        case ssa::Op::LESS:
+            return number_test(a, b, std::less<double>());
+        case ssa::Op::LESS_EQUAL:
+            return number_test(a, b, std::less_equal<double>());
+        case ssa::Op::GREATER:
+            return number_test(a, b, std::greater<double>());
+        case ssa::Op::GREATER_EQUAL:
+            return number_test(a, b, std::greater_equal<double>());
+        case ssa::Op::EQUAL:
+            return number_test(a, b, std::equal_to<double>());
+        default:
+            return number_test(a, b, std::not_equal_to<double>());
+        }
+    }
+
+    static Test compare_values(const ssa::Instr *instr, const Operand &a, const Operand &b) {
+        const Token::ptr &token = instr->token;
+        switch (instr->op) {
+        case ssa::Op::LESS:
+            return value_test(a, b, token, std::less<Value>());
+        case ssa::Op::LESS_EQUAL:
+            return value_test(a, b, token, std::less_equal<Value>());
+        case ssa::Op::GREATER:
+            return value_test(a, b, token, std::greater<Value>());
+        case ssa::Op::GREATER_EQUAL:
+            return value_test(a, b, token, std::greater_equal<Value>());
+        case ssa::Op::EQUAL:
+            return value_test(a, b, token, std::equal_to<Value>());
+        default:
+            return value_test(a, b, token, std::not_equal_to<Value>());
+        }
+    }
+
+    void lower(const ssa::Instr *instr, std::vector<Step> &steps) {
+        std::vector<Operand> args;
+        for (const ssa::Instr *arg : instr->args) {
+            args.push_back(operand(arg));
+        }
+        const Token::ptr &token = instr->token;
+        switch (instr->op) {
+        case ssa::Op::ADD:
+            if (instr->number) {
+                return number_binary(instr, args[0], args[1], std::plus<double>(), steps);
+            }
+            return value_binary(instr, args[0], args[1], std::plus<Value>(), steps);
+        case ssa::Op::SUB:
+            if (instr->number) {
+                return number_binary(instr, args[0], args[1], std::minus<double>(), steps);
+            }
+            return value_binary(instr, args[0], args[1], std::minus<Value>(), steps);
+        case ssa::Op::MUL:
+            if (instr->number) {
+                return number_binary(instr, args[0], args[1], std::multiplies<double>(), steps);
+            }
+            return value_binary(instr, args[0], args[1], std::multiplies<Value>(), steps);
+        case ssa::Op::DIV:
+            if (instr->number) {
+                return number_binary(instr, args[0], args[1], std::divides<double>(), steps);
+            }
+            return value_binary(instr, args[0], args[1], std::divides<Value>(), steps);
+        case ssa::Op::LESS:
+        case ssa::Op::LESS_EQUAL:
+        case ssa::Op::GREATER:
+        case ssa::Op::GREATER_EQUAL:
+        case ssa::Op::EQUAL:
+        case ssa::Op::NOT_EQUAL:
+            return define(instr, [test = compare(instr, args[0], args[1])](Frame &frame) {
+                return Value(test(frame));
+            }, steps);
+        case ssa::Op::NEG:
+            if (instr->number) {
+                return define(instr, [a = args[0]](Frame &frame) {
+                    return -a.as_number(frame);
+                }, steps);
+            }
+            return define(instr, [a = args[0], token](Frame &frame) {
+                Value scratch;
+                const Value &value = a.read(frame, scratch);
+                if (auto *number = value.get_if<double>()) {
+                    return Value(-*number);
+                }
+                return frame.interpreter->unary(token, value);
+            }, steps);
+        case ssa::Op::NOT:
+            return define(instr, [a = args[0]](Frame &frame) {
+                Value scratch;
+                return Value(!a.read(frame, scratch));
+            }, steps);
+        case ssa::Op::UNARY:
+            return define(instr, [a = args[0], token](Frame &frame) {
+                Value scratch;
+                return frame.interpreter->unary(token, a.read(frame, scratch));
+            }, steps);
+        case ssa::Op::CAPTURE:
+            return define(instr, [capture = instr->index](Frame &frame) {
+                return *frame.captures[capture];
+            }, steps);
+        case ssa::Op::SET_CAPTURE:
+            steps.push_back([a = args[0], capture = instr->index](Frame &frame) {
+                *frame.captures[capture] = a.value(frame);
+            });
+            return;
+        case ssa::Op::GLOBAL:
+            return define(instr, [global = std::make_shared<Global>(token, top_)](Frame &) {
+                return global->get();
+            }, steps);
+        case ssa::Op::SET_GLOBAL:
+            steps.push_back([a = args[0], global = std::make_shared<Global>(token, top_)](Frame &frame) {
+                Value value = a.value(frame);
+                global->get() = std::move(value);
+            });
+            return;
+        case ssa::Op::CHECK_INSTANCE:
+            return define(instr, [a = args[0], token](Frame &frame) {
+                Value object = a.value(frame);
+                if (!object.is<LoxInstance::ptr>()) {
+                    throw RuntimeError(token, "Only instances have fields.");
+                }
+                return object;
+            }, steps);
+        case ssa::Op::GET:
+            return define(instr, [a = args[0], token](Frame &frame) {
+                Value scratch;
+                return frame.interpreter->property(a.read(frame, scratch), token);
+            }, steps);
+        case ssa::Op::SET:
+            steps.push_back([a = args[0], b = args[1], token](Frame &frame) {
+                Value object = a.value(frame);
+                Value value = b.value(frame);
+                object.as<LoxInstance::ptr>()->set(token, std::move(value));
+            });
+            return;
+        case ssa::Op::SUPER:
+            return define(instr, [a = args[0], b = args[1], token](Frame &frame) -> Value {
+                Value superclass = a.value(frame);
+                LoxFunction::ptr found = superclass.as<LoxClass::ptr>()->find_method(token->lexeme);
+                if (found == nullptr) {
+                    throw RuntimeError(token, "Undefined property '" + token->lexeme + "'.");
+                }
+                return found->bind(b.value(frame).as<LoxInstance::ptr>());
+            }, steps);
+        case ssa::Op::CALL:
+            return define(instr, [args, token](Frame &frame) {
+                Value scratch;
+                const Value &callee = args[0].read(frame, scratch);
+                std::vector<Value> values;
+                values.reserve(args.size() - 1);
+                for (size_t i = 1; i < args.size(); i++) {
+                    values.push_back(args[i].value(frame));
+                }
+                Interpreter *interpreter = frame.interpreter;
+                return interpreter->invoke(token, interpreter->to_callable(callee, token, values.size()), values);
+            }, steps);
+        case ssa::Op::PRINT:
+            steps.push_back([a = args[0]](Frame &frame) {
+                Value scratch;
+                *frame.interpreter->output() << a.read(frame, scratch).str() << std::endl;
+            });
+            return;
+        case ssa::Op::IS_CLASS:
+            // the class last seen with the initializer, any class with it creates the same fields
+            return define(instr, [a = args[0], initializer = instr->initializer,
+                                  seen = std::make_shared<LoxClass::ptr>()](Frame &frame) {
+                Value scratch;
+                auto *klass = a.read(frame, scratch).get_if<LoxClass::ptr>();
+                if (klass == nullptr) {
+                    return Value(false);
+                }
+                if (*klass == *seen) {
+                    return Value(true);
+                }
+                LoxFunction::ptr init = (*klass)->find_method("init");
+                if (init == nullptr || init->declaration() != initializer) {
+                    return Value(false);
+                }
+                *seen = *klass;
+                return Value(true);
+            }, steps);
+        case ssa::Op::GET_FIELD:
+            return define(instr, [a = args[0], b = args[1], c = args[2], token](Frame &frame) {
+                Value flag_scratch;
+                Value real_scratch;
+                bool replaced = static_cast<bool>(a.read(frame, flag_scratch));
+                const Value &real = b.read(frame, real_scratch);
+                Value value = c.value(frame);
+                return replaced ? value : frame.interpreter->property(real, token);
+            }, steps);
+        case ssa::Op::CHECK_FIELD:
+            steps.push_back([a = args[0], b = args[1], token](Frame &frame) {
+                Value flag_scratch;
+                Value real_scratch;
+                bool replaced = static_cast<bool>(a.read(frame, flag_scratch));
+                if (!replaced && !b.read(frame, real_scratch).is<LoxInstance::ptr>()) {
+                    throw RuntimeError(token, "Only instances have fields.");
+                }
+            });
+            return;
+        case ssa::Op::SET_FIELD:
+            steps.push_back([a = args[0], b = args[1], c = args[2], token](Frame &frame) {
+                Value scratch;
+                bool replaced = static_cast<bool>(a.read(frame, scratch));
+                Value object = b.value(frame);
+                Value value = c.value(frame);
+                if (!replaced) {
+                    object.as<LoxInstance::ptr>()->set(token, std::move(value));
+                }
+            });
+            return;
+        default:
+            throw std::logic_error("unexpected instruction");
+        }
+    }
+
+    Test condition(const ssa::Instr *instr) {
+        if (fused(instr)) {
+            return compare(instr, operand(instr->args[0]), operand(instr->args[1]));
+        }
+        Operand value = operand(instr);
+        if (value.kind == Operand::SLOT) {
+            return [index = value.index](Frame &frame) {
+                return static_cast<bool>(frame.slots[index]);
+            };
+        }
+        if (value.kind == Operand::EVAL) {
+            return [eval = value.eval](Frame &frame) {
+                return static_cast<bool>(eval(frame));
+            };
+        }
+        // numbers are truthy
+        if (value.kind == Operand::NUMBER_EVAL) {
+            return [eval = value.number_eval](Frame &frame) {
+                eval(frame);
+                return true;
+            };
+        }
+        bool truthy = value.kind == Operand::NUMBER || static_cast<bool>(value.constant);
+        return [truthy](Frame &) {
+            return truthy;
+        };
+    }
+
+    // the copies into the phis of to on the edge from from, ordered so none overwrites a value another still reads,
+    // with a scratch register breaking cycles; nullptr when there are none
+    Step moves(const ssa::Block *from, const ssa::Block *to) {
+        size_t edge = std::find(to->preds.begin(), to->preds.end(), from) - to->preds.begin();
+        std::vector<Move> pending;
+        for (const ssa::Instr *phi : to->phis) {
+            auto found = registers_.find(phi);
+            if (found == registers_.end()) {
+                continue;
+            }
+            Move move{operand(phi->args[edge]), phi->number, found->second};
+            Operand target;
+            target.kind = move.number ? Operand::NUMBER : Operand::SLOT;
+            target.index = move.to;
+            if (!move.from.same_register(target)) {
+                pending.push_back(move);
+            }
+        }
+        if (pending.empty()) {
+            return nullptr;
+        }
+        auto reads = [&pending](const Move &move, size_t except) {
+            for (size_t i = 0; i < pending.size(); i++) {
+                const Operand &from = pending[i].from;
+                if (i != except && from.kind == (move.number ? Operand::NUMBER : Operand::SLOT) &&
+                    from.index == move.to) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        std::vector<Move> ordered;
+        while (!pending.empty()) {
+            size_t ready = pending.size();
+            for (size_t i = 0; i < pending.size(); i++) {
+                if (!reads(pending[i], i)) {
+                    ready = i;
+                    break;
+                }
+            }
+            if (ready == pending.size()) {
+                // a cycle: save the first target in scratch and read it from there
+                const Move &first = pending[0];
+                Operand saved;
+                saved.kind = first.number ? Operand::NUMBER : Operand::SLOT;
+                saved.index = first.to;
+                Operand scratch = saved;
+                scratch.index = first.number ? numbers_ : slots_;
+                ordered.push_back({saved, first.number, scratch.index});
+                for (Move &move : pending) {
+                    if (move.from.same_register(saved)) {
+                        move.from = scratch;
+                    }
+                }
+                continue;
+            }
+            ordered.push_back(pending[ready]);
+            pending.erase(pending.begin() + static_cast<long>(ready));
+        }
+        return [ordered](Frame &frame) {
+            for (const Move &move : ordered) {
+                if (move.number) {
+                    frame.numbers[move.to] = move.from.as_number(frame);
+                } else {
+                    frame.slots[move.to] = move.from.value(frame);
+                }
+            }
+        };
+    }
+
+    Exit exit(const ssa::Block *block) {
+        switch (block->exit) {
+        case ssa::Block::JUMP: {
+            const ssa::Block *target = block->targets[0];
+            Step move = moves(block, target);
+            int next = target->id;
+            if (!move) {
+                return [next](Frame &) {
+                    return next;
+                };
+            }
+            return [move, next](Frame &frame) {
+                move(frame);
+                return next;
+            };
+        }
+        case ssa::Block::BRANCH: {
+            Test test = condition(block->operands[0]);
+            Step then_move = moves(block, block->targets[0]);
+            Step else_move = moves(block, block->targets[1]);
+            int then_block = block->targets[0]->id;
+            int else_block = block->targets[1]->id;
+            return [test, then_move, else_move, then_block, else_block](Frame &frame) {
+                if (test(frame)) {
+                    if (then_move) {
+                        then_move(frame);
+                    }
+                    return then_block;
+                }
+                if (else_move) {
+                    else_move(frame);
+                }
+                return else_block;
+            };
+        }
+        case ssa::Block::RETURN: {
+            // the frame is done with its registers, a boxed result is moved out of its own
+            Operand value = operand(block->operands[0]);
+            if (value.kind == Operand::SLOT) {
+                return [index = value.index](Frame &frame) {
+                    frame.result = std::move(frame.slots[index]);
+                    return kReturn;
+                };
+            }
+            return [value](Frame &frame) {
+                frame.result = value.value(frame);
+                return kReturn;
+            };
+        }
+        case ssa::Block::TAIL_CALL: {
+            // a compiled function called in tail position runs in place of this one, anything else is called
+            std::vector<Operand> operands;
+            for (const ssa::Instr *instr : block->operands) {
+                operands.push_back(operand(instr));
+            }
+            return [operands, paren = block->token](Frame &frame) {
+                Value scratch;
+                const Value &callee = operands[0].read(frame, scratch);
+                std::vector<Value> values;
+                values.reserve(operands.size() - 1);
+                for (size_t i = 1; i < operands.size(); i++) {
+                    values.push_back(operands[i].value(frame));
+                }
+                Interpreter *interpreter = frame.interpreter;
+                Callable::ptr callable = interpreter->to_callable(callee, paren, values.size());
+                if (auto compiled = std::dynamic_pointer_cast<CompiledFunction>(callable)) {
+                    *frame.tail = {std::move(compiled), std::move(values), paren->line};
+                    return kTailCall;
+                }
+                frame.result = interpreter->invoke(paren, callable, values);
+                return kReturn;
+            };
+        }
+        }
+        throw std::logic_error("unexpected block exit");
+    }
+
+    const ssa::Function &function_;
+    Environment::ptr top_;
+    std::unordered_map<const ssa::Instr *, size_t> uses_;
+    // the values computed by their only use
+    std::unordered_set<const ssa::Instr *> inlined_;
+    std::unordered_map<const ssa::Instr *, Operand> computed_;
+    std::unordered_map<const ssa::Block *, std::unordered_set<const ssa::Instr *>> live_in_;
+    std::unordered_map<const ssa::Block *, std::unordered_set<const ssa::Instr *>> live_out_;
+    std::unordered_map<const ssa::Instr *, size_t> registers_;
+    // which registers hold a live value, Value slots first, then numbers
+    std::vector<bool> busy_[2];
+    size_t slots_{0};
+    size_t numbers_{0};
+};
+
+struct FunctionInfo;
+
+// a parameter or local of a function, or the this or super a method sees
+struct Binding {
+    FunctionInfo *owner;
+    // used by a nested function, it lives in a cell
+    bool captured{false};
+    // a var only ever assigned numbers, it lives in an unboxed slot
+    bool number{false};
+    // assigned after its declaration, a function capturing it can't assume it keeps its value through a call
+    bool assigned{false};
+    // captured by a function declared before it, its cell holds no value at all until its declaration runs
+    bool late{false};
+    // of its slot, number slot or cell
+    size_t index{0};
+    // the declaration of a var, for the type report
+    Token::ptr name;
+};
+
+struct FunctionInfo {
+    std::string name;
+    FunctionInfo *parent{nullptr};
+    std::vector<Binding *> locals;
+    std::vector<Binding *> captures;
+    std::unordered_map<const Binding *, size_t> capture_index;
+    // uses a late binding, compiled from the AST since the SSA IR has no notion of one
+    bool late{false};
+    std::shared_ptr<Code> code{std::make_shared<Code>()};
+};
+
+class Compiler {
+ public:
+    Compiler(Interpreter *interpreter, const ClosureCompiler::Options &options)
+        : interpreter_(interpreter), options_(options) {}
+
+    Value run(const Program &program, bool echo) {
+        const auto &statements = program.statements();
+        current_ = &root_;
+        for (const auto &stmt : statements) {
+            if (auto *klass = dynamic_cast<const stmt::Class *>(stmt.get())) {
+                auto [found, inserted] = classes_.emplace(klass->name->lexeme, klass);
+                if (!inserted) {
+                    found->second = nullptr;
+                }
+            }
+        }
+        for (const auto &stmt : statements) {
+            resolve(stmt.get());
+        }
+        infer_numbers();
+        assign_indices();
+        if (options_.type_report != nullptr) {
+            report_numbers(*options_.type_report);
+        }
+
+        // a top-level expression statement is evaluated for its value, the result of the program
+        std::vector<std::pair<Eval, Exec>> steps;
+        for (const auto &stmt : statements) {
+            auto *expression_stmt = dynamic_cast<stmt::Expression *>(stmt.get());
+            if (expression_stmt != nullptr && dynamic_cast<expr::Break *>(expression_stmt->expression.get()) == nullptr) {
+                steps.emplace_back(expression(expression_stmt->expression.get()), nullptr);
+            } else {
+                steps.emplace_back(nullptr, statement(stmt.get()));
+            }
+        }
+
+        std::vector<Value> slots(root_.code->slots);
+        std::vector<double> numbers(root_.code->numbers);
+        std::vector<std::shared_ptr<Value>> cells(root_.code->cells);
+        Frame frame{interpreter_, slots.data(), numbers.data(), cells.data(), nullptr, Value(), nullptr};
+        Value result;
+        for (const auto &[eval, exec] : steps) {
+            if (eval) {
+                result = eval(frame);
+                if (echo) {
+                    *interpreter_->output() << result.str() << std::endl;
+                }
+            } else {
+                exec(frame);
+            }
+        }
+        return result;
+    }
+
+ private:
+    struct Entry {
+        Binding *binding;
+        // declared by now; a nested function sees the whole block, it runs after more of it has
+        bool visible;
+    };
+
+    struct Scope {
+        FunctionInfo *function;
+        std::unordered_map<std::string, Entry> names;
+    };
+
+    // what the SSA builder asks about the variables of the function being compiled
+    class IrNames : public ssa::Names {
+     public:
+        IrNames(Compiler *compiler, const stmt::Function *function) : compiler_(compiler), function_(function) {}
+
+        Name use(const expr::Expr *expr) override {
+            return name(compiler_->uses_.at(expr));
+        }
+
+        Name super_this(const expr::Super *expr) override {
+            return name(compiler_->super_selves_.at(expr));
+        }
+
+        Name declaration(const stmt::Var *var) override {
+            return name(compiler_->declarations_.at(var));
+        }
+
+        Name parameter(size_t i) override {
+            return name(compiler_->params_.at(function_)[i]);
+        }
+
+        const stmt::Class *constructs(const expr::Call *call) override {
+            auto *callee = dynamic_cast<const expr::Variable *>(call->callee.get());
+            if (callee == nullptr || compiler_->uses_.at(callee) != nullptr) {
+                return nullptr;
+            }
+            auto found = compiler_->classes_.find(callee->name->lexeme);
+            return found != compiler_->classes_.end() ? found->second : nullptr;
+        }
+
+     private:
+        Name name(const Binding *binding) const {
+            if (binding == nullptr) {
+                return {GLOBAL};
+            }
+            if (binding->owner == compiler_->current_) {
+                return {LOCAL, binding};
+            }
+            return {CAPTURE, nullptr, compiler_->current_->capture_index.at(binding), !binding->assigned};
+        }
+
+        Compiler *compiler_;
+        const stmt::Function *function_;
+    };
+
+    // resolution: binds every variable to its declaration and works out what closures capture
+
+    // nullptr at top level, where declarations are globals
+    Binding *declare(const std::string &name, const void *owner, bool visible) {
+        if (scopes_.empty()) {
+            return nullptr;
+        }
+        Binding *binding = &bindings_.emplace_back();
+        binding->owner = current_;
+        scopes_.back().names[name] = {binding, visible};
+        current_->locals.push_back(binding);
+        if (owner != nullptr) {
+            scoped_[owner].push_back(binding);
+        }
+        return binding;
+    }
+
+    void declare_all(const std::vector<stmt::Statement::ptr> &statements, const void *owner) {
+        for (const auto &stmt : statements) {
+            if (auto *var = dynamic_cast<stmt::Var *>(stmt.get())) {
+                declarations_[var] = declare(var->name->lexeme, owner, false);
+            } else if (auto *function = dynamic_cast<stmt::Function *>(stmt.get())) {
+                declarations_[function] = declare(function->name->lexeme, owner, false);
+            } else if (auto *klass = dynamic_cast<stmt::Class *>(stmt.get())) {
+                declarations_[klass] = declare(klass->name->lexeme, owner, false);
+            }
+        }
+    }
+
+    void make_visible(const Token::ptr &name) {
+        if (!scopes_.empty()) {
+            scopes_.back().names[name->lexeme].visible = true;
+        }
+    }
+
+    // nullptr for a global or builtin; an enclosing local declared after the function using it is only found
+    // once its declaration has run, before that use finds what the name means further out, as in the tree walker
+    Binding *lookup(const std::string &name, const void *use = nullptr) {
+        std::vector<Binding *> chain;
+        bool visible = false;
+        for (auto scope = scopes_.rbegin(); scope != scopes_.rend() && !visible; ++scope) {
+            auto found = scope->names.find(name);
+            if (found == scope->names.end()) {
+                continue;
+            }
+            visible = found->second.visible;
+            if (scope->function == current_) {
+                if (visible) {
+                    return found->second.binding;
+                }
+                continue;
+            }
+            Binding *binding = found->second.binding;
+            binding->captured = true;
+            binding->late = binding->late || !visible;
+            capture(current_, binding);
+            chain.push_back(binding);
+        }
+        if (chain.empty()) {
+            return nullptr;
+        }
+        if (chain.size() > 1 || !visible) {
+            if (!visible) {
+                chain.push_back(nullptr);
+            }
+            late_[use] = chain;
+            current_->late = true;
+        }
+        return chain.front();
+    }
+
+    // the capture of binding in function, added to the functions between it and the binding's owner as needed
+    size_t capture(FunctionInfo *function, const Binding *binding) {
+        auto found = function->capture_index.find(binding);
+        if (found != function->capture_index.end()) {
+            return found->second;
+        }
+        if (function->parent != binding->owner) {
+            capture(function->parent, binding);
+        }
+        size_t index = function->captures.size();
+        function->captures.push_back(const_cast<Binding *>(binding));
+        function->capture_index[binding] = index;
+        return index;
+    }
+
+    void resolve(stmt::Statement *stmt) {
+        if (stmt == nullptr) {
+            return;
+        }
+        if (auto *expression_stmt = dynamic_cast<stmt::Expression *>(stmt)) {
+            resolve(expression_stmt->expression.get());
+        } else if (auto *print = dynamic_cast<stmt::Print *>(stmt)) {
+            resolve(print->expression.get());
+        } else if (auto *var = dynamic_cast<stmt::Var *>(stmt)) {
+            if (var->value) {
+                resolve(var->value.get());
+            }
+            if (Binding *binding = declarations_[var]) {
+                binding->name = var->name;
+                definitions_.emplace_back(binding, var->value.get());
+            }
+            make_visible(var->name);
+        } else if (auto *block = dynamic_cast<stmt::Block *>(stmt)) {
+            scopes_.push_back({current_, {}});
+            declare_all(block->statements, block);
+            for (const auto &item : block->statements) {
+                resolve(item.get());
+            }
+            scopes_.pop_back();
+        } else if (auto *if_stmt = dynamic_cast<stmt::If *>(stmt)) {
+            resolve(if_stmt->condition.get());
+            resolve(if_stmt->then_branch.get());
+            resolve(if_stmt->else_branch.get());
+        } else if (auto *while_stmt = dynamic_cast<stmt::While *>(stmt)) {
+            resolve(while_stmt->condition.get());
+            resolve(while_stmt->body.get());
+        } else if (auto *for_stmt = dynamic_cast<stmt::For *>(stmt)) {
+            scopes_.push_back({current_, {}});
+            if (auto *var = dynamic_cast<stmt::Var *>(for_stmt->initializer.get())) {
+                declarations_[var] = declare(var->name->lexeme, for_stmt, false);
+            }
+            resolve(for_stmt->initializer.get());
+            resolve(for_stmt->condition.get());
+            resolve(for_stmt->increment.get());
+            resolve(for_stmt->body.get());
+            scopes_.pop_back();
+        } else if (auto *function = dynamic_cast<stmt::Function *>(stmt)) {
+            make_visible(function->name);
+            resolve_function(function);
+        } else if (auto *ret = dynamic_cast<stmt::Return *>(stmt)) {
+            if (ret->value) {
+                resolve(ret->value.get());
+            }
+        } else if (auto *klass = dynamic_cast<stmt::Class *>(stmt)) {
+            if (klass->super) {
+                resolve(klass->super.get());
+            }
+            make_visible(klass->name);
+            // the scopes the tree walker gives methods: the class's with super, then the bound instance's with this
+            if (klass->super) {
+                scopes_.push_back({current_, {}});
+                supers_[klass] = declare("super", nullptr, true);
+            }
+            scopes_.push_back({current_, {}});
+            Binding *self = declare("this", nullptr, true);
+            selves_[klass] = self;
+            for (const auto &method : klass->methods) {
+                resolve_function(method.get());
+            }
+            scopes_.pop_back();
+            if (klass->super) {
+                scopes_.pop_back();
+            }
+        }
+    }
+
+    void resolve_function(stmt::Function *function) {
+        FunctionInfo *info = &functions_[function];
+        info->name = function->name->lexeme + "()";
+        info->parent = current_;
+        current_ = info;
+        scopes_.push_back({current_, {}});
+        for (const auto &param : function->params) {
+            params_[function].push_back(declare(param->lexeme, nullptr, true));
+        }
+        auto *body = static_cast<stmt::Block *>(function->body.get());
+        declare_all(body->statements, function);
+        for (const auto &item : body->statements) {
+            resolve(item.get());
+        }
+        scopes_.pop_back();
+        current_ = info->parent;
+    }
+
+    void resolve(expr::Expr *expr) {
+        if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            resolve(grouping->expression.get());
+        } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            resolve(unary->right.get());
+        } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            resolve(binary->left.get());
+            resolve(binary->right.get());
+        } else if (auto *logical = dynamic_cast<expr::Logical *>(expr)) {
+            resolve(logical->left.get());
+            resolve(logical->right.get());
+        } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            uses_[variable] = lookup(variable->name->lexeme, variable);
+        } else if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            resolve(assign->value.get());
+            uses_[assign] = lookup(assign->name->lexeme, assign);
+            if (Binding *binding = uses_[assign]) {
+                binding->assigned = true;
+                definitions_.emplace_back(binding, assign->value.get());
+            }
+            if (auto late = late_.find(assign); late != late_.end()) {
+                for (Binding *binding : late->second) {
+                    if (binding != nullptr) {
+                        binding->assigned = true;
+                    }
+                }
+            }
+        } else if (auto *call = dynamic_cast<expr::Call *>(expr)) {
+            resolve(call->callee.get());
+            for (const auto &argument : call->arguments) {
+                resolve(argument.get());
+            }
+        } else if (auto *get = dynamic_cast<expr::Get *>(expr)) {
+            resolve(get->object.get());
+        } else if (auto *set = dynamic_cast<expr::Set *>(expr)) {
+            resolve(set->object.get());
+            resolve(set->value.get());
+        } else if (auto *self = dynamic_cast<expr::This *>(expr)) {
+            uses_[self] = lookup("this");
+        } else if (auto *super = dynamic_cast<expr::Super *>(expr)) {
+            uses_[super] = lookup("super");
+            super_selves_[super] = lookup("this");
+        }
+    }
+
+    // type inference: what an expression evaluates to, given the vars currently assumed to be numbers
+    enum class Kind { NUMBER, BOOL, VALUE };
+
+    static bool arithmetic(Token::Kind op) {
+        return op == Token::PLUS || op == Token::MINUS || op == Token::STAR || op == Token::SLASH;
+    }
+
+    static bool comparison(Token::Kind op) {
+        return op == Token::GREATER || op == Token::GREATER_EQUAL || op == Token::LESS || op == Token::LESS_EQUAL ||
+               op == Token::BANG_EQUAL || op == Token::EQUAL_EQUAL;
+    }
+
+    Kind kind_of(expr::Expr *expr) {
+        if (auto *literal = dynamic_cast<expr::Literal *>(expr)) {
+            if (literal->value.is<double>()) {
+                return Kind::NUMBER;
+            }
+            return literal->value.is<bool>() ? Kind::BOOL : Kind::VALUE;
+        } else if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            return kind_of(grouping->expression.get());
+        } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            if (unary->op->kind == Token::BANG) {
+                return Kind::BOOL;
+            }
+            if (unary->op->kind == Token::MINUS && kind_of(unary->right.get()) == Kind::NUMBER) {
+                return Kind::NUMBER;
+            }
+        } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            if (comparison(binary->op->kind)) {
+                return Kind::BOOL;
+            }
+            if (arithmetic(binary->op->kind) && kind_of(binary->left.get()) == Kind::NUMBER &&
+                kind_of(binary->right.get()) == Kind::NUMBER) {
+                return Kind::NUMBER;
+            }
+        } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            const Binding *binding = uses_[variable];
+            if (binding != nullptr && binding->number) {
+                return Kind::NUMBER;
+            }
+        } else if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            return kind_of(assign->value.get());
+        }
+        return Kind::VALUE;
+    }
+
+    // every var starts out a number unless a closure captures it, those assigned anything that isn't one are
+    // demoted until no assignment changes its mind; what is left only ever holds numbers, wherever control goes
+    void infer_numbers() {
+        for (Binding &binding : bindings_) {
+            binding.number = binding.name != nullptr && !binding.captured;
+        }
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (const auto &[binding, value] : definitions_) {
+                if (binding->number && (value == nullptr || kind_of(value) != Kind::NUMBER)) {
+                    binding->number = false;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    void report_numbers(std::ostream &os) {
+        std::vector<const Binding *> numbers;
+        size_t vars = 0;
+        for (const Binding &binding : bindings_) {
+            if (binding.number) {
+                numbers.push_back(&binding);
+            }
+            vars += binding.name != nullptr;
+        }
+        std::stable_sort(numbers.begin(), numbers.end(), [](const Binding *a, const Binding *b) {
+            return a->name->line < b->name->line;
+        });
+        for (const Binding *binding : numbers) {
+            const std::string &function = binding->owner == &root_ ? "top level" : binding->owner->name;
+            os << "line " << binding->name->line << ": " << binding->name->lexeme << " in " << function
+               << " is an unboxed number" << std::endl;
+        }
+        os << numbers.size() << " of " << vars << " local vars unboxed" << std::endl;
+    }
+
+    // a number takes an unboxed slot, a captured binding a cell, any other a slot
+    void assign_indices() {
+        auto assign = [](FunctionInfo &info) {
+            for (Binding *binding : info.locals) {
+                if (binding->number) {
+                    binding->index = info.code->numbers++;
+                } else {
+                    binding->index = binding->captured ? info.code->cells++ : info.code->slots++;
+                }
+            }
+        };
+        assign(root_);
+        for (auto &item : functions_) {
+            assign(item.second);
+        }
+    }
+
+    // code generation
+
+    // reads binding, or the global name when it is nullptr
+    Eval load(const Binding *binding, const Token::ptr &name) {
+        if (binding == nullptr) {
+            auto global = std::make_shared<Global>(name, interpreter_->top_level());
+            return [global](Frame &) {
+                return global->get();
+            };
+        }
+        size_t index = binding->index;
+        if (binding->number) {
+            return [index](Frame &frame) {
+                return Value(frame.numbers[index]);
+            };
+        }
+        if (binding->owner != current_) {
+            size_t capture = current_->capture_index.at(binding);
+            return [capture](Frame &frame) {
+                return *frame.captures[capture];
+            };
+        }
+        if (binding->captured) {
+            return [index](Frame &frame) {
+                return *frame.cells[index];
+            };
+        }
+        return [index](Frame &frame) {
+            return frame.slots[index];
+        };
+    }
+
+    // the value a use of late bindings finds: that of the innermost one declared by now, or what it falls back to
+    Place place(const std::vector<Binding *> &chain, const Token::ptr &name) {
+        Place place;
+        if (chain.back() == nullptr) {
+            auto global = std::make_shared<Global>(name, interpreter_->top_level());
+            place = [global](Frame &) {
+                return &global->get();
+            };
+        } else {
+            size_t capture = current_->capture_index.at(chain.back());
+            place = [capture](Frame &frame) {
+                return frame.captures[capture].get();
+            };
+        }
+        for (auto binding = chain.rbegin() + 1; binding != chain.rend(); ++binding) {
+            size_t capture = current_->capture_index.at(*binding);
+            place = [capture, place](Frame &frame) {
+                Value *value = frame.captures[capture].get();
+                return value->is<void>() ? place(frame) : value;
+            };
+        }
+        return place;
+    }
+
+    // evaluates value into binding; a global is defined when define is set and must exist otherwise
+    Eval store(const Binding *binding, const Token::ptr &name, Eval value, bool define) {
+        if (binding == nullptr) {
+            if (define) {
+                Environment::ptr top = interpreter_->top_level();
+                std::string key = name->lexeme;
+                return [top, key, value](Frame &frame) {
+                    Value result = value(frame);
+                    top->define(key, result);
+                    return result;
+                };
+            }
+            auto global = std::make_shared<Global>(name, interpreter_->top_level());
+            return [global, value](Frame &frame) {
+                Value result = value(frame);
+                return global->get() = std::move(result);
+            };
+        }
+        size_t index = binding->index;
+        if (binding->owner != current_) {
+            size_t capture = current_->capture_index.at(binding);
+            return [capture, value](Frame &frame) {
+                return *frame.captures[capture] = value(frame);
+            };
+        }
+        if (binding->captured) {
+            return [index, value](Frame &frame) {
+                return *frame.cells[index] = value(frame);
+            };
+        }
+        return [index, value](Frame &frame) {
+            return frame.slots[index] = value(frame);
+        };
+    }
+
+    // evaluates value, a number, into the unboxed slot of binding
+    NumberEval store_number(const Binding *binding, expr::Expr *value) {
+        size_t index = binding->index;
+        NumberEval number = numeric(value);
+        return [index, number](Frame &frame) {
+            return frame.numbers[index] = number(frame);
+        };
+    }
+
+    // an expression whose kind is NUMBER, evaluated without boxing where its operands are known to be numbers
+    NumberEval numeric(expr::Expr *expr) {
+        if (auto *literal = dynamic_cast<expr::Literal *>(expr)) {
+            double value = literal->value.as<double>();
+            return [value](Frame &) {
+                return value;
+            };
+        } else if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            return numeric(grouping->expression.get());
+        } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            const Binding *binding = uses_[variable];
+            if (binding != nullptr && binding->number) {
+                size_t index = binding->index;
+                return [index](Frame &frame) {
+                    return frame.numbers[index];
+                };
+            }
+        } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            NumberEval right = numeric(unary->right.get());
+            return [right](Frame &frame) {
+                return -right(frame);
+            };
+        } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            NumberEval left = numeric(binary->left.get());
+            NumberEval right = numeric(binary->right.get());
+            switch (binary->op->kind) {
+            case Token::PLUS:
+                return [left, right](Frame &frame) {
+                    double a = left(frame);
+                    return a + right(frame);
+                };
+            case Token::MINUS:
+                return [left, right](Frame &frame) {
+                    double a = left(frame);
+                    return a - right(frame);
+                };
+            case Token::STAR:
+                return [left, right](Frame &frame) {
+                    double a = left(frame);
+                    return a * right(frame);
+                };
+            default:
+                return [left, right](Frame &frame) {
+                    double a = left(frame);
+                    return a / right(frame);
+                };
+            }
+        } else if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            const Binding *binding = uses_[assign];
+            if (binding != nullptr && binding->number) {
+                return store_number(binding, assign->value.get());
+            }
+        }
+        // a number that comes boxed, from a global, a captured variable or a call
+        Eval eval = expression(expr);
+        return [eval](Frame &frame) {
+            return eval(frame).as<double>();
+        };
+    }
+
+    // the truth of a condition; comparisons of numbers compare doubles
+    Test condition(expr::Expr *expr) {
+        if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            return condition(grouping->expression.get());
+        }
+        if (auto *unary = dynamic_cast<expr::Unary *>(expr); unary != nullptr && unary->op->kind == Token::BANG) {
+            Test right = condition(unary->right.get());
+            return [right](Frame &frame) {
+                return !right(frame);
+            };
+        }
+        auto *binary = dynamic_cast<expr::Binary *>(expr);
+        if (binary == nullptr || !comparison(binary->op->kind) || kind_of(binary->left.get()) != Kind::NUMBER ||
+            kind_of(binary->right.get()) != Kind::NUMBER) {
+            Eval eval = expression(expr);
+            return [eval](Frame &frame) {
+                return static_cast<bool>(eval(frame));
+            };
+        }
+        NumberEval left = numeric(binary->left.get());
+        NumberEval right = numeric(binary->right.get());
+        switch (binary->op->kind) {
+        case Token::GREATER:
+            return [left, right](Frame &frame) {
+                double a = left(frame);
+                return a > right(frame);
+            };
+        case Token::GREATER_EQUAL:
+            return [left, right](Frame &frame) {
+                double a = left(frame);
+                return a >= right(frame);
+            };
+        case Token::LESS:
+            return [left, right](Frame &frame) {
+                double a = left(frame);
+                return a < right(frame);
+            };
+        case Token::LESS_EQUAL:
+            return [left, right](Frame &frame) {
+                double a = left(frame);
+                return a <= right(frame);
+            };
+        case Token::BANG_EQUAL:
+            return [left, right](Frame &frame) {
+                double a = left(frame);
+                return a != right(frame);
+            };
+        default:
+            return [left, right](Frame &frame) {
+                double a = left(frame);
+                return a == right(frame);
+            };
+        }
+    }
+
+    template <typename F> static Eval binary(Eval left, Eval right, Token::ptr op, F fn) {
+        return [left, right, op, fn](Frame &frame) -> Value {
+            Value a = left(frame);
+            Value b = right(frame);
+            try {
+                return fn(a, b);
+            } catch (const std::exception &e) {
+                throw RuntimeError(op, e.what());
+            }
+        };
+    }
+
+    Eval binary_expression(expr::Binary *expr) {
+        if (kind_of(expr) == Kind::NUMBER) {
+            NumberEval number = numeric(expr);
+            return [number](Frame &frame) {
+                return Value(number(frame));
+            };
+        }
+        if (comparison(expr->op->kind) && kind_of(expr->left.get()) == Kind::NUMBER &&
+            kind_of(expr->right.get()) == Kind::NUMBER) {
+            Test test = condition(expr);
+            return [test](Frame &frame) {
+                return Value(test(frame));
+            };
+        }
+        Eval left = expression(expr->left.get());
+        Eval right = expression(expr->right.get());
+        const Token::ptr &op = expr->op;
+        switch (op->kind) {
+        case Token::PLUS:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a + b;
+            });
+        case Token::MINUS:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a - b;
+            });
+        case Token::STAR:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a * b;
+            });
+        case Token::SLASH:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a / b;
+            });
+        case Token::GREATER:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a > b;
+            });
+        case Token::GREATER_EQUAL:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a >= b;
+            });
+        case Token::LESS:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a < b;
+            });
+        case Token::LESS_EQUAL:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a <= b;
+            });
+        case Token::BANG_EQUAL:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a != b;
+            });
+        case Token::EQUAL_EQUAL:
+            return binary(left, right, op, [](const Value &a, const Value &b) {
+                return a == b;
+            });
+        default:
+            return binary(left, right, op, [](const Value &, const Value &) -> Value {
+                throw std::runtime_error("unknown binary operator");
+            });
+        }
+    }
+
+    Eval expression(expr::Expr *expr) {
+        if (auto *literal = dynamic_cast<expr::Literal *>(expr)) {
+            Value value = literal->value;
+            return [value](Frame &) {
+                return value;
+            };
+        } else if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            return expression(grouping->expression.get());
+        } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            Token::ptr op = unary->op;
+            if (op->kind == Token::BANG) {
+                Test test = condition(unary);
+                return [test](Frame &frame) {
+                    return Value(test(frame));
+                };
+            }
+            if (kind_of(unary) == Kind::NUMBER) {
+                NumberEval number = numeric(unary);
+                return [number](Frame &frame) {
+                    return Value(number(frame));
+                };
+            }
+            Eval right = expression(unary->right.get());
+            if (op->kind == Token::MINUS) {
+                return [right, op](Frame &frame) {
+                    Value value = right(frame);
+                    if (auto *number = value.get_if<double>()) {
+                        return Value(-*number);
+                    }
+                    return frame.interpreter->unary(op, value);
+                };
+            }
+            return [right, op](Frame &frame) {
+                return frame.interpreter->unary(op, right(frame));
+            };
+        } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            return binary_expression(binary);
+        } else if (auto *logical = dynamic_cast<expr::Logical *>(expr)) {
+            Eval left = expression(logical->left.get());
+            Eval right = expression(logical->right.get());
+            if (logical->op->kind == Token::OR) {
+                return [left, right](Frame &frame) {
+                    Value value = left(frame);
+                    return value ? value : right(frame);
+                };
+            }
+            return [left, right](Frame &frame) {
+                Value value = left(frame);
+                return !value ? value : right(frame);
+            };
+        } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            auto late = late_.find(variable);
+            if (late != late_.end()) {
+                Place found = place(late->second, variable->name);
+                return [found](Frame &frame) {
+                    return *found(frame);
+                };
+            }
+            return load(uses_[variable], variable->name);
+        } else if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            auto late = late_.find(assign);
+            if (late != late_.end()) {
+                Place found = place(late->second, assign->name);
+                Eval value = expression(assign->value.get());
+                return [found, value](Frame &frame) {
+                    Value result = value(frame);
+                    return *found(frame) = std::move(result);
+                };
+            }
+            const Binding *binding = uses_[assign];
+            if (binding != nullptr && binding->number) {
+                NumberEval number = store_number(binding, assign->value.get());
+                return [number](Frame &frame) {
+                    return Value(number(frame));
+                };
+            }
+            return store(binding, assign->name, expression(assign->value.get()), false);
+        } else if (auto *call = dynamic_cast<expr::Call *>(expr)) {
+            Eval callee = expression(call->callee.get());
+            std::vector<Eval> arguments = expressions(call->arguments);
+            Token::ptr paren = call->paren;
+            return [callee, arguments, paren](Frame &frame) {
+                Value function = callee(frame);
+                std::vector<Value> values;
+                values.reserve(arguments.size());
+                for (const auto &argument : arguments) {
+                    values.push_back(argument(frame));
+                }
+                Interpreter *interpreter = frame.interpreter;
+                return interpreter->invoke(paren, interpreter->to_callable(function, paren, values.size()), values);
+            };
+        } else if (auto *get = dynamic_cast<expr::Get *>(expr)) {
+            Eval object = expression(get->object.get());
+            Token::ptr name = get->name;
+            return [object, name](Frame &frame) {
+                return frame.interpreter->property(object(frame), name);
+            };
+        } else if (auto *set = dynamic_cast<expr::Set *>(expr)) {
+            Eval object = expression(set->object.get());
+            Eval value = expression(set->value.get());
+            Token::ptr name = set->name;
+            return [object, value, name](Frame &frame) {
+                Value target = object(frame);
+                auto *instance = target.get_if<LoxInstance::ptr>();
+                if (instance == nullptr) {
+                    throw RuntimeError(name, "Only instances have fields.");
+                }
+                Value result = value(frame);
+                (*instance)->set(name, result);
+                return result;
+            };
+        } else if (auto *self = dynamic_cast<expr::This *>(expr)) {
+            return load(uses_[self], self->name);
+        } else if (auto *super = dynamic_cast<expr::Super *>(expr)) {
+            Eval superclass = load(uses_[super], super->keyword);
+            Eval instance = load(super_selves_[super], super->keyword);
+            Token::ptr method = super->method;
+            return [superclass, instance, method](Frame &frame) -> Value {
+                LoxFunction::ptr found = superclass(frame).as<LoxClass::ptr>()->find_method(method->lexeme);
+                if (found == nullptr) {
+                    throw RuntimeError(method, "Undefined property '" + method->lexeme + "'.");
+                }
+                return found->bind(instance(frame).as<LoxInstance::ptr>());
+            };
+        } else if (auto *brk = dynamic_cast<expr::Break *>(expr)) {
+            Token::ptr keyword = brk->keyword;
+            return [keyword](Frame &) -> Value {
+                throw BreakException(keyword);
+            };
+        }
+        throw std::logic_error("unknown expression");
+    }
+
+    std::vector<Eval> expressions(const std::vector<expr::Expr::ptr> &exprs) {
+        std::vector<Eval> evals;
+        for (const auto &expr : exprs) {
+            evals.push_back(expression(expr.get()));
+        }
+        return evals;
+    }
+
+    // the cells of the captured locals the block, for loop or function body owner declares, fresh on every entry,
+    // with what each starts out holding
+    std::vector<std::pair<size_t, Value>> fresh_cells(const void *owner) {
+        std::vector<std::pair<size_t, Value>> cells;
+        for (const Binding *binding : scoped_[owner]) {
+            if (binding->captured) {
+                cells.emplace_back(binding->index, binding->late ? Value(std::any()) : Value());
+            }
+        }
+        return cells;
+    }
+
+    Exec block(const std::vector<stmt::Statement::ptr> &statements, const void *owner) {
+        std::vector<std::pair<size_t, Value>> cells = fresh_cells(owner);
+        std::vector<Exec> steps;
+        for (const auto &stmt : statements) {
+            steps.push_back(statement(stmt.get()));
+        }
+        return [cells, steps](Frame &frame) {
+            for (const auto &[index, value] : cells) {
+                frame.cells[index] = std::make_shared<Value>(value);
+            }
+            for (const auto &step : steps) {
+                Flow flow = step(frame);
+                if (flow != Flow::NORMAL) {
+                    return flow;
+                }
+            }
+            return Flow::NORMAL;
+        };
+    }
+
+    // a loop body; a break in an expression, or in a function it calls, leaves the loop like the tree walker's
+    Exec loop_body(stmt::Statement *body) {
+        loops_++;
+        Exec exec = statement(body);
+        loops_--;
+        return exec;
+    }
+
+    Exec statement(stmt::Statement *stmt) {
+        if (auto *expression_stmt = dynamic_cast<stmt::Expression *>(stmt)) {
+            if (auto *brk = dynamic_cast<expr::Break *>(expression_stmt->expression.get())) {
+                if (loops_ > 0) {
+                    return [](Frame &) {
+                        return Flow::BREAK;
+                    };
+                }
+                // breaks out of a loop in a caller
+                Token::ptr keyword = brk->keyword;
+                return [keyword](Frame &) -> Flow {
+                    throw BreakException(keyword);
+                };
+            }
+            expr::Expr *expression_expr = expression_stmt->expression.get();
+            // a number computed for its side effect, like an increment, is never boxed
+            if (kind_of(expression_expr) == Kind::NUMBER) {
+                NumberEval number = numeric(expression_expr);
+                return [number](Frame &frame) {
+                    number(frame);
+                    return Flow::NORMAL;
+                };
+            }
+            Eval eval = expression(expression_expr);
+            return [eval](Frame &frame) {
+                eval(frame);
+                return Flow::NORMAL;
+            };
+        } else if (auto *print = dynamic_cast<stmt::Print *>(stmt)) {
+            Eval eval = expression(print->expression.get());
+            return [eval](Frame &frame) {
+                *frame.interpreter->output() << eval(frame).str() << std::endl;
+                return Flow::NORMAL;
+            };
+        } else if (auto *var = dynamic_cast<stmt::Var *>(stmt)) {
+            const Binding *binding = declarations_[var];
+            if (binding != nullptr && binding->number) {
+                NumberEval define = store_number(binding, var->value.get());
+                return [define](Frame &frame) {
+                    define(frame);
+                    return Flow::NORMAL;
+                };
+            }
+            Eval value = var->value ? expression(var->value.get()) : [](Frame &) {
+                return Value();
+            };
+            Eval define = store(declarations_[var], var->name, value, true);
+            return [define](Frame &frame) {
+                define(frame);
+                return Flow::NORMAL;
+            };
+        } else if (auto *block_stmt = dynamic_cast<stmt::Block *>(stmt)) {
+            return block(block_stmt->statements, block_stmt);
+        } else if (auto *if_stmt = dynamic_cast<stmt::If *>(stmt)) {
+            Test test = condition(if_stmt->condition.get());
+            Exec then_branch = statement(if_stmt->then_branch.get());
+            Exec else_branch = if_stmt->else_branch ? statement(if_stmt->else_branch.get()) : nullptr;
+            return [test, then_branch, else_branch](Frame &frame) {
+                if (test(frame)) {
+                    return then_branch(frame);
+                }
+                return else_branch ? else_branch(frame) : Flow::NORMAL;
+            };
+        } else if (auto *while_stmt = dynamic_cast<stmt::While *>(stmt)) {
+            Test test = condition(while_stmt->condition.get());
+            Exec body = loop_body(while_stmt->body.get());
+            return [test, body](Frame &frame) {
+                try {
+                    while (test(frame)) {
+                        Flow flow = body(frame);
+                        if (flow == Flow::BREAK) {
+                            break;
+                        }
+                        if (flow != Flow::NORMAL) {
+                            return flow;
+                        }
+                    }
+                } catch (const BreakException &) {
+                }
+                return Flow::NORMAL;
+            };
+        } else if (auto *for_stmt = dynamic_cast<stmt::For *>(stmt)) {
+            std::vector<std::pair<size_t, Value>> cells = fresh_cells(for_stmt);
+            Exec initializer = for_stmt->initializer ? statement(for_stmt->initializer.get()) : nullptr;
+            Test test = condition(for_stmt->condition.get());
+            Exec increment = for_stmt->increment ? statement(for_stmt->increment.get()) : nullptr;
+            Exec body = loop_body(for_stmt->body.get());
+            return [cells, initializer, test, increment, body](Frame &frame) {
+                for (const auto &[index, value] : cells) {
+                    frame.cells[index] = std::make_shared<Value>(value);
+                }
+                if (initializer) {
+                    initializer(frame);
+                }
+                try {
+                    for (; test(frame); increment ? increment(frame) : Flow::NORMAL) {
+                        Flow flow = body(frame);
+                        if (flow == Flow::BREAK) {
+                            break;
+                        }
+                        if (flow != Flow::NORMAL) {
+                            return flow;
+                        }
+                    }
+                } catch (const BreakException &) {
+                }
+                return Flow::NORMAL;
+            };
+        } else if (auto *function = dynamic_cast<stmt::Function *>(stmt)) {
+            Eval value = closure(function);
+            Eval define = store(declarations_[function], function->name, [value](Frame &frame) {
+                return Value(std::static_pointer_cast<Callable>(value(frame).as<LoxFunction::ptr>()));
+            }, true);
+            return [define](Frame &frame) {
+                define(frame);
+                return Flow::NORMAL;
+            };
+        } else if (auto *ret = dynamic_cast<stmt::Return *>(stmt)) {
+            return return_statement(ret);
+        } else if (auto *klass = dynamic_cast<stmt::Class *>(stmt)) {
+            return class_declaration(klass);
+        }
+        throw std::logic_error("unknown statement");
+    }
+
+    Exec return_statement(stmt::Return *ret) {
+        if (!ret->value) {
+            return [](Frame &frame) {
+                frame.result = Value();
+                return Flow::RETURN;
+            };
+        }
+        if (!ret->tail_call) {
+            Eval value = expression(ret->value.get());
+            return [value](Frame &frame) {
+                frame.result = value(frame);
+                return Flow::RETURN;
+            };
+        }
+        // a compiled function called in tail position runs in place of this one, anything else is called
+        auto *call = static_cast<expr::Call *>(ret->value.get());
+        Eval callee = expression(call->callee.get());
+        std::vector<Eval> arguments = expressions(call->arguments);
+        Token::ptr paren = call->paren;
+        return [callee, arguments, paren](Frame &frame) {
+            Value function = callee(frame);
+            std::vector<Value> values;
+            values.reserve(arguments.size());
+            for (const auto &argument : arguments) {
+                values.push_back(argument(frame));
+            }
+            Interpreter *interpreter = frame.interpreter;
+            Callable::ptr callable = interpreter->to_callable(function, paren, values.size());
+            if (auto compiled = std::dynamic_pointer_cast<CompiledFunction>(callable)) {
+                *frame.tail = {std::move(compiled), std::move(values), paren->line};
+                return Flow::TAIL_CALL;
+            }
+            frame.result = interpreter->invoke(paren, callable, values);
+            return Flow::RETURN;
+        };
+    }
+
+    // creates a closure of function over the captures it needs from the running frame
+    Eval closure(stmt::Function *function) {
+        FunctionInfo *info = &functions_[function];
+        std::shared_ptr<const Code> code = compile_function(function);
+        std::vector<CaptureSource> sources;
+        for (const Binding *binding : info->captures) {
+            if (binding->owner == current_) {
+                sources.push_back({true, binding->index});
+            } else {
+                sources.push_back({false, current_->capture_index.at(binding)});
+            }
+        }
+        Eval make = [function, code, sources](Frame &frame) {
+            std::vector<std::shared_ptr<Value>> captures;
+            captures.reserve(sources.size());
+            for (const auto &source : sources) {
+                captures.push_back(source.cell ? frame.cells[source.index] : frame.captures[source.index]);
+            }
+            return Value(LoxFunction::ptr(std::make_shared<CompiledFunction>(function, code, std::move(captures))));
+        };
+        const auto &captured = info->captures;
+        bool own = captured.empty() || (captured.size() == 1 && captured[0] == declarations_[function]);
+        if (!function->shared() || !own) {
+            return make;
+        }
+        // made by the first run of the declaration, as the tree walker shares it
+        auto shared = std::make_shared<LoxFunction::ptr>();
+        return [make, shared](Frame &frame) {
+            if (*shared == nullptr) {
+                *shared = make(frame).as<LoxFunction::ptr>();
+            }
+            return Value(*shared);
+        };
+    }
+
+    std::shared_ptr<const Code> compile_function(stmt::Function *function) {
+        FunctionInfo *info = &functions_[function];
+        FunctionInfo *enclosing = current_;
+        int loops = loops_;
+        current_ = info;
+        loops_ = 0;
+        std::shared_ptr<Code> code = info->code;
+        std::unique_ptr<ssa::Function> ir;
+        if (options_.optimize && !info->late) {
+            IrNames names(this, function);
+            ir = ssa::Function::build(function, names);
+        }
+        if (ir) {
+            ir->optimize();
+            if (options_.ir_dump != nullptr) {
+                ir->print(*options_.ir_dump);
+            }
+            code->body = Lowering(*ir, interpreter_->top_level()).lower(*code);
+        } else {
+            for (const Binding *param : params_[function]) {
+                code->params.push_back({param->captured, param->index});
+            }
+            code->body = block(static_cast<stmt::Block *>(function->body.get())->statements, function);
+        }
+        current_ = enclosing;
+        loops_ = loops;
+        return code;
+    }
+
+    Exec class_declaration(stmt::Class *klass) {
+        Eval superclass = klass->super ? expression(klass->super.get()) : nullptr;
+        Token::ptr super_name = klass->super ? klass->super->name : nullptr;
+        const Binding *super = supers_[klass];
+        int super_cell = super != nullptr && super->captured ? static_cast<int>(super->index) : -1;
+        const Binding *self = selves_[klass];
+
+        std::vector<std::pair<std::string, Eval>> methods;
+        for (const auto &method : klass->methods) {
+            FunctionInfo *info = &functions_[method.get()];
+            auto found = info->capture_index.find(self);
+            info->code->self = found == info->capture_index.end() ? -1 : static_cast<int>(found->second);
+            methods.emplace_back(method->name->lexeme, closure(method.get()));
+        }
+
+        Binding *binding = declarations_[klass];
+        auto value = std::make_shared<Value>();
+        Eval define = store(binding, klass->name, [value](Frame &) {
+            return *value;
+        }, true);
+        std::string name = klass->name->lexeme;
+        return [superclass, super_name, super_cell, methods, value, define, name](Frame &frame) {
+            LoxClass::ptr super;
+            if (superclass) {
+                Value evaluated = superclass(frame);
+                if (!evaluated.is<LoxClass::ptr>()) {
+                    throw RuntimeError(super_name, "Superclass must be a class.");
+                }
+                super = evaluated.as<LoxClass::ptr>();
+                if (super_cell >= 0) {
+                    frame.cells[super_cell] = std::make_shared<Value>(evaluated);
+                }
+            }
+            *value = Value();
+            define(frame);
+            std::unordered_map<std::string, LoxFunction::ptr> functions;
+            for (const auto &[method, create] : methods) {
+                functions[method] = create(frame).as<LoxFunction::ptr>();
+            }
+            *value = std::make_shared<LoxClass>(name, super, std::move(functions));
+            define(frame);
+            *value = Value();
+            return Flow::NORMAL;
+        };
+    }
+
+    Interpreter *interpreter_;
+    ClosureCompiler::Options options_;
+    FunctionInfo root_;
+    FunctionInfo *current_{nullptr};
+    int loops_{0};
+    std::vector<Scope> scopes_;
+    std::deque<Binding> bindings_;
+    std::unordered_map<const stmt::Function *, FunctionInfo> functions_;
+    std::unordered_map<const void *, Binding *> declarations_;
+    std::unordered_map<const void *, Binding *> uses_;
+    // the uses that may find a late binding: the bindings they look through, innermost first, then the one they
+    // fall back to, nullptr for a global
+    std::unordered_map<const void *, std::vector<Binding *>> late_;
+    std::unordered_map<const expr::Super *, Binding *> super_selves_;
+    std::unordered_map<const stmt::Class *, Binding *> supers_;
+    std::unordered_map<const stmt::Class *, Binding *> selves_;
+    std::unordered_map<const stmt::Function *, std::vector<Binding *>> params_;
+    // the locals declared directly in each block, for loop and function body
+    std::unordered_map<const void *, std::vector<Binding *>> scoped_;
+    // every value a local is declared with or assigned, nullptr for a var without initializer
+    std::vector<std::pair<Binding *, expr::Expr *>> definitions_;
+    // the top-level class declarations by name, nullptr for a name declared by more than one
+    std::unordered_map<std::string, const stmt::Class *> classes_;
+};
+
+} // namespace
+
+Value ClosureCompiler::run(Interpreter *interpreter, const Program &program, bool echo, const Options &options) {
+    return Compiler(interpreter, options).run(program, echo);
+}
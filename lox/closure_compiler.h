@@ -0,0 +1,55 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <ostream>
+
+#include "lox/program.h"
+#include "lox/value.h"
+
+class Interpreter;
+
+/*
+ * The execution engine behind --closures. Instead of walking the tree with a
+ * visitor, every node is compiled once into a C++ closure specialized for
+ * it: operators become one closure per operator with nothing left to
+ * switch on, literals carry their Value, and variables are resolved to where
+ * they live before anything runs. Running the program is then a chain of
+ * indirect calls through those closures.
+ *
+ * A function's parameters and locals live in a frame of slots indexed at
+ * compile time instead of Environments looked up by name. A local a nested
+ * function uses is a cell on the heap the closures share; a function
+ * captures the cells it needs, this and super among them, when it is
+ * declared. Globals and builtins stay in the interpreter's Environments,
+ * where embedders and later programs see them; a global's location is cached
+ * after the first lookup. Functions and methods are LoxFunctions, so
+ * classes, instances, spawn() and the call stack treat them as usual.
+ *
+ * Before compiling, type inference finds the locals only ever assigned
+ * numbers. They live in unboxed double slots, and arithmetic and comparisons
+ * over them compile to closures on plain doubles; anything it can't prove
+ * stays boxed and behaves exactly as in the tree walker.
+ *
+ * A function body that declares no functions or classes is compiled through
+ * the SSA form in ssa.h instead: it is optimized as a whole, its values are
+ * given registers in the frame, and its blocks run as lists of closures. The
+ * top level and functions with nested declarations stay on the AST path.
+ */
+class ClosureCompiler {
+ public:
+    struct Options {
+        // lists the locals kept unboxed
+        std::ostream *type_report{nullptr};
+        // prints the optimized SSA form of every function compiled through it
+        std::ostream *ir_dump{nullptr};
+        // compiles function bodies through the SSA form when they allow it
+        bool optimize{true};
+    };
+
+    // compiles program and runs it at top level on interpreter, returns the value of its last expression statement;
+    // with echo the value of every top-level expression statement is printed, as in the REPL
+    static Value run(Interpreter *interpreter, const Program &program, bool echo, const Options &options);
+};
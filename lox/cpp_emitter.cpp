@@ -0,0 +1,836 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/cpp_emitter.h"
+
+#include <cstdio>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "lox/exception.h"
+#include "lox/expr.h"
+#include "lox/statement.h"
+
+namespace {
+
+enum class Kind { NUMBER, BOOL, VALUE };
+
+struct Binding {
+    enum Storage { GLOBAL, LOCAL, CELL };
+
+    std::string name;
+    Storage storage{LOCAL};
+    // a var whose every initializer and assignment is a number, emitted as a double
+    bool number{false};
+    // only declared by var, with the initializers and assigned values, nullptr for a var without initializer
+    bool var{true};
+    std::vector<expr::Expr *> values;
+    // a cell captured by a function declared before it, holding no value at all until its declaration runs
+    bool late{false};
+};
+
+// an expression translated to C++
+struct Code {
+    std::string text;
+    Kind kind;
+    // evaluating it changes nothing, so it can be dropped or reordered with what it doesn't read
+    bool pure;
+};
+
+class Emitter {
+ public:
+    std::string emit(const Program &program, const std::string &source) {
+        const auto &statements = program.statements();
+        declare_all(statements, nullptr);
+        for (const auto &stmt : statements) {
+            resolve(stmt.get());
+        }
+        infer_numbers();
+
+        indent_ = 1;
+        for (const auto &stmt : statements) {
+            statement(stmt.get());
+        }
+
+        std::ostringstream out;
+        out << "// generated by lox --emit-cpp from " << source << "\n"
+            << "#include \"lox/aot.h\"\n\n"
+            << "namespace {\n\n"
+            << constants_.str() << "\n";
+        for (const auto &binding : bindings_) {
+            if (binding.storage == Binding::GLOBAL) {
+                out << (binding.number ? "double " : "Value ") << binding.name << ";\n";
+            }
+        }
+        out << "\nValue script(const std::vector<Value> &) {\n"
+            << body_.str() << "    return Value();\n"
+            << "}\n\n"
+            << "} // namespace\n\n"
+            << "int main() {\n"
+            << "    return aot::main(script);\n"
+            << "}\n";
+        return out.str();
+    }
+
+ private:
+    struct Entry {
+        Binding *binding;
+        // declared by now; a nested function sees the whole block, it runs after more of it has
+        bool visible;
+    };
+
+    struct Scope {
+        // the function the scope belongs to, 0 for the top level
+        int function;
+        std::unordered_map<std::string, Entry> names;
+    };
+
+    // resolution: binds every variable to its declaration
+
+    Binding *declare(const Token::ptr &name, bool var, const void *owner) {
+        if (scopes_.empty()) {
+            auto found = globals_.find(name->lexeme);
+            if (found != globals_.end()) {
+                found->second->var &= var;
+                return found->second;
+            }
+            Binding *binding = new_binding("g_" + name->lexeme, var);
+            binding->storage = Binding::GLOBAL;
+            globals_[name->lexeme] = binding;
+            return binding;
+        }
+        Binding *binding = new_binding(name->lexeme + "_" + std::to_string(next_name_++), var);
+        scopes_.back().names[name->lexeme] = {binding, false};
+        if (owner != nullptr) {
+            locals_[owner].push_back(binding);
+        }
+        return binding;
+    }
+
+    Binding *new_binding(const std::string &name, bool var) {
+        bindings_.emplace_back();
+        Binding *binding = &bindings_.back();
+        binding->name = name;
+        binding->var = var;
+        return binding;
+    }
+
+    // declares the declarations directly in statements up front, closures declared before them may use them
+    void declare_all(const std::vector<stmt::Statement::ptr> &statements, const void *owner) {
+        for (const auto &stmt : statements) {
+            if (auto *var = dynamic_cast<stmt::Var *>(stmt.get())) {
+                declarations_[var] = declare(var->name, true, owner);
+            } else if (auto *function = dynamic_cast<stmt::Function *>(stmt.get())) {
+                declarations_[function] = declare(function->name, false, owner);
+            } else if (auto *klass = dynamic_cast<stmt::Class *>(stmt.get())) {
+                declarations_[klass] = declare(klass->name, false, owner);
+            }
+        }
+    }
+
+    void make_visible(const Token::ptr &name) {
+        if (!scopes_.empty()) {
+            scopes_.back().names[name->lexeme].visible = true;
+        }
+    }
+
+    // nullptr for a builtin; an enclosing local declared after the function using it is only found once its
+    // declaration has run, before that use finds what the name means further out, as in the tree walker
+    Binding *lookup(const std::string &name, const void *use = nullptr) {
+        std::vector<Binding *> chain;
+        for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+            auto found = scope->names.find(name);
+            if (found == scope->names.end()) {
+                continue;
+            }
+            if (scope->function == function_) {
+                if (found->second.visible) {
+                    return found->second.binding;
+                }
+                continue;
+            }
+            Binding *binding = found->second.binding;
+            binding->storage = Binding::CELL;
+            chain.push_back(binding);
+            if (found->second.visible) {
+                return late(std::move(chain), use);
+            }
+            binding->late = true;
+        }
+        auto found = globals_.find(name);
+        chain.push_back(found == globals_.end() ? nullptr : found->second);
+        return late(std::move(chain), use);
+    }
+
+    // the first binding of chain, what a use finds unless it looks through late cells to the rest
+    Binding *late(std::vector<Binding *> chain, const void *use) {
+        Binding *binding = chain.front();
+        if (chain.size() > 1) {
+            late_[use] = std::move(chain);
+        }
+        return binding;
+    }
+
+    void resolve(stmt::Statement *stmt) {
+        if (stmt == nullptr) {
+            return;
+        }
+        if (auto *expression = dynamic_cast<stmt::Expression *>(stmt)) {
+            resolve(expression->expression.get());
+        } else if (auto *print = dynamic_cast<stmt::Print *>(stmt)) {
+            resolve(print->expression.get());
+        } else if (auto *var = dynamic_cast<stmt::Var *>(stmt)) {
+            if (var->value) {
+                resolve(var->value.get());
+            }
+            declarations_[var]->values.push_back(var->value.get());
+            make_visible(var->name);
+        } else if (auto *block = dynamic_cast<stmt::Block *>(stmt)) {
+            scopes_.push_back({function_, {}});
+            declare_all(block->statements, block);
+            for (const auto &item : block->statements) {
+                resolve(item.get());
+            }
+            scopes_.pop_back();
+        } else if (auto *if_stmt = dynamic_cast<stmt::If *>(stmt)) {
+            resolve(if_stmt->condition.get());
+            resolve(if_stmt->then_branch.get());
+            resolve(if_stmt->else_branch.get());
+        } else if (auto *while_stmt = dynamic_cast<stmt::While *>(stmt)) {
+            resolve(while_stmt->condition.get());
+            resolve(while_stmt->body.get());
+        } else if (auto *for_stmt = dynamic_cast<stmt::For *>(stmt)) {
+            scopes_.push_back({function_, {}});
+            if (auto *var = dynamic_cast<stmt::Var *>(for_stmt->initializer.get())) {
+                declarations_[var] = declare(var->name, true, for_stmt);
+            }
+            resolve(for_stmt->initializer.get());
+            resolve(for_stmt->condition.get());
+            resolve(for_stmt->increment.get());
+            resolve(for_stmt->body.get());
+            scopes_.pop_back();
+        } else if (auto *function = dynamic_cast<stmt::Function *>(stmt)) {
+            make_visible(function->name);
+            resolve_function(function);
+        } else if (auto *ret = dynamic_cast<stmt::Return *>(stmt)) {
+            if (ret->value) {
+                resolve(ret->value.get());
+            }
+        } else if (auto *klass = dynamic_cast<stmt::Class *>(stmt)) {
+            if (klass->super) {
+                resolve(klass->super.get());
+            }
+            make_visible(klass->name);
+            for (const auto &method : klass->methods) {
+                resolve_function(method.get());
+            }
+        }
+    }
+
+    void resolve_function(stmt::Function *function) {
+        function_++;
+        scopes_.push_back({function_, {}});
+        for (const auto &param : function->params) {
+            Binding *binding = declare(param, false, nullptr);
+            make_visible(param);
+            params_[function].push_back(binding);
+        }
+        auto *body = static_cast<stmt::Block *>(function->body.get());
+        declare_all(body->statements, function);
+        for (const auto &item : body->statements) {
+            resolve(item.get());
+        }
+        scopes_.pop_back();
+        function_--;
+    }
+
+    void resolve(expr::Expr *expr) {
+        if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            resolve(grouping->expression.get());
+        } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            resolve(unary->right.get());
+        } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            resolve(binary->left.get());
+            resolve(binary->right.get());
+        } else if (auto *logical = dynamic_cast<expr::Logical *>(expr)) {
+            resolve(logical->left.get());
+            resolve(logical->right.get());
+        } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            uses_[variable] = lookup(variable->name->lexeme, variable);
+        } else if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            resolve(assign->value.get());
+            Binding *binding = lookup(assign->name->lexeme, assign);
+            uses_[assign] = binding;
+            if (binding != nullptr) {
+                binding->values.push_back(assign->value.get());
+            }
+            if (auto late = late_.find(assign); late != late_.end()) {
+                for (Binding *other : late->second) {
+                    if (other != nullptr && other != binding) {
+                        other->values.push_back(assign->value.get());
+                    }
+                }
+            }
+        } else if (auto *call = dynamic_cast<expr::Call *>(expr)) {
+            resolve(call->callee.get());
+            for (const auto &argument : call->arguments) {
+                resolve(argument.get());
+            }
+        } else if (auto *get = dynamic_cast<expr::Get *>(expr)) {
+            resolve(get->object.get());
+        } else if (auto *set = dynamic_cast<expr::Set *>(expr)) {
+            resolve(set->object.get());
+            resolve(set->value.get());
+        }
+    }
+
+    // number inference: start from every plain var and drop those assigned anything that may not be a number
+    void infer_numbers() {
+        for (auto &binding : bindings_) {
+            binding.number = binding.var && binding.storage != Binding::CELL;
+            for (expr::Expr *value : binding.values) {
+                binding.number &= value != nullptr;
+            }
+        }
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto &binding : bindings_) {
+                if (!binding.number) {
+                    continue;
+                }
+                for (expr::Expr *value : binding.values) {
+                    if (kind_of(value) != Kind::NUMBER) {
+                        binding.number = false;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // the kind expression() translates expr to, given the numbers inferred so far
+    Kind kind_of(expr::Expr *expr) {
+        if (auto *literal = dynamic_cast<expr::Literal *>(expr)) {
+            if (literal->value.is<double>()) {
+                return Kind::NUMBER;
+            }
+            return literal->value.is<bool>() ? Kind::BOOL : Kind::VALUE;
+        } else if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            return kind_of(grouping->expression.get());
+        } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            if (unary->op->kind == Token::BANG) {
+                return Kind::BOOL;
+            }
+            return kind_of(unary->right.get()) == Kind::NUMBER ? Kind::NUMBER : Kind::VALUE;
+        } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            if (comparison(binary->op->kind)) {
+                return Kind::BOOL;
+            }
+            bool numbers = kind_of(binary->left.get()) == Kind::NUMBER && kind_of(binary->right.get()) == Kind::NUMBER;
+            return numbers ? Kind::NUMBER : Kind::VALUE;
+        } else if (auto *logical = dynamic_cast<expr::Logical *>(expr)) {
+            Kind left = kind_of(logical->left.get());
+            Kind right = kind_of(logical->right.get());
+            return logical_kind(logical->op->kind, left, right);
+        } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            Binding *binding = uses_[variable];
+            return binding != nullptr && binding->number ? Kind::NUMBER : Kind::VALUE;
+        } else if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            Binding *binding = uses_[assign];
+            return binding != nullptr && binding->number ? Kind::NUMBER : Kind::VALUE;
+        }
+        return Kind::VALUE;
+    }
+
+    static bool comparison(Token::Kind op) {
+        switch (op) {
+        case Token::GREATER:
+        case Token::GREATER_EQUAL:
+        case Token::LESS:
+        case Token::LESS_EQUAL:
+        case Token::BANG_EQUAL:
+        case Token::EQUAL_EQUAL:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // `or` returns a number on the left without looking right, `and` goes on to the right
+    static Kind logical_kind(Token::Kind op, Kind left, Kind right) {
+        if (left == Kind::NUMBER) {
+            return op == Token::OR ? Kind::NUMBER : right;
+        }
+        return left == Kind::BOOL && right == Kind::BOOL ? Kind::BOOL : Kind::VALUE;
+    }
+
+    // code generation
+
+    void line(const std::string &text) {
+        body_ << std::string(4 * indent_, ' ') << text << "\n";
+    }
+
+    std::string fresh(const std::string &prefix) {
+        return prefix + "_" + std::to_string(next_name_++);
+    }
+
+    static std::string kind_name(Token::Kind kind) {
+        switch (kind) {
+        case Token::MINUS:
+            return "MINUS";
+        case Token::PLUS:
+            return "PLUS";
+        case Token::SLASH:
+            return "SLASH";
+        case Token::STAR:
+            return "STAR";
+        case Token::BANG:
+            return "BANG";
+        case Token::BANG_EQUAL:
+            return "BANG_EQUAL";
+        case Token::EQUAL_EQUAL:
+            return "EQUAL_EQUAL";
+        case Token::GREATER:
+            return "GREATER";
+        case Token::GREATER_EQUAL:
+            return "GREATER_EQUAL";
+        case Token::LESS:
+            return "LESS";
+        case Token::LESS_EQUAL:
+            return "LESS_EQUAL";
+        default:
+            return "IDENTIFIER";
+        }
+    }
+
+    static std::string quote(const std::string &text) {
+        std::string quoted = "\"";
+        for (char c : text) {
+            auto byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+                quoted += c;
+            } else if (byte < 0x20 || byte == 0x7f) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\%03o", byte);
+                quoted += escaped;
+            } else {
+                quoted += c;
+            }
+        }
+        return quoted + "\"";
+    }
+
+    static std::string number(double value) {
+        std::ostringstream os;
+        os << std::setprecision(17) << value;
+        std::string text = os.str();
+        if (text.find_first_of(".e") == std::string::npos) {
+            text += ".0";
+        }
+        return text;
+    }
+
+    // a token the runtime reports errors at, one constant per token of the source
+    std::string token(const Token::ptr &token) {
+        auto found = tokens_.find(token.get());
+        if (found != tokens_.end()) {
+            return found->second;
+        }
+        std::string name = fresh("t");
+        constants_ << "const Token::ptr " << name << " = aot::token(Token::" << kind_name(token->kind) << ", "
+                   << quote(token->lexeme) << ", " << token->line << ");\n";
+        tokens_[token.get()] = name;
+        return name;
+    }
+
+    std::string string(const std::string &value) {
+        std::string name = fresh("s");
+        constants_ << "const Value " << name << "(std::string(" << quote(value) << ", " << value.size() << "));\n";
+        return name;
+    }
+
+    static std::string ref(const Binding *binding) {
+        return binding->storage == Binding::CELL ? "(*" + binding->name + ")" : binding->name;
+    }
+
+    static std::string box(const Code &code) {
+        return code.kind == Kind::VALUE ? code.text : "Value(" + code.text + ")";
+    }
+
+    static std::string truth(const Code &code) {
+        switch (code.kind) {
+        case Kind::BOOL:
+            return code.text;
+        case Kind::NUMBER:
+            return code.pure ? "true" : "((void)" + code.text + ", true)";
+        default:
+            return "static_cast<bool>(" + code.text + ")";
+        }
+    }
+
+    Code expression(expr::Expr *expr) {
+        if (auto *literal = dynamic_cast<expr::Literal *>(expr)) {
+            const Value &value = literal->value;
+            if (auto *number_value = value.get_if<double>()) {
+                return {number(*number_value), Kind::NUMBER, true};
+            } else if (auto *bool_value = value.get_if<bool>()) {
+                return {*bool_value ? "true" : "false", Kind::BOOL, true};
+            } else if (auto *string_value = value.get_if<std::string>()) {
+                return {string(*string_value), Kind::VALUE, true};
+            }
+            return {"Value()", Kind::VALUE, true};
+        } else if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            return expression(grouping->expression.get());
+        } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            Code right = expression(unary->right.get());
+            if (unary->op->kind == Token::BANG) {
+                return {"(!" + truth(right) + ")", Kind::BOOL, right.pure};
+            }
+            if (right.kind == Kind::NUMBER) {
+                return {"(-" + right.text + ")", Kind::NUMBER, right.pure};
+            }
+            return {"aot::interpreter->unary(" + token(unary->op) + ", " + box(right) + ")", Kind::VALUE, false};
+        } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            return binary_expression(binary);
+        } else if (auto *logical = dynamic_cast<expr::Logical *>(expr)) {
+            return logical_expression(logical);
+        } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            Binding *binding = uses_[variable];
+            if (auto late = late_.find(variable); late != late_.end()) {
+                return late_read(late->second, variable->name);
+            }
+            if (binding == nullptr) {
+                return {"aot::global(" + token(variable->name) + ")", Kind::VALUE, false};
+            }
+            return {ref(binding), binding->number ? Kind::NUMBER : Kind::VALUE, true};
+        } else if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            Binding *binding = uses_[assign];
+            Code value = expression(assign->value.get());
+            if (auto late = late_.find(assign); late != late_.end()) {
+                return late_assign(late->second, assign->name, value);
+            }
+            if (binding == nullptr) {
+                return {"aot::assign_global(" + token(assign->name) + ", " + box(value) + ")", Kind::VALUE, false};
+            }
+            if (binding->number) {
+                return {"(" + ref(binding) + " = " + value.text + ")", Kind::NUMBER, false};
+            }
+            return {"(" + ref(binding) + " = " + box(value) + ")", Kind::VALUE, false};
+        } else if (auto *call = dynamic_cast<expr::Call *>(expr)) {
+            return {"aot::call(" + token(call->paren) + ", " + call_values(call) + ")", Kind::VALUE, false};
+        } else if (auto *get = dynamic_cast<expr::Get *>(expr)) {
+            Code object = expression(get->object.get());
+            return {"aot::interpreter->property(" + box(object) + ", " + token(get->name) + ")", Kind::VALUE, false};
+        } else if (auto *set = dynamic_cast<expr::Set *>(expr)) {
+            Code object = expression(set->object.get());
+            Code value = expression(set->value.get());
+            return {"aot::set(" + token(set->name) + ", {" + box(object) + ", " + box(value) + "})", Kind::VALUE,
+                    false};
+        } else if (dynamic_cast<expr::This *>(expr) != nullptr) {
+            return {"Value(self)", Kind::VALUE, true};
+        } else if (auto *super = dynamic_cast<expr::Super *>(expr)) {
+            return {"aot::super_method(" + token(super->method) + ", " + supers_.back() + ", self)", Kind::VALUE,
+                    false};
+        } else if (auto *brk = dynamic_cast<expr::Break *>(expr)) {
+            throw RuntimeError(brk->keyword, "--emit-cpp only translates break as a statement of its own");
+        }
+        throw std::logic_error("unknown expression");
+    }
+
+    // {callee, arguments...}, braced so they are evaluated in order
+    std::string call_values(expr::Call *call) {
+        std::string text = "{" + box(expression(call->callee.get()));
+        for (const auto &argument : call->arguments) {
+            text += ", " + box(expression(argument.get()));
+        }
+        return text + "}";
+    }
+
+    Code binary_expression(expr::Binary *binary) {
+        Code left = expression(binary->left.get());
+        Code right = expression(binary->right.get());
+        Token::Kind op = binary->op->kind;
+        bool numbers = left.kind == Kind::NUMBER && right.kind == Kind::NUMBER;
+        bool bools = left.kind == Kind::BOOL && right.kind == Kind::BOOL;
+        bool equality = op == Token::EQUAL_EQUAL || op == Token::BANG_EQUAL;
+        if (numbers || (bools && equality)) {
+            Kind kind = comparison(op) ? Kind::BOOL : Kind::NUMBER;
+            const std::string &symbol = binary->op->lexeme;
+            // an assignment on the right may change what the left reads, the left is read first
+            if (!right.pure && dynamic_cast<expr::Literal *>(binary->left.get()) == nullptr) {
+                std::string type = left.kind == Kind::NUMBER ? "double" : "bool";
+                return {"[&] { " + type + " l = " + left.text + "; return l " + symbol + " " + right.text + "; }()",
+                        kind, false};
+            }
+            return {"(" + left.text + " " + symbol + " " + right.text + ")", kind, left.pure && right.pure};
+        }
+        std::string text = "aot::binary(" + token(binary->op) + ", {" + box(left) + ", " + box(right) + "})";
+        if (comparison(op)) {
+            return {"static_cast<bool>(" + text + ")", Kind::BOOL, false};
+        }
+        return {text, Kind::VALUE, false};
+    }
+
+    Code logical_expression(expr::Logical *logical) {
+        Code left = expression(logical->left.get());
+        Code right = expression(logical->right.get());
+        bool is_or = logical->op->kind == Token::OR;
+        Kind kind = logical_kind(logical->op->kind, left.kind, right.kind);
+        if (left.kind == Kind::NUMBER) {
+            // a number is always true
+            if (is_or) {
+                return left;
+            }
+            if (left.pure) {
+                return right;
+            }
+            return {"((void)" + left.text + ", " + right.text + ")", right.kind, false};
+        }
+        if (kind == Kind::BOOL) {
+            return {"(" + left.text + (is_or ? " || " : " && ") + right.text + ")", Kind::BOOL,
+                    left.pure && right.pure};
+        }
+        std::string test = is_or ? "l" : "!l";
+        return {"[&]() -> Value { Value l = " + box(left) + "; if (" + test + ") { return l; } return " + box(right) +
+                    "; }()",
+                Kind::VALUE, false};
+    }
+
+    // reads the first of the late cells in chain declared by now, or what the name falls back to
+    Code late_read(const std::vector<Binding *> &chain, const Token::ptr &name) {
+        Binding *fallback = chain.back();
+        std::string text = "aot::global(" + token(name) + ")";
+        if (fallback != nullptr) {
+            text = box({ref(fallback), fallback->number ? Kind::NUMBER : Kind::VALUE, true});
+        }
+        for (auto binding = chain.rbegin() + 1; binding != chain.rend(); ++binding) {
+            text = "(!" + (*binding)->name + "->is<void>() ? *" + (*binding)->name + " : " + text + ")";
+        }
+        return {text, Kind::VALUE, false};
+    }
+
+    // assigns value to the first of the late cells in chain declared by now, or to what the name falls back to
+    Code late_assign(const std::vector<Binding *> &chain, const Token::ptr &name, const Code &value) {
+        std::string text = "[&]() -> Value { auto v = " + value.text + "; ";
+        Code v{"v", value.kind, true};
+        for (auto binding = chain.begin(); binding + 1 != chain.end(); ++binding) {
+            const std::string &cell = (*binding)->name;
+            text += "if (!" + cell + "->is<void>()) { return *" + cell + " = " + box(v) + "; } ";
+        }
+        Binding *fallback = chain.back();
+        if (fallback == nullptr) {
+            text += "return aot::assign_global(" + token(name) + ", " + box(v) + ");";
+        } else if (fallback->number) {
+            text += "return Value(" + ref(fallback) + " = v);";
+        } else {
+            text += "return " + ref(fallback) + " = " + box(v) + ";";
+        }
+        return {text + " }()", Kind::VALUE, false};
+    }
+
+    // hoists the cells declared in the scope owner opens, closures may capture them before their declaration runs
+    void cells(const void *owner) {
+        for (const Binding *binding : locals_[owner]) {
+            if (binding->storage == Binding::CELL) {
+                line("auto " + binding->name + " = std::make_shared<Value>(" +
+                     (binding->late ? "Value(std::any())" : "") + ");");
+            }
+        }
+    }
+
+    // the statements of a block or of a branch or loop body
+    void nested(stmt::Statement *stmt) {
+        if (auto *block = dynamic_cast<stmt::Block *>(stmt)) {
+            cells(block);
+            for (const auto &item : block->statements) {
+                statement(item.get());
+            }
+        } else if (stmt != nullptr) {
+            statement(stmt);
+        }
+    }
+
+    // target = value for the declaration of binding
+    std::string define(const Binding *binding, const std::string &value) {
+        switch (binding->storage) {
+        case Binding::LOCAL:
+            return (binding->number ? "double " : "Value ") + binding->name + " = " + value + ";";
+        case Binding::CELL:
+            return "*" + binding->name + " = " + value + ";";
+        default:
+            return binding->name + " = " + value + ";";
+        }
+    }
+
+    void statement(stmt::Statement *stmt) {
+        if (auto *expression_stmt = dynamic_cast<stmt::Expression *>(stmt)) {
+            if (dynamic_cast<expr::Break *>(expression_stmt->expression.get()) != nullptr) {
+                line("break;");
+                return;
+            }
+            Code code = expression(expression_stmt->expression.get());
+            line((code.kind == Kind::VALUE ? code.text : "(void)" + code.text) + ";");
+        } else if (auto *print = dynamic_cast<stmt::Print *>(stmt)) {
+            line("aot::print(" + box(expression(print->expression.get())) + ");");
+        } else if (auto *var = dynamic_cast<stmt::Var *>(stmt)) {
+            Binding *binding = declarations_[var];
+            if (!var->value) {
+                line(define(binding, "Value()"));
+                return;
+            }
+            Code value = expression(var->value.get());
+            line(define(binding, binding->number ? value.text : box(value)));
+        } else if (auto *block = dynamic_cast<stmt::Block *>(stmt)) {
+            line("{");
+            indent_++;
+            nested(block);
+            indent_--;
+            line("}");
+        } else if (auto *if_stmt = dynamic_cast<stmt::If *>(stmt)) {
+            line("if (" + truth(expression(if_stmt->condition.get())) + ") {");
+            indent_++;
+            nested(if_stmt->then_branch.get());
+            indent_--;
+            if (if_stmt->else_branch) {
+                line("} else {");
+                indent_++;
+                nested(if_stmt->else_branch.get());
+                indent_--;
+            }
+            line("}");
+        } else if (auto *while_stmt = dynamic_cast<stmt::While *>(stmt)) {
+            line("while (" + truth(expression(while_stmt->condition.get())) + ") {");
+            indent_++;
+            nested(while_stmt->body.get());
+            indent_--;
+            line("}");
+        } else if (auto *for_stmt = dynamic_cast<stmt::For *>(stmt)) {
+            line("{");
+            indent_++;
+            cells(for_stmt);
+            if (for_stmt->initializer) {
+                statement(for_stmt->initializer.get());
+            }
+            std::string increment;
+            if (auto *expression_stmt = dynamic_cast<stmt::Expression *>(for_stmt->increment.get())) {
+                increment = expression(expression_stmt->expression.get()).text;
+            }
+            line("for (; " + truth(expression(for_stmt->condition.get())) + "; " + increment + ") {");
+            indent_++;
+            nested(for_stmt->body.get());
+            indent_--;
+            line("}");
+            indent_--;
+            line("}");
+        } else if (auto *function = dynamic_cast<stmt::Function *>(stmt)) {
+            std::string lambda = "Value(Callable::ptr(std::make_shared<aot::Function>(" +
+                                 quote(function->name->lexeme) + ", " + std::to_string(function->params.size()) +
+                                 ", [=](const std::vector<Value> &args) -> Value {";
+            if (function->shared()) {
+                // made by the first run of the declaration, as the tree walker shares it
+                std::string shared = fresh("shared");
+                line("static const Value " + shared + " = " + lambda);
+                function_body(function);
+                line("})));");
+                line(define(declarations_[function], shared));
+                return;
+            }
+            // the lambda's closing line ends the statement define() ends with ';'
+            std::string head = define(declarations_[function], lambda);
+            line(head.substr(0, head.size() - 1));
+            function_body(function);
+            line("})));");
+        } else if (auto *ret = dynamic_cast<stmt::Return *>(stmt)) {
+            if (ret->tail_call) {
+                // made by the runtime once this body has returned, the way the tree walker makes it
+                auto *call = static_cast<expr::Call *>(ret->value.get());
+                line("return aot::tail_call(" + token(call->paren) + ", " + call_values(call) + ");");
+                return;
+            }
+            line(ret->value ? "return " + box(expression(ret->value.get())) + ";" : "return Value();");
+        } else if (auto *klass = dynamic_cast<stmt::Class *>(stmt)) {
+            class_declaration(klass);
+        }
+    }
+
+    void function_body(stmt::Function *function) {
+        indent_++;
+        const auto &params = params_[function];
+        for (size_t i = 0; i < params.size(); i++) {
+            std::string argument = "args[" + std::to_string(i) + "]";
+            if (params[i]->storage == Binding::CELL) {
+                line("auto " + params[i]->name + " = std::make_shared<Value>(" + argument + ");");
+            } else {
+                line("Value " + params[i]->name + " = " + argument + ";");
+            }
+        }
+        cells(function);
+        for (const auto &item : static_cast<stmt::Block *>(function->body.get())->statements) {
+            statement(item.get());
+        }
+        line("return Value();");
+        indent_--;
+    }
+
+    void class_declaration(stmt::Class *klass) {
+        Binding *binding = declarations_[klass];
+        std::string super = "Value()";
+        if (klass->super) {
+            super = fresh("super");
+            line("Value " + super + " = " + box(expression(klass->super.get())) + ";");
+            line("aot::check_superclass(" + token(klass->super->name) + ", " + super + ");");
+        }
+        if (binding->storage == Binding::LOCAL) {
+            line("Value " + binding->name + ";");
+        }
+        std::string methods = fresh("methods");
+        line("std::unordered_map<std::string, LoxFunction::ptr> " + methods + ";");
+        supers_.push_back(super);
+        for (const auto &method : klass->methods) {
+            line(methods + "[" + quote(method->name->lexeme) + "] = aot::Method::make(" + quote(method->name->lexeme) +
+                 ", " + std::to_string(method->params.size()) + ", " + std::to_string(method->name->line) +
+                 ", [=](const LoxInstance::ptr &self, const std::vector<Value> &args) -> Value {");
+            function_body(method.get());
+            line("});");
+        }
+        supers_.pop_back();
+        std::string value = "aot::make_class(" + quote(klass->name->lexeme) + ", " + super + ", std::move(" + methods +
+                            "))";
+        line((binding->storage == Binding::CELL ? "*" : "") + binding->name + " = " + value + ";");
+    }
+
+    std::deque<Binding> bindings_;
+    std::unordered_map<std::string, Binding *> globals_;
+    std::vector<Scope> scopes_;
+    int function_{0};
+    int next_name_{0};
+    std::unordered_map<const void *, Binding *> declarations_;
+    std::unordered_map<const void *, Binding *> uses_;
+    // the uses that may find a late cell: the cells they look through, innermost first, then the binding they fall
+    // back to, nullptr for a builtin
+    std::unordered_map<const void *, std::vector<Binding *>> late_;
+    std::unordered_map<const stmt::Function *, std::vector<Binding *>> params_;
+    // the locals declared directly in each block, for loop and function body, parameters aside
+    std::unordered_map<const void *, std::vector<Binding *>> locals_;
+
+    std::ostringstream constants_;
+    std::ostringstream body_;
+    int indent_{0};
+    std::unordered_map<const Token *, std::string> tokens_;
+    // the superclass variable of each class being emitted, innermost last
+    std::vector<std::string> supers_;
+};
+
+} // namespace
+
+std::string CppEmitter::emit(const Program &program, const std::string &source) {
+    return Emitter().emit(program, source);
+}
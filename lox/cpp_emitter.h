@@ -0,0 +1,37 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <string>
+
+#include "lox/program.h"
+
+/*
+ * Translates a compiled program to C++ for --emit-cpp; built against
+ * liblox, the result runs the script as a standalone binary on the runtime
+ * in lox/aot.h.
+ *
+ * Every variable becomes a C++ variable: top-level declarations statics,
+ * locals locals, and a local a nested function reads or writes a
+ * std::shared_ptr<Value> cell the closures share. Functions and methods are
+ * lambdas capturing those cells. A variable only ever assigned numbers is a
+ * plain double, and arithmetic and comparisons on doubles are emitted as C++
+ * operators for the C++ compiler to optimize; values are boxed where they
+ * meet anything else. Operators on boxed values, calls, properties and the
+ * builtins go through the runtime and behave as in the tree walker; that
+ * includes `return f(...)`, which the runtime makes in place of the returning
+ * function's frame, so tail recursion doesn't reach the depth limit.
+ *
+ * Names are bound lexically. A nested function using an enclosing local
+ * before the local's declaration has run finds what the name means further
+ * out, as the tree walker does; a global read before its declaration has run
+ * is nil, or 0 for a number, instead of an error.
+ */
+class CppEmitter {
+ public:
+    // the C++ source of program, source is named in its header comment; throws RuntimeError at a construct it
+    // can't translate
+    static std::string emit(const Program &program, const std::string &source);
+};
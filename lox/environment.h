@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "lox/alloc_profiler.h"
 #include "lox/exception.h"
 #include "lox/token.h"
 #include "lox/value.h"
@@ -16,12 +17,23 @@ class Environment {
  public:
     using ptr = std::shared_ptr<Environment>;
 
-    Environment() = default;
+    Environment() {
+        AllocProfiler::record(AllocProfiler::ENVIRONMENT, sizeof(Environment));
+    }
+
+    explicit Environment(ptr enclosing) : enclosing_(std::move(enclosing)) {
+        AllocProfiler::record(AllocProfiler::ENVIRONMENT, sizeof(Environment));
+    }
 
-    explicit Environment(ptr enclosing) : enclosing_(std::move(enclosing)) {}
+    // a scope inside another object rather than allocated on its own
+    struct Embedded {};
+    Environment(ptr enclosing, Embedded) : enclosing_(std::move(enclosing)) {}
 
     void define(const std::string &name, const Value &value) {
-        values_[name] = value;
+        if (values_.insert_or_assign(name, value).second) {
+            // a hash node holding the key, the value, the cached hash and the next pointer
+            AllocProfiler::record(AllocProfiler::VARIABLE, sizeof(std::pair<const std::string, Value>) + 16);
+        }
     }
 
 
@@ -34,6 +46,17 @@ class Environment {
         return env->values_.count(name) ? env->values_[name] : nullptr;
     }
 
+    // where get() would find the variable, nullptr if it isn't defined
+    Value *lookup(const std::string &name) {
+        for (Environment *env = this; env != nullptr; env = env->enclosing_.get()) {
+            auto it = env->values_.find(name);
+            if (it != env->values_.end()) {
+                return &it->second;
+            }
+        }
+        return nullptr;
+    }
+
     Value get(const Token::ptr &name) {
         if (values_.count(name->lexeme)) {
             return values_[name->lexeme];
@@ -72,10 +95,23 @@ class Environment {
         throw RuntimeError(name, "Undefined variable '" + name->lexeme + "'.");
     }
 
+    bool contains(const std::string &name) const {
+        return values_.count(name) != 0;
+    }
+
+    // the number of variables defined in this scope itself
+    size_t size() const {
+        return values_.size();
+    }
+
     ptr enclosing() const {
         return enclosing_;
     }
 
+    const std::unordered_map<std::string, Value> &values() const {
+        return values_;
+    }
+
     void print() {
         Environment *env = this;
         int i = 0;
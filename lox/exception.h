@@ -8,15 +8,24 @@
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "lox/token.h"
 #include "lox/value.h"
 
+// one Lox call of a backtrace: the function and the line it was called from
+struct StackFrame {
+    std::string function;
+    int line;
+};
+
 class RuntimeError : public std::runtime_error {
  public:
     RuntimeError(Token::ptr token, const std::string &message) : std::runtime_error(message), token(std::move(token)) {}
 
     Token::ptr token;
+    // the calls in progress when the error was raised, innermost first
+    std::vector<StackFrame> backtrace;
 };
 
 class TypeError : public std::exception {
@@ -30,11 +39,11 @@ class TypeError : public std::exception {
     std::string message_;
 };
 
-class ReturnException : public std::exception {
+// thrown by the exit() builtin so an embedding host decides what exiting means
+class ExitException : public std::exception {
  public:
-    explicit ReturnException(Value value) : value(std::move(value)) {}
-
-    Value value;
+    explicit ExitException(int code) : code(code) {}
+    int code;
 };
 
 class BreakException : public std::exception {
@@ -0,0 +1,68 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/execution_stack.h"
+
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utility>
+
+// kept free below the limit for builtins and for unwinding out of an overflow
+static constexpr size_t kReserve = 256 << 10;
+
+ExecutionStack::ExecutionStack(size_t bytes) {
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_ = (bytes + page - 1) / page * page + page;
+    void *memory = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                          -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    memory_ = static_cast<char *>(memory);
+    // the stack grows down towards the guard page
+    ::mprotect(memory_, page, PROT_NONE);
+}
+
+ExecutionStack::~ExecutionStack() {
+    ::munmap(memory_, size_);
+}
+
+const char *ExecutionStack::limit() const {
+    return memory_ + kReserve;
+}
+
+void ExecutionStack::run(const std::function<void()> &fn) {
+    if (active_) {
+        fn();
+        return;
+    }
+    fn_ = &fn;
+    error_ = nullptr;
+    ::getcontext(&callee_);
+    callee_.uc_stack.ss_sp = memory_;
+    callee_.uc_stack.ss_size = size_;
+    callee_.uc_link = &caller_;
+    // makecontext passes int arguments only, the pointer travels in two halves
+    auto self = reinterpret_cast<uintptr_t>(this);
+    ::makecontext(&callee_, reinterpret_cast<void (*)()>(&ExecutionStack::trampoline), 2,
+                  static_cast<unsigned int>(self >> 32), static_cast<unsigned int>(self & 0xffffffffu));
+    active_ = true;
+    ::swapcontext(&caller_, &callee_);
+    active_ = false;
+    if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+}
+
+void ExecutionStack::trampoline(unsigned int high, unsigned int low) {
+    auto *self = reinterpret_cast<ExecutionStack *>((static_cast<uintptr_t>(high) << 32) | low);
+    // exceptions can't unwind across the context switch, they are carried over and rethrown on the caller's stack
+    try {
+        (*self->fn_)();
+    } catch (...) {
+        self->error_ = std::current_exception();
+    }
+}
@@ -0,0 +1,45 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <ucontext.h>
+
+/*
+ * A large native stack the interpreter switches onto while it runs a script,
+ * on the same thread, so thread-local state such as the profiler's shadow
+ * stack stays where it is. The memory is reserved up front but only committed
+ * as deep calls touch it, and a guard page below it turns a runaway past the
+ * call stack's checks into a fault instead of silent corruption. This is not
+ * a stackless interpreter: Lox calls still recurse natively on it, it only
+ * makes that recursion deep.
+ */
+class ExecutionStack {
+ public:
+    explicit ExecutionStack(size_t bytes);
+    ~ExecutionStack();
+
+    ExecutionStack(const ExecutionStack &) = delete;
+    ExecutionStack &operator=(const ExecutionStack &) = delete;
+
+    // runs fn on this stack and rethrows what it throws; called from fn itself it just runs in place
+    void run(const std::function<void()> &fn);
+
+    // the lowest address calls should reach, leaving room for natives and the unwinder below it
+    const char *limit() const;
+
+ private:
+    static void trampoline(unsigned int high, unsigned int low);
+
+    char *memory_{nullptr};
+    size_t size_{0};
+    bool active_{false};
+    const std::function<void()> *fn_{nullptr};
+    std::exception_ptr error_;
+    ucontext_t caller_{};
+    ucontext_t callee_{};
+};
@@ -12,6 +12,10 @@
 #include "lox/token.h"
 #include "lox/value.h"
 
+namespace stmt {
+class Function;
+} // namespace stmt
+
 namespace expr {
 
 class Binary;
@@ -59,12 +63,16 @@ class Expr {
     using ptr = std::shared_ptr<Expr>;
 
     virtual Value accept(Visitor *visitor) = 0;
+
+    // source line the node starts on, for diagnostics and profiles
+    int line{0};
 };
 
 class Binary : public Expr {
  public:
     using ptr = std::shared_ptr<Binary>;
     Binary(Expr::ptr left, Token::ptr op, Expr::ptr right) {
+        this->line = op->line;
         this->left = std::move(left);
         this->op = std::move(op);
         this->right = std::move(right);
@@ -83,6 +91,7 @@ class Grouping : public Expr {
  public:
     using ptr = std::shared_ptr<Grouping>;
     explicit Grouping(Expr::ptr expression) {
+        this->line = expression->line;
         this->expression = std::move(expression);
     }
 
@@ -111,6 +120,7 @@ class Unary : public Expr {
  public:
     using ptr = std::shared_ptr<Unary>;
     Unary(Token::ptr op, Expr::ptr right) {
+        this->line = op->line;
         this->op = std::move(op);
         this->right = std::move(right);
     }
@@ -127,6 +137,7 @@ class Variable : public Expr, public std::enable_shared_from_this<Variable> {
  public:
     using ptr = std::shared_ptr<Variable>;
     explicit Variable(Token::ptr name) {
+        this->line = name->line;
         this->name = std::move(name);
     }
 
@@ -141,6 +152,7 @@ class Assign : public Expr, public std::enable_shared_from_this<Assign> {
  public:
     using ptr = std::shared_ptr<Assign>;
     Assign(Token::ptr name, Expr::ptr value) {
+        this->line = name->line;
         this->name = std::move(name);
         this->value = std::move(value);
     }
@@ -157,6 +169,7 @@ class Logical : public Expr {
  public:
     using ptr = std::shared_ptr<Logical>;
     Logical(Expr::ptr left, Token::ptr op, Expr::ptr right) {
+        this->line = op->line;
         this->left = std::move(left);
         this->op = std::move(op);
         this->right = std::move(right);
@@ -175,6 +188,7 @@ class Break : public Expr {
  public:
     using ptr = std::shared_ptr<Break>;
     explicit Break(Token::ptr keyword) {
+        this->line = keyword->line;
         this->keyword = std::move(keyword);
     }
     Value accept(Visitor *visitor) override {
@@ -187,6 +201,7 @@ class Call : public Expr {
  public:
     using ptr = std::shared_ptr<Call>;
     Call(Expr::ptr callee, Token::ptr paren, std::vector<Expr::ptr> arguments) {
+        this->line = callee->line;
         this->callee = std::move(callee);
         this->paren = std::move(paren);
         this->arguments = std::move(arguments);
@@ -199,12 +214,17 @@ class Call : public Expr {
     Expr::ptr callee;
     Token::ptr paren;
     std::vector<Expr::ptr> arguments;
+    // set by the Inliner: the top-level function this call is expected to reach
+    stmt::Function *inline_target{nullptr};
+    // set by the Inliner: the callee is a property that may be an inlinable method
+    bool inline_method{false};
 };
 
 class Get : public Expr {
  public:
     using ptr = std::shared_ptr<Get>;
     Get(Expr::ptr object, Token::ptr name) {
+        this->line = name->line;
         this->object = std::move(object);
         this->name = std::move(name);
     }
@@ -221,6 +241,7 @@ class Set : public Expr {
  public:
     using ptr = std::shared_ptr<Set>;
     Set(Expr::ptr object, Token::ptr name, Expr::ptr value) {
+        this->line = name->line;
         this->object = std::move(object);
         this->name = std::move(name);
         this->value = std::move(value);
@@ -239,6 +260,7 @@ class This : public Expr {
  public:
     using ptr = std::shared_ptr<This>;
     explicit This(Token::ptr name) {
+        this->line = name->line;
         this->name = std::move(name);
     }
 
@@ -253,6 +275,7 @@ class Super : public Expr {
  public:
     using ptr = std::shared_ptr<Super>;
     explicit Super(Token::ptr keyword, Token::ptr method) {
+        this->line = keyword->line;
         this->keyword = std::move(keyword);
         this->method = std::move(method);
     }
@@ -0,0 +1,34 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/float64_array.h"
+
+#include "lox/alloc_profiler.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static constexpr size_t kAlignment = 32;
+
+Float64Array::Float64Array(size_t size) : size_(size) {
+    // aligned_alloc wants the size to be a multiple of the alignment
+    size_t bytes = (size * sizeof(double) + kAlignment - 1) / kAlignment * kAlignment;
+    data_ = static_cast<double *>(std::aligned_alloc(kAlignment, bytes == 0 ? kAlignment : bytes));
+    if (data_ == nullptr) {
+        throw std::bad_alloc();
+    }
+    std::memset(data_, 0, size * sizeof(double));
+    AllocProfiler::record(AllocProfiler::ARRAY, bytes);
+}
+
+Float64Array::~Float64Array() {
+    std::free(data_);
+}
+
+Float64Array::ptr Float64Array::clone() const {
+    auto copy = std::make_shared<Float64Array>(size_);
+    std::memcpy(copy->data_, data_, size_ * sizeof(double));
+    return copy;
+}
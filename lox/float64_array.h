@@ -0,0 +1,57 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/*
+ * A fixed-size array of unboxed doubles. Elements live in one 32-byte aligned
+ * block so the bulk kernels in lox/simd.h can stream over them directly. A
+ * frozen array never changes again, which lets isolates share it by pointer.
+ */
+class Float64Array {
+ public:
+    using ptr = std::shared_ptr<Float64Array>;
+
+    explicit Float64Array(size_t size);
+    ~Float64Array();
+
+    Float64Array(const Float64Array &) = delete;
+    Float64Array &operator=(const Float64Array &) = delete;
+
+    size_t size() const {
+        return size_;
+    }
+
+    double *data() {
+        return data_;
+    }
+
+    const double *data() const {
+        return data_;
+    }
+
+    std::string str() const {
+        return "Float64Array(" + std::to_string(size_) + ")";
+    }
+
+    void freeze() {
+        frozen_ = true;
+    }
+
+    bool frozen() const {
+        return frozen_;
+    }
+
+    // a mutable copy of the elements
+    ptr clone() const;
+
+ private:
+    double *data_{nullptr};
+    size_t size_{0};
+    bool frozen_{false};
+};
@@ -4,30 +4,62 @@
 
 #include "lox/function.h"
 
+#include "lox/alloc_profiler.h"
 #include "lox/environment.h"
 #include "lox/interpreter.h"
+#include "lox/profiler.h"
 #include "lox/return.h"
+#include "lox/tracer.h"
 #include "lox/value.h"
 #include <iostream>
 #include <utility>
 
 Value LoxFunction::call(Interpreter *interpreter, const std::vector<Value> &arguments) {
-    Environment::ptr env = std::make_shared<Environment>(closure_);
+    Completion completion = run(interpreter, arguments);
+    // a tail call swaps the running function and its arguments instead of nesting another call
+    while (completion.kind == Completion::TAIL_CALL) {
+        LoxFunction::ptr callee = std::move(completion.callee);
+        std::vector<Value> callee_arguments = std::move(completion.arguments);
+        interpreter->call_stack().replace(callee, completion.line);
+        completion = callee->run(interpreter, callee_arguments);
+    }
+    return completion.value;
+}
+
+Completion LoxFunction::run(Interpreter *interpreter, const std::vector<Value> &arguments) {
+    ShadowFrame frame(func_->name->lexeme.c_str(), interpreter->call_stack().line());
+    Tracer::Scope trace(func_->name->lexeme.c_str(), "call", func_->name->line);
+    // an initializer returns its instance whatever the body says, which compiled code doesn't know about
+    Jit *jit = is_initializer ? nullptr : interpreter->jit();
+    if (jit != nullptr) {
+        if (!tier_ || tier_->owner != jit) {
+            tier_ = jit->tier(func_);
+        }
+        if (const JitFunction *code = jit->code(tier_)) {
+            return jit->run(*code, closure(), arguments);
+        }
+    }
+    // the body's loops count towards this function's tier and may switch to its compiled code
+    std::shared_ptr<void> restore(nullptr, [interpreter, previous = interpreter->interpreted_function()](void *) {
+        interpreter->set_interpreted_function(previous);
+    });
+    interpreter->set_interpreted_function(jit != nullptr ? this : nullptr);
+    Environment::ptr env = std::make_shared<Environment>(closure());
 
     for (size_t i = 0; i < func_->params.size(); i++) {
         env->define(func_->params[i]->lexeme, arguments[i]);
     }
-    auto bd = std::dynamic_pointer_cast<stmt::Block>(func_->body);
-    try {
-        interpreter->execute_block(bd->statements, env);
-    } catch (const ReturnException &ret) {
-        return ret.value;
+    // the parser always gives a function a block body
+    auto *body = static_cast<stmt::Block *>(func_->body.get());
+    interpreter->execute_block(body->statements, env);
+    if (interpreter->returning()) {
+        return interpreter->take_completion();
     }
 
     if (is_initializer) {
-        return env->get(0, "this");
+        return Completion::returning(env->get(0, "this"));
     }
-    return nullptr;
+    return {};
 }
 
 int LoxFunction::arity() const {
@@ -39,7 +71,10 @@ std::string LoxFunction::name() const {
 }
 
 std::shared_ptr<LoxFunction> LoxFunction::bind(std::shared_ptr<LoxInstance> instance) {
-    auto env = std::make_shared<Environment>(this->closure_);
+    auto env = std::make_shared<Environment>(closure());
     env->define("this", std::move(instance));
-    return std::make_shared<LoxFunction>(func_, env);
+    AllocProfiler::record(AllocProfiler::BOUND_METHOD, sizeof(LoxFunction));
+    auto bound = std::make_shared<LoxFunction>(func_, env);
+    bound->tier_ = tier_;
+    return bound;
 }
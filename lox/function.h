@@ -11,16 +11,23 @@
 
 #include "lox/callable.h"
 #include "lox/environment.h"
+#include "lox/jit.h"
+#include "lox/return.h"
 #include "lox/statement.h"
 
 class Interpreter;
 class LoxInstance;
 
+/*
+ * A function or method closed over its defining environment. The declaration
+ * is borrowed from a Program the interpreter keeps alive; not owning it keeps
+ * calls and binds from touching reference counts of an AST other isolates may
+ * be running at the same time.
+ */
 class LoxFunction : public Callable {
  public:
     using ptr = std::shared_ptr<LoxFunction>;
-    explicit LoxFunction(std::shared_ptr<stmt::Function> func, Environment::ptr closure)
-        : func_(std::move(func)), closure_(std::move(closure)) {}
+    explicit LoxFunction(stmt::Function *func, Environment::ptr closure) : func_(func), closure_(std::move(closure)) {}
 
     Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override;
 
@@ -28,7 +35,7 @@ class LoxFunction : public Callable {
 
     std::string name() const override;
 
-    std::shared_ptr<LoxFunction> bind(std::shared_ptr<LoxInstance> instance);
+    virtual std::shared_ptr<LoxFunction> bind(std::shared_ptr<LoxInstance> instance);
 
     bool is_initializer{false};
 
@@ -36,7 +43,48 @@ class LoxFunction : public Callable {
         return "function<" + name() + ">";
     }
 
+    stmt::Function *declaration() const {
+        return func_;
+    }
+
+    // the environment a call's own encloses
+    virtual Environment::ptr closure() const {
+        return closure_;
+    }
+
+    // the JIT's call and loop counters and compiled code for the declaration, null until the JIT first sees a call
+    const std::shared_ptr<Jit::Tier> &tier() const {
+        return tier_;
+    }
+
  private:
-    std::shared_ptr<stmt::Function> func_;
+    // one activation: binds the arguments and runs the body up to its end or a return
+    Completion run(Interpreter *interpreter, const std::vector<Value> &arguments);
+
+    stmt::Function *func_;
     Environment::ptr closure_;
+    std::shared_ptr<Jit::Tier> tier_;
+};
+
+/*
+ * A lifted function that captures locals. The copies live in an environment
+ * inside the function, enclosing the top level, so creating one takes a
+ * single allocation besides the copies; calls borrow it through the
+ * function's own reference count.
+ */
+class LiftedFunction : public LoxFunction, public std::enable_shared_from_this<LiftedFunction> {
+ public:
+    LiftedFunction(stmt::Function *func, Environment::ptr top)
+        : LoxFunction(func, nullptr), captures_(std::move(top), Environment::Embedded{}) {}
+
+    Environment::ptr closure() const override {
+        return {std::const_pointer_cast<LiftedFunction>(shared_from_this()), &captures_};
+    }
+
+    void capture(const std::string &name, const Value &value) {
+        captures_.define(name, value);
+    }
+
+ private:
+    mutable Environment captures_;
 };
@@ -0,0 +1,110 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/hotspots.h"
+
+#include <algorithm>
+#include <cxxabi.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static std::string kind_name(const std::type_info *kind) {
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(kind->name(), nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : kind->name();
+    std::free(demangled);
+    size_t pos = name.rfind("::");
+    return pos == std::string::npos ? name : name.substr(pos + 2);
+}
+
+static const char *morphism(size_t types) {
+    if (types == 1) {
+        return "monomorphic";
+    }
+    return types <= 4 ? "polymorphic" : "megamorphic";
+}
+
+static std::string json_string(const std::string &s) {
+    std::string out = "\"";
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        } else if (static_cast<unsigned char>(ch) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", ch);
+            out += buf;
+        } else {
+            out += ch;
+        }
+    }
+    return out + "\"";
+}
+
+std::vector<Hotspots::Line> Hotspots::hottest_lines(size_t top) const {
+    std::map<int, Line> lines;
+    for (const auto &item : nodes_) {
+        const Node &node = item.second;
+        Line &line = lines.emplace(node.line, Line{node.line, 0, {}}).first->second;
+        line.count += node.count;
+        if (!node.types.empty()) {
+            line.sites.push_back(&node);
+        }
+    }
+
+    std::vector<Line> result;
+    for (auto &item : lines) {
+        std::sort(item.second.sites.begin(), item.second.sites.end(), [](const Node *a, const Node *b) {
+            return a->count > b->count;
+        });
+        result.push_back(std::move(item.second));
+    }
+    std::sort(result.begin(), result.end(), [](const Line &a, const Line &b) {
+        return a.count > b.count || (a.count == b.count && a.line < b.line);
+    });
+    if (result.size() > top) {
+        result.resize(top);
+    }
+    return result;
+}
+
+void Hotspots::report(std::ostream &os, size_t top) const {
+    os << "hotspots: line, evaluated nodes, type feedback per site" << std::endl;
+    for (const Line &line : hottest_lines(top)) {
+        os << "line " << line.line << ": " << line.count << std::endl;
+        for (const Node *site : line.sites) {
+            os << "    " << kind_name(site->kind) << " x" << site->count << " " << morphism(site->types.size())
+               << std::endl;
+            for (const auto &type : site->types) {
+                char percent[16];
+                std::snprintf(percent, sizeof(percent), "%5.1f%%", 100.0 * type.second / site->count);
+                os << "        " << percent << "  " << type.first << std::endl;
+            }
+        }
+    }
+}
+
+void Hotspots::report_json(std::ostream &os, size_t top) const {
+    os << "{\"lines\":[";
+    bool first_line = true;
+    for (const Line &line : hottest_lines(top)) {
+        os << (first_line ? "" : ",") << "{\"line\":" << line.line << ",\"count\":" << line.count << ",\"sites\":[";
+        first_line = false;
+        bool first_site = true;
+        for (const Node *site : line.sites) {
+            os << (first_site ? "" : ",") << "{\"kind\":" << json_string(kind_name(site->kind))
+               << ",\"count\":" << site->count << ",\"state\":\"" << morphism(site->types.size()) << "\",\"types\":{";
+            first_site = false;
+            bool first_type = true;
+            for (const auto &type : site->types) {
+                os << (first_type ? "" : ",") << json_string(type.first) << ":" << type.second;
+                first_type = false;
+            }
+            os << "}}";
+        }
+        os << "]}";
+    }
+    os << "]}" << std::endl;
+}
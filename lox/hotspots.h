@@ -0,0 +1,59 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Execution counters and type feedback collected by the interpreter when
+ * --hotspots is on. Every evaluated node is counted; binary operators record
+ * their operand types, calls the kind of callee and property reads the class
+ * of the receiver. Counters are kept per interpreter, never on the shared AST.
+ */
+class Hotspots {
+ public:
+    using ptr = std::shared_ptr<Hotspots>;
+
+    void hit(const void *node, const std::type_info &kind, int line) {
+        Node &n = nodes_[node];
+        if (n.count++ == 0) {
+            n.kind = &kind;
+            n.line = line;
+        }
+    }
+
+    void observe(const void *node, const std::string &type) {
+        nodes_[node].types[type]++;
+    }
+
+    // the top lines by evaluated nodes, with the type profile of every site on them
+    void report(std::ostream &os, size_t top) const;
+    void report_json(std::ostream &os, size_t top) const;
+
+ private:
+    struct Node {
+        const std::type_info *kind{nullptr};
+        int line{0};
+        uint64_t count{0};
+        std::map<std::string, uint64_t> types;
+    };
+
+    struct Line {
+        int line;
+        uint64_t count;
+        std::vector<const Node *> sites;
+    };
+
+    std::vector<Line> hottest_lines(size_t top) const;
+
+    std::unordered_map<const void *, Node> nodes_;
+};
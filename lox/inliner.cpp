@@ -0,0 +1,292 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/inliner.h"
+
+InlineBody::ptr InlineBody::compile(const stmt::Function &function, bool method) {
+    // an initializer returns its instance whatever the body says
+    if (function.params.size() > kMaxParams || (method && function.name->lexeme == "init")) {
+        return nullptr;
+    }
+    auto *body = static_cast<stmt::Block *>(function.body.get());
+    if (body->statements.size() != 1) {
+        return nullptr;
+    }
+    auto *ret = dynamic_cast<stmt::Return *>(body->statements.front().get());
+    if (ret == nullptr || !ret->value) {
+        return nullptr;
+    }
+    auto inlined = std::make_shared<InlineBody>();
+    inlined->arity_ = function.params.size();
+    if (!inlined->add(ret->value.get(), function, method)) {
+        return nullptr;
+    }
+    return inlined;
+}
+
+bool InlineBody::add(expr::Expr *expr, const stmt::Function &function, bool method) {
+    Node node{};
+    if (auto *literal = dynamic_cast<expr::Literal *>(expr)) {
+        node.op = Node::CONSTANT;
+        node.constant = literal->value;
+    } else if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+        return add(grouping->expression.get(), function, method);
+    } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+        // anything but a parameter depends on where the function was declared
+        size_t slot = 0;
+        while (slot < function.params.size() && function.params[slot]->lexeme != variable->name->lexeme) {
+            slot++;
+        }
+        if (slot == function.params.size()) {
+            return false;
+        }
+        node.op = Node::PARAM;
+        node.slot = slot;
+    } else if (dynamic_cast<expr::This *>(expr) != nullptr) {
+        if (!method) {
+            return false;
+        }
+        node.op = Node::THIS;
+    } else if (auto *get = dynamic_cast<expr::Get *>(expr)) {
+        if (!add(get->object.get(), function, method)) {
+            return false;
+        }
+        node.op = Node::GET;
+        node.token = get->name;
+        node.left = nodes_.size() - 1;
+    } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+        if (unary->op->kind != Token::MINUS && unary->op->kind != Token::BANG) {
+            return false;
+        }
+        if (!add(unary->right.get(), function, method)) {
+            return false;
+        }
+        node.op = unary->op->kind == Token::MINUS ? Node::NEGATE : Node::NOT;
+        node.token = unary->op;
+        node.left = nodes_.size() - 1;
+    } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+        if (!add(binary->left.get(), function, method)) {
+            return false;
+        }
+        node.left = nodes_.size() - 1;
+        if (!add(binary->right.get(), function, method)) {
+            return false;
+        }
+        node.op = Node::BINARY;
+        node.token = binary->op;
+        node.right = nodes_.size() - 1;
+    } else if (auto *logical = dynamic_cast<expr::Logical *>(expr)) {
+        if (!add(logical->left.get(), function, method)) {
+            return false;
+        }
+        node.left = nodes_.size() - 1;
+        if (!add(logical->right.get(), function, method)) {
+            return false;
+        }
+        node.op = Node::LOGICAL;
+        node.token = logical->op;
+        node.right = nodes_.size() - 1;
+    } else {
+        // calls, assignments and super make a function too big to inline
+        return false;
+    }
+    if (nodes_.size() == kMaxNodes) {
+        return false;
+    }
+    nodes_.push_back(std::move(node));
+    return true;
+}
+
+void Inliner::run(const std::vector<stmt::Statement::ptr> &statements) {
+    Inliner inliner;
+    // a name declared twice at top level is no more stable than an assigned one
+    std::unordered_map<std::string, int> declarations;
+    for (const auto &stmt : statements) {
+        if (auto *function = dynamic_cast<stmt::Function *>(stmt.get())) {
+            declarations[function->name->lexeme]++;
+            function->inline_body = InlineBody::compile(*function, false);
+            if (function->inline_body) {
+                inliner.functions_[function->name->lexeme] = function;
+            }
+        } else if (auto *var = dynamic_cast<stmt::Var *>(stmt.get())) {
+            declarations[var->name->lexeme]++;
+        } else if (auto *klass = dynamic_cast<stmt::Class *>(stmt.get())) {
+            declarations[klass->name->lexeme]++;
+        }
+    }
+
+    for (const auto &stmt : statements) {
+        inliner.walk(stmt.get());
+    }
+    for (auto it = inliner.functions_.begin(); it != inliner.functions_.end();) {
+        if (declarations[it->first] > 1 || inliner.assigned_.count(it->first)) {
+            it = inliner.functions_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    inliner.phase_ = MARK;
+    for (const auto &stmt : statements) {
+        inliner.walk(stmt.get());
+    }
+}
+
+void Inliner::walk(stmt::Statement *stmt) {
+    if (stmt) {
+        stmt->accept(this);
+    }
+}
+
+void Inliner::walk(expr::Expr *expr) {
+    if (expr) {
+        expr->accept(this);
+    }
+}
+
+Value Inliner::visit_expression_stmt(stmt::Expression *stmt) {
+    walk(stmt->expression.get());
+    return nullptr;
+}
+
+Value Inliner::visit_print_stmt(stmt::Print *stmt) {
+    walk(stmt->expression.get());
+    return nullptr;
+}
+
+Value Inliner::visit_block_stmt(stmt::Block *stmt) {
+    for (const auto &statement : stmt->statements) {
+        walk(statement.get());
+    }
+    return nullptr;
+}
+
+Value Inliner::visit_var_stmt(stmt::Var *stmt) {
+    walk(stmt->value.get());
+    return nullptr;
+}
+
+Value Inliner::visit_if_stmt(stmt::If *stmt) {
+    walk(stmt->condition.get());
+    walk(stmt->then_branch.get());
+    walk(stmt->else_branch.get());
+    return nullptr;
+}
+
+Value Inliner::visit_while_stmt(stmt::While *stmt) {
+    walk(stmt->condition.get());
+    walk(stmt->body.get());
+    return nullptr;
+}
+
+Value Inliner::visit_for_stmt(stmt::For *stmt) {
+    walk(stmt->initializer.get());
+    walk(stmt->condition.get());
+    walk(stmt->increment.get());
+    walk(stmt->body.get());
+    return nullptr;
+}
+
+Value Inliner::visit_function_stmt(stmt::Function *stmt) {
+    walk(stmt->body.get());
+    return nullptr;
+}
+
+Value Inliner::visit_return_stmt(stmt::Return *stmt) {
+    walk(stmt->value.get());
+    return nullptr;
+}
+
+Value Inliner::visit_class_stmt(stmt::Class *stmt) {
+    for (const auto &method : stmt->methods) {
+        if (phase_ == COLLECT) {
+            method->inline_body = InlineBody::compile(*method, true);
+            if (method->inline_body) {
+                methods_.insert(method->name->lexeme);
+            }
+        }
+        walk(method->body.get());
+    }
+    return nullptr;
+}
+
+Value Inliner::visit_binary_expr(expr::Binary *expr) {
+    walk(expr->left.get());
+    walk(expr->right.get());
+    return nullptr;
+}
+
+Value Inliner::visit_grouping_expr(expr::Grouping *expr) {
+    walk(expr->expression.get());
+    return nullptr;
+}
+
+Value Inliner::visit_literal_expr(expr::Literal * /*expr*/) {
+    return nullptr;
+}
+
+Value Inliner::visit_unary_expr(expr::Unary *expr) {
+    walk(expr->right.get());
+    return nullptr;
+}
+
+Value Inliner::visit_variable_expr(expr::Variable * /*expr*/) {
+    return nullptr;
+}
+
+Value Inliner::visit_assign_expr(expr::Assign *expr) {
+    if (phase_ == COLLECT) {
+        assigned_.insert(expr->name->lexeme);
+    }
+    walk(expr->value.get());
+    return nullptr;
+}
+
+Value Inliner::visit_logical_expr(expr::Logical *expr) {
+    walk(expr->left.get());
+    walk(expr->right.get());
+    return nullptr;
+}
+
+Value Inliner::visit_break_expr(expr::Break * /*expr*/) {
+    return nullptr;
+}
+
+Value Inliner::visit_call_expr(expr::Call *expr) {
+    walk(expr->callee.get());
+    for (const auto &argument : expr->arguments) {
+        walk(argument.get());
+    }
+    if (phase_ != MARK) {
+        return nullptr;
+    }
+    if (auto *variable = dynamic_cast<expr::Variable *>(expr->callee.get())) {
+        auto it = functions_.find(variable->name->lexeme);
+        if (it != functions_.end() && it->second->params.size() == expr->arguments.size()) {
+            expr->inline_target = it->second;
+        }
+    } else if (auto *get = dynamic_cast<expr::Get *>(expr->callee.get())) {
+        expr->inline_method = methods_.count(get->name->lexeme) > 0;
+    }
+    return nullptr;
+}
+
+Value Inliner::visit_get_expr(expr::Get *expr) {
+    walk(expr->object.get());
+    return nullptr;
+}
+
+Value Inliner::visit_set_expr(expr::Set *expr) {
+    walk(expr->object.get());
+    walk(expr->value.get());
+    return nullptr;
+}
+
+Value Inliner::visit_this_expr(expr::This * /*expr*/) {
+    return nullptr;
+}
+
+Value Inliner::visit_super_expr(expr::Super * /*expr*/) {
+    return nullptr;
+}
@@ -0,0 +1,118 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "lox/expr.h"
+#include "lox/statement.h"
+#include "lox/token.h"
+#include "lox/value.h"
+
+/*
+ * The body of a function small enough to be inlined: a single
+ * `return EXPRESSION;` built from literals, parameters, `this`, property
+ * reads and operators. It calls nothing, so it can't recurse, and it reads no
+ * variable but its own parameters, so it means the same wherever it is
+ * evaluated. Parameters become argument slots, which lets a call site evaluate
+ * it without an environment or a call frame.
+ */
+class InlineBody {
+ public:
+    using ptr = std::shared_ptr<const InlineBody>;
+
+    static constexpr size_t kMaxParams = 4;
+    static constexpr size_t kMaxNodes = 16;
+
+    struct Node {
+        enum Op { CONSTANT, PARAM, THIS, GET, NEGATE, NOT, BINARY, LOGICAL };
+
+        Op op;
+        Value constant;
+        // the operator, or the property name of a GET
+        Token::ptr token;
+        // the argument slot of a PARAM
+        size_t slot{0};
+        // operands, always earlier nodes
+        size_t left{0};
+        size_t right{0};
+    };
+
+    // nullptr when the function doesn't qualify
+    static ptr compile(const stmt::Function &function, bool method);
+
+    size_t arity() const {
+        return arity_;
+    }
+
+    // operands come before their operator, the last node is the returned expression
+    const std::vector<Node> &nodes() const {
+        return nodes_;
+    }
+
+ private:
+    // appends the nodes of expr, false when it can't be inlined
+    bool add(expr::Expr *expr, const stmt::Function &function, bool method);
+
+    size_t arity_{0};
+    std::vector<Node> nodes_;
+};
+
+/*
+ * A pass over a freshly compiled program, before anything runs or shares it.
+ * It gives every small top-level function and method an InlineBody, and marks
+ * the calls that can use one: calls to top-level functions the program never
+ * reassigns or redeclares, and method calls whose name has an inlinable
+ * method. The interpreter still guards every marked call with the callee it
+ * actually finds and falls back to a normal call when it isn't the expected
+ * one, so the marks are hints and never change what a program does.
+ */
+class Inliner : public stmt::Visitor, public expr::Visitor {
+ public:
+    static void run(const std::vector<stmt::Statement::ptr> &statements);
+
+    Value visit_expression_stmt(stmt::Expression *stmt) override;
+    Value visit_print_stmt(stmt::Print *stmt) override;
+    Value visit_block_stmt(stmt::Block *stmt) override;
+    Value visit_var_stmt(stmt::Var *stmt) override;
+    Value visit_if_stmt(stmt::If *stmt) override;
+    Value visit_while_stmt(stmt::While *stmt) override;
+    Value visit_for_stmt(stmt::For *stmt) override;
+    Value visit_function_stmt(stmt::Function *stmt) override;
+    Value visit_return_stmt(stmt::Return *stmt) override;
+    Value visit_class_stmt(stmt::Class *stmt) override;
+
+    Value visit_binary_expr(expr::Binary *expr) override;
+    Value visit_grouping_expr(expr::Grouping *expr) override;
+    Value visit_literal_expr(expr::Literal *expr) override;
+    Value visit_unary_expr(expr::Unary *expr) override;
+    Value visit_variable_expr(expr::Variable *expr) override;
+    Value visit_assign_expr(expr::Assign *expr) override;
+    Value visit_logical_expr(expr::Logical *expr) override;
+    Value visit_break_expr(expr::Break *expr) override;
+    Value visit_call_expr(expr::Call *expr) override;
+    Value visit_get_expr(expr::Get *expr) override;
+    Value visit_set_expr(expr::Set *expr) override;
+    Value visit_this_expr(expr::This *expr) override;
+    Value visit_super_expr(expr::Super *expr) override;
+
+ private:
+    enum Phase { COLLECT, MARK };
+
+    void walk(stmt::Statement *stmt);
+    void walk(expr::Expr *expr);
+
+    Phase phase_{COLLECT};
+    // names assigned anywhere in the program
+    std::unordered_set<std::string> assigned_;
+    // the top-level functions calls may be inlined to, by name
+    std::unordered_map<std::string, stmt::Function *> functions_;
+    // names of methods with an InlineBody
+    std::unordered_set<std::string> methods_;
+};
@@ -7,6 +7,7 @@
 #include <memory>
 #include <unordered_map>
 
+#include "lox/alloc_profiler.h"
 #include "lox/klass.h"
 #include "lox/token.h"
 #include "lox/value.h"
@@ -14,14 +15,28 @@
 class LoxInstance : public std::enable_shared_from_this<LoxInstance> {
  public:
     using ptr = std::shared_ptr<LoxInstance>;
-    explicit LoxInstance(LoxClass klass) : klass_(std::move(klass)) {}
+    explicit LoxInstance(LoxClass::ptr klass) : klass_(std::move(klass)) {
+        AllocProfiler::record(AllocProfiler::INSTANCE, sizeof(LoxInstance));
+    }
 
     std::string str() const;
 
     Value get(const Token::ptr &name);
     void set(const Token::ptr &name, Value value);
 
+    void set(const std::string &name, Value value) {
+        fields_[name] = std::move(value);
+    }
+
+    const LoxClass::ptr &klass() const {
+        return klass_;
+    }
+
+    const std::unordered_map<std::string, Value> &fields() const {
+        return fields_;
+    }
+
  private:
-    LoxClass klass_;
+    LoxClass::ptr klass_;
     std::unordered_map<std::string, Value> fields_;
 };
\ No newline at end of file
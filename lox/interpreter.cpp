@@ -4,6 +4,7 @@
 
 #include "lox/interpreter.h"
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -11,6 +12,7 @@
 #include <utility>
 
 #include "lox/builtin.h"
+#include "lox/closure_compiler.h"
 #include "lox/function.h"
 #include "lox/instance.h"
 #include "lox/klass.h"
@@ -18,14 +20,45 @@
 #include "lox/token.h"
 
 Interpreter::Interpreter() {
+    reset();
+}
+
+void Interpreter::reset() {
+    environment_ = nullptr;
     globals_environment_ = std::make_shared<Environment>();
-    globals_environment_->define("clock", std::shared_ptr<Callable>(new Clock()));
-    globals_environment_->define("assert", std::shared_ptr<Callable>(new Assert()));
-    globals_environment_->define("str", std::shared_ptr<Callable>(new Str()));
-    globals_environment_->define("getc", std::shared_ptr<Callable>(new Getc()));
-    globals_environment_->define("chr", std::shared_ptr<Callable>(new Chr()));
-    globals_environment_->define("exit", std::shared_ptr<Callable>(new Exit()));
+    define_builtins();
     environment_ = std::make_shared<Environment>(globals_environment_);
+    // the compiler thread may be reading a declaration from one of the programs
+    if (jit_) {
+        jit_->clear();
+    }
+    programs_.clear();
+    lifted_.clear();
+    completion_ = Completion{};
+}
+
+void Interpreter::enable_jit() {
+    jit_ = std::make_unique<Jit>(this);
+}
+
+void Interpreter::configure(const Options &options) {
+    options_ = options.engine();
+    set_max_depth(options_.max_depth);
+    set_inlining(options_.inline_calls);
+    if (options_.jit) {
+        enable_jit();
+    }
+    if (options_.closures) {
+        ClosureCompiler::Options closure_options;
+        closure_options.type_report = options_.type_report ? &std::cerr : nullptr;
+        closure_options.ir_dump = options_.dump_ir ? &std::cerr : nullptr;
+        closure_options.optimize = options_.ssa;
+        enable_closures(closure_options);
+    }
+}
+
+void Interpreter::define_builtins() {
+    register_builtins(this);
 }
 
 Value Interpreter::visit_literal_expr(expr::Literal *expr) {
@@ -37,23 +70,32 @@ Value Interpreter::visit_grouping_expr(expr::Grouping *expr) {
 }
 
 Value Interpreter::visit_unary_expr(expr::Unary *expr) {
-    Value value = evaluate(expr->right.get());
-    switch (expr->op->kind) {
+    return unary(expr->op, evaluate(expr->right.get()));
+}
+
+Value Interpreter::unary(const Token::ptr &op, const Value &value) {
+    switch (op->kind) {
     case Token::Kind::MINUS:
         return -value.as<double>();
     case Token::Kind::BANG:
         return !value;
     default:
-        throw RuntimeError(expr->op, "Unknown unary operator");
+        throw RuntimeError(op, "Unknown unary operator");
     }
 }
 
 Value Interpreter::visit_binary_expr(expr::Binary *expr) {
     Value left = evaluate(expr->left.get());
     Value right = evaluate(expr->right.get());
+    if (hotspots_) {
+        hotspots_->observe(expr, left.type() + " " + expr->op->lexeme + " " + right.type());
+    }
+    return binary(expr->op, left, right);
+}
 
+Value Interpreter::binary(const Token::ptr &op, const Value &left, const Value &right) {
     try {
-        switch (expr->op->kind) {
+        switch (op->kind) {
         case Token::Kind::PLUS:
             return left + right;
         case Token::Kind::MINUS:
@@ -78,7 +120,7 @@ Value Interpreter::visit_binary_expr(expr::Binary *expr) {
             throw std::runtime_error("unknown binary operator");
         }
     } catch (const std::exception &e) {
-        throw RuntimeError(expr->op, e.what());
+        throw RuntimeError(op, e.what());
     }
 }
 
@@ -97,12 +139,120 @@ Value Interpreter::visit_break_expr(expr::Break *expr) {
 }
 
 Value Interpreter::visit_call_expr(expr::Call *expr) {
-    Value callee = evaluate(expr->callee.get());
+    Value callee;
+    Value result;
+    if (evaluate_call_site(expr, &callee, &result)) {
+        return result;
+    }
+    if (hotspots_) {
+        hotspots_->observe(expr, callee.str());
+    }
+    std::vector<Value> arguments = evaluate_arguments(expr);
+    return invoke(expr->paren, to_callable(callee, expr->paren, arguments.size()), arguments);
+}
+
+bool Interpreter::evaluate_call_site(expr::Call *expr, Value *callee, Value *result) {
+    if (!inlining_ || (expr->inline_target == nullptr && !expr->inline_method)) {
+        *callee = evaluate(expr->callee.get());
+        return false;
+    }
+
+    const InlineBody *body = nullptr;
+    Callable *inlined = nullptr;
+    Value receiver;
+    if (expr->inline_method) {
+        // guarded by the receiver's class: the method it finds has to be inlinable and not shadowed by a field
+        auto *get = static_cast<expr::Get *>(expr->callee.get());
+        receiver = evaluate(get->object.get());
+        if (auto *instance = receiver.get_if<LoxInstance::ptr>()) {
+            const auto &name = get->name->lexeme;
+            if ((*instance)->fields().count(name) == 0) {
+                auto method = (*instance)->klass()->find_method(name);
+                if (method && method->declaration()->inline_body) {
+                    body = method->declaration()->inline_body.get();
+                    inlined = method.get();
+                }
+            }
+        }
+        if (body == nullptr || body->arity() != expr->arguments.size()) {
+            if (hotspots_) {
+                hotspots_->observe(get, receiver.type());
+            }
+            *callee = property(receiver, get->name);
+            return false;
+        }
+    } else {
+        // guarded by the callee's identity, a shadowing local or a redefinition in a later program deoptimizes
+        *callee = evaluate(expr->callee.get());
+        auto *function = callee->get_if<Callable::ptr>();
+        auto *declared = function ? dynamic_cast<LoxFunction *>(function->get()) : nullptr;
+        if (declared == nullptr || declared->declaration() != expr->inline_target) {
+            return false;
+        }
+        body = expr->inline_target->inline_body.get();
+        inlined = declared;
+    }
+
+    Value arguments[InlineBody::kMaxParams];
+    for (size_t i = 0; i < expr->arguments.size(); i++) {
+        arguments[i] = evaluate(expr->arguments[i].get());
+    }
+    try {
+        *result = evaluate_inline(*body, body->nodes().size() - 1, arguments, receiver);
+    } catch (RuntimeError &e) {
+        // the backtrace shows the call that was inlined as if it had been made
+        if (e.backtrace.empty()) {
+            CallStack::Scope frame(&call_stack_, inlined, expr->paren);
+            e.backtrace = call_stack_.capture();
+        }
+        throw;
+    }
+    return true;
+}
+
+Value Interpreter::evaluate_inline(const InlineBody &body, size_t node, const Value *arguments,
+                                   const Value &receiver) {
+    const auto &n = body.nodes()[node];
+    switch (n.op) {
+    case InlineBody::Node::CONSTANT:
+        return n.constant;
+    case InlineBody::Node::PARAM:
+        return arguments[n.slot];
+    case InlineBody::Node::THIS:
+        return receiver;
+    case InlineBody::Node::GET:
+        return property(evaluate_inline(body, n.left, arguments, receiver), n.token);
+    case InlineBody::Node::NEGATE:
+    case InlineBody::Node::NOT:
+        return unary(n.token, evaluate_inline(body, n.left, arguments, receiver));
+    case InlineBody::Node::BINARY: {
+        Value left = evaluate_inline(body, n.left, arguments, receiver);
+        return binary(n.token, left, evaluate_inline(body, n.right, arguments, receiver));
+    }
+    case InlineBody::Node::LOGICAL: {
+        Value left = evaluate_inline(body, n.left, arguments, receiver);
+        if (n.token->kind == Token::OR ? static_cast<bool>(left) : !left) {
+            return left;
+        }
+        return evaluate_inline(body, n.right, arguments, receiver);
+    }
+    }
+    return nullptr;
+}
+
+std::vector<Value> Interpreter::evaluate_arguments(expr::Call *expr) {
     std::vector<Value> arguments;
+    if (!expr->arguments.empty()) {
+        arguments.reserve(expr->arguments.size());
+        AllocProfiler::record(AllocProfiler::ARGUMENTS, expr->arguments.size() * sizeof(Value));
+    }
     for (const auto &arg : expr->arguments) {
         arguments.push_back(evaluate(arg.get()));
     }
+    return arguments;
+}
 
+Callable::ptr Interpreter::to_callable(const Value &callee, const Token::ptr &paren, size_t arguments) {
     std::shared_ptr<Callable> callable;
     if (callee.is<LoxFunction::ptr>()) {
         callable = std::dynamic_pointer_cast<Callable>(callee.as<LoxFunction::ptr>());
@@ -111,25 +261,49 @@ Value Interpreter::visit_call_expr(expr::Call *expr) {
     } else if (callee.is<Callable::ptr>()) {
         callable = callee.as<Callable::ptr>();
     } else {
-        throw RuntimeError(expr->paren, "function or method is required");
+        throw RuntimeError(paren, "function or method is required");
     }
 
-    if (arguments.size() != callable->arity()) {
+    if (callable->arity() >= 0 && arguments != static_cast<size_t>(callable->arity())) {
         std::ostringstream os;
         os << "function " << callable->name() << " require " << callable->arity() << " argument(s) but "
-           << arguments.size() << " given.";
-        throw RuntimeError(expr->paren, os.str());
+           << arguments << " given.";
+        throw RuntimeError(paren, os.str());
     }
+    return callable;
+}
 
-    return callable->call(this, arguments);
+Value Interpreter::invoke(const Token::ptr &paren, const Callable::ptr &callable, const std::vector<Value> &arguments) {
+    CallStack::Scope frame(&call_stack_, callable.get(), paren);
+    try {
+        return callable->call(this, arguments);
+    } catch (RuntimeError &e) {
+        // the innermost call the error passes through sees every frame still in place
+        if (e.backtrace.empty()) {
+            e.backtrace = call_stack_.capture();
+        }
+        throw;
+    } catch (const std::runtime_error &e) {
+        // natives report errors without a token, attribute them to the call site
+        RuntimeError error(paren, e.what());
+        error.backtrace = call_stack_.capture();
+        throw error;
+    }
 }
 
 Value Interpreter::visit_get_expr(expr::Get *expr) {
     Value object = evaluate(expr->object.get());
+    if (hotspots_) {
+        hotspots_->observe(expr, object.type());
+    }
+    return property(object, expr->name);
+}
+
+Value Interpreter::property(const Value &object, const Token::ptr &name) {
     if (object.is<LoxInstance::ptr>()) {
-        return object.as<LoxInstance::ptr>()->get(expr->name);
+        return object.as<LoxInstance::ptr>()->get(name);
     }
-    throw RuntimeError(expr->name, "Only instances have properties.");
+    throw RuntimeError(name, "Only instances have properties.");
 }
 
 Value Interpreter::visit_set_expr(expr::Set *expr) {
@@ -169,7 +343,7 @@ Value Interpreter::visit_expression_stmt(stmt::Expression *stmt) {
 
 Value Interpreter::visit_print_stmt(stmt::Print *stmt) {
     Value value = evaluate(stmt->expression.get());
-    std::cout << value.str() << std::endl;
+    *out_ << value.str() << std::endl;
     return nullptr;
 }
 
@@ -184,7 +358,7 @@ Value Interpreter::visit_var_stmt(stmt::Var *stmt) {
 }
 
 Value Interpreter::visit_block_stmt(stmt::Block *stmt) {
-    execute_block(stmt->statements, std::make_shared<Environment>(environment_));
+    execute_block(stmt->statements, stmt->scoped ? std::make_shared<Environment>(environment_) : environment_);
     return nullptr;
 }
 
@@ -220,12 +394,23 @@ Value Interpreter::visit_while_stmt(stmt::While *stmt) {
     });
     this->environment_ = std::make_shared<Environment>(this->environment_);
 
-    while (evaluate(stmt->condition.get())) {
+    Jit::LoopRun run;
+    while (true) {
+        if (jit_ && jit_->loop_header(stmt, run, stmt->condition.get(), stmt->body.get(), nullptr,
+                                      environment_.get(), interpreted_function_, &completion_)) {
+            break;
+        }
+        if (!evaluate(stmt->condition.get())) {
+            break;
+        }
         try {
             execute(stmt->body.get());
         } catch (const BreakException &e) {
             break;
         }
+        if (returning()) {
+            break;
+        }
     }
     return nullptr;
 }
@@ -236,29 +421,155 @@ Value Interpreter::visit_for_stmt(stmt::For *stmt) {
     });
     this->environment_ = std::make_shared<Environment>(this->environment_);
 
-    for (execute(stmt->initializer.get()); evaluate(stmt->condition.get()); execute(stmt->increment.get())) {
+    execute(stmt->initializer.get());
+    // hotspots and the JIT's loop traces see every evaluation of the condition and increment
+    if (stmt->counted && !hotspots_ && !jit_ && run_counted(stmt)) {
+        return nullptr;
+    }
+    Jit::LoopRun run;
+    for (;; execute(stmt->increment.get())) {
+        if (jit_ && jit_->loop_header(stmt, run, stmt->condition.get(), stmt->body.get(), stmt->increment.get(),
+                                      environment_.get(), interpreted_function_, &completion_)) {
+            break;
+        }
+        if (!evaluate(stmt->condition.get())) {
+            break;
+        }
         try {
             execute(stmt->body.get());
         } catch (const BreakException &e) {
             break;
         }
+        if (returning()) {
+            break;
+        }
     }
     return nullptr;
 }
 
+bool Interpreter::run_counted(stmt::For *stmt) {
+    auto *var = static_cast<stmt::Var *>(stmt->initializer.get());
+    auto *condition = static_cast<expr::Binary *>(stmt->condition.get());
+    auto *increment = static_cast<stmt::Expression *>(stmt->increment.get());
+    auto *step = static_cast<expr::Binary *>(static_cast<expr::Assign *>(increment->expression.get())->value.get());
+    // the initializer defined it in the loop's own environment, nothing else is declared there
+    Value *slot = environment_->lookup(var->name->lexeme);
+    const double *start = slot->get_if<double>();
+    if (start == nullptr) {
+        return false;
+    }
+    double counter = *start;
+    double delta = static_cast<expr::Literal *>(step->right.get())->value.as<double>();
+    if (step->op->kind == Token::MINUS) {
+        delta = -delta;
+    }
+    // a literal bound is read once, a variable on every iteration
+    auto *literal = dynamic_cast<expr::Literal *>(condition->right.get());
+    Value bound = literal != nullptr ? literal->value : Value();
+    Token::Kind compare = condition->op->kind;
+    while (true) {
+        if (literal == nullptr) {
+            bound = evaluate(condition->right.get());
+        }
+        const double *limit = bound.get_if<double>();
+        if (limit == nullptr) {
+            return false;
+        }
+        bool more = compare == Token::LESS         ? counter < *limit
+                    : compare == Token::LESS_EQUAL ? counter <= *limit
+                    : compare == Token::GREATER    ? counter > *limit
+                                                   : counter >= *limit;
+        if (!more) {
+            return true;
+        }
+        try {
+            execute(stmt->body.get());
+        } catch (const BreakException &e) {
+            return true;
+        }
+        if (returning()) {
+            return true;
+        }
+        counter += delta;
+        *slot = counter;
+    }
+}
+
 Value Interpreter::visit_function_stmt(stmt::Function *stmt) {
-    auto func = std::make_shared<LoxFunction>(stmt->shared_from_this(), environment_);
-    auto callable = std::dynamic_pointer_cast<Callable>(func);
+    Callable::ptr callable;
+    if (stmt->lifted) {
+        callable = lift(stmt);
+    } else {
+        callable = std::make_shared<LoxFunction>(stmt, environment_);
+        AllocProfiler::record(AllocProfiler::CLOSURE, sizeof(LoxFunction));
+    }
     this->environment_->define(stmt->name->lexeme, callable);
     return callable;
 }
 
+Callable::ptr Interpreter::lift(stmt::Function *stmt) {
+    if (stmt->shared()) {
+        auto found = lifted_.find(stmt);
+        if (found != lifted_.end()) {
+            return found->second;
+        }
+    }
+    const std::vector<std::string> &captures = stmt->captures;
+    const std::string &name = stmt->name->lexeme;
+    // the top level is the scope right inside the globals
+    Environment::ptr top = environment_;
+    while (top->enclosing() != nullptr && top->enclosing()->enclosing() != nullptr) {
+        top = top->enclosing();
+    }
+    Callable::ptr callable;
+    if (captures.empty()) {
+        callable = std::make_shared<LoxFunction>(stmt, top);
+        AllocProfiler::record(AllocProfiler::CLOSURE, sizeof(LoxFunction));
+    } else {
+        auto lifted = std::make_shared<LiftedFunction>(stmt, top);
+        AllocProfiler::record(AllocProfiler::CLOSURE, sizeof(LiftedFunction));
+        for (const auto &capture : captures) {
+            lifted->capture(capture, capture == name ? Value(Callable::ptr(lifted)) : environment_->get(capture));
+        }
+        callable = lifted;
+    }
+    if (stmt->shared()) {
+        lifted_.emplace(stmt, callable);
+    }
+    return callable;
+}
+
 Value Interpreter::visit_return_stmt(stmt::Return *stmt) {
+    if (stmt->tail_call) {
+        auto *call = static_cast<expr::Call *>(stmt->value.get());
+        Value callee;
+        Value inlined;
+        if (evaluate_call_site(call, &callee, &inlined)) {
+            completion_ = Completion::returning(std::move(inlined));
+            return nullptr;
+        }
+        if (hotspots_) {
+            hotspots_->observe(call, callee.str());
+        }
+        std::vector<Value> arguments = evaluate_arguments(call);
+        Callable::ptr callable = to_callable(callee, call->paren, arguments.size());
+        // classes and natives don't recurse through Lox code, they are called as usual
+        if (auto function = std::dynamic_pointer_cast<LoxFunction>(callable)) {
+            completion_ = {Completion::TAIL_CALL, nullptr, std::move(function), std::move(arguments),
+                           call->paren->line};
+            return nullptr;
+        }
+        Value value = invoke(call->paren, callable, arguments);
+        completion_ = Completion::returning(std::move(value));
+        return nullptr;
+    }
+
     Value value = nullptr;
     if (stmt->value) {
         value = evaluate(stmt->value.get());
     }
-    throw ReturnException(value);
+    completion_ = Completion::returning(std::move(value));
+    return nullptr;
 }
 
 Value Interpreter::visit_class_stmt(stmt::Class *stmt) {
@@ -277,7 +588,8 @@ Value Interpreter::visit_class_stmt(stmt::Class *stmt) {
 
     std::unordered_map<std::string, LoxFunction::ptr> methods;
     for (const auto &item : stmt->methods) {
-        auto fn = std::make_shared<LoxFunction>(item, environment_);
+        auto fn = std::make_shared<LoxFunction>(item.get(), environment_);
+        AllocProfiler::record(AllocProfiler::CLOSURE, sizeof(LoxFunction));
         methods[item->name->lexeme] = fn;
     }
 
@@ -295,6 +607,13 @@ Value Interpreter::execute(stmt::Statement *statement) {
     if (statement == nullptr) {
         return nullptr;
     }
+    if (hotspots_) {
+        hotspots_->hit(statement, typeid(*statement), statement->line);
+    }
+    if (AllocProfiler::enabled()) {
+        AllocProfiler::LineScope scope(statement->line);
+        return statement->accept(this);
+    }
     return statement->accept(this);
 }
 
@@ -306,25 +625,73 @@ void Interpreter::execute_block(const std::vector<stmt::Statement::ptr> &stateme
 
     for (const auto &stmt : statements) {
         execute(stmt.get());
+        if (returning()) {
+            break;
+        }
     }
 }
 
 Value Interpreter::evaluate(expr::Expr *expr) {
+    if (hotspots_) {
+        hotspots_->hit(expr, typeid(*expr), expr->line);
+    }
+    if (AllocProfiler::enabled()) {
+        AllocProfiler::LineScope scope(expr->line);
+        return expr->accept(this);
+    }
     return expr->accept(this);
 }
 
-void Interpreter::interpret(const std::vector<stmt::Statement::ptr> &statements) {
-    try {
-        for (const auto &statement : statements) {
-            Value v = execute(statement.get());
-            if (repl_mode_) {
-                stmt::Expression::ptr expression = std::dynamic_pointer_cast<stmt::Expression>(statement);
-                if (expression) {
-                    std::cout << v.str() << std::endl;
+Value Interpreter::interpret(const Program::ptr &program) {
+    // functions borrow their declarations from the program, it has to outlive them
+    if (std::find(programs_.begin(), programs_.end(), program) == programs_.end()) {
+        programs_.push_back(program);
+    }
+
+    Value result;
+    run_on_stack([&]() {
+        try {
+            if (closures_) {
+                result = ClosureCompiler::run(this, *program, repl_mode_, closure_options_);
+                return;
+            }
+            for (const auto &statement : program->statements()) {
+                Value v = execute(statement.get());
+                if (dynamic_cast<stmt::Expression *>(statement.get()) != nullptr) {
+                    result = v;
+                    if (repl_mode_) {
+                        *out_ << v.str() << std::endl;
+                    }
                 }
             }
+        } catch (const BreakException &e) {
+            throw RuntimeError(e.token, "break must in the body of 'for' or 'while'");
         }
-    } catch (const BreakException &e) {
-        throw RuntimeError(e.token, "break must in the body of 'for' or 'while'");
+    });
+    return result;
+}
+
+Value Interpreter::call(const Callable::ptr &callee, const std::vector<Value> &arguments) {
+    Value result;
+    run_on_stack([&]() {
+        result = callee->call(this, arguments);
+    });
+    return result;
+}
+
+// native stack a Lox call takes at most, through the visitor, evaluate, visit_call_expr and the callee
+static constexpr size_t kStackPerCall = 4096;
+
+void Interpreter::set_max_depth(size_t max_depth) {
+    call_stack_.set_max_depth(max_depth);
+    stack_ = nullptr;
+}
+
+void Interpreter::run_on_stack(const std::function<void()> &fn) {
+    if (!stack_) {
+        stack_ = std::make_unique<ExecutionStack>(
+            std::max<size_t>(64 << 20, call_stack_.max_depth() * kStackPerCall));
     }
+    call_stack_.set_native_limit(stack_->limit());
+    stack_->run(fn);
 }
@@ -4,28 +4,151 @@
 
 #pragma once
 
+#include <functional>
+#include <memory>
 #include <stack>
 #include <unordered_map>
 #include <vector>
 
+#include "lox/call_stack.h"
+#include "lox/closure_compiler.h"
 #include "lox/environment.h"
+#include "lox/execution_stack.h"
 #include "lox/expr.h"
+#include "lox/hotspots.h"
+#include "lox/inliner.h"
+#include "lox/jit.h"
+#include "lox/native.h"
+#include "lox/options.h"
+#include "lox/program.h"
+#include "lox/return.h"
 #include "lox/statement.h"
 
 class Interpreter : public expr::Visitor, public stmt::Visitor {
  public:
     Interpreter();
 
-    void interpret(const std::vector<stmt::Statement::ptr> &statements);
+    // executes the program and returns the value of its last expression statement
+    Value interpret(const Program::ptr &program);
+
+    // calls a function or class from outside any script, on the interpreter's own stack like interpret()
+    Value call(const Callable::ptr &callee, const std::vector<Value> &arguments);
+
+    // bounds the nesting of Lox calls, the native stack is sized to match
+    void set_max_depth(size_t max_depth);
+
+    // applies the options of Options::engine(), the isolates this one spawns get the same
+    void configure(const Options &options);
+
+    const Options &options() const {
+        return options_;
+    }
+
+    // a return statement has run and the statements around it are being left
+    bool returning() const {
+        return completion_.kind != Completion::NORMAL;
+    }
+
+    // hands the pending return to the function it returns from
+    Completion take_completion() {
+        return std::exchange(completion_, Completion{});
+    }
+
+    CallStack &call_stack() {
+        return call_stack_;
+    }
+
+    // drops all globals defined by scripts and starts over with just the builtins
+    void reset();
+
+    void set_output(std::ostream *out) {
+        out_ = out;
+    }
+
+    // whether calls the Inliner marked evaluate the callee's body in place
+    void set_inlining(bool inlining) {
+        inlining_ = inlining;
+    }
 
     void enable_repl_mode() {
         repl_mode_ = true;
     }
 
+    void enable_hotspots(Hotspots::ptr hotspots) {
+        hotspots_ = std::move(hotspots);
+    }
+
+    // exposes a C++ function, lambda or functor as a global, see bind_native()
+    template <typename F> void define_native(const std::string &name, F fn) {
+        globals_environment_->define(name, bind_native(name, std::move(fn)));
+    }
+
     Environment::ptr globals() {
         return globals_environment_;
     }
 
+    // every program run since the last reset(), oldest first
+    const std::vector<Program::ptr> &programs() const {
+        return programs_;
+    }
+
+    // the scope top-level declarations go to, enclosed by globals(); only stable between runs
+    Environment::ptr top_level() const {
+        return environment_;
+    }
+
+    // continues from a saved state: the programs its functions come from and its top-level scope
+    void restore(std::vector<Program::ptr> programs, Environment::ptr top_level) {
+        programs_ = std::move(programs);
+        environment_ = std::move(top_level);
+        lifted_.clear();
+    }
+
+    // a variable visible at top level, nil when there is none
+    Value global(const std::string &name) {
+        for (Environment *env = environment_.get(); env != nullptr; env = env->enclosing().get()) {
+            if (env->contains(name)) {
+                return env->get(0, name);
+            }
+        }
+        return nullptr;
+    }
+
+    // the semantics of single operations, shared by the tree walker and the JIT's calls into the runtime
+    Value property(const Value &object, const Token::ptr &name);
+    Value unary(const Token::ptr &op, const Value &value);
+    Value binary(const Token::ptr &op, const Value &left, const Value &right);
+    // the callable behind callee, checked against the number of arguments it is given
+    Callable::ptr to_callable(const Value &callee, const Token::ptr &paren, size_t arguments);
+    // calls with a frame on the call stack, the way a call expression does
+    Value invoke(const Token::ptr &paren, const Callable::ptr &callable, const std::vector<Value> &arguments);
+
+    std::ostream *output() const {
+        return out_;
+    }
+
+    // compiles hot functions to machine code from now on, see Jit
+    void enable_jit();
+
+    // runs programs compiled to closures by ClosureCompiler from now on instead of walking their trees
+    void enable_closures(ClosureCompiler::Options options = {}) {
+        closures_ = true;
+        closure_options_ = options;
+    }
+
+    Jit *jit() const {
+        return jit_.get();
+    }
+
+    // the function whose body the tree walker is running, nullptr at top level and without the JIT
+    LoxFunction *interpreted_function() const {
+        return interpreted_function_;
+    }
+
+    void set_interpreted_function(LoxFunction *function) {
+        interpreted_function_ = function;
+    }
+
     Value execute(stmt::Statement *statement);
 
     void execute_block(const std::vector<stmt::Statement::ptr> &statements, Environment::ptr env);
@@ -59,8 +182,37 @@ class Interpreter : public expr::Visitor, public stmt::Visitor {
 
  private:
     Value evaluate(expr::Expr *expr);
+    std::vector<Value> evaluate_arguments(expr::Call *expr);
+    // evaluates the callee of a call into *callee, or, when the Inliner marked the call and the callee
+    // is the one it expected, the whole call into *result and returns true
+    bool evaluate_call_site(expr::Call *expr, Value *callee, Value *result);
+    Value evaluate_inline(const InlineBody &body, size_t node, const Value *arguments, const Value &receiver);
+    // runs a counted for loop on a double, storing it in the counter variable for the body; false when the counter
+    // or the bound isn't a number, the loop then goes on from its condition
+    bool run_counted(stmt::For *stmt);
+    void define_builtins();
+    void run_on_stack(const std::function<void()> &fn);
+    // a function the resolver lifted, closed over the top level and copies of the locals it captures; one shared by
+    // every run of the declaration when it captures nothing but itself
+    Callable::ptr lift(stmt::Function *stmt);
 
     Environment::ptr globals_environment_;
     Environment::ptr environment_;
     bool repl_mode_{false};
+    bool inlining_{true};
+    bool closures_{false};
+    ClosureCompiler::Options closure_options_;
+    Options options_;
+    std::ostream *out_{&std::cout};
+    // programs run so far, kept alive until reset() for the functions that borrow their AST
+    std::vector<Program::ptr> programs_;
+    // the lifted functions every run of their declaration shares
+    std::unordered_map<const stmt::Function *, Callable::ptr> lifted_;
+    Hotspots::ptr hotspots_;
+    CallStack call_stack_;
+    Completion completion_;
+    std::unique_ptr<Jit> jit_;
+    LoxFunction *interpreted_function_{nullptr};
+    // allocated by the first run, a deep recursion runs out of call stack before it runs out of this
+    std::unique_ptr<ExecutionStack> stack_;
 };
@@ -0,0 +1,130 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/isolate.h"
+
+#include <stdexcept>
+#include <utility>
+
+#include "lox/channel.h"
+#include "lox/exception.h"
+#include "lox/float64_array.h"
+#include "lox/function.h"
+#include "lox/interpreter.h"
+#include "lox/tracer.h"
+
+Value transfer(const Value &value) {
+    if (value.is<nullptr_t>() || value.is<bool>() || value.is<double>() || value.is<std::string>() ||
+        value.is<Channel::ptr>()) {
+        return value;
+    }
+    if (const auto *array = value.get_if<Float64Array::ptr>()) {
+        // the value being transferred is the only reference left in the sending isolate
+        if ((*array)->frozen() || array->use_count() == 1) {
+            return value;
+        }
+        return (*array)->clone();
+    }
+    throw std::runtime_error(value.type() + " can't leave its isolate, only nil, booleans, numbers, strings, "
+                                            "Float64Arrays and channels can");
+}
+
+Task::Task(Program::ptr declarations, stmt::Function *function, std::vector<Value> arguments, Options options)
+    : name_(function->name->lexeme), options_(std::move(options)) {
+    thread_ = std::thread([this, declarations = std::move(declarations), function, arguments = std::move(arguments)]() {
+        run(declarations, function, arguments);
+    });
+}
+
+Task::~Task() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+Value Task::join(std::ostream *out) {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    // a second join has nothing left to print
+    *out << output_.str();
+    output_.str("");
+    if (!error_.empty()) {
+        throw std::runtime_error(error_);
+    }
+    return result_;
+}
+
+void Task::run(const Program::ptr &declarations, stmt::Function *function, const std::vector<Value> &arguments) {
+    Value result;
+    {
+        Interpreter interpreter;
+        interpreter.configure(options_);
+        interpreter.set_output(&output_);
+        try {
+            interpreter.interpret(declarations);
+            // the last declaration of a name wins, just as it did in the spawning isolate
+            Value global = interpreter.global(name_);
+            const auto *callable = global.get_if<Callable::ptr>();
+            auto *fn = callable ? dynamic_cast<LoxFunction *>(callable->get()) : nullptr;
+            if (fn == nullptr || fn->declaration() != function) {
+                throw std::runtime_error(name_ + "() was redeclared before spawn()");
+            }
+            result = interpreter.call(*callable, arguments);
+        } catch (const RuntimeError &e) {
+            error_ = "spawned " + name_ + "() failed at line " + std::to_string(e.token->line) + ": " + e.what();
+        } catch (const ExitException &e) {
+            error_ = "spawned " + name_ + "() called exit(" + std::to_string(e.code) + ")";
+        } catch (const std::exception &e) {
+            error_ = "spawned " + name_ + "() failed: " + e.what();
+        }
+    }
+    // with the isolate gone, an array the function returns is no longer referenced and moves instead of copying
+    try {
+        result_ = transfer(result);
+    } catch (const std::exception &e) {
+        error_ = "spawned " + name_ + "() returned " + e.what();
+    }
+    if (Tracer::enabled()) {
+        Tracer::collect();
+    }
+}
+
+Value Spawn::call(Interpreter *interpreter, const std::vector<Value> &arguments) {
+    if (arguments.empty()) {
+        throw std::runtime_error("spawn() needs a function to run");
+    }
+    const auto *callable = arguments[0].get_if<Callable::ptr>();
+    auto *function = callable ? dynamic_cast<LoxFunction *>(callable->get()) : nullptr;
+    if (function == nullptr) {
+        throw std::runtime_error("spawn() argument 1 must be a function, got " + arguments[0].type());
+    }
+    if (arguments.size() - 1 != static_cast<size_t>(function->arity())) {
+        throw std::runtime_error("function " + function->name() + " require " + std::to_string(function->arity()) +
+                                 " argument(s) but " + std::to_string(arguments.size() - 1) + " given.");
+    }
+
+    // the new isolate starts from the top-level declarations, the spawned function has to be one of them
+    std::vector<stmt::Statement::ptr> declarations;
+    bool top_level = false;
+    for (const auto &program : interpreter->programs()) {
+        for (const auto &statement : program->statements()) {
+            if (dynamic_cast<stmt::Function *>(statement.get()) || dynamic_cast<stmt::Class *>(statement.get())) {
+                declarations.push_back(statement);
+                top_level = top_level || statement.get() == function->declaration();
+            }
+        }
+    }
+    if (!top_level) {
+        throw std::runtime_error("spawn() can only run top-level functions, " + function->name() + "() is not one");
+    }
+
+    std::vector<Value> transferred;
+    transferred.reserve(arguments.size() - 1);
+    for (size_t i = 1; i < arguments.size(); i++) {
+        transferred.push_back(transfer(arguments[i]));
+    }
+    return std::make_shared<Task>(std::make_shared<Program>(std::move(declarations)), function->declaration(),
+                                  std::move(transferred), interpreter->options());
+}
@@ -0,0 +1,80 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lox/callable.h"
+#include "lox/options.h"
+#include "lox/program.h"
+#include "lox/statement.h"
+#include "lox/value.h"
+
+/*
+ * What may cross from one isolate to another. Numbers, booleans, nil and
+ * strings are copied; frozen arrays and channels are shared by pointer, they
+ * are immutable or safe to use concurrently. A mutable array moves when
+ * nothing else in the sending isolate references it and is copied otherwise.
+ * Instances, functions and classes live in one isolate's heap and are refused
+ * with std::runtime_error.
+ */
+Value transfer(const Value &value);
+
+/*
+ * A function running in its own isolate on its own thread. The new isolate
+ * gets the top-level functions and classes of the programs the spawning
+ * interpreter has run, but none of its variables; arguments and the result
+ * go through transfer(), and it runs with the spawner's engine options. What
+ * it prints is kept and written to the output of the interpreter that joins
+ * it, two threads never share a stream. Releasing the last reference joins
+ * the thread.
+ */
+class Task {
+ public:
+    using ptr = std::shared_ptr<Task>;
+
+    Task(Program::ptr declarations, stmt::Function *function, std::vector<Value> arguments, Options options);
+    ~Task();
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    // waits for the function to return, writes what it printed to out and hands over its result, throws
+    // std::runtime_error if it failed
+    Value join(std::ostream *out);
+
+    std::string str() const {
+        return "Task<" + name_ + ">";
+    }
+
+ private:
+    void run(const Program::ptr &declarations, stmt::Function *function, const std::vector<Value> &arguments);
+
+    std::string name_;
+    Options options_;
+    std::ostringstream output_;
+    std::thread thread_;
+    Value result_;
+    std::string error_;
+};
+
+// spawn(fn, args...): starts fn, a top-level function, in a new isolate and returns its Task
+class Spawn : public Callable {
+ public:
+    std::string name() const override {
+        return "spawn";
+    }
+
+    int arity() const override {
+        return -1;
+    }
+
+    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override;
+};
@@ -0,0 +1,1027 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/jit.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "lox/assembler.h"
+#include "lox/function.h"
+#include "lox/instance.h"
+#include "lox/interpreter.h"
+
+namespace {
+
+// what a slot holds: numbers and booleans live unboxed in the slot's word, other values in a side array
+enum Kind : uint8_t { BOXED, NUMBER, BOOLEAN, NIL };
+
+/*
+ * One step of a compiled function, on slots. The emitter turns each into
+ * machine code, with a fast path for the ops that have one; the runtime
+ * executes any of them generically when called for its index.
+ */
+struct Instruction {
+    enum Op {
+        NUMBER,          // dst = number
+        BOOL,            // dst = a != 0
+        NIL,             // dst = nil
+        CONSTANT,        // dst = constant
+        MOVE,            // dst = a
+        ARITH,           // dst = a token b, for + - * /
+        COMPARE,         // dst = a token b, for comparisons and equality
+        NEGATE,          // dst = -a
+        NOT,             // dst = !a
+        GET_VAR,         // dst = the variable named token, found through the closure
+        SET_VAR,         // the variable named token = a
+        GET_PROP,        // dst = a.token
+        EXPECT_INSTANCE, // a has to be an instance to have its field token set
+        SET_PROP,        // dst = a.token = b
+        CALL,            // dst = a(a + 1, ..., a + argc)
+        TAIL_CALL,       // return a(a + 1, ..., a + argc), in the caller's frame when a is a Lox function
+        RETURN,          // return a
+        PRINT,           // print a
+        LABEL,           // target: where jumps to label target land
+        JUMP,            // goto target
+        JUMP_IF_FALSE,   // goto target when a is falsy
+        JUMP_IF_TRUE,    // goto target when a is truthy
+    };
+
+    Op op;
+    uint32_t dst{0};
+    uint32_t a{0};
+    uint32_t b{0};
+    uint32_t argc{0};
+    size_t target{0};
+    double number{0};
+    Value constant;
+    Token::ptr token;
+    expr::Call *call{nullptr};
+};
+
+/*
+ * Where a run of the function in the tree walker can switch over to its
+ * compiled code: the label at the top of a loop and the locals live there,
+ * outermost scope first. Scopes match the Environments the tree walker has
+ * at the loop header one for one, the loop's own being the last.
+ */
+struct OsrEntry {
+    stmt::Statement *loop;
+    size_t label;
+    std::vector<std::vector<std::pair<std::string, uint32_t>>> scopes;
+};
+
+/*
+ * Lowers a function's AST to instructions. Parameters take the first slots,
+ * locals the next ones in declaration order and temporaries whatever is above
+ * the innermost live local, so slots are reused as scopes close.
+ */
+class Compiler {
+ public:
+    // the entry code picks one by comparing an 8-bit immediate
+    static constexpr size_t kMaxOsrEntries = 127;
+
+    explicit Compiler(stmt::Function *function) : function_(function) {}
+
+    // false when the function uses something compiled code can't run
+    bool compile() {
+        scopes_.emplace_back();
+        for (const auto &param : function_->params) {
+            scopes_.back()[param->lexeme] = allocate();
+        }
+        auto *body = static_cast<stmt::Block *>(function_->body.get());
+        for (const auto &stmt : body->statements) {
+            if (!statement(stmt.get())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<Instruction> instructions;
+    uint32_t slots{0};
+    size_t labels{0};
+    std::vector<OsrEntry> osr;
+
+ private:
+    uint32_t allocate() {
+        uint32_t slot = next_++;
+        slots = std::max(slots, next_);
+        return slot;
+    }
+
+    size_t label() {
+        return labels++;
+    }
+
+    Instruction &emit(Instruction::Op op) {
+        Instruction &instruction = instructions.emplace_back();
+        instruction.op = op;
+        return instruction;
+    }
+
+    void emit_label(size_t target) {
+        emit(Instruction::LABEL).target = target;
+    }
+
+    void emit_jump(Instruction::Op op, uint32_t condition, size_t target) {
+        auto &ins = emit(op);
+        ins.a = condition;
+        ins.target = target;
+    }
+
+    // the slot of a local visible here, -1 when the name is looked up through the closure
+    int64_t lookup(const std::string &name) const {
+        for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+            auto it = scope->find(name);
+            if (it != scope->end()) {
+                return it->second;
+            }
+        }
+        return -1;
+    }
+
+    bool statement(stmt::Statement *stmt) {
+        if (stmt == nullptr) {
+            return true;
+        }
+        // temporaries die with the statement that needed them
+        uint32_t mark = next_;
+        bool ok = true;
+        if (auto *expression_stmt = dynamic_cast<stmt::Expression *>(stmt)) {
+            ok = expression(expression_stmt->expression.get(), allocate());
+        } else if (auto *print = dynamic_cast<stmt::Print *>(stmt)) {
+            uint32_t value = allocate();
+            ok = expression(print->expression.get(), value);
+            emit(Instruction::PRINT).a = value;
+        } else if (auto *var = dynamic_cast<stmt::Var *>(stmt)) {
+            // the initializer still sees whatever the name meant before the declaration
+            uint32_t slot = allocate();
+            if (var->value) {
+                ok = expression(var->value.get(), slot);
+            } else {
+                emit(Instruction::NIL).dst = slot;
+            }
+            scopes_.back()[var->name->lexeme] = slot;
+            mark = slot + 1;
+        } else if (auto *block = dynamic_cast<stmt::Block *>(stmt)) {
+            scopes_.emplace_back();
+            for (const auto &inner : block->statements) {
+                if (!(ok = statement(inner.get()))) {
+                    break;
+                }
+            }
+            scopes_.pop_back();
+        } else if (auto *if_stmt = dynamic_cast<stmt::If *>(stmt)) {
+            size_t otherwise = label();
+            size_t end = label();
+            uint32_t condition = allocate();
+            ok = expression(if_stmt->condition.get(), condition);
+            emit_jump(Instruction::JUMP_IF_FALSE, condition, otherwise);
+            next_ = mark;
+            ok = ok && statement(if_stmt->then_branch.get());
+            emit_jump(Instruction::JUMP, 0, end);
+            emit_label(otherwise);
+            ok = ok && statement(if_stmt->else_branch.get());
+            emit_label(end);
+        } else if (auto *while_stmt = dynamic_cast<stmt::While *>(stmt)) {
+            ok = loop(while_stmt, nullptr, while_stmt->condition.get(), nullptr, while_stmt->body.get());
+        } else if (auto *for_stmt = dynamic_cast<stmt::For *>(stmt)) {
+            ok = loop(for_stmt, for_stmt->initializer.get(), for_stmt->condition.get(), for_stmt->increment.get(),
+                      for_stmt->body.get());
+        } else if (auto *ret = dynamic_cast<stmt::Return *>(stmt)) {
+            ok = return_statement(ret);
+        } else {
+            // nested functions and classes capture locals, which live in an Environment
+            ok = false;
+        }
+        next_ = mark;
+        return ok;
+    }
+
+    bool loop(stmt::Statement *stmt, stmt::Statement *initializer, expr::Expr *condition,
+              stmt::Statement *increment, stmt::Statement *body) {
+        scopes_.emplace_back();
+        uint32_t mark = next_;
+        bool ok = statement(initializer);
+        // a declaration in the initializer stays live for the whole loop
+        uint32_t live = next_;
+        size_t top = label();
+        size_t end = label();
+        emit_label(top);
+        if (osr.size() < kMaxOsrEntries) {
+            OsrEntry entry{stmt, top, {}};
+            for (const auto &scope : scopes_) {
+                entry.scopes.emplace_back(scope.begin(), scope.end());
+            }
+            osr.push_back(std::move(entry));
+        }
+        uint32_t test = allocate();
+        ok = ok && expression(condition, test);
+        emit_jump(Instruction::JUMP_IF_FALSE, test, end);
+        next_ = live;
+        breaks_.push_back(end);
+        ok = ok && statement(body) && statement(increment);
+        breaks_.pop_back();
+        emit_jump(Instruction::JUMP, 0, top);
+        emit_label(end);
+        scopes_.pop_back();
+        next_ = mark;
+        return ok;
+    }
+
+    bool return_statement(stmt::Return *ret) {
+        uint32_t value = allocate();
+        if (ret->tail_call) {
+            auto *call = static_cast<expr::Call *>(ret->value.get());
+            if (!call_arguments(call, value)) {
+                return false;
+            }
+            auto &ins = emit(Instruction::TAIL_CALL);
+            ins.a = value;
+            ins.argc = static_cast<uint32_t>(call->arguments.size());
+            ins.call = call;
+            return true;
+        }
+        if (ret->value) {
+            if (!expression(ret->value.get(), value)) {
+                return false;
+            }
+        } else {
+            emit(Instruction::NIL).dst = value;
+        }
+        emit(Instruction::RETURN).a = value;
+        return true;
+    }
+
+    // the callee into base and the arguments into the slots after it
+    bool call_arguments(expr::Call *call, uint32_t base) {
+        uint32_t mark = next_;
+        next_ = std::max(next_, base + 1);
+        if (!expression(call->callee.get(), base)) {
+            return false;
+        }
+        for (size_t i = 0; i < call->arguments.size(); i++) {
+            uint32_t slot = allocate();
+            if (slot != base + 1 + i || !expression(call->arguments[i].get(), slot)) {
+                return false;
+            }
+        }
+        next_ = mark;
+        return true;
+    }
+
+    bool expression(expr::Expr *expr, uint32_t dst) {
+        uint32_t mark = next_;
+        next_ = std::max(next_, dst + 1);
+        bool ok = true;
+        if (auto *literal = dynamic_cast<expr::Literal *>(expr)) {
+            if (auto *number = literal->value.get_if<double>()) {
+                auto &ins = emit(Instruction::NUMBER);
+                ins.dst = dst;
+                ins.number = *number;
+            } else if (auto *boolean = literal->value.get_if<bool>()) {
+                auto &ins = emit(Instruction::BOOL);
+                ins.dst = dst;
+                ins.a = *boolean ? 1 : 0;
+            } else if (literal->value.is<nullptr_t>()) {
+                emit(Instruction::NIL).dst = dst;
+            } else {
+                auto &ins = emit(Instruction::CONSTANT);
+                ins.dst = dst;
+                ins.constant = literal->value;
+            }
+        } else if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            ok = expression(grouping->expression.get(), dst);
+        } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            int64_t slot = lookup(variable->name->lexeme);
+            auto &ins = emit(slot >= 0 ? Instruction::MOVE : Instruction::GET_VAR);
+            ins.dst = dst;
+            ins.a = static_cast<uint32_t>(slot);
+            ins.token = variable->name;
+        } else if (auto *self = dynamic_cast<expr::This *>(expr)) {
+            auto &ins = emit(Instruction::GET_VAR);
+            ins.dst = dst;
+            ins.token = self->name;
+        } else if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            ok = expression(assign->value.get(), dst);
+            int64_t slot = lookup(assign->name->lexeme);
+            if (slot >= 0) {
+                auto &ins = emit(Instruction::MOVE);
+                ins.dst = static_cast<uint32_t>(slot);
+                ins.a = dst;
+            } else {
+                auto &ins = emit(Instruction::SET_VAR);
+                ins.a = dst;
+                ins.token = assign->name;
+            }
+        } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            ok = expression(unary->right.get(), dst);
+            auto &ins = emit(unary->op->kind == Token::MINUS ? Instruction::NEGATE : Instruction::NOT);
+            ins.dst = dst;
+            ins.a = dst;
+            ins.token = unary->op;
+        } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            uint32_t right = allocate();
+            ok = expression(binary->left.get(), dst) && expression(binary->right.get(), right);
+            switch (binary->op->kind) {
+            case Token::PLUS:
+            case Token::MINUS:
+            case Token::STAR:
+            case Token::SLASH:
+                emit(Instruction::ARITH);
+                break;
+            default:
+                emit(Instruction::COMPARE);
+                break;
+            }
+            auto &ins = instructions.back();
+            ins.dst = dst;
+            ins.a = dst;
+            ins.b = right;
+            ins.token = binary->op;
+        } else if (auto *logical = dynamic_cast<expr::Logical *>(expr)) {
+            size_t end = label();
+            ok = expression(logical->left.get(), dst);
+            emit_jump(logical->op->kind == Token::OR ? Instruction::JUMP_IF_TRUE : Instruction::JUMP_IF_FALSE, dst,
+                      end);
+            ok = ok && expression(logical->right.get(), dst);
+            emit_label(end);
+        } else if (auto *call = dynamic_cast<expr::Call *>(expr)) {
+            uint32_t base = allocate();
+            ok = call_arguments(call, base);
+            auto &ins = emit(Instruction::CALL);
+            ins.dst = dst;
+            ins.a = base;
+            ins.argc = static_cast<uint32_t>(call->arguments.size());
+            ins.call = call;
+        } else if (auto *get = dynamic_cast<expr::Get *>(expr)) {
+            ok = expression(get->object.get(), dst);
+            auto &ins = emit(Instruction::GET_PROP);
+            ins.dst = dst;
+            ins.a = dst;
+            ins.token = get->name;
+        } else if (auto *set = dynamic_cast<expr::Set *>(expr)) {
+            uint32_t object = allocate();
+            uint32_t value = allocate();
+            ok = expression(set->object.get(), object);
+            auto &check = emit(Instruction::EXPECT_INSTANCE);
+            check.a = object;
+            check.token = set->name;
+            ok = ok && expression(set->value.get(), value);
+            auto &ins = emit(Instruction::SET_PROP);
+            ins.dst = dst;
+            ins.a = object;
+            ins.b = value;
+            ins.token = set->name;
+        } else if (dynamic_cast<expr::Break *>(expr) != nullptr && !breaks_.empty()) {
+            emit_jump(Instruction::JUMP, 0, breaks_.back());
+        } else {
+            // super, and break outside a loop, which is an error the tree walker reports
+            ok = false;
+        }
+        next_ = mark;
+        return ok;
+    }
+
+    stmt::Function *function_;
+    std::vector<std::unordered_map<std::string, uint32_t>> scopes_;
+    std::vector<size_t> breaks_;
+    uint32_t next_{0};
+};
+
+} // namespace
+
+/*
+ * What compiled code works on: the slot arrays, which it addresses directly,
+ * and what the runtime needs for everything it calls back for.
+ */
+struct JitFrame {
+    uint64_t *numbers;
+    uint8_t *kinds;
+    const JitFunction *function;
+    Interpreter *interpreter;
+    Environment *closure;
+    // boxed slots, allocated the first time a slot holds something else than a number, boolean or nil
+    std::unique_ptr<Value[]> values;
+    Completion completion;
+    std::exception_ptr error;
+
+    Value load(uint32_t slot) const {
+        switch (kinds[slot]) {
+        case NUMBER: {
+            double number;
+            std::memcpy(&number, &numbers[slot], sizeof(number));
+            return number;
+        }
+        case BOOLEAN:
+            return numbers[slot] != 0;
+        case NIL:
+            return nullptr;
+        default:
+            return values[slot];
+        }
+    }
+
+    void store(uint32_t slot, Value value);
+};
+
+class JitFunction {
+ public:
+    JitFunction(std::string name, std::vector<Instruction> instructions, uint32_t slots, size_t labels,
+                std::vector<OsrEntry> osr)
+        : name_(std::move(name)), instructions_(std::move(instructions)), slots_(slots), osr_(std::move(osr)) {
+        emit(labels);
+        write_perf_map(region_->entry(), region_->size(), "lox:" + name_);
+    }
+
+    Completion run(Interpreter *interpreter, Environment *closure, const std::vector<Value> &arguments) const;
+
+    // the on-stack replacement entry at the header of loop, -1 if there is none
+    int osr_entry(stmt::Statement *loop) const {
+        for (size_t i = 0; i < osr_.size(); i++) {
+            if (osr_[i].loop == loop) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    // continues a call the tree walker started at the loop header of osr entry index, env being the loop's Environment
+    Completion run_osr(Interpreter *interpreter, Environment *closure, Environment *env, int index) const;
+
+    uint32_t slots() const {
+        return slots_;
+    }
+
+ private:
+    friend struct JitFrame;
+
+    // the last argument is the osr entry to start at, -1 for the top of the function
+    using Entry = int (*)(JitFrame *, uint64_t *, uint8_t *, int);
+
+    // runs the code in a frame filled in by init
+    Completion enter(Interpreter *interpreter, Environment *closure, int osr,
+                     const std::function<void(JitFrame &)> &init) const;
+
+    // the generic version of instruction index, for the JIT'd code; -1 and the error in the frame when it throws
+    static int slow(JitFrame *frame, uint32_t index);
+
+    void emit(size_t labels);
+
+    std::string name_;
+    std::vector<Instruction> instructions_;
+    uint32_t slots_;
+    std::vector<OsrEntry> osr_;
+    std::unique_ptr<CodeRegion> region_;
+};
+
+void JitFrame::store(uint32_t slot, Value value) {
+    if (auto *number = value.get_if<double>()) {
+        std::memcpy(&numbers[slot], number, sizeof(*number));
+        kinds[slot] = NUMBER;
+    } else if (auto *boolean = value.get_if<bool>()) {
+        numbers[slot] = *boolean ? 1 : 0;
+        kinds[slot] = BOOLEAN;
+    } else if (value.is<nullptr_t>()) {
+        kinds[slot] = NIL;
+    } else {
+        if (!values) {
+            values = std::make_unique<Value[]>(function->slots());
+        }
+        values[slot] = std::move(value);
+        kinds[slot] = BOXED;
+    }
+}
+
+Completion JitFunction::run(Interpreter *interpreter, Environment *closure, const std::vector<Value> &arguments) const {
+    return enter(interpreter, closure, -1, [&](JitFrame &frame) {
+        for (uint32_t i = 0; i < arguments.size(); i++) {
+            frame.store(i, arguments[i]);
+        }
+    });
+}
+
+Completion JitFunction::run_osr(Interpreter *interpreter, Environment *closure, Environment *env, int index) const {
+    return enter(interpreter, closure, index, [&](JitFrame &frame) {
+        const auto &scopes = osr_[index].scopes;
+        for (size_t i = 0; i < scopes.size(); i++) {
+            // the innermost scope is the loop's Environment, the outermost the call's
+            size_t depth = scopes.size() - 1 - i;
+            for (const auto &[name, slot] : scopes[i]) {
+                frame.store(slot, env->get(depth, name));
+            }
+        }
+    });
+}
+
+Completion JitFunction::enter(Interpreter *interpreter, Environment *closure, int osr,
+                              const std::function<void(JitFrame &)> &init) const {
+    // most functions fit in slots on the native stack
+    constexpr uint32_t kStackSlots = 32;
+    uint64_t stack_numbers[kStackSlots];
+    uint8_t stack_kinds[kStackSlots];
+    std::unique_ptr<uint64_t[]> heap_numbers;
+    std::unique_ptr<uint8_t[]> heap_kinds;
+    JitFrame frame{stack_numbers, stack_kinds, this, interpreter, closure, nullptr, {}, nullptr};
+    if (slots_ > kStackSlots) {
+        heap_numbers = std::make_unique<uint64_t[]>(slots_);
+        heap_kinds = std::make_unique<uint8_t[]>(slots_);
+        frame.numbers = heap_numbers.get();
+        frame.kinds = heap_kinds.get();
+    }
+    init(frame);
+
+    auto entry = reinterpret_cast<Entry>(const_cast<void *>(region_->entry()));
+    int status = entry(&frame, frame.numbers, frame.kinds, osr);
+    if (status < 0) {
+        std::rethrow_exception(frame.error);
+    }
+    if (status == 0) {
+        return {};
+    }
+    return std::move(frame.completion);
+}
+
+int JitFunction::slow(JitFrame *frame, uint32_t index) {
+    const Instruction &ins = frame->function->instructions_[index];
+    Interpreter *interpreter = frame->interpreter;
+    try {
+        switch (ins.op) {
+        case Instruction::CONSTANT:
+            frame->store(ins.dst, ins.constant);
+            break;
+        case Instruction::MOVE:
+            frame->store(ins.dst, frame->load(ins.a));
+            break;
+        case Instruction::ARITH:
+        case Instruction::COMPARE:
+            frame->store(ins.dst, interpreter->binary(ins.token, frame->load(ins.a), frame->load(ins.b)));
+            break;
+        case Instruction::NEGATE:
+            frame->store(ins.dst, interpreter->unary(ins.token, frame->load(ins.a)));
+            break;
+        case Instruction::NOT:
+        case Instruction::JUMP_IF_FALSE:
+        case Instruction::JUMP_IF_TRUE:
+            // the emitted code branches on the truthiness returned
+            return frame->load(ins.a) ? 1 : 0;
+        case Instruction::GET_VAR:
+            frame->store(ins.dst, frame->closure->get(ins.token));
+            break;
+        case Instruction::SET_VAR:
+            frame->closure->assign(ins.token, frame->load(ins.a));
+            break;
+        case Instruction::GET_PROP:
+            frame->store(ins.dst, interpreter->property(frame->load(ins.a), ins.token));
+            break;
+        case Instruction::EXPECT_INSTANCE:
+            if (!frame->load(ins.a).is<LoxInstance::ptr>()) {
+                throw RuntimeError(ins.token, "Only instances have fields.");
+            }
+            break;
+        case Instruction::SET_PROP: {
+            Value value = frame->load(ins.b);
+            frame->load(ins.a).as<LoxInstance::ptr>()->set(ins.token, value);
+            frame->store(ins.dst, std::move(value));
+            break;
+        }
+        case Instruction::CALL:
+        case Instruction::TAIL_CALL: {
+            Value callee = frame->load(ins.a);
+            std::vector<Value> arguments;
+            arguments.reserve(ins.argc);
+            for (uint32_t i = 0; i < ins.argc; i++) {
+                arguments.push_back(frame->load(ins.a + 1 + i));
+            }
+            Callable::ptr callable = interpreter->to_callable(callee, ins.call->paren, arguments.size());
+            if (ins.op == Instruction::CALL) {
+                frame->store(ins.dst, interpreter->invoke(ins.call->paren, callable, arguments));
+            } else if (auto function = std::dynamic_pointer_cast<LoxFunction>(callable)) {
+                frame->completion = {Completion::TAIL_CALL, nullptr, std::move(function), std::move(arguments),
+                                     ins.call->paren->line};
+            } else {
+                frame->completion = Completion::returning(interpreter->invoke(ins.call->paren, callable, arguments));
+            }
+            break;
+        }
+        case Instruction::RETURN:
+            frame->completion = Completion::returning(frame->load(ins.a));
+            break;
+        case Instruction::PRINT:
+            *interpreter->output() << frame->load(ins.a).str() << std::endl;
+            break;
+        default:
+            break;
+        }
+        return 0;
+    } catch (...) {
+        // an exception can't unwind through the generated code, it is rethrown once that has returned
+        frame->error = std::current_exception();
+        return -1;
+    }
+}
+
+void JitFunction::emit(size_t labels) {
+    using A = Assembler;
+    A a;
+    std::vector<A::Label> targets;
+    for (size_t i = 0; i < labels; i++) {
+        targets.push_back(a.new_label());
+    }
+    A::Label returned = a.new_label();
+    A::Label error = a.new_label();
+    A::Label exit = a.new_label();
+
+    auto number = [](uint32_t slot) {
+        return A::Mem{A::RBX, static_cast<int32_t>(slot * 8)};
+    };
+    auto kind = [](uint32_t slot) {
+        return A::Mem{A::R13, static_cast<int32_t>(slot)};
+    };
+    // calls slow() for instruction index, leaving its result in eax
+    auto call_slow = [&](uint32_t index) {
+        a.mov(A::RDI, A::R12);
+        a.mov_imm32(A::RSI, index);
+        a.mov_imm64(A::RAX, reinterpret_cast<uint64_t>(&JitFunction::slow));
+        a.call(A::RAX);
+        a.cmp_imm(A::RAX, -1);
+        a.jcc(A::E, error);
+    };
+    // jumps to truthy or falsy, with the Lox notion of truth: nil, false and "" are falsy
+    auto branch = [&](uint32_t slot, uint32_t index, A::Label truthy, A::Label falsy) {
+        A::Label boxed = a.new_label();
+        a.movzx_byte(A::RAX, kind(slot));
+        a.cmp_imm(A::RAX, NUMBER);
+        a.jcc(A::E, truthy);
+        a.cmp_imm(A::RAX, NIL);
+        a.jcc(A::E, falsy);
+        a.cmp_imm(A::RAX, BOOLEAN);
+        a.jcc(A::NE, boxed);
+        a.cmp_qword_imm(number(slot), 0);
+        a.jcc(A::E, falsy);
+        a.jmp(truthy);
+        a.bind(boxed);
+        call_slow(index);
+        a.test(A::RAX, A::RAX);
+        a.jcc(A::E, falsy);
+        a.jmp(truthy);
+    };
+    // jumps to slow unless both slots hold numbers
+    auto guard_numbers = [&](uint32_t left, uint32_t right, A::Label slow) {
+        a.cmp_byte(kind(left), NUMBER);
+        a.jcc(A::NE, slow);
+        a.cmp_byte(kind(right), NUMBER);
+        a.jcc(A::NE, slow);
+    };
+
+    // frame, numbers and kinds arrive in rdi, rsi and rdx and stay in callee-saved registers
+    a.push(A::RBX);
+    a.push(A::R12);
+    a.push(A::R13);
+    a.mov(A::R12, A::RDI);
+    a.mov(A::RBX, A::RSI);
+    a.mov(A::R13, A::RDX);
+    // an osr entry in ecx starts at the top of its loop instead
+    for (size_t i = 0; i < osr_.size(); i++) {
+        a.cmp_imm(A::RCX, static_cast<int8_t>(i));
+        a.jcc(A::E, targets[osr_[i].label]);
+    }
+
+    for (uint32_t i = 0; i < instructions_.size(); i++) {
+        const Instruction &ins = instructions_[i];
+        A::Label slow = a.new_label();
+        A::Label done = a.new_label();
+        switch (ins.op) {
+        case Instruction::NUMBER: {
+            uint64_t bits;
+            std::memcpy(&bits, &ins.number, sizeof(bits));
+            a.mov_imm64(A::RAX, bits);
+            a.mov(number(ins.dst), A::RAX);
+            a.mov_byte(kind(ins.dst), NUMBER);
+            break;
+        }
+        case Instruction::BOOL:
+            a.mov_imm32(A::RAX, ins.a);
+            a.mov(number(ins.dst), A::RAX);
+            a.mov_byte(kind(ins.dst), BOOLEAN);
+            break;
+        case Instruction::NIL:
+            a.mov_byte(kind(ins.dst), NIL);
+            break;
+        case Instruction::MOVE:
+            a.movzx_byte(A::RAX, kind(ins.a));
+            a.test(A::RAX, A::RAX);
+            a.jcc(A::E, slow);
+            a.mov(A::RCX, number(ins.a));
+            a.mov(number(ins.dst), A::RCX);
+            a.mov_byte(kind(ins.dst), A::RAX);
+            a.jmp(done);
+            a.bind(slow);
+            call_slow(i);
+            break;
+        case Instruction::ARITH: {
+            A::SseOp op = ins.token->kind == Token::PLUS    ? A::ADD
+                          : ins.token->kind == Token::MINUS ? A::SUB
+                          : ins.token->kind == Token::STAR  ? A::MUL
+                                                            : A::DIV;
+            guard_numbers(ins.a, ins.b, slow);
+            a.movsd(A::XMM0, number(ins.a));
+            a.sse(op, A::XMM0, number(ins.b));
+            a.movsd(number(ins.dst), A::XMM0);
+            a.mov_byte(kind(ins.dst), NUMBER);
+            a.jmp(done);
+            a.bind(slow);
+            call_slow(i);
+            break;
+        }
+        case Instruction::COMPARE: {
+            guard_numbers(ins.a, ins.b, slow);
+            // ucomisd reports unordered like "below and equal", so NaN compares false except for !=
+            switch (ins.token->kind) {
+            case Token::LESS:
+                a.movsd(A::XMM0, number(ins.b));
+                a.ucomisd(A::XMM0, number(ins.a));
+                a.setcc(A::A, A::RAX);
+                break;
+            case Token::LESS_EQUAL:
+                a.movsd(A::XMM0, number(ins.b));
+                a.ucomisd(A::XMM0, number(ins.a));
+                a.setcc(A::AE, A::RAX);
+                break;
+            case Token::GREATER:
+                a.movsd(A::XMM0, number(ins.a));
+                a.ucomisd(A::XMM0, number(ins.b));
+                a.setcc(A::A, A::RAX);
+                break;
+            case Token::GREATER_EQUAL:
+                a.movsd(A::XMM0, number(ins.a));
+                a.ucomisd(A::XMM0, number(ins.b));
+                a.setcc(A::AE, A::RAX);
+                break;
+            case Token::EQUAL_EQUAL:
+                a.movsd(A::XMM0, number(ins.a));
+                a.ucomisd(A::XMM0, number(ins.b));
+                a.setcc(A::E, A::RAX);
+                a.setcc(A::NP, A::RCX);
+                a.and_byte(A::RAX, A::RCX);
+                break;
+            default:
+                a.movsd(A::XMM0, number(ins.a));
+                a.ucomisd(A::XMM0, number(ins.b));
+                a.setcc(A::NE, A::RAX);
+                a.setcc(A::P, A::RCX);
+                a.or_byte(A::RAX, A::RCX);
+                break;
+            }
+            a.movzx_byte(A::RAX, A::RAX);
+            a.mov(number(ins.dst), A::RAX);
+            a.mov_byte(kind(ins.dst), BOOLEAN);
+            a.jmp(done);
+            a.bind(slow);
+            call_slow(i);
+            break;
+        }
+        case Instruction::NEGATE:
+            a.cmp_byte(kind(ins.a), NUMBER);
+            a.jcc(A::NE, slow);
+            a.mov(A::RAX, number(ins.a));
+            a.btc_sign(A::RAX);
+            a.mov(number(ins.dst), A::RAX);
+            a.mov_byte(kind(ins.dst), NUMBER);
+            a.jmp(done);
+            a.bind(slow);
+            call_slow(i);
+            break;
+        case Instruction::NOT: {
+            A::Label truthy = a.new_label();
+            A::Label falsy = a.new_label();
+            A::Label store = a.new_label();
+            branch(ins.a, i, truthy, falsy);
+            a.bind(truthy);
+            a.xor_(A::RAX, A::RAX);
+            a.jmp(store);
+            a.bind(falsy);
+            a.mov_imm32(A::RAX, 1);
+            a.bind(store);
+            a.mov(number(ins.dst), A::RAX);
+            a.mov_byte(kind(ins.dst), BOOLEAN);
+            break;
+        }
+        case Instruction::TAIL_CALL:
+        case Instruction::RETURN:
+            call_slow(i);
+            a.jmp(returned);
+            break;
+        case Instruction::LABEL:
+            a.bind(targets[ins.target]);
+            break;
+        case Instruction::JUMP:
+            a.jmp(targets[ins.target]);
+            break;
+        case Instruction::JUMP_IF_FALSE:
+            branch(ins.a, i, done, targets[ins.target]);
+            break;
+        case Instruction::JUMP_IF_TRUE:
+            branch(ins.a, i, targets[ins.target], done);
+            break;
+        default:
+            call_slow(i);
+            break;
+        }
+        a.bind(done);
+    }
+
+    // falling off the end returns nothing
+    a.xor_(A::RAX, A::RAX);
+    a.jmp(exit);
+    a.bind(returned);
+    a.mov_imm32(A::RAX, 1);
+    a.jmp(exit);
+    a.bind(error);
+    a.mov_imm32(A::RAX, static_cast<uint32_t>(-1));
+    a.bind(exit);
+    a.pop(A::R13);
+    a.pop(A::R12);
+    a.pop(A::RBX);
+    a.ret();
+
+    region_ = std::make_unique<CodeRegion>(a.finish());
+}
+
+Jit::Tier::Tier(Jit *owner, stmt::Function *declaration) : owner(owner), declaration(declaration) {}
+
+Jit::Tier::~Tier() = default;
+
+Jit::Jit(Interpreter *interpreter) : interpreter_(interpreter) {}
+
+Jit::~Jit() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        queue_.clear();
+    }
+    wake_.notify_all();
+    if (compiler_.joinable()) {
+        compiler_.join();
+    }
+}
+
+std::shared_ptr<Jit::Tier> Jit::tier(stmt::Function *function) {
+    std::shared_ptr<Tier> &tier = tiers_[function];
+    if (!tier) {
+        tier = std::make_shared<Tier>(this, function);
+    }
+    return tier;
+}
+
+const JitFunction *Jit::code(const std::shared_ptr<Tier> &tier) {
+    if (tier->state == Tier::INTERPRETED && ++tier->calls >= kHotCalls) {
+        queue(tier);
+    }
+    if (tier->state == Tier::COMPILING && ready_.load(std::memory_order_acquire)) {
+        collect();
+    }
+    return tier->code.get();
+}
+
+Completion Jit::run(const JitFunction &code, const Environment::ptr &closure, const std::vector<Value> &arguments) {
+    return code.run(interpreter_, closure.get(), arguments);
+}
+
+bool Jit::loop_header(stmt::Statement *loop, LoopRun &run, expr::Expr *condition, stmt::Statement *body,
+                      stmt::Statement *increment, Environment *env, LoxFunction *function, Completion *completion) {
+    Tier *tier = function ? function->tier().get() : nullptr;
+    if (tier != nullptr) {
+        if (tier->state == Tier::INTERPRETED && ++tier->back_edges >= kHotBackEdges) {
+            queue(function->tier());
+        }
+        if (tier->state == Tier::COMPILING && ready_.load(std::memory_order_acquire)) {
+            collect();
+        }
+        int osr = tier->code ? tier->code->osr_entry(loop) : -1;
+        if (osr >= 0) {
+            *completion = tier->code->run_osr(interpreter_, function->closure().get(), env, osr);
+            if (completion->kind == Completion::NORMAL) {
+                // falling off the end of the body returns nil, which the statements around have to see as a return
+                completion->kind = Completion::RETURN;
+            }
+            return true;
+        }
+    }
+
+    if (run.misses < 0 || ++run.back_edges < kHotIterations) {
+        return false;
+    }
+    LoopEntry &entry = loops_[loop];
+    if (run.misses >= kMaxMisses || entry.traces.empty()) {
+        if (entry.failed || entry.traces.size() == kMaxTraces) {
+            run.misses = -1;
+            return false;
+        }
+        auto trace = LoopTrace::record("loop:" + std::to_string(condition->line), condition, body, increment, env);
+        if (!trace) {
+            // whatever path it takes, this iteration can't be traced; the interpreter keeps the loop
+            entry.failed = true;
+            run.misses = -1;
+            return false;
+        }
+        entry.traces.push_back(std::move(trace));
+        run.misses = 0;
+    }
+    // the newest trace is the likeliest to match, the path having changed when it was recorded
+    for (auto trace = entry.traces.rbegin(); trace != entry.traces.rend(); ++trace) {
+        int64_t iterations = (*trace)->run(env);
+        if (iterations < 0) {
+            run.misses = -1;
+            return false;
+        }
+        if (iterations > 0) {
+            if (tier != nullptr) {
+                tier->back_edges += static_cast<int>(std::min<int64_t>(iterations, kHotBackEdges));
+            }
+            run.misses = 0;
+            return false;
+        }
+    }
+    run.misses++;
+    return false;
+}
+
+void Jit::queue(const std::shared_ptr<Tier> &tier) {
+    tier->state = Tier::COMPILING;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(tier);
+        if (!compiler_.joinable()) {
+            compiler_ = std::thread(&Jit::compile_loop, this);
+        }
+    }
+    wake_.notify_one();
+}
+
+void Jit::collect() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &[tier, code] : compiled_) {
+        tier->state = code ? Tier::COMPILED : Tier::FAILED;
+        tier->code = std::move(code);
+    }
+    compiled_.clear();
+    ready_.store(false, std::memory_order_release);
+}
+
+void Jit::compile_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] {
+            return stopping_ || !queue_.empty();
+        });
+        if (stopping_) {
+            return;
+        }
+        std::shared_ptr<Tier> tier = std::move(queue_.front());
+        queue_.pop_front();
+        busy_ = true;
+        lock.unlock();
+
+        // the declaration is only read, and clear() waits for this before its Program can go away
+        stmt::Function *function = tier->declaration;
+        std::unique_ptr<JitFunction> code;
+        try {
+            Compiler compiler(function);
+            if (compiler.compile()) {
+                std::string name = function->name->lexeme + ":" + std::to_string(function->name->line);
+                code = std::make_unique<JitFunction>(std::move(name), std::move(compiler.instructions),
+                                                     compiler.slots, compiler.labels, std::move(compiler.osr));
+            }
+        } catch (const std::exception &) {
+            // out of memory for the code; the function stays interpreted
+        }
+
+        lock.lock();
+        busy_ = false;
+        compiled_.emplace_back(std::move(tier), std::move(code));
+        ready_.store(true, std::memory_order_release);
+        idle_.notify_all();
+    }
+}
+
+void Jit::clear() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        queue_.clear();
+        idle_.wait(lock, [this] {
+            return !busy_;
+        });
+        compiled_.clear();
+        ready_.store(false, std::memory_order_release);
+    }
+    tiers_.clear();
+    loops_.clear();
+}
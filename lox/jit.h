@@ -0,0 +1,133 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "lox/environment.h"
+#include "lox/loop_trace.h"
+#include "lox/return.h"
+#include "lox/statement.h"
+#include "lox/value.h"
+
+class Interpreter;
+class JitFunction;
+class LoxFunction;
+
+/*
+ * The baseline method JIT behind --jit. Code starts out in the tree walker;
+ * a function that has been called kHotCalls times, or whose loops have run
+ * kHotBackEdges iterations, is compiled once, for every closure of its
+ * declaration, to x86-64 code in which parameters, locals and temporaries
+ * live in slots. Number arithmetic and comparisons on slots run inline behind
+ * a type check; everything else, and every check that fails, calls back into
+ * the runtime, which does what the tree walker would have done. A function
+ * using a construct the compiler doesn't handle, a nested function or class,
+ * super, keeps being interpreted.
+ *
+ * Compilation runs on a thread of its own: the interpreter queues the
+ * function and keeps walking its tree until the code is there. A call
+ * started before that finishes in the tree walker, except that its loops
+ * switch over at their next header: on-stack replacement copies the locals
+ * from the Environments into slots and enters the compiled code at the top of
+ * that loop, the rest of the call running compiled.
+ *
+ * Compiled code runs without Environments, so it reads and writes its own
+ * locals only through slots and reaches everything else through the
+ * closure, by name, like the tree walker. It doesn't feed --hotspots.
+ *
+ * Loops the interpreter runs, at top level or in functions not compiled
+ * yet, are traced instead: after kHotIterations back edges in one run of a
+ * loop its next iteration is recorded into a LoopTrace, which runs from the
+ * loop header on until a guard fails. A loop whose traces keep failing in
+ * their first iteration has taken another path; that path gets a trace of
+ * its own, up to kMaxTraces per loop.
+ */
+class Jit {
+ public:
+    static constexpr int kHotCalls = 1000;
+    static constexpr int kHotBackEdges = 10000;
+    static constexpr int kHotIterations = 64;
+    // entries in a row that left every trace of a loop in its first iteration before another path is recorded
+    static constexpr int kMaxMisses = 8;
+    static constexpr size_t kMaxTraces = 4;
+
+    // what the JIT knows about a function declaration, shared by all its closures; only the interpreter's thread
+    // touches it
+    struct Tier {
+        enum State { INTERPRETED, COMPILING, COMPILED, FAILED };
+
+        Tier(Jit *owner, stmt::Function *declaration);
+        ~Tier();
+
+        Jit *owner;
+        stmt::Function *declaration;
+        int calls{0};
+        int back_edges{0};
+        State state{INTERPRETED};
+        std::unique_ptr<JitFunction> code;
+    };
+
+    // one run of a loop, from the first time its condition is evaluated to leaving it
+    struct LoopRun {
+        int back_edges{0};
+        // entries in a row that didn't get through an iteration, -1 once the run has given up on traces
+        int misses{0};
+    };
+
+    explicit Jit(Interpreter *interpreter);
+    ~Jit();
+
+    std::shared_ptr<Tier> tier(stmt::Function *function);
+
+    // counts a call and returns the compiled code once it is ready, nullptr before that or if it can't be
+    const JitFunction *code(const std::shared_ptr<Tier> &tier);
+
+    Completion run(const JitFunction &code, const Environment::ptr &closure, const std::vector<Value> &arguments);
+
+    // at the header of loop, before its condition, in the body of function, nullptr at top level: runs the rest of
+    // the function compiled if it can and returns true with its completion, otherwise runs the loop's trace for as
+    // long as that holds once the loop is hot
+    bool loop_header(stmt::Statement *loop, LoopRun &run, expr::Expr *condition, stmt::Statement *body,
+                     stmt::Statement *increment, Environment *env, LoxFunction *function, Completion *completion);
+
+    // forgets all compiled code, the declarations it was compiled from are about to go away
+    void clear();
+
+ private:
+    struct LoopEntry {
+        bool failed{false};
+        std::vector<std::unique_ptr<LoopTrace>> traces;
+    };
+
+    // hands tier's declaration to the compiler thread
+    void queue(const std::shared_ptr<Tier> &tier);
+    // hands code the compiler thread finished to its tiers
+    void collect();
+    void compile_loop();
+
+    Interpreter *interpreter_;
+    std::unordered_map<stmt::Function *, std::shared_ptr<Tier>> tiers_;
+    std::unordered_map<stmt::Statement *, LoopEntry> loops_;
+
+    // the compiler thread, started by the first function to get hot
+    std::thread compiler_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<std::shared_ptr<Tier>> queue_;
+    std::vector<std::pair<std::shared_ptr<Tier>, std::unique_ptr<JitFunction>>> compiled_;
+    std::atomic<bool> ready_{false};
+    bool busy_{false};
+    bool stopping_{false};
+};
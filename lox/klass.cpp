@@ -6,6 +6,9 @@
 
 #include "lox/exception.h"
 #include "lox/instance.h"
+#include "lox/interpreter.h"
+#include "lox/profiler.h"
+#include "lox/tracer.h"
 #include <utility>
 
 std::ostream &operator<<(std::ostream &os, const LoxClass &k) {
@@ -14,8 +17,11 @@ std::ostream &operator<<(std::ostream &os, const LoxClass &k) {
 }
 
 Value LoxClass::call(Interpreter *interpreter, const std::vector<Value> &arguments) {
-    auto instance = std::make_shared<LoxInstance>(*this);
     auto initializer = find_method("init");
+    int line = initializer ? initializer->declaration()->name->line : 0;
+    ShadowFrame frame(frame_name_, interpreter->call_stack().line());
+    Tracer::Scope trace(frame_name_, "class", line);
+    auto instance = std::make_shared<LoxInstance>(shared_from_this());
     if (initializer) {
         initializer->is_initializer = true;
         initializer->bind(instance)->call(interpreter, arguments);
@@ -13,15 +13,17 @@
 
 #include "lox/callable.h"
 #include "lox/function.h"
+#include "lox/profiler.h"
 #include "lox/token.h"
 
-class LoxClass : public Callable {
+class LoxClass : public Callable, public std::enable_shared_from_this<LoxClass> {
  public:
     using ptr = std::shared_ptr<LoxClass>;
 
     explicit LoxClass(
         std::string name, ptr super, std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods)
-        : name_(std::move(name)), super_(std::move(super)), methods_(std::move(methods)) {}
+        : name_(std::move(name)), super_(std::move(super)), methods_(std::move(methods)),
+          frame_name_(ShadowStack::intern(name_)) {}
 
     Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override;
 
@@ -37,8 +39,17 @@ class LoxClass : public Callable {
 
     std::shared_ptr<LoxFunction> find_method(const std::string &name) const;
 
+    const ptr &superclass() const {
+        return super_;
+    }
+
+    const std::unordered_map<std::string, LoxFunction::ptr> &methods() const {
+        return methods_;
+    }
+
  private:
     std::string name_;
     ptr super_;
     std::unordered_map<std::string, LoxFunction::ptr> methods_;
+    const char *frame_name_;
 };
@@ -13,7 +13,7 @@
 Lexer::Lexer(std::string source) : source_(std::move(source)) {}
 
 bool Lexer::is_at_end() {
-    return current_ >= source_.size();
+    return current_ >= static_cast<int>(source_.size());
 }
 
 std::vector<Token::ptr> Lexer::scan() {
@@ -173,7 +173,7 @@ void Lexer::number() {
     add_token(Token::NUMBER, source_.substr(start_, current_ - start_));
 }
 
-static std::unordered_map<std::string, Token::Kind> keywords = {
+static const std::unordered_map<std::string, Token::Kind> keywords = {
     {"and", Token::AND},
     {"class", Token::CLASS},
     {"else", Token::ELSE},
@@ -200,8 +200,9 @@ void Lexer::identifier() {
         ch = lookahead(0);
     }
     std::string text = source_.substr(start_, current_ - start_);
-    if (keywords.count(text) != 0) {
-        add_token(keywords[text], text);
+    auto keyword = keywords.find(text);
+    if (keyword != keywords.end()) {
+        add_token(keyword->second, text);
     } else {
         add_token(Token::IDENTIFIER, text);
     }
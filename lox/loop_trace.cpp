@@ -0,0 +1,659 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/loop_trace.h"
+
+#include <cstring>
+#include <map>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include "lox/assembler.h"
+
+namespace {
+
+/*
+ * One op of a trace, in SSA form: it defines value number its index. The
+ * operands a and b are value numbers, bits holds a constant's bits or the
+ * slot a LOAD or STORE works on.
+ */
+struct TraceOp {
+    enum Op {
+        CONST,       // bits
+        LOAD,        // slot bits as it was at the loop header
+        ADD,         // a + b, and so on for numbers
+        SUB,
+        MUL,
+        DIV,
+        NEG,         // -a
+        LT,          // a < b, and so on for numbers
+        LE,
+        GT,
+        GE,
+        EQ,
+        NE,
+        BOOL_EQ,     // a == b for booleans
+        BOOL_NE,
+        NOT,         // !a for a boolean
+        GUARD_TRUE,  // leave the trace unless a is true
+        GUARD_FALSE, // leave the trace unless a is false
+        STORE,       // slot bits = a, once the iteration is complete
+    };
+
+    Op op;
+    LoopTrace::Type type{LoopTrace::NUMBER};
+    uint32_t a{0};
+    uint32_t b{0};
+    uint64_t bits{0};
+    // hoisted in front of the loop
+    bool invariant{false};
+    bool live{false};
+};
+
+bool pure(TraceOp::Op op) {
+    return op != TraceOp::GUARD_TRUE && op != TraceOp::GUARD_FALSE && op != TraceOp::STORE;
+}
+
+uint64_t number_bits(double number) {
+    uint64_t bits;
+    std::memcpy(&bits, &number, sizeof(bits));
+    return bits;
+}
+
+double bits_number(uint64_t bits) {
+    double number;
+    std::memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+// what op computes from operands with these bits, as the native code does
+uint64_t compute(TraceOp::Op op, uint64_t a, uint64_t b) {
+    double x = bits_number(a);
+    double y = bits_number(b);
+    switch (op) {
+    case TraceOp::ADD:
+        return number_bits(x + y);
+    case TraceOp::SUB:
+        return number_bits(x - y);
+    case TraceOp::MUL:
+        return number_bits(x * y);
+    case TraceOp::DIV:
+        return number_bits(x / y);
+    case TraceOp::NEG:
+        return number_bits(-x);
+    case TraceOp::LT:
+        return x < y;
+    case TraceOp::LE:
+        return x <= y;
+    case TraceOp::GT:
+        return x > y;
+    case TraceOp::GE:
+        return x >= y;
+    case TraceOp::EQ:
+        return x == y;
+    case TraceOp::NE:
+        return x != y;
+    case TraceOp::BOOL_EQ:
+        return a == b;
+    case TraceOp::BOOL_NE:
+        return a != b;
+    case TraceOp::NOT:
+        return a == 0;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Walks one iteration of a loop the way the interpreter would, computing
+ * every value on the side and emitting the ops that compute it. Variables
+ * declared in the iteration are SSA values; the others become slots, loaded
+ * on first read and stored at the end if assigned.
+ */
+class Recorder {
+ public:
+    explicit Recorder(Environment *env) : env_(env) {}
+
+    // false when the iteration leaves what a trace can run
+    bool iteration(expr::Expr *condition, stmt::Statement *body, stmt::Statement *increment) {
+        uint32_t test;
+        if (!expression(condition, &test) || !truthy(test)) {
+            return false;
+        }
+        if (!statement(body) || (increment && !statement(increment))) {
+            return false;
+        }
+        for (uint32_t slot = 0; slot < slots.size(); slot++) {
+            if (!slots[slot].stored) {
+                continue;
+            }
+            // the next iteration has to find the type this one started with
+            LoopTrace::Type type = ops[current_[slot]].type;
+            if (slots[slot].loaded && slots[slot].type != type) {
+                return false;
+            }
+            slots[slot].type = type;
+            TraceOp store{TraceOp::STORE, type, static_cast<uint32_t>(current_[slot])};
+            store.bits = slot;
+            ops.push_back(store);
+        }
+        return true;
+    }
+
+    std::vector<TraceOp> ops;
+    std::vector<LoopTrace::Slot> slots;
+
+ private:
+    uint32_t emit(TraceOp op) {
+        if (op.op == TraceOp::CONST || pure(op.op)) {
+            bool constant = op.op != TraceOp::LOAD && op.op != TraceOp::CONST && ops[op.a].op == TraceOp::CONST &&
+                            (op.op == TraceOp::NEG || op.op == TraceOp::NOT || ops[op.b].op == TraceOp::CONST);
+            if (constant) {
+                op.bits = compute(op.op, concrete_[op.a], concrete_[op.b]);
+                op.op = TraceOp::CONST;
+                op.a = op.b = 0;
+            }
+            auto key = std::make_tuple(op.op, op.a, op.b, op.bits);
+            auto it = cse_.find(key);
+            if (it != cse_.end()) {
+                return it->second;
+            }
+            cse_[key] = ops.size();
+        }
+        uint64_t value = 0;
+        if (op.op == TraceOp::CONST) {
+            value = op.bits;
+        } else if (op.op == TraceOp::LOAD) {
+            value = loaded_[op.bits];
+        } else if (pure(op.op)) {
+            value = compute(op.op, concrete_[op.a], concrete_[op.b]);
+        }
+        ops.push_back(op);
+        concrete_.push_back(value);
+        return ops.size() - 1;
+    }
+
+    uint32_t constant(LoopTrace::Type type, uint64_t bits) {
+        TraceOp op{TraceOp::CONST, type};
+        op.bits = bits;
+        return emit(op);
+    }
+
+    uint32_t op(TraceOp::Op code, LoopTrace::Type type, uint32_t a, uint32_t b = 0) {
+        return emit(TraceOp{code, type, a, b});
+    }
+
+    // the Lox truth of value, guarded so the trace only runs while it stays the same
+    bool truthy(uint32_t value) {
+        if (ops[value].type == LoopTrace::NUMBER) {
+            return true;
+        }
+        bool truth = concrete_[value] != 0;
+        guard(value, truth);
+        return truth;
+    }
+
+    void guard(uint32_t value, bool expected) {
+        // guards on a negation test what was negated; ones that always pass or repeat are dropped
+        while (ops[value].op == TraceOp::NOT) {
+            value = ops[value].a;
+            expected = !expected;
+        }
+        if (ops[value].op == TraceOp::CONST || !guarded_.insert({value, expected}).second) {
+            return;
+        }
+        ops.push_back(TraceOp{expected ? TraceOp::GUARD_TRUE : TraceOp::GUARD_FALSE, LoopTrace::BOOL, value});
+        concrete_.push_back(0);
+    }
+
+    // the slot for a variable declared outside the iteration, -1 if it isn't defined
+    int slot(const std::string &name) {
+        auto it = slot_index_.find(name);
+        if (it != slot_index_.end()) {
+            return it->second;
+        }
+        Value *cell = env_->lookup(name);
+        if (cell == nullptr) {
+            return -1;
+        }
+        LoopTrace::Slot slot{name, LoopTrace::NUMBER};
+        uint64_t bits = 0;
+        if (auto number = cell->get_if<double>()) {
+            bits = number_bits(*number);
+        } else if (auto boolean = cell->get_if<bool>()) {
+            slot.type = LoopTrace::BOOL;
+            bits = *boolean;
+        } else {
+            slot.type = LoopTrace::OTHER;
+        }
+        slots.push_back(slot);
+        loaded_.push_back(bits);
+        current_.push_back(-1);
+        slot_index_[name] = slots.size() - 1;
+        return slots.size() - 1;
+    }
+
+    bool read(const std::string &name, uint32_t *out) {
+        for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+            auto it = scope->find(name);
+            if (it != scope->end()) {
+                *out = it->second;
+                return true;
+            }
+        }
+        int index = slot(name);
+        if (index < 0) {
+            return false;
+        }
+        if (current_[index] < 0) {
+            if (slots[index].type == LoopTrace::OTHER) {
+                return false;
+            }
+            slots[index].loaded = true;
+            TraceOp load{TraceOp::LOAD, slots[index].type};
+            load.bits = index;
+            current_[index] = emit(load);
+        }
+        *out = current_[index];
+        return true;
+    }
+
+    bool write(const std::string &name, uint32_t value) {
+        for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+            auto it = scope->find(name);
+            if (it != scope->end()) {
+                it->second = value;
+                return true;
+            }
+        }
+        int index = slot(name);
+        if (index < 0) {
+            return false;
+        }
+        slots[index].stored = true;
+        current_[index] = value;
+        return true;
+    }
+
+    bool statement(stmt::Statement *stmt) {
+        if (auto *expression_stmt = dynamic_cast<stmt::Expression *>(stmt)) {
+            uint32_t ignored;
+            return expression(expression_stmt->expression.get(), &ignored);
+        }
+        if (auto *var = dynamic_cast<stmt::Var *>(stmt)) {
+            // a var outside any block would land in the loop's own Environment; nil has no slot type
+            uint32_t value;
+            if (scopes_.empty() || !var->value || !expression(var->value.get(), &value)) {
+                return false;
+            }
+            scopes_.back()[var->name->lexeme] = value;
+            return true;
+        }
+        if (auto *block = dynamic_cast<stmt::Block *>(stmt)) {
+            scopes_.emplace_back();
+            for (const auto &statement : block->statements) {
+                if (!this->statement(statement.get())) {
+                    return false;
+                }
+            }
+            scopes_.pop_back();
+            return true;
+        }
+        if (auto *if_stmt = dynamic_cast<stmt::If *>(stmt)) {
+            uint32_t condition;
+            if (!expression(if_stmt->condition.get(), &condition)) {
+                return false;
+            }
+            stmt::Statement *branch = truthy(condition) ? if_stmt->then_branch.get() : if_stmt->else_branch.get();
+            return branch == nullptr || statement(branch);
+        }
+        return false;
+    }
+
+    bool expression(expr::Expr *expr, uint32_t *out) {
+        if (auto *literal = dynamic_cast<expr::Literal *>(expr)) {
+            if (auto number = literal->value.get_if<double>()) {
+                *out = constant(LoopTrace::NUMBER, number_bits(*number));
+                return true;
+            }
+            if (auto boolean = literal->value.get_if<bool>()) {
+                *out = constant(LoopTrace::BOOL, *boolean);
+                return true;
+            }
+            return false;
+        }
+        if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            return expression(grouping->expression.get(), out);
+        }
+        if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            return read(variable->name->lexeme, out);
+        }
+        if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            return expression(assign->value.get(), out) && write(assign->name->lexeme, *out);
+        }
+        if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            uint32_t right;
+            if (!expression(unary->right.get(), &right)) {
+                return false;
+            }
+            LoopTrace::Type type = ops[right].type;
+            if (unary->op->kind == Token::MINUS) {
+                if (type != LoopTrace::NUMBER) {
+                    return false;
+                }
+                *out = op(TraceOp::NEG, LoopTrace::NUMBER, right);
+                return true;
+            }
+            // a number is always truthy
+            *out = type == LoopTrace::NUMBER ? constant(LoopTrace::BOOL, 0) : op(TraceOp::NOT, LoopTrace::BOOL, right);
+            return true;
+        }
+        if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            uint32_t left;
+            uint32_t right;
+            if (!expression(binary->left.get(), &left) || !expression(binary->right.get(), &right)) {
+                return false;
+            }
+            return this->binary(binary->op->kind, left, right, out);
+        }
+        if (auto *logical = dynamic_cast<expr::Logical *>(expr)) {
+            uint32_t left;
+            if (!expression(logical->left.get(), &left)) {
+                return false;
+            }
+            // or yields a truthy left operand, and yields a falsy one, each without looking right
+            if (truthy(left) == (logical->op->kind == Token::OR)) {
+                *out = left;
+                return true;
+            }
+            return expression(logical->right.get(), out);
+        }
+        return false;
+    }
+
+    bool binary(Token::Kind kind, uint32_t left, uint32_t right, uint32_t *out) {
+        LoopTrace::Type l = ops[left].type;
+        LoopTrace::Type r = ops[right].type;
+        if (kind == Token::EQUAL_EQUAL || kind == Token::BANG_EQUAL) {
+            bool equal = kind == Token::EQUAL_EQUAL;
+            if (l != r) {
+                *out = constant(LoopTrace::BOOL, !equal);
+            } else if (l == LoopTrace::NUMBER) {
+                *out = op(equal ? TraceOp::EQ : TraceOp::NE, LoopTrace::BOOL, left, right);
+            } else {
+                *out = op(equal ? TraceOp::BOOL_EQ : TraceOp::BOOL_NE, LoopTrace::BOOL, left, right);
+            }
+            return true;
+        }
+        if (l != LoopTrace::NUMBER || r != LoopTrace::NUMBER) {
+            return false;
+        }
+        static const std::unordered_map<Token::Kind, std::pair<TraceOp::Op, LoopTrace::Type>> ops_by_kind{
+            {Token::PLUS, {TraceOp::ADD, LoopTrace::NUMBER}},   {Token::MINUS, {TraceOp::SUB, LoopTrace::NUMBER}},
+            {Token::STAR, {TraceOp::MUL, LoopTrace::NUMBER}},   {Token::SLASH, {TraceOp::DIV, LoopTrace::NUMBER}},
+            {Token::LESS, {TraceOp::LT, LoopTrace::BOOL}},      {Token::LESS_EQUAL, {TraceOp::LE, LoopTrace::BOOL}},
+            {Token::GREATER, {TraceOp::GT, LoopTrace::BOOL}}, {Token::GREATER_EQUAL, {TraceOp::GE, LoopTrace::BOOL}},
+        };
+        auto it = ops_by_kind.find(kind);
+        if (it == ops_by_kind.end()) {
+            return false;
+        }
+        *out = op(it->second.first, it->second.second, left, right);
+        return true;
+    }
+
+    Environment *env_;
+    // the value each op computed while recording
+    std::vector<uint64_t> concrete_;
+    std::map<std::tuple<TraceOp::Op, uint32_t, uint32_t, uint64_t>, uint32_t> cse_;
+    std::set<std::pair<uint32_t, bool>> guarded_;
+    std::vector<std::unordered_map<std::string, uint32_t>> scopes_;
+    std::unordered_map<std::string, uint32_t> slot_index_;
+    // per slot: its bits at the header and the value it holds at this point of the iteration, -1 before first use
+    std::vector<uint64_t> loaded_;
+    std::vector<int64_t> current_;
+};
+
+uint32_t operands(const TraceOp &op) {
+    switch (op.op) {
+    case TraceOp::CONST:
+    case TraceOp::LOAD:
+        return 0;
+    case TraceOp::NEG:
+    case TraceOp::NOT:
+    case TraceOp::GUARD_TRUE:
+    case TraceOp::GUARD_FALSE:
+    case TraceOp::STORE:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+// marks what can move in front of the loop and what anything observable depends on
+void optimize(std::vector<TraceOp> &ops, const std::vector<LoopTrace::Slot> &slots) {
+    for (auto &op : ops) {
+        if (op.op == TraceOp::STORE) {
+            continue;
+        }
+        // a slot nothing stores into holds the same value in every iteration
+        op.invariant = op.op == TraceOp::LOAD ? !slots[op.bits].stored : true;
+        if (operands(op) > 0) {
+            op.invariant = op.invariant && ops[op.a].invariant;
+        }
+        if (operands(op) > 1) {
+            op.invariant = op.invariant && ops[op.b].invariant;
+        }
+    }
+    for (size_t i = ops.size(); i-- > 0;) {
+        TraceOp &op = ops[i];
+        if (!pure(op.op)) {
+            op.live = true;
+        }
+        if (!op.live) {
+            continue;
+        }
+        if (operands(op) > 0) {
+            ops[op.a].live = true;
+        }
+        if (operands(op) > 1) {
+            ops[op.b].live = true;
+        }
+    }
+}
+
+/*
+ * Emits the loop for void(uint64_t *slots, uint64_t *values), returning the
+ * number of iterations it completed. Slots stay at rdi, values at rsi, one
+ * word per op, and the iteration count in rdx.
+ */
+std::vector<uint8_t> emit(const std::vector<TraceOp> &ops) {
+    using A = Assembler;
+    A a;
+    A::Label loop = a.new_label();
+    A::Label exit = a.new_label();
+
+    auto value = [](uint32_t index) {
+        return A::Mem{A::RSI, static_cast<int32_t>(index * 8)};
+    };
+    auto slot = [](uint64_t index) {
+        return A::Mem{A::RDI, static_cast<int32_t>(index * 8)};
+    };
+    auto emit_op = [&](uint32_t i) {
+        const TraceOp &op = ops[i];
+        switch (op.op) {
+        case TraceOp::CONST:
+            a.mov_imm64(A::RAX, op.bits);
+            a.mov(value(i), A::RAX);
+            break;
+        case TraceOp::LOAD:
+            a.mov(A::RAX, slot(op.bits));
+            a.mov(value(i), A::RAX);
+            break;
+        case TraceOp::ADD:
+        case TraceOp::SUB:
+        case TraceOp::MUL:
+        case TraceOp::DIV:
+            a.movsd(A::XMM0, value(op.a));
+            a.sse(op.op == TraceOp::ADD   ? A::ADD
+                  : op.op == TraceOp::SUB ? A::SUB
+                  : op.op == TraceOp::MUL ? A::MUL
+                                          : A::DIV,
+                  A::XMM0, value(op.b));
+            a.movsd(value(i), A::XMM0);
+            break;
+        case TraceOp::NEG:
+            a.mov(A::RAX, value(op.a));
+            a.btc_sign(A::RAX);
+            a.mov(value(i), A::RAX);
+            break;
+        case TraceOp::LT:
+        case TraceOp::LE:
+        case TraceOp::GT:
+        case TraceOp::GE: {
+            // ucomisd reports unordered like "below and equal", so NaN compares false
+            bool swap = op.op == TraceOp::LT || op.op == TraceOp::LE;
+            a.movsd(A::XMM0, value(swap ? op.b : op.a));
+            a.ucomisd(A::XMM0, value(swap ? op.a : op.b));
+            a.setcc(op.op == TraceOp::LT || op.op == TraceOp::GT ? A::A : A::AE, A::RAX);
+            a.movzx_byte(A::RAX, A::RAX);
+            a.mov(value(i), A::RAX);
+            break;
+        }
+        case TraceOp::EQ:
+        case TraceOp::NE:
+            a.movsd(A::XMM0, value(op.a));
+            a.ucomisd(A::XMM0, value(op.b));
+            if (op.op == TraceOp::EQ) {
+                a.setcc(A::E, A::RAX);
+                a.setcc(A::NP, A::RCX);
+                a.and_byte(A::RAX, A::RCX);
+            } else {
+                a.setcc(A::NE, A::RAX);
+                a.setcc(A::P, A::RCX);
+                a.or_byte(A::RAX, A::RCX);
+            }
+            a.movzx_byte(A::RAX, A::RAX);
+            a.mov(value(i), A::RAX);
+            break;
+        case TraceOp::BOOL_EQ:
+        case TraceOp::BOOL_NE:
+            a.mov(A::RAX, value(op.a));
+            a.cmp(A::RAX, value(op.b));
+            a.setcc(op.op == TraceOp::BOOL_EQ ? A::E : A::NE, A::RAX);
+            a.movzx_byte(A::RAX, A::RAX);
+            a.mov(value(i), A::RAX);
+            break;
+        case TraceOp::NOT:
+            a.cmp_qword_imm(value(op.a), 0);
+            a.setcc(A::E, A::RAX);
+            a.movzx_byte(A::RAX, A::RAX);
+            a.mov(value(i), A::RAX);
+            break;
+        case TraceOp::GUARD_TRUE:
+        case TraceOp::GUARD_FALSE:
+            a.cmp_qword_imm(value(op.a), 0);
+            a.jcc(op.op == TraceOp::GUARD_TRUE ? A::E : A::NE, exit);
+            break;
+        case TraceOp::STORE:
+            a.mov(A::RAX, value(op.a));
+            a.mov(slot(op.bits), A::RAX);
+            break;
+        }
+    };
+
+    a.xor_(A::RDX, A::RDX);
+    for (uint32_t i = 0; i < ops.size(); i++) {
+        if (ops[i].live && ops[i].invariant) {
+            emit_op(i);
+        }
+    }
+    a.bind(loop);
+    for (uint32_t i = 0; i < ops.size(); i++) {
+        if (ops[i].live && !ops[i].invariant) {
+            emit_op(i);
+        }
+    }
+    a.add_imm(A::RDX, 1);
+    a.jmp(loop);
+    a.bind(exit);
+    a.mov(A::RAX, A::RDX);
+    a.ret();
+    return a.finish();
+}
+
+} // namespace
+
+LoopTrace::LoopTrace(std::string name, std::vector<Slot> slots, size_t values, std::unique_ptr<CodeRegion> region)
+    : name_(std::move(name)), slots_(std::move(slots)), values_(values), region_(std::move(region)) {
+    write_perf_map(region_->entry(), region_->size(), "lox:" + name_);
+}
+
+LoopTrace::~LoopTrace() = default;
+
+std::unique_ptr<LoopTrace> LoopTrace::record(const std::string &name, expr::Expr *condition, stmt::Statement *body,
+                                             stmt::Statement *increment, Environment *env) {
+    Recorder recorder(env);
+    if (!recorder.iteration(condition, body, increment)) {
+        return nullptr;
+    }
+    optimize(recorder.ops, recorder.slots);
+    // with no guard left inside the loop the native code could only leave it before the first iteration
+    bool exits = false;
+    for (const auto &op : recorder.ops) {
+        exits = exits || (!pure(op.op) && op.op != TraceOp::STORE && !op.invariant);
+    }
+    if (!exits) {
+        return nullptr;
+    }
+    auto region = std::make_unique<CodeRegion>(emit(recorder.ops));
+    return std::make_unique<LoopTrace>(name, std::move(recorder.slots), recorder.ops.size(), std::move(region));
+}
+
+int64_t LoopTrace::run(Environment *env) const {
+    std::vector<Value *> cells(slots_.size());
+    std::vector<uint64_t> slots(slots_.size());
+    std::vector<uint64_t> values(values_);
+    for (size_t i = 0; i < slots_.size(); i++) {
+        cells[i] = env->lookup(slots_[i].name);
+        if (cells[i] == nullptr) {
+            return -1;
+        }
+        if (!slots_[i].loaded) {
+            continue;
+        }
+        if (slots_[i].type == NUMBER) {
+            auto number = cells[i]->get_if<double>();
+            if (!number) {
+                return -1;
+            }
+            slots[i] = number_bits(*number);
+        } else {
+            auto boolean = cells[i]->get_if<bool>();
+            if (!boolean) {
+                return -1;
+            }
+            slots[i] = *boolean;
+        }
+    }
+    auto entry = reinterpret_cast<uint64_t (*)(uint64_t *, uint64_t *)>(const_cast<void *>(region_->entry()));
+    auto iterations = static_cast<int64_t>(entry(slots.data(), values.data()));
+    if (iterations == 0) {
+        // nothing was stored, and a slot only ever assigned may not hold its type yet
+        return 0;
+    }
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (!slots_[i].stored) {
+            continue;
+        }
+        if (slots_[i].type == NUMBER) {
+            *cells[i] = bits_number(slots[i]);
+        } else {
+            *cells[i] = slots[i] != 0;
+        }
+    }
+    return iterations;
+}
@@ -0,0 +1,67 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lox/environment.h"
+#include "lox/expr.h"
+#include "lox/statement.h"
+
+class CodeRegion;
+
+/*
+ * A hot loop compiled from one recorded iteration. Recording walks the
+ * condition, the body and the increment of the next iteration with the
+ * values the variables hold right then, without changing any of them, and
+ * writes a linear IR: loads of the variables declared outside the loop body,
+ * typed number and boolean ops, a guard for every branch the iteration took
+ * and stores of the variables it assigned. Constant folding, common
+ * subexpression and guard elimination run while recording; loop-invariant
+ * ops and guards are then hoisted in front of the loop and dead ops dropped.
+ *
+ * The native loop keeps the variables in a slot array and only stores into
+ * it once a whole iteration succeeded, so every side exit, a failing guard
+ * or the loop condition turning false, leaves the variables as they were at
+ * the loop header. The slots are written back to their Environments and the
+ * interpreter carries on from the header, running the iteration itself.
+ *
+ * Only loops that stay within numbers and booleans, variables, if, blocks
+ * and var declarations are traced; a call, print, property, string, nested
+ * loop or break on the recorded path keeps the loop interpreted.
+ */
+class LoopTrace {
+ public:
+    // OTHER only for a variable the trace assigns before it reads it
+    enum Type : uint8_t { NUMBER, BOOL, OTHER };
+
+    struct Slot {
+        std::string name;
+        Type type;
+        // the trace reads the variable and relies on its type on entry
+        bool loaded{false};
+        bool stored{false};
+    };
+
+    LoopTrace(std::string name, std::vector<Slot> slots, size_t values, std::unique_ptr<CodeRegion> region);
+    ~LoopTrace();
+
+    // records the iteration about to start in env and compiles it, nullptr if the loop can't be traced
+    static std::unique_ptr<LoopTrace> record(const std::string &name, expr::Expr *condition, stmt::Statement *body,
+                                             stmt::Statement *increment, Environment *env);
+
+    // runs the loop natively from its header and returns the iterations it completed, -1 when env doesn't hold the
+    // types the trace was recorded with
+    int64_t run(Environment *env) const;
+
+ private:
+    std::string name_;
+    std::vector<Slot> slots_;
+    size_t values_;
+    std::unique_ptr<CodeRegion> region_;
+};
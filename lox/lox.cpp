@@ -7,13 +7,63 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
+#include <thread>
 #include <utility>
 #include <vector>
 
-#include "lox/lexer.h"
-#include "lox/parser.h"
-#include "lox/resolver.h"
+#include "lox/alloc_profiler.h"
+#include "lox/cpp_emitter.h"
+#include "lox/exception.h"
+#include "lox/profiler.h"
+#include "lox/program_cache.h"
+#include "lox/snapshot.h"
 #include "lox/token.h"
+#include "lox/tracer.h"
+
+Lox::Lox(Options options) : options_(std::move(options)) {
+    interpreter_.configure(options_);
+    if (!options_.profile_path.empty()) {
+        SamplingProfiler::start(options_.profile_hz, options_.profile_wall_clock);
+    }
+    if (options_.hotspots || !options_.hotspots_json_path.empty()) {
+        hotspots_ = std::make_shared<Hotspots>();
+        interpreter_.enable_hotspots(hotspots_);
+    }
+    if (options_.alloc_profile) {
+        AllocProfiler::enable();
+    }
+    if (!options_.trace_path.empty()) {
+        Tracer::enable(options_.trace_min_us, options_.trace_buffer);
+    }
+}
+
+Lox::~Lox() {
+    if (!options_.profile_path.empty()) {
+        SamplingProfiler::stop();
+        SamplingProfiler::collect();
+        if (!SamplingProfiler::write(options_.profile_path)) {
+            std::cerr << "can't write profile to '" << options_.profile_path << "'" << std::endl;
+        }
+    }
+    if (options_.hotspots) {
+        hotspots_->report(std::cerr, options_.hotspots_top);
+    }
+    if (options_.alloc_profile) {
+        AllocProfiler::report(std::cerr, options_.alloc_profile_top);
+    }
+    if (!options_.trace_path.empty() && !Tracer::write(options_.trace_path)) {
+        std::cerr << "can't write trace to '" << options_.trace_path << "'" << std::endl;
+    }
+    if (!options_.hotspots_json_path.empty()) {
+        std::ofstream out(options_.hotspots_json_path);
+        if (out.is_open()) {
+            hotspots_->report_json(out, options_.hotspots_top);
+        } else {
+            std::cerr << "can't write hotspots to '" << options_.hotspots_json_path << "'" << std::endl;
+        }
+    }
+}
 
 void Lox::execute_script(const std::string &filepath) {
     std::ifstream file(filepath.c_str(), std::ios::binary);
@@ -22,32 +72,209 @@ void Lox::execute_script(const std::string &filepath) {
         return;
     }
     std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    execute(content);
+    if (options_.isolates > 1) {
+        execute_isolates(content);
+        return;
+    }
+
+    Error error;
+    if (!options_.snapshot_in.empty() && !load_snapshot(options_.snapshot_in, &error)) {
+        report(error);
+        return;
+    }
+    if (execute(content) && !options_.snapshot_out.empty() && !save_snapshot(options_.snapshot_out, &error)) {
+        report(error);
+    }
+}
+
+bool Lox::emit_cpp(const std::string &filepath, std::ostream &out) {
+    std::ifstream file(filepath.c_str(), std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "can't open file '" << filepath << "': No such file or directory" << std::endl;
+        return false;
+    }
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    Error error;
+    Program::ptr program = compile_cached(content, &error);
+    if (program) {
+        try {
+            out << CppEmitter::emit(*program, filepath);
+            return true;
+        } catch (const RuntimeError &e) {
+            error = {e.what(), e.token->line, {}};
+        }
+    }
+    report(error);
+    return false;
 }
 
-void Lox::execute(const std::string &script) {
-    Lexer lexer(script);
-    std::vector<Token::ptr> tokens;
+bool Lox::execute(const std::string &script) {
+    Error error;
+    Program::ptr program = compile_cached(script, &error);
+    if (program) {
+        Result result = run(program);
+        error = result.error;
+        exit_code_ = result.exit_code;
+    }
+    report(error);
+    return error.message.empty();
+}
 
-    try {
-        tokens = lexer.scan();
+void Lox::execute_isolates(const std::string &script) {
+    Error error;
+    Program::ptr program = compile_cached(script, &error);
+    if (!program) {
+        report(error);
+        return;
+    }
 
-        Parser parser(tokens);
-        std::vector<stmt::Statement::ptr> statements = parser.parse();
+    size_t count = options_.isolates;
+    std::vector<std::ostringstream> outputs(count);
+    std::vector<Result> results(count);
+    std::vector<std::thread> threads;
+    threads.reserve(count - 1);
+    for (size_t i = 1; i < count; i++) {
+        threads.emplace_back([&, i]() {
+            // the engine options only: the process-wide instrumentation belongs to isolate 0
+            Lox isolate(options_.engine());
+            isolate.set_output(&outputs[i]);
+            results[i] = isolate.run(program);
+        });
+    }
+    set_output(&outputs[0]);
+    results[0] = run(program);
+    set_output(&std::cout);
+    for (auto &thread : threads) {
+        thread.join();
+    }
 
-        auto resolver = std::make_shared<Resolver>();
-        resolver->resolve(statements);
+    for (size_t i = 0; i < count; i++) {
+        std::cout << outputs[i].str();
+        report(results[i].error, "isolate " + std::to_string(i) + ": ");
+    }
+    exit_code_ = results[0].exit_code;
+}
 
-        interpreter_.interpret(statements);
+void Lox::report(const Error &error, const std::string &prefix) {
+    if (error.message.empty()) {
+        return;
+    }
+    std::cerr << prefix;
+    if (error.line > 0) {
+        std::cerr << "line:" << error.line << "  ";
+    }
+    std::cerr << error.message << std::endl;
+
+    // a runaway recursion repeats itself, its ends are what tell where it started and where it went wrong
+    constexpr size_t kShown = 10;
+    const auto &frames = error.backtrace;
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (frames.size() > 2 * kShown && i == kShown) {
+            std::cerr << prefix << "    ... " << frames.size() - 2 * kShown << " more" << std::endl;
+            i = frames.size() - kShown;
+        }
+        std::cerr << prefix << "    in " << frames[i].function << "() called at line " << frames[i].line << std::endl;
+    }
+}
+
+Program::ptr Lox::compile(const std::string &source, Error *error) {
+    try {
+        return Program::compile(source);
     } catch (const RuntimeError &e) {
-        std::cerr << "line:" << e.token->line << "  " << e.what() << std::endl;
+        *error = {e.what(), e.token->line, {}};
     } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
+        *error = {e.what(), 0, {}};
+    }
+    return nullptr;
+}
+
+Program::ptr Lox::compile_cached(const std::string &source, Error *error) {
+    if (options_.cache_dir.empty()) {
+        return compile(source, error);
+    }
+    ProgramCache cache(options_.cache_dir);
+    Program::ptr program = cache.load(source);
+    if (!program) {
+        program = compile(source, error);
+        if (program && !cache.store(source, *program)) {
+            std::cerr << "can't write to cache directory '" << options_.cache_dir << "'" << std::endl;
+        }
+    }
+    return program;
+}
+
+Lox::Result Lox::run(const Program::ptr &program, const std::unordered_map<std::string, Value> &globals) {
+    Result result;
+    for (const auto &item : globals) {
+        set_global(item.first, item.second);
+    }
+    try {
+        Tracer::Scope trace("execute", "phase", 0);
+        result.value = interpreter_.interpret(program);
+    } catch (const RuntimeError &e) {
+        result.ok = false;
+        result.error = {e.what(), e.token->line, e.backtrace};
+    } catch (const ExitException &e) {
+        result.exit_code = e.code;
+    } catch (const std::exception &e) {
+        result.ok = false;
+        result.error = {e.what(), 0, {}};
+    }
+
+    if (!options_.profile_path.empty()) {
+        // samples point at names in this program's AST, fold them before it is released
+        SamplingProfiler::collect();
+    }
+    if (Tracer::enabled()) {
+        Tracer::collect();
     }
+    return result;
+}
+
+bool Lox::save_snapshot(const std::string &path, Error *error) {
+    try {
+        Snapshot::write(interpreter_, path);
+        return true;
+    } catch (const std::runtime_error &e) {
+        *error = {e.what(), 0, {}};
+        return false;
+    }
+}
+
+bool Lox::load_snapshot(const std::string &path, Error *error) {
+    try {
+        Snapshot::read(&interpreter_, path);
+        return true;
+    } catch (const std::runtime_error &e) {
+        *error = {e.what(), 0, {}};
+        return false;
+    }
+}
+
+void Lox::reset() {
+    interpreter_.reset();
+    exit_code_ = -1;
+}
+
+void Lox::set_output(std::ostream *out) {
+    interpreter_.set_output(out);
+}
+
+Value Lox::global(const std::string &name) {
+    return interpreter_.global(name);
+}
+
+void Lox::set_global(const std::string &name, const Value &value) {
+    interpreter_.globals()->define(name, value);
 }
 
 void Lox::prompt() {
     interpreter_.enable_repl_mode();
+    Error error;
+    if (!options_.snapshot_in.empty() && !load_snapshot(options_.snapshot_in, &error)) {
+        report(error);
+        return;
+    }
 
     std::string line;
     std::cout << "> ";
@@ -59,6 +286,9 @@ void Lox::prompt() {
             break;
         }
         execute(line);
+        if (exit_code_ >= 0) {
+            break;
+        }
         std::cout << "> " << std::flush;
     }
 }
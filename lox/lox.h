@@ -3,19 +3,102 @@
 //
 #pragma once
 
+#include <ostream>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "lox/interpreter.h"
+#include "lox/options.h"
+#include "lox/program.h"
 #include "lox/token.h"
 
+/*
+ * An isolate: one interpreter with its own globals, heap and output. Isolates
+ * share nothing mutable, so any number of them can run on as many threads at
+ * once without locks; a Lox object itself must only be used by one thread at
+ * a time. A compiled Program is immutable and may be run by several isolates
+ * concurrently. Process-wide instrumentation (--profile, --trace) is started
+ * and written by the Lox constructed with those options, per-interpreter
+ * reports (--hotspots, --alloc-profile) describe that isolate only.
+ */
 class Lox {
  public:
+    struct Error {
+        std::string message;
+        // 0 when the error is not tied to a source line
+        int line{0};
+        // the calls the error passed through, innermost first
+        std::vector<StackFrame> backtrace;
+    };
+
+    struct Result {
+        bool ok{true};
+        // value of the last top-level expression statement, nil when there is none
+        Value value;
+        Error error;
+        // the argument of exit() when the script called it, -1 otherwise
+        int exit_code{-1};
+    };
+
+    explicit Lox(Options options = {});
+    ~Lox();
+
     void execute_script(const std::string &filepath);
 
     void prompt();
 
+    // writes the script translated to C++ to out, see CppEmitter; returns false after reporting an error
+    bool emit_cpp(const std::string &filepath, std::ostream &out);
+
+    // compiles source once into a program that can be run many times; returns nullptr and fills error on failure
+    static Program::ptr compile(const std::string &source, Error *error);
+
+    // runs a program after defining the given globals; errors are returned in the result, never printed
+    Result run(const Program::ptr &program, const std::unordered_map<std::string, Value> &globals = {});
+
+    // forgets every global scripts have defined, only the builtins remain
+    void reset();
+
+    // where print statements write to, std::cout by default
+    void set_output(std::ostream *out);
+
+    // value of a global variable, nil when it is not defined
+    Value global(const std::string &name);
+
+    void set_global(const std::string &name, const Value &value);
+
+    // saves every global and the heap it reaches, see lox/snapshot.h
+    bool save_snapshot(const std::string &path, Error *error);
+
+    // replaces the globals with a saved heap
+    bool load_snapshot(const std::string &path, Error *error);
+
+    // exposes a C++ function, lambda or functor to scripts, see bind_native()
+    template <typename F> void define_native(const std::string &name, F fn) {
+        interpreter_.define_native(name, std::move(fn));
+    }
+
+    // prints error to std::cerr the way the command line reports errors, nothing when its message is empty
+    static void report(const Error &error, const std::string &prefix = "");
+
+    // exit code requested by a script through exit(), -1 when none did
+    int exit_code() const {
+        return exit_code_;
+    }
+
  private:
-    void execute(const std::string &content);
+    // returns false when the script failed to compile or run
+    bool execute(const std::string &content);
+
+    // compile() going through the --cache-dir cache when there is one
+    Program::ptr compile_cached(const std::string &source, Error *error);
+
+    // runs the script in options_.isolates isolates, this one included, and prints their outputs in order
+    void execute_isolates(const std::string &content);
 
+    Options options_;
     Interpreter interpreter_;
+    Hotspots::ptr hotspots_;
+    int exit_code_{-1};
 };
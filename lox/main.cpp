@@ -1,17 +1,32 @@
 #include "lox/lox.h"
+#include "lox/options.h"
+#include "lox/server.h"
 #include <iostream>
 
 int main(int argc, char **argv) {
-    if (argc > 2) {
-        std::cout << "Usage: cx [script]" << std::endl;
+    Options options;
+    try {
+        options = Options::parse(argc, argv);
+    } catch (const std::invalid_argument &e) {
+        std::cerr << e.what() << std::endl << Options::usage();
         exit(64);
     }
 
-    Lox lox;
-    if (argc == 2) {
-        lox.execute_script(argv[1]);
+    if (!options.serve_path.empty()) {
+        return Server(options).serve();
+    }
+    if (!options.client_path.empty()) {
+        return Server::client(options);
+    }
+
+    Lox lox(options);
+    if (options.emit_cpp) {
+        return lox.emit_cpp(options.script, std::cout) ? 0 : 65;
+    }
+    if (!options.script.empty()) {
+        lox.execute_script(options.script);
     } else {
         lox.prompt();
     }
-    exit(0);
+    return lox.exit_code() < 0 ? 0 : lox.exit_code();
 }
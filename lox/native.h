@@ -0,0 +1,202 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "lox/callable.h"
+#include "lox/exception.h"
+#include "lox/value.h"
+
+/*
+ * bind_native() turns a plain C++ function, lambda or member function into a
+ * Lox callable. Arity, parameter and return types are deduced at compile
+ * time; the generated trampoline unboxes each argument with a single type
+ * check and reports mismatches by name:
+ *
+ *     interpreter.define_native("hypot", [](double x, double y) { return std::hypot(x, y); });
+ *
+ * Parameters may be double, any integer type, bool, std::string, Value or any
+ * other type a Value can hold (Float64Array::ptr, LoxInstance::ptr, ...). A
+ * leading Interpreter * parameter receives the calling interpreter and does
+ * not count towards the arity. Results are boxed the same way; void returns nil.
+ */
+
+namespace native {
+
+template <typename T> struct TypeName {
+    static const char *get() {
+        return "object";
+    }
+};
+template <> struct TypeName<double> {
+    static const char *get() {
+        return "number";
+    }
+};
+template <> struct TypeName<bool> {
+    static const char *get() {
+        return "bool";
+    }
+};
+template <> struct TypeName<std::string> {
+    static const char *get() {
+        return "string";
+    }
+};
+
+// the type of value by the names TypeName uses
+inline std::string type_name(const Value &value) {
+    return value.is<double>() ? TypeName<double>::get() : value.type();
+}
+
+[[noreturn]] inline void argument_error(const std::string &func, size_t index, const char *expected, const Value &got) {
+    throw std::runtime_error(func + "() argument " + std::to_string(index + 1) + " must be " + expected + ", got " +
+                             type_name(got));
+}
+
+template <typename T, typename = void> struct Unbox {
+    static const T &get(const std::string &func, size_t index, const Value &value) {
+        const T *p = value.get_if<T>();
+        if (p == nullptr) {
+            argument_error(func, index, TypeName<T>::get(), value);
+        }
+        return *p;
+    }
+};
+
+template <> struct Unbox<Value> {
+    static const Value &get(const std::string &, size_t, const Value &value) {
+        return value;
+    }
+};
+
+// every integer type but bool, from a number that is a whole value in its range
+template <typename T> struct Unbox<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+    static T get(const std::string &func, size_t index, const Value &value) {
+        // converting a double outside of T's range is undefined, so the range is checked first; 2^digits is exact
+        constexpr double high = static_cast<double>(uint64_t{1} << (std::numeric_limits<T>::digits - 1)) * 2;
+        constexpr double low = std::numeric_limits<T>::is_signed ? -high : 0;
+        const double *p = value.get_if<double>();
+        if (p == nullptr || !(*p >= low && *p < high) || *p != static_cast<double>(static_cast<T>(*p))) {
+            const char *expected = std::numeric_limits<T>::is_signed ? "an integer" : "a non-negative integer";
+            argument_error(func, index, expected, value);
+        }
+        return static_cast<T>(*p);
+    }
+};
+
+template <> struct Unbox<float> {
+    static float get(const std::string &func, size_t index, const Value &value) {
+        return static_cast<float>(Unbox<double>::get(func, index, value));
+    }
+};
+
+template <typename T> Value box(T &&value) {
+    using U = std::decay_t<T>;
+    if constexpr (std::is_same_v<U, bool> || std::is_same_v<U, Value>) {
+        return std::forward<T>(value);
+    } else if constexpr (std::is_arithmetic_v<U>) {
+        return static_cast<double>(value);
+    } else if constexpr (std::is_same_v<U, const char *> || std::is_same_v<U, char *>) {
+        return std::string(value);
+    } else {
+        return Value(std::forward<T>(value));
+    }
+}
+
+template <typename R, typename... Args> struct Signature {
+    using result = R;
+    using arguments = std::tuple<Args...>;
+    static constexpr bool takes_interpreter = false;
+};
+
+template <typename R, typename... Args> struct Signature<R, Interpreter *, Args...> {
+    using result = R;
+    using arguments = std::tuple<Args...>;
+    static constexpr bool takes_interpreter = true;
+};
+
+template <typename F> struct Traits : Traits<decltype(&F::operator())> {};
+template <typename R, typename... Args> struct Traits<R (*)(Args...)> : Signature<R, Args...> {};
+template <typename R, typename... Args> struct Traits<R(Args...)> : Signature<R, Args...> {};
+template <typename C, typename R, typename... Args> struct Traits<R (C::*)(Args...)> : Signature<R, Args...> {};
+template <typename C, typename R, typename... Args>
+struct Traits<R (C::*)(Args...) const> : Signature<R, Args...> {};
+
+template <typename F, typename Arguments, bool TakesInterpreter> class Function;
+
+template <typename F, typename... Args, bool TakesInterpreter>
+class Function<F, std::tuple<Args...>, TakesInterpreter> : public Callable {
+ public:
+    Function(std::string name, F fn) : name_(std::move(name)), fn_(std::move(fn)) {}
+
+    std::string name() const override {
+        return name_;
+    }
+
+    int arity() const override {
+        return sizeof...(Args);
+    }
+
+    Value call(Interpreter *interpreter, const std::vector<Value> &arguments) override {
+        return invoke(interpreter, arguments, std::index_sequence_for<Args...>{});
+    }
+
+ private:
+    template <size_t... I>
+    Value invoke(Interpreter *interpreter, const std::vector<Value> &arguments, std::index_sequence<I...>) {
+        if constexpr (TakesInterpreter) {
+            return apply([&]() -> decltype(auto) {
+                return fn_(interpreter, Unbox<std::decay_t<Args>>::get(name_, I, arguments[I])...);
+            });
+        } else {
+            return apply([&]() -> decltype(auto) {
+                return fn_(Unbox<std::decay_t<Args>>::get(name_, I, arguments[I])...);
+            });
+        }
+    }
+
+    template <typename Thunk> static Value apply(Thunk &&thunk) {
+        if constexpr (std::is_void_v<decltype(thunk())>) {
+            thunk();
+            return nullptr;
+        } else {
+            return box(thunk());
+        }
+    }
+
+    std::string name_;
+    F fn_;
+};
+
+} // namespace native
+
+template <typename F> Callable::ptr bind_native(std::string name, F fn) {
+    using Traits = native::Traits<std::remove_pointer_t<std::decay_t<F>>>;
+    using Trampoline = native::Function<std::decay_t<F>, typename Traits::arguments, Traits::takes_interpreter>;
+    return std::make_shared<Trampoline>(std::move(name), std::move(fn));
+}
+
+template <typename C, typename R, typename... Args>
+Callable::ptr bind_native(std::string name, R (C::*method)(Args...), C *object) {
+    return bind_native(std::move(name), [method, object](Args... args) -> R {
+        return (object->*method)(std::forward<Args>(args)...);
+    });
+}
+
+template <typename C, typename R, typename... Args>
+Callable::ptr bind_native(std::string name, R (C::*method)(Args...) const, const C *object) {
+    return bind_native(std::move(name), [method, object](Args... args) -> R {
+        return (object->*method)(std::forward<Args>(args)...);
+    });
+}
@@ -0,0 +1,177 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/options.h"
+
+#include <stdexcept>
+#include <string>
+
+static bool match_flag(const std::string &arg, const std::string &flag, std::string *value) {
+    if (arg.compare(0, flag.size() + 1, flag + "=") != 0) {
+        return false;
+    }
+    *value = arg.substr(flag.size() + 1);
+    if (value->empty()) {
+        throw std::invalid_argument("missing value for " + flag);
+    }
+    return true;
+}
+
+static int parse_int(const std::string &flag, const std::string &value, int min = 1) {
+    try {
+        size_t end = 0;
+        int n = std::stoi(value, &end);
+        if (end == value.size() && n >= min) {
+            return n;
+        }
+    } catch (const std::exception &) {
+    }
+    throw std::invalid_argument("invalid value for " + flag + ": " + value);
+}
+
+Options Options::parse(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+        if (match_flag(arg, "--profile", &value)) {
+            options.profile_path = value;
+        } else if (match_flag(arg, "--profile-hz", &value)) {
+            options.profile_hz = parse_int("--profile-hz", value);
+        } else if (match_flag(arg, "--profile-clock", &value)) {
+            if (value != "cpu" && value != "wall") {
+                throw std::invalid_argument("--profile-clock must be 'cpu' or 'wall'");
+            }
+            options.profile_wall_clock = value == "wall";
+        } else if (arg == "--hotspots") {
+            options.hotspots = true;
+        } else if (match_flag(arg, "--hotspots-json", &value)) {
+            options.hotspots_json_path = value;
+        } else if (match_flag(arg, "--hotspots-top", &value)) {
+            options.hotspots_top = parse_int("--hotspots-top", value);
+        } else if (arg == "--alloc-profile") {
+            options.alloc_profile = true;
+        } else if (match_flag(arg, "--alloc-profile-top", &value)) {
+            options.alloc_profile_top = parse_int("--alloc-profile-top", value);
+        } else if (match_flag(arg, "--trace", &value)) {
+            options.trace_path = value;
+        } else if (match_flag(arg, "--trace-min-us", &value)) {
+            options.trace_min_us = parse_int("--trace-min-us", value, 0);
+        } else if (match_flag(arg, "--trace-buffer", &value)) {
+            options.trace_buffer = parse_int("--trace-buffer", value);
+        } else if (arg == "--jit") {
+            options.jit = true;
+        } else if (arg == "--closures") {
+            options.closures = true;
+        } else if (arg == "--type-report") {
+            options.type_report = true;
+        } else if (arg == "--dump-ir") {
+            options.dump_ir = true;
+        } else if (arg == "--no-ssa") {
+            options.ssa = false;
+        } else if (arg == "--emit-cpp") {
+            options.emit_cpp = true;
+        } else if (arg == "--no-inline") {
+            options.inline_calls = false;
+        } else if (match_flag(arg, "--max-depth", &value)) {
+            options.max_depth = parse_int("--max-depth", value);
+        } else if (match_flag(arg, "--cache-dir", &value)) {
+            options.cache_dir = value;
+        } else if (match_flag(arg, "--snapshot-out", &value)) {
+            options.snapshot_out = value;
+        } else if (match_flag(arg, "--snapshot-in", &value)) {
+            options.snapshot_in = value;
+        } else if (match_flag(arg, "--isolates", &value)) {
+            options.isolates = parse_int("--isolates", value);
+        } else if (match_flag(arg, "--serve", &value)) {
+            options.serve_path = value;
+        } else if (match_flag(arg, "--serve-workers", &value)) {
+            options.serve_workers = parse_int("--serve-workers", value, 0);
+        } else if (match_flag(arg, "--client", &value)) {
+            options.client_path = value;
+        } else if (match_flag(arg, "--args", &value)) {
+            options.args_json = value;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            throw std::invalid_argument("unknown option " + arg);
+        } else if (options.script.empty()) {
+            options.script = arg;
+        } else {
+            throw std::invalid_argument("only one script can be given");
+        }
+    }
+    if (!options.client_path.empty() && options.script.empty()) {
+        throw std::invalid_argument("--client needs a script to run");
+    }
+    if ((!options.snapshot_in.empty() || !options.snapshot_out.empty()) && options.isolates > 1) {
+        throw std::invalid_argument("snapshots can't be combined with --isolates");
+    }
+    if (!options.snapshot_out.empty() && options.script.empty()) {
+        throw std::invalid_argument("--snapshot-out needs a script to run");
+    }
+    if (options.closures && options.jit) {
+        throw std::invalid_argument("--closures can't be combined with --jit");
+    }
+    if (options.closures && (!options.snapshot_in.empty() || !options.snapshot_out.empty())) {
+        throw std::invalid_argument("snapshots can't be combined with --closures");
+    }
+    if (options.type_report && !options.closures) {
+        throw std::invalid_argument("--type-report only applies to --closures runs");
+    }
+    if ((options.dump_ir || !options.ssa) && !options.closures) {
+        throw std::invalid_argument("--dump-ir and --no-ssa only apply to --closures runs");
+    }
+    if (options.dump_ir && !options.ssa) {
+        throw std::invalid_argument("--dump-ir can't be combined with --no-ssa");
+    }
+    if (options.emit_cpp && options.script.empty()) {
+        throw std::invalid_argument("--emit-cpp needs a script to translate");
+    }
+    if (!options.args_json.empty() && options.client_path.empty()) {
+        throw std::invalid_argument("--args only applies to --client runs");
+    }
+    return options;
+}
+
+Options Options::engine() const {
+    Options options;
+    options.jit = jit;
+    options.closures = closures;
+    options.type_report = type_report;
+    options.dump_ir = dump_ir;
+    options.ssa = ssa;
+    options.inline_calls = inline_calls;
+    options.max_depth = max_depth;
+    return options;
+}
+
+const char *Options::usage() {
+    return "Usage: lox [options] [script]\n"
+           "  --profile=FILE      write sampled call stacks in collapsed format to FILE\n"
+           "  --profile-hz=N      sampling frequency for --profile (default 1000)\n"
+           "  --profile-clock=C   'cpu' (default) samples CPU time, 'wall' samples elapsed time\n"
+           "  --hotspots          print the hottest lines and their type feedback on exit\n"
+           "  --hotspots-json=FILE  write the hotspot report as JSON to FILE\n"
+           "  --hotspots-top=N    number of lines in the hotspot report (default 20)\n"
+           "  --alloc-profile     print heap allocations by kind and by source line on exit\n"
+           "  --alloc-profile-top=N  number of lines in the allocation report (default 20)\n"
+           "  --trace=FILE        write Chrome trace events (ui.perfetto.dev) to FILE\n"
+           "  --trace-min-us=N    leave out spans shorter than N microseconds\n"
+           "  --trace-buffer=N    spans kept per thread before the oldest are overwritten\n"
+           "  --jit               compile hot functions to x86-64 code, listed in /tmp/perf-<pid>.map\n"
+           "  --closures          run the script as a tree of compiled closures instead of walking its AST\n"
+           "  --type-report       list the locals --closures proved to be numbers and keeps unboxed\n"
+           "  --dump-ir           print the optimized SSA form of the functions --closures compiles\n"
+           "  --no-ssa            compile --closures functions straight from the AST, without optimizing\n"
+           "  --emit-cpp          print the script as C++ to build against liblox instead of running it\n"
+           "  --no-inline         always call functions, even small ones the optimizer would inline\n"
+           "  --max-depth=N       nested calls allowed before a stack overflow error (default 10000)\n"
+           "  --cache-dir=DIR     cache compiled scripts in DIR, unchanged scripts start without parsing\n"
+           "  --snapshot-out=FILE save the globals and everything they reach to FILE after the script\n"
+           "  --snapshot-in=FILE  start from the heap saved in FILE instead of running its script again\n"
+           "  --isolates=N        run the script in N interpreters on N threads, outputs in order\n"
+           "  --serve=SOCK        serve runs on the Unix domain socket SOCK from warm isolates\n"
+           "  --serve-workers=N   isolates kept by --serve (default one per core)\n"
+           "  --client=SOCK       run the script on the server listening on SOCK\n"
+           "  --args=JSON         globals for a --client run, e.g. '{\"n\": 30}'\n";
+}
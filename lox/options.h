@@ -0,0 +1,88 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <string>
+
+struct Options {
+    // script to run, the REPL is started when empty
+    std::string script;
+
+    // --profile=FILE: sample the Lox call stack and write collapsed stacks to FILE
+    std::string profile_path;
+    // --profile-hz=N: sampling frequency of --profile
+    int profile_hz{1000};
+    // --profile-clock=wall: sample elapsed time instead of CPU time
+    bool profile_wall_clock{false};
+
+    // --hotspots: print the hottest lines with their type feedback on exit
+    bool hotspots{false};
+    // --hotspots-json=FILE: write the same report as JSON
+    std::string hotspots_json_path;
+    // --hotspots-top=N: number of lines in the report
+    int hotspots_top{20};
+
+    // --alloc-profile: print allocations by kind and by source line on exit
+    bool alloc_profile{false};
+    // --alloc-profile-top=N: number of lines in the report
+    int alloc_profile_top{20};
+
+    // --trace=FILE: write Chrome trace events for phases, calls and instantiations to FILE
+    std::string trace_path;
+    // --trace-min-us=N: drop spans shorter than N microseconds
+    int trace_min_us{0};
+    // --trace-buffer=N: spans kept per thread, the oldest are overwritten beyond that
+    int trace_buffer{1 << 20};
+
+    // --jit: compile hot functions to x86-64 machine code
+    bool jit{false};
+
+    // --closures: run scripts compiled to C++ closures instead of walking their trees, see ClosureCompiler
+    bool closures{false};
+    // --type-report: list the locals --closures keeps in unboxed number slots on stderr
+    bool type_report{false};
+    // --dump-ir: print the optimized SSA form of the functions --closures compiles through it on stderr
+    bool dump_ir{false};
+    // --no-ssa: compile every function --closures runs from its AST, without the SSA optimizer
+    bool ssa{true};
+
+    // --emit-cpp: print the script translated to C++ instead of running it, see CppEmitter
+    bool emit_cpp{false};
+
+    // --no-inline: call small functions and methods instead of evaluating their bodies in place
+    bool inline_calls{true};
+
+    // --max-depth=N: nested Lox calls allowed before a stack overflow error
+    int max_depth{10000};
+
+    // --cache-dir=DIR: keep compiled scripts in DIR and skip parsing when the source is unchanged
+    std::string cache_dir;
+
+    // --snapshot-out=FILE: save the heap the script leaves behind to FILE
+    std::string snapshot_out;
+    // --snapshot-in=FILE: start from a saved heap instead of an empty one
+    std::string snapshot_in;
+
+    // --isolates=N: run the script in N isolated interpreters on N threads at once
+    int isolates{1};
+
+    // --serve=SOCK: serve runs on a Unix domain socket from a pool of warm isolates
+    std::string serve_path;
+    // --serve-workers=N: isolates in the pool, one per core when 0
+    int serve_workers{0};
+    // --client=SOCK: run the script on the server listening on SOCK
+    std::string client_path;
+    // --args=JSON: a JSON object of globals to define before a --client run
+    std::string args_json;
+
+    // throws std::invalid_argument on a malformed command line
+    static Options parse(int argc, char **argv);
+
+    // the options that shape how a script runs, for the further interpreters of one process: the instrumentation,
+    // the cache, the snapshots and the run mode are process-wide and stay with the first one
+    Options engine() const;
+
+    static const char *usage();
+};
@@ -13,6 +13,12 @@
 #include "lox/function.h"
 #include "lox/lox.h"
 
+expr::Expr::ptr Parser::literal(Value value) {
+    auto literal = std::make_shared<expr::Literal>(std::move(value));
+    literal->line = previous()->line;
+    return literal;
+}
+
 expr::Expr::ptr Parser::expression() {
     return assignment();
 }
@@ -154,20 +160,20 @@ expr::Expr::ptr Parser::unary() {
 
 expr::Expr::ptr Parser::primary() {
     if (match(Token::TRUE)) {
-        return std::make_shared<expr::Literal>(true);
+        return literal(true);
     }
     if (match(Token::FALSE)) {
-        return std::make_shared<expr::Literal>(false);
+        return literal(false);
     }
     if (match(Token::NIL)) {
-        return std::make_shared<expr::Literal>(nullptr);
+        return literal(nullptr);
     }
     if (match(Token::STRING)) {
-        return std::make_shared<expr::Literal>(previous()->lexeme);
+        return literal(previous()->lexeme);
     }
     if (match(Token::NUMBER)) {
         double d = std::stod(previous()->lexeme, nullptr);
-        return std::make_shared<expr::Literal>(d);
+        return literal(d);
     }
     if (match(Token::LEFT_PAREN)) {
         expr::Expr::ptr expr = expression();
@@ -286,8 +292,10 @@ stmt::Statement::ptr Parser::block_statement() {
     while (!check(Token::RIGHT_BRACE) && !is_at_end()) {
         statements.push_back(declaration());
     }
-    consume(Token::RIGHT_BRACE, "Expect '}' after block.");
-    return std::make_shared<stmt::Block>(statements);
+    Token::ptr brace = consume(Token::RIGHT_BRACE, "Expect '}' after block.");
+    auto block = std::make_shared<stmt::Block>(statements);
+    block->line = statements.empty() ? brace->line : statements.front()->line;
+    return block;
 }
 
 stmt::Statement::ptr Parser::if_statement() {
@@ -327,7 +335,7 @@ stmt::Statement::ptr Parser::for_statement() {
     if (!check(Token::SEMICOLON)) {
         condition = expression();
     } else {
-        condition = std::make_shared<expr::Literal>(true);
+        condition = literal(true);
     }
     consume(Token::SEMICOLON, "Expect ';' after loop condition.");
 
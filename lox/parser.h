@@ -47,6 +47,7 @@ class Parser {
     expr::Expr::ptr factor();
     expr::Expr::ptr unary();
     expr::Expr::ptr primary();
+    expr::Expr::ptr literal(Value value);
     expr::Expr::ptr logical_or();
     expr::Expr::ptr logical_and();
     expr::Expr::ptr call();
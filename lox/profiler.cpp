@@ -0,0 +1,212 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/profiler.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <unordered_set>
+
+thread_local ShadowStack shadow_stack;
+
+const char *ShadowStack::intern(const std::string &name) {
+    static std::mutex mutex;
+    static auto *names = new std::unordered_set<std::string>();
+    std::lock_guard<std::mutex> lock(mutex);
+    return names->insert(name).first->c_str();
+}
+
+std::map<std::string, uint64_t> SamplingProfiler::folded_;
+
+namespace {
+
+constexpr size_t kTableSize = 1 << 14;
+constexpr size_t kPoolSize = 1 << 18;
+
+struct Entry {
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t depth;
+    uint64_t count;
+};
+
+// one slot per distinct stack, frames of all stacks are appended to a shared pool
+Entry table[kTableSize];
+ShadowStack::Frame pool[kPoolSize];
+size_t pool_used = 0;
+
+std::atomic_flag busy = ATOMIC_FLAG_INIT;
+timer_t timer;
+bool timer_armed = false;
+std::atomic<uint64_t> dropped{0};
+
+// the timer always runs on the monotonic clock, in CPU time mode every tick is weighed by the CPU time used since
+int64_t interval_ns = 0;
+bool cpu_time = false;
+int64_t cpu_last = 0;
+int64_t cpu_credit = 0;
+std::atomic<uint64_t> ticks{0};
+int64_t started_ns = 0;
+
+int64_t now_ns(clockid_t clock) {
+    timespec now{};
+    clock_gettime(clock, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+uint64_t hash_stack(int depth) {
+    uint64_t h = 1469598103934665603ULL ^ static_cast<uint64_t>(depth);
+    for (int i = 0; i < depth; i++) {
+        const ShadowStack::Frame &frame = shadow_stack.frame(i);
+        h = (h ^ reinterpret_cast<uintptr_t>(frame.name)) * 1099511628211ULL;
+        h = (h ^ static_cast<uint64_t>(frame.line)) * 1099511628211ULL;
+    }
+    return h == 0 ? 1 : h;
+}
+
+bool record_sample(uint64_t weight) {
+    int depth = std::min(shadow_stack.depth(), ShadowStack::kMaxFrames);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    uint64_t h = hash_stack(depth);
+
+    for (size_t probe = 0; probe < kTableSize; probe++) {
+        Entry &entry = table[(h + probe) & (kTableSize - 1)];
+        if (entry.hash == h && entry.depth == static_cast<uint32_t>(depth)) {
+            entry.count += weight;
+            return true;
+        }
+        if (entry.hash == 0) {
+            if (pool_used + depth > kPoolSize) {
+                return false;
+            }
+            for (int i = 0; i < depth; i++) {
+                pool[pool_used + i] = shadow_stack.frame(i);
+            }
+            entry = {h, static_cast<uint32_t>(pool_used), static_cast<uint32_t>(depth), weight};
+            pool_used += depth;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the samples a tick stands for: one in wall clock mode, in CPU time mode one per interval of CPU time used,
+// none while the process waits
+uint64_t tick_weight() {
+    if (!cpu_time) {
+        return 1;
+    }
+    int64_t cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    cpu_credit += cpu - cpu_last;
+    cpu_last = cpu;
+    if (cpu_credit < interval_ns) {
+        return 0;
+    }
+    uint64_t weight = cpu_credit / interval_ns;
+    cpu_credit %= interval_ns;
+    return weight;
+}
+
+void on_sigprof(int) {
+    ticks.fetch_add(1, std::memory_order_relaxed);
+    // a sample racing with collect() or with another thread's handler is dropped rather than waited for
+    if (busy.test_and_set(std::memory_order_acquire)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint64_t weight = tick_weight();
+    if (weight > 0 && !record_sample(weight)) {
+        dropped.fetch_add(weight, std::memory_order_relaxed);
+    }
+    busy.clear(std::memory_order_release);
+}
+
+} // namespace
+
+void SamplingProfiler::start(int hz, bool wall_clock) {
+    struct sigaction action {};
+    action.sa_handler = on_sigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    // a timer on a CPU time clock, ITIMER_PROF's or a POSIX one, only expires on the scheduler tick (often 250 Hz);
+    // the monotonic clock's is high resolution, CPU time is measured on each tick instead
+    sigevent event{};
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    if (timer_create(CLOCK_MONOTONIC, &event, &timer) != 0) {
+        return;
+    }
+    interval_ns = 1000000000L / std::max(1, std::min(hz, 1000000));
+    cpu_time = !wall_clock;
+    cpu_last = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    cpu_credit = 0;
+    ticks = 0;
+    started_ns = now_ns(CLOCK_MONOTONIC);
+    itimerspec spec{};
+    spec.it_interval.tv_nsec = interval_ns;
+    spec.it_value = spec.it_interval;
+    timer_settime(timer, 0, &spec, nullptr);
+    timer_armed = true;
+}
+
+void SamplingProfiler::stop() {
+    if (timer_armed) {
+        timer_delete(timer);
+        timer_armed = false;
+        // a timer that can't keep up, on a loaded or coarse kernel, makes for fewer samples than asked for
+        double seconds = static_cast<double>(now_ns(CLOCK_MONOTONIC) - started_ns) / 1e9;
+        double rate = static_cast<double>(ticks.load()) / seconds;
+        double requested = 1e9 / static_cast<double>(interval_ns);
+        if (seconds >= 0.1 && rate < requested * 0.8) {
+            std::cerr << "profiler: sampled at " << static_cast<int>(rate) << " Hz of the " << static_cast<int>(requested)
+                      << " Hz requested" << std::endl;
+        }
+    }
+    // the default action of SIGPROF terminates the process, a late signal must not do that
+    signal(SIGPROF, SIG_IGN);
+}
+
+void SamplingProfiler::collect() {
+    while (busy.test_and_set(std::memory_order_acquire)) {
+    }
+    for (Entry &entry : table) {
+        if (entry.hash == 0) {
+            continue;
+        }
+        std::string stack = "main";
+        for (uint32_t i = 0; i < entry.depth; i++) {
+            const ShadowStack::Frame &frame = pool[entry.offset + i];
+            stack += ';';
+            stack += frame.name;
+            if (frame.line > 0) {
+                stack += ':' + std::to_string(frame.line);
+            }
+        }
+        folded_[stack] += entry.count;
+        entry = {};
+    }
+    pool_used = 0;
+    busy.clear(std::memory_order_release);
+}
+
+bool SamplingProfiler::write(const std::string &path) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        return false;
+    }
+    for (const auto &item : folded_) {
+        out << item.first << ' ' << item.second << '\n';
+    }
+    if (dropped.load() > 0) {
+        out << "main;[dropped] " << dropped.load() << '\n';
+    }
+    return out.good();
+}
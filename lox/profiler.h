@@ -0,0 +1,95 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+
+/*
+ * Every Lox call pushes a frame, the callee's name and the line it was called
+ * from, onto a per-thread shadow stack. The stack is plain data written in
+ * push order with a signal fence before the depth is published, so a SIGPROF
+ * handler interrupting the owning thread always sees a consistent prefix
+ * without taking any lock.
+ */
+class ShadowStack {
+ public:
+    static constexpr int kMaxFrames = 1024;
+
+    struct Frame {
+        const char *name;
+        int line;
+    };
+
+    void push(const char *name, int line) {
+        int depth = depth_.load(std::memory_order_relaxed);
+        if (depth < kMaxFrames) {
+            frames_[depth] = {name, line};
+        }
+        std::atomic_signal_fence(std::memory_order_release);
+        depth_.store(depth + 1, std::memory_order_relaxed);
+    }
+
+    void pop() {
+        depth_.store(depth_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
+
+    int depth() const {
+        return depth_.load(std::memory_order_relaxed);
+    }
+
+    const Frame &frame(int i) const {
+        return frames_[i];
+    }
+
+    // frame names normally point into the AST, names owned by short-lived runtime objects are interned instead
+    static const char *intern(const std::string &name);
+
+ private:
+    Frame frames_[kMaxFrames]{};
+    std::atomic<int> depth_{0};
+};
+
+extern thread_local ShadowStack shadow_stack;
+
+// pushes a shadow frame for the lifetime of one Lox call, exceptions included
+class ShadowFrame {
+ public:
+    ShadowFrame(const char *name, int line) {
+        shadow_stack.push(name, line);
+    }
+    ~ShadowFrame() {
+        shadow_stack.pop();
+    }
+
+    ShadowFrame(const ShadowFrame &) = delete;
+    ShadowFrame &operator=(const ShadowFrame &) = delete;
+};
+
+/*
+ * SIGPROF driven sampler. The signal handler hashes the interrupted shadow
+ * stack into a fixed, preallocated table, so it neither allocates nor locks.
+ * The timer runs on the monotonic clock at the requested rate; sampling CPU
+ * time, each tick counts the intervals of CPU time used since the last.
+ * Frame names point into the AST; collect() must run while the program that
+ * produced the samples is still alive and turns them into collapsed stacks.
+ */
+class SamplingProfiler {
+ public:
+    // samples consumed CPU time, or elapsed time including blocking I/O when wall_clock is set
+    static void start(int hz, bool wall_clock);
+    static void stop();
+
+    // moves the samples taken so far into the collapsed-stack totals
+    static void collect();
+
+    // writes Brendan Gregg's collapsed format: "main;outer:3;inner:7 42"
+    static bool write(const std::string &path);
+
+ private:
+    static std::map<std::string, uint64_t> folded_;
+};
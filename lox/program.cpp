@@ -0,0 +1,36 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/program.h"
+
+#include "lox/inliner.h"
+#include "lox/lexer.h"
+#include "lox/parser.h"
+#include "lox/resolver.h"
+#include "lox/tracer.h"
+
+Program::ptr Program::compile(const std::string &source) {
+    std::vector<Token::ptr> tokens;
+    std::vector<stmt::Statement::ptr> statements;
+    {
+        Tracer::Scope trace("lex", "phase", 0);
+        Lexer lexer(source);
+        tokens = lexer.scan();
+    }
+    {
+        Tracer::Scope trace("parse", "phase", 0);
+        Parser parser(tokens);
+        statements = parser.parse();
+    }
+    {
+        Tracer::Scope trace("resolve", "phase", 0);
+        Resolver resolver;
+        resolver.resolve(statements);
+    }
+    {
+        Tracer::Scope trace("inline", "phase", 0);
+        Inliner::run(statements);
+    }
+    return std::make_shared<Program>(std::move(statements));
+}
@@ -0,0 +1,34 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lox/statement.h"
+
+/*
+ * A lexed, parsed and resolved script. Nothing mutates a program once it is
+ * compiled, so one program can be run any number of times, by any number of
+ * interpreters.
+ */
+class Program {
+ public:
+    using ptr = std::shared_ptr<const Program>;
+
+    explicit Program(std::vector<stmt::Statement::ptr> statements) : statements_(std::move(statements)) {}
+
+    // throws RuntimeError on lexical, syntax and resolution errors
+    static ptr compile(const std::string &source);
+
+    const std::vector<stmt::Statement::ptr> &statements() const {
+        return statements_;
+    }
+
+ private:
+    std::vector<stmt::Statement::ptr> statements_;
+};
@@ -0,0 +1,720 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/program_cache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "lox/expr.h"
+#include "lox/inliner.h"
+#include "lox/resolver.h"
+#include "lox/statement.h"
+#include "lox/tracer.h"
+
+namespace {
+
+constexpr char kMagic[4] = {'L', 'O', 'X', 'C'};
+constexpr uint32_t kFormatVersion = 7;
+
+// followed by the source itself, compared on load: the file name is only a hash of it
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_size;
+    // of the encoded program after the source
+    uint64_t checksum;
+};
+
+struct ProgramHeader {
+    uint32_t string_count;
+    uint32_t statement_count;
+};
+
+// node tags of the preorder stream, a null child is written as NONE
+enum Tag : uint8_t {
+    NONE,
+    BINARY,
+    GROUPING,
+    LITERAL,
+    UNARY,
+    VARIABLE,
+    ASSIGN,
+    LOGICAL,
+    BREAK,
+    CALL,
+    GET,
+    SET,
+    THIS,
+    SUPER,
+    EXPRESSION,
+    PRINT,
+    VAR,
+    BLOCK,
+    IF,
+    WHILE,
+    FOR,
+    FUNCTION,
+    RETURN,
+    CLASS,
+};
+
+enum LiteralType : uint8_t { NIL, FALSE, TRUE, NUMBER, STRING };
+
+uint64_t fnv1a(uint64_t hash, const char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t content_hash(const std::string &source) {
+    // FNV-1a over the format version and the source
+    return fnv1a(14695981039346656037ULL ^ kFormatVersion, source.data(), source.size());
+}
+
+class Writer : public expr::Visitor, public stmt::Visitor {
+ public:
+    explicit Writer(std::vector<stmt::Function *> *functions) : functions_(functions) {}
+
+    std::string finish(const Program &program) {
+        for (const auto &statement : program.statements()) {
+            write(statement.get());
+        }
+        std::string out;
+        ProgramHeader header{};
+        header.string_count = static_cast<uint32_t>(strings_.size());
+        header.statement_count = static_cast<uint32_t>(program.statements().size());
+        out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (const auto &s : strings_) {
+            uint32_t size = static_cast<uint32_t>(s.size());
+            out.append(reinterpret_cast<const char *>(&size), sizeof(size));
+            out.append(s);
+        }
+        return out + nodes_;
+    }
+
+    Value visit_binary_expr(expr::Binary *expr) override {
+        node(BINARY, expr->line);
+        write(expr->left.get());
+        token(expr->op);
+        write(expr->right.get());
+        return nullptr;
+    }
+
+    Value visit_grouping_expr(expr::Grouping *expr) override {
+        node(GROUPING, expr->line);
+        write(expr->expression.get());
+        return nullptr;
+    }
+
+    Value visit_literal_expr(expr::Literal *expr) override {
+        node(LITERAL, expr->line);
+        const Value &value = expr->value;
+        if (value.is<bool>()) {
+            u8(value.as<bool>() ? TRUE : FALSE);
+        } else if (value.is<double>()) {
+            u8(NUMBER);
+            double number = value.as<double>();
+            nodes_.append(reinterpret_cast<const char *>(&number), sizeof(number));
+        } else if (value.is<std::string>()) {
+            u8(STRING);
+            string(value.as<std::string>());
+        } else {
+            u8(NIL);
+        }
+        return nullptr;
+    }
+
+    Value visit_unary_expr(expr::Unary *expr) override {
+        node(UNARY, expr->line);
+        token(expr->op);
+        write(expr->right.get());
+        return nullptr;
+    }
+
+    Value visit_variable_expr(expr::Variable *expr) override {
+        node(VARIABLE, expr->line);
+        token(expr->name);
+        return nullptr;
+    }
+
+    Value visit_assign_expr(expr::Assign *expr) override {
+        node(ASSIGN, expr->line);
+        token(expr->name);
+        write(expr->value.get());
+        return nullptr;
+    }
+
+    Value visit_logical_expr(expr::Logical *expr) override {
+        node(LOGICAL, expr->line);
+        write(expr->left.get());
+        token(expr->op);
+        write(expr->right.get());
+        return nullptr;
+    }
+
+    Value visit_break_expr(expr::Break *expr) override {
+        node(BREAK, expr->line);
+        token(expr->keyword);
+        return nullptr;
+    }
+
+    Value visit_call_expr(expr::Call *expr) override {
+        node(CALL, expr->line);
+        write(expr->callee.get());
+        token(expr->paren);
+        u32(static_cast<uint32_t>(expr->arguments.size()));
+        for (const auto &argument : expr->arguments) {
+            write(argument.get());
+        }
+        return nullptr;
+    }
+
+    Value visit_get_expr(expr::Get *expr) override {
+        node(GET, expr->line);
+        write(expr->object.get());
+        token(expr->name);
+        return nullptr;
+    }
+
+    Value visit_set_expr(expr::Set *expr) override {
+        node(SET, expr->line);
+        write(expr->object.get());
+        token(expr->name);
+        write(expr->value.get());
+        return nullptr;
+    }
+
+    Value visit_this_expr(expr::This *expr) override {
+        node(THIS, expr->line);
+        token(expr->name);
+        return nullptr;
+    }
+
+    Value visit_super_expr(expr::Super *expr) override {
+        node(SUPER, expr->line);
+        token(expr->keyword);
+        token(expr->method);
+        return nullptr;
+    }
+
+    Value visit_expression_stmt(stmt::Expression *stmt) override {
+        node(EXPRESSION, stmt->line);
+        write(stmt->expression.get());
+        return nullptr;
+    }
+
+    Value visit_print_stmt(stmt::Print *stmt) override {
+        node(PRINT, stmt->line);
+        write(stmt->expression.get());
+        return nullptr;
+    }
+
+    Value visit_var_stmt(stmt::Var *stmt) override {
+        node(VAR, stmt->line);
+        token(stmt->name);
+        write(stmt->value.get());
+        return nullptr;
+    }
+
+    Value visit_block_stmt(stmt::Block *stmt) override {
+        node(BLOCK, stmt->line);
+        u32(static_cast<uint32_t>(stmt->statements.size()));
+        for (const auto &statement : stmt->statements) {
+            write(statement.get());
+        }
+        return nullptr;
+    }
+
+    Value visit_if_stmt(stmt::If *stmt) override {
+        node(IF, stmt->line);
+        write(stmt->condition.get());
+        write(stmt->then_branch.get());
+        write(stmt->else_branch.get());
+        return nullptr;
+    }
+
+    Value visit_while_stmt(stmt::While *stmt) override {
+        node(WHILE, stmt->line);
+        write(stmt->condition.get());
+        write(stmt->body.get());
+        return nullptr;
+    }
+
+    Value visit_for_stmt(stmt::For *stmt) override {
+        node(FOR, stmt->line);
+        write(stmt->initializer.get());
+        write(stmt->condition.get());
+        write(stmt->increment.get());
+        write(stmt->body.get());
+        return nullptr;
+    }
+
+    Value visit_function_stmt(stmt::Function *stmt) override {
+        if (functions_ != nullptr) {
+            functions_->push_back(stmt);
+        }
+        node(FUNCTION, stmt->line);
+        token(stmt->name);
+        u32(static_cast<uint32_t>(stmt->params.size()));
+        for (const auto &param : stmt->params) {
+            token(param);
+        }
+        write(stmt->body.get());
+        return nullptr;
+    }
+
+    Value visit_return_stmt(stmt::Return *stmt) override {
+        node(RETURN, stmt->line);
+        token(stmt->keyword);
+        write(stmt->value.get());
+        return nullptr;
+    }
+
+    Value visit_class_stmt(stmt::Class *stmt) override {
+        node(CLASS, stmt->line);
+        token(stmt->name);
+        write(stmt->super.get());
+        u32(static_cast<uint32_t>(stmt->methods.size()));
+        for (const auto &method : stmt->methods) {
+            write(method.get());
+        }
+        return nullptr;
+    }
+
+ private:
+    void write(expr::Expr *expr) {
+        if (expr == nullptr) {
+            u8(NONE);
+        } else {
+            expr->accept(this);
+        }
+    }
+
+    void write(stmt::Statement *stmt) {
+        if (stmt == nullptr) {
+            u8(NONE);
+        } else {
+            stmt->accept(this);
+        }
+    }
+
+    void node(Tag tag, int line) {
+        u8(tag);
+        u32(static_cast<uint32_t>(line));
+    }
+
+    void token(const Token::ptr &token) {
+        u8(static_cast<uint8_t>(token->kind));
+        string(token->lexeme);
+        u32(static_cast<uint32_t>(token->line));
+    }
+
+    void string(const std::string &s) {
+        auto it = string_index_.find(s);
+        if (it == string_index_.end()) {
+            it = string_index_.emplace(s, static_cast<uint32_t>(strings_.size())).first;
+            strings_.push_back(s);
+        }
+        u32(it->second);
+    }
+
+    void u8(uint8_t value) {
+        nodes_.push_back(static_cast<char>(value));
+    }
+
+    void u32(uint32_t value) {
+        nodes_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    std::vector<stmt::Function *> *functions_;
+    std::vector<std::string> strings_;
+    std::unordered_map<std::string, uint32_t> string_index_;
+    std::string nodes_;
+};
+
+// rebuilds the tree from a mapped file, every read is bounds checked and a damaged file throws
+class Reader {
+ public:
+    Reader(const char *data, size_t size, std::vector<stmt::Function *> *functions)
+        : position_(data), end_(data + size), functions_(functions) {}
+
+    std::vector<stmt::Statement::ptr> read() {
+        ProgramHeader header;
+        bytes(&header, sizeof(header));
+        strings_.reserve(header.string_count);
+        for (uint32_t i = 0; i < header.string_count; i++) {
+            uint32_t size = u32();
+            check(size);
+            strings_.emplace_back(position_, size);
+            position_ += size;
+        }
+        std::vector<stmt::Statement::ptr> statements;
+        statements.reserve(header.statement_count);
+        for (uint32_t i = 0; i < header.statement_count; i++) {
+            statements.push_back(statement());
+        }
+        if (position_ != end_) {
+            throw std::runtime_error("trailing bytes");
+        }
+        return statements;
+    }
+
+ private:
+    expr::Expr::ptr expression() {
+        uint8_t tag = u8();
+        if (tag == NONE) {
+            return nullptr;
+        }
+        int line = static_cast<int>(u32());
+        expr::Expr::ptr node;
+        switch (tag) {
+        case BINARY: {
+            auto left = expression();
+            auto op = token();
+            node = std::make_shared<expr::Binary>(required(left), op, required(expression()));
+            break;
+        }
+        case GROUPING:
+            node = std::make_shared<expr::Grouping>(required(expression()));
+            break;
+        case LITERAL:
+            node = std::make_shared<expr::Literal>(literal());
+            break;
+        case UNARY: {
+            auto op = token();
+            node = std::make_shared<expr::Unary>(op, required(expression()));
+            break;
+        }
+        case VARIABLE:
+            node = std::make_shared<expr::Variable>(token());
+            break;
+        case ASSIGN: {
+            auto name = token();
+            node = std::make_shared<expr::Assign>(name, required(expression()));
+            break;
+        }
+        case LOGICAL: {
+            auto left = expression();
+            auto op = token();
+            node = std::make_shared<expr::Logical>(required(left), op, required(expression()));
+            break;
+        }
+        case BREAK:
+            node = std::make_shared<expr::Break>(token());
+            break;
+        case CALL: {
+            auto callee = required(expression());
+            auto paren = token();
+            std::vector<expr::Expr::ptr> arguments(count());
+            for (auto &argument : arguments) {
+                argument = required(expression());
+            }
+            node = std::make_shared<expr::Call>(callee, paren, std::move(arguments));
+            break;
+        }
+        case GET: {
+            auto object = required(expression());
+            node = std::make_shared<expr::Get>(object, token());
+            break;
+        }
+        case SET: {
+            auto object = required(expression());
+            auto name = token();
+            node = std::make_shared<expr::Set>(object, name, required(expression()));
+            break;
+        }
+        case THIS:
+            node = std::make_shared<expr::This>(token());
+            break;
+        case SUPER: {
+            auto keyword = token();
+            node = std::make_shared<expr::Super>(keyword, token());
+            break;
+        }
+        default:
+            throw std::runtime_error("bad expression tag");
+        }
+        node->line = line;
+        return node;
+    }
+
+    stmt::Statement::ptr statement() {
+        uint8_t tag = u8();
+        if (tag == NONE) {
+            return nullptr;
+        }
+        int line = static_cast<int>(u32());
+        stmt::Statement::ptr node;
+        switch (tag) {
+        case EXPRESSION:
+            node = std::make_shared<stmt::Expression>(required(expression()));
+            break;
+        case PRINT:
+            node = std::make_shared<stmt::Print>(required(expression()));
+            break;
+        case VAR: {
+            auto name = token();
+            node = std::make_shared<stmt::Var>(name, expression());
+            break;
+        }
+        case BLOCK: {
+            std::vector<stmt::Statement::ptr> statements(count());
+            for (auto &statement : statements) {
+                statement = required(this->statement());
+            }
+            node = std::make_shared<stmt::Block>(std::move(statements));
+            break;
+        }
+        case IF: {
+            auto condition = required(expression());
+            auto then_branch = required(statement());
+            node = std::make_shared<stmt::If>(condition, then_branch, statement());
+            break;
+        }
+        case WHILE: {
+            auto condition = required(expression());
+            node = std::make_shared<stmt::While>(condition, required(statement()));
+            break;
+        }
+        case FOR: {
+            auto initializer = statement();
+            auto condition = required(expression());
+            auto increment = statement();
+            node = std::make_shared<stmt::For>(initializer, condition, increment, required(statement()));
+            break;
+        }
+        case FUNCTION:
+            node = function(line);
+            break;
+        case RETURN: {
+            auto keyword = token();
+            node = std::make_shared<stmt::Return>(keyword, expression());
+            break;
+        }
+        case CLASS: {
+            auto name = token();
+            auto super = std::dynamic_pointer_cast<expr::Variable>(expression());
+            std::vector<stmt::Function::ptr> methods(count());
+            for (auto &method : methods) {
+                if (u8() != FUNCTION) {
+                    throw std::runtime_error("bad method tag");
+                }
+                method = function(static_cast<int>(u32()));
+            }
+            node = std::make_shared<stmt::Class>(name, super, std::move(methods));
+            break;
+        }
+        default:
+            throw std::runtime_error("bad statement tag");
+        }
+        node->line = line;
+        return node;
+    }
+
+    stmt::Function::ptr function(int line) {
+        // numbered in preorder like the writer does, before the nested functions of the body
+        size_t index = functions_ ? functions_->size() : 0;
+        if (functions_ != nullptr) {
+            functions_->push_back(nullptr);
+        }
+        auto name = token();
+        std::vector<Token::ptr> params(count());
+        for (auto &param : params) {
+            param = token();
+        }
+        auto body = std::dynamic_pointer_cast<stmt::Block>(statement());
+        auto node = std::make_shared<stmt::Function>(name, std::move(params), required(body));
+        node->line = line;
+        if (functions_ != nullptr) {
+            (*functions_)[index] = node.get();
+        }
+        return node;
+    }
+
+    Value literal() {
+        switch (u8()) {
+        case NIL:
+            return nullptr;
+        case FALSE:
+            return false;
+        case TRUE:
+            return true;
+        case NUMBER: {
+            double number;
+            bytes(&number, sizeof(number));
+            return number;
+        }
+        case STRING:
+            return string();
+        default:
+            throw std::runtime_error("bad literal");
+        }
+    }
+
+    Token::ptr token() {
+        auto kind = static_cast<Token::Kind>(u8());
+        const std::string &lexeme = string();
+        return std::make_shared<Token>(kind, lexeme, static_cast<int>(u32()));
+    }
+
+    const std::string &string() {
+        uint32_t index = u32();
+        if (index >= strings_.size()) {
+            throw std::runtime_error("bad string index");
+        }
+        return strings_[index];
+    }
+
+    template <typename T> static T required(T node) {
+        if (!node) {
+            throw std::runtime_error("missing node");
+        }
+        return node;
+    }
+
+    // an element count, bounded by the bytes left so a damaged count can't allocate gigabytes
+    size_t count() {
+        uint32_t n = u32();
+        check(n);
+        return n;
+    }
+
+    uint8_t u8() {
+        uint8_t value;
+        bytes(&value, sizeof(value));
+        return value;
+    }
+
+    uint32_t u32() {
+        uint32_t value;
+        bytes(&value, sizeof(value));
+        return value;
+    }
+
+    void bytes(void *out, size_t size) {
+        check(size);
+        std::memcpy(out, position_, size);
+        position_ += size;
+    }
+
+    void check(size_t size) const {
+        if (size > static_cast<size_t>(end_ - position_)) {
+            throw std::runtime_error("truncated cache file");
+        }
+    }
+
+    const char *position_;
+    const char *end_;
+    std::vector<stmt::Function *> *functions_;
+    std::vector<std::string> strings_;
+};
+
+} // namespace
+
+uint64_t checksum(const char *data, size_t size) {
+    return fnv1a(14695981039346656037ULL, data, size);
+}
+
+std::string encode_program(const Program &program, std::vector<stmt::Function *> *functions) {
+    return Writer(functions).finish(program);
+}
+
+Program::ptr decode_program(const char *data, size_t size, std::vector<stmt::Function *> *functions) {
+    auto statements = Reader(data, size, functions).read();
+    // the resolver's annotations are remade rather than read: the interpreter relies on them to know the shape of
+    // the nodes they mark, so a damaged flag would crash it instead of failing here; inlining decisions alike
+    Resolver resolver;
+    resolver.resolve(statements);
+    Inliner::run(statements);
+    return std::make_shared<Program>(std::move(statements));
+}
+
+std::string ProgramCache::path(const std::string &source) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.loxc", static_cast<unsigned long long>(content_hash(source)));
+    return directory_ + "/" + name;
+}
+
+Program::ptr ProgramCache::load(const std::string &source) const {
+    Tracer::Scope trace("load", "phase", 0);
+    int fd = ::open(path(source).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    Program::ptr program;
+    try {
+        const auto *bytes = static_cast<const char *>(data);
+        Header header;
+        if (static_cast<size_t>(st.st_size) < sizeof(header)) {
+            throw std::runtime_error("truncated cache file");
+        }
+        std::memcpy(&header, bytes, sizeof(header));
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kFormatVersion ||
+            header.source_size != source.size() || st.st_size - sizeof(header) < source.size() ||
+            std::memcmp(bytes + sizeof(header), source.data(), source.size()) != 0) {
+            throw std::runtime_error("not a cache file for this source");
+        }
+        size_t offset = sizeof(header) + source.size();
+        if (checksum(bytes + offset, st.st_size - offset) != header.checksum) {
+            throw std::runtime_error("damaged cache file");
+        }
+        program = decode_program(bytes + offset, st.st_size - offset);
+    } catch (const std::exception &) {
+        // a damaged or foreign file is a miss, the next store replaces it
+    }
+    ::munmap(data, st.st_size);
+    return program;
+}
+
+bool ProgramCache::store(const std::string &source, const Program &program) const {
+    ::mkdir(directory_.c_str(), 0755);
+    std::string target = path(source);
+    // written aside and renamed, a concurrent load never sees half a file
+    std::string temporary = target + ".tmp." + std::to_string(::getpid());
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            return false;
+        }
+        Header header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kFormatVersion;
+        header.source_size = source.size();
+        std::string bytes = encode_program(program);
+        header.checksum = checksum(bytes.data(), bytes.size());
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(source.data(), static_cast<std::streamsize>(source.size()));
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!out.good()) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), target.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lox/program.h"
+#include "lox/statement.h"
+
+// the binary program encoding shared by the cache and heap snapshots; functions, when given, receives every
+// function declaration in preorder, the same numbering on both sides
+std::string encode_program(const Program &program, std::vector<stmt::Function *> *functions = nullptr);
+
+// FNV-1a over size bytes, stored by the cache and snapshots to notice a damaged file before decoding it
+uint64_t checksum(const char *data, size_t size);
+
+// throws std::runtime_error when the bytes are damaged, a RuntimeError among them when the tree they encode doesn't
+// resolve
+Program::ptr decode_program(const char *data, size_t size, std::vector<stmt::Function *> *functions = nullptr);
+
+/*
+ * Keeps compiled programs in a directory so an unchanged script skips lexing
+ * and parsing. A program is stored as a flat preorder stream of node tags
+ * with every identifier and string literal interned once in a table up
+ * front. Files are named after a hash of the source and the format version,
+ * so editing the script or upgrading the interpreter just misses; the file
+ * keeps the source too, so two scripts whose hashes collide miss as well.
+ * Loading maps the file, rebuilds the tree in one linear pass and resolves
+ * it again, the resolver's annotations are not stored.
+ *
+ * Bump kFormatVersion in program_cache.cpp whenever a node gains a field.
+ */
+class ProgramCache {
+ public:
+    explicit ProgramCache(std::string directory) : directory_(std::move(directory)) {}
+
+    // the cached program for this source, nullptr when there is none or the file is damaged
+    Program::ptr load(const std::string &source) const;
+
+    // writes the program atomically, returns false when the directory is not writable
+    bool store(const std::string &source, const Program &program) const;
+
+    std::string path(const std::string &source) const;
+
+ private:
+    std::string directory_;
+};
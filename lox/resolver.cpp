@@ -4,8 +4,11 @@
 
 #include "lox/resolver.h"
 
+#include <algorithm>
+
 Resolver::Resolver() {
     scopes_.emplace_back();
+    scope_ids_.push_back(0);
 }
 
 void Resolver::resolve(const std::vector<stmt::Statement::ptr> &statements) {
@@ -34,10 +37,69 @@ void Resolver::resolve_function(stmt::Function *stmt) {
 
 void Resolver::begin_scope() {
     scopes_.emplace_back();
+    scope_ids_.push_back(next_scope_id_++);
 }
 
 void Resolver::end_scope() {
+    // a name declared after a local function in a scope around it is what the interpreter's lookup finds at run time
+    size_t closing = scopes_.size() - 1;
+    for (Local &local : locals_) {
+        if (local.scope < closing) {
+            continue;
+        }
+        for (const auto &[name, found] : local.uses) {
+            if (found.first < closing && scopes_.back().count(name) != 0) {
+                local.shadowed = true;
+            }
+        }
+    }
     scopes_.pop_back();
+    scope_ids_.pop_back();
+    if (scopes_.size() == 1) {
+        lift();
+    }
+}
+
+size_t Resolver::scope_of(const std::string &name) const {
+    for (size_t i = scopes_.size() - 1; i > 0; i--) {
+        if (scopes_[i].count(name) != 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+void Resolver::reference(const std::string &name) {
+    size_t scope = scope_of(name);
+    for (size_t index : open_) {
+        Local &local = locals_[index];
+        // its parameters are in the scope after the one it is declared in
+        if (scope <= local.scope) {
+            local.uses.emplace(name, std::make_pair(scope, scope_ids_[scope]));
+        }
+    }
+}
+
+void Resolver::lift() {
+    for (Local &local : locals_) {
+        bool lifted = !local.shadowed;
+        std::vector<std::string> captures;
+        for (const auto &[name, found] : local.uses) {
+            if (found.first == 0) {
+                continue;
+            }
+            if (assigned_locals_.count({found.second, name}) != 0) {
+                lifted = false;
+            }
+            captures.push_back(name);
+        }
+        local.function->lifted = lifted;
+        if (lifted) {
+            local.function->captures = std::move(captures);
+        }
+    }
+    locals_.clear();
+    assigned_locals_.clear();
 }
 
 void Resolver::declare(const Token::ptr &name) {
@@ -61,6 +123,7 @@ void Resolver::define(const Token::ptr &name) {
 Value Resolver::visit_block_stmt(stmt::Block *stmt) {
     begin_scope();
     resolve(stmt->statements);
+    stmt->scoped = !scopes_.back().empty();
     end_scope();
     return nullptr;
 }
@@ -78,7 +141,14 @@ Value Resolver::visit_function_stmt(stmt::Function *stmt) {
     declare(stmt->name);
     define(stmt->name); // lets a function recursively refer to itself inside its own body
 
+    if (scopes_.size() == 1) {
+        resolve_function(stmt);
+        return nullptr;
+    }
+    open_.push_back(locals_.size());
+    locals_.push_back({stmt, scopes_.size() - 1, {}});
     resolve_function(stmt);
+    open_.pop_back();
 
     return nullptr;
 }
@@ -89,13 +159,60 @@ Value Resolver::visit_expression_stmt(stmt::Expression *stmt) {
 }
 
 Value Resolver::visit_for_stmt(stmt::For *stmt) {
-    resolve(stmt->initializer);
+    // the interpreter runs every loop in its own environment, so does the resolver
+    begin_scope();
+    if (stmt->initializer) {
+        resolve(stmt->initializer);
+    }
     resolve(stmt->condition);
-    resolve(stmt->increment);
+    if (stmt->increment) {
+        resolve(stmt->increment);
+    }
+    size_t assigned = assigned_.size();
     resolve(stmt->body);
+    end_scope();
+    stmt->counted = counted(stmt, {assigned_.begin() + static_cast<long>(assigned), assigned_.end()});
     return nullptr;
 }
 
+bool Resolver::counted(const stmt::For *stmt, const std::vector<std::string> &assigned) {
+    auto *var = dynamic_cast<const stmt::Var *>(stmt->initializer.get());
+    auto *condition = dynamic_cast<const expr::Binary *>(stmt->condition.get());
+    auto *increment = dynamic_cast<const stmt::Expression *>(stmt->increment.get());
+    if (var == nullptr || !var->value || condition == nullptr || increment == nullptr) {
+        return false;
+    }
+    const std::string &counter = var->name->lexeme;
+    auto names = [&counter](const expr::Expr *expr) {
+        auto *variable = dynamic_cast<const expr::Variable *>(expr);
+        return variable != nullptr && variable->name->lexeme == counter;
+    };
+
+    Token::Kind compare = condition->op->kind;
+    if (compare != Token::LESS && compare != Token::LESS_EQUAL && compare != Token::GREATER &&
+        compare != Token::GREATER_EQUAL) {
+        return false;
+    }
+    auto *literal_bound = dynamic_cast<const expr::Literal *>(condition->right.get());
+    bool bound = literal_bound != nullptr ? literal_bound->value.is<double>()
+                                          : dynamic_cast<const expr::Variable *>(condition->right.get()) != nullptr;
+    if (!names(condition->left.get()) || !bound || names(condition->right.get())) {
+        return false;
+    }
+
+    auto *assign = dynamic_cast<const expr::Assign *>(increment->expression.get());
+    auto *step = assign != nullptr ? dynamic_cast<const expr::Binary *>(assign->value.get()) : nullptr;
+    if (step == nullptr || assign->name->lexeme != counter ||
+        (step->op->kind != Token::PLUS && step->op->kind != Token::MINUS) || !names(step->left.get())) {
+        return false;
+    }
+    auto *literal_step = dynamic_cast<const expr::Literal *>(step->right.get());
+    if (literal_step == nullptr || !literal_step->value.is<double>()) {
+        return false;
+    }
+    return std::find(assigned.begin(), assigned.end(), counter) == assigned.end();
+}
+
 Value Resolver::visit_while_stmt(stmt::While *stmt) {
     resolve(stmt->condition);
     resolve(stmt->body);
@@ -123,6 +240,8 @@ Value Resolver::visit_return_stmt(stmt::Return *stmt) {
     if (scopes_.size() == 1) {
         throw RuntimeError(stmt->keyword, "Can't return from top-level code.");
     }
+    // nothing runs after a returned call, not even a finally, so every `return f(...)` is a tail call
+    stmt->tail_call = dynamic_cast<expr::Call *>(stmt->value.get()) != nullptr;
     return nullptr;
 }
 
@@ -165,6 +284,8 @@ Value Resolver::visit_super_expr(expr::Super *expr) {
     if (!class_has_super_) {
         throw RuntimeError(expr->keyword, "Can't use 'super' in a class which has no super class.");
     }
+    reference("super");
+    reference("this");
     return nullptr;
 }
 
@@ -183,6 +304,7 @@ Value Resolver::visit_this_expr(expr::This *expr) {
     if (!in_class_) {
         throw RuntimeError(expr->name, "Can't use 'this' outside of a class.");
     }
+    reference("this");
     return nullptr;
 }
 
@@ -190,10 +312,17 @@ Value Resolver::visit_variable_expr(expr::Variable *expr) {
     if (!scopes_.empty() && scopes_.back().count(expr->name->lexeme) && !scopes_.back()[expr->name->lexeme]) {
         throw RuntimeError(expr->name, "Can't read local variable in its own initializer.");
     }
+    reference(expr->name->lexeme);
     return nullptr;
 }
 
 Value Resolver::visit_assign_expr(expr::Assign *expr) {
     resolve(expr->value);
+    assigned_.push_back(expr->name->lexeme);
+    reference(expr->name->lexeme);
+    size_t scope = scope_of(expr->name->lexeme);
+    if (scope != 0) {
+        assigned_locals_.emplace(scope_ids_[scope], expr->name->lexeme);
+    }
     return nullptr;
 }
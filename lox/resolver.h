@@ -4,8 +4,11 @@
 
 #pragma once
 
+#include <map>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "lox/exception.h"
@@ -38,7 +41,7 @@ class Resolver : public stmt::Visitor, public expr::Visitor {
     Value visit_this_expr(expr::This *expr) override;
     Value visit_variable_expr(expr::Variable *expr) override;
     Value visit_assign_expr(expr::Assign *expr) override;
-    Value visit_literal_expr(expr::Literal *expr) override {
+    Value visit_literal_expr(expr::Literal * /*expr*/) override {
         return nullptr;
     }
     Value visit_grouping_expr(expr::Grouping *expr) override {
@@ -80,7 +83,39 @@ class Resolver : public stmt::Visitor, public expr::Visitor {
     void declare(const Token::ptr &name);
     void define(const Token::ptr &name);
 
+    // the index in scopes_ of the innermost scope declaring name, 0 when it is a global or undeclared
+    size_t scope_of(const std::string &name) const;
+    // a read or assignment of name, noted as a capture of the local functions being resolved it isn't local to
+    void reference(const std::string &name);
+    // decides which local functions are lifted, once every scope they could capture from is resolved
+    void lift();
+
+    // whether a for loop is counted, given the names assigned in its body
+    static bool counted(const stmt::For *stmt, const std::vector<std::string> &assigned);
+
     std::vector<std::unordered_map<std::string, bool>> scopes_;
+    // every name assigned so far, in resolution order
+    std::vector<std::string> assigned_;
+
+    // a function declared in a local scope, until it is decided whether it is lifted
+    struct Local {
+        stmt::Function *function;
+        // the index in scopes_ of the scope it is declared in
+        size_t scope;
+        // the names it uses from outside its body, by the index and the id of the scope they are found in
+        std::map<std::string, std::pair<size_t, size_t>> uses;
+        // a use found a different variable than the one a name lookup at run time finds
+        bool shadowed{false};
+    };
+
+    // ids of the scopes in scopes_, 0 for the global one
+    std::vector<size_t> scope_ids_;
+    size_t next_scope_id_{1};
+    std::vector<Local> locals_;
+    // the locals_ being resolved, innermost last
+    std::vector<size_t> open_;
+    // the locals ever assigned, by the id of their scope
+    std::set<std::pair<size_t, std::string>> assigned_locals_;
     bool in_class_{false};
     bool class_has_super_{false};
 };
@@ -4,5 +4,33 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include "lox/value.h"
-#include <exception>
+
+class LoxFunction;
+
+/*
+ * How a function body finished. A return statement records it on the
+ * interpreter and the blocks and loops around it stop early, so returning
+ * costs a flag check per enclosing statement instead of an unwind. A
+ * `return f(...)` to a Lox function records the call rather than making it,
+ * and the function returning runs it in its own place.
+ */
+struct Completion {
+    enum Kind { NORMAL, RETURN, TAIL_CALL };
+
+    Kind kind{NORMAL};
+    Value value;
+    std::shared_ptr<LoxFunction> callee;
+    std::vector<Value> arguments;
+    int line{0};
+
+    static Completion returning(Value value) {
+        Completion completion;
+        completion.kind = RETURN;
+        completion.value = std::move(value);
+        return completion;
+    }
+};
@@ -0,0 +1,468 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/server.h"
+
+#include <arpa/inet.h>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "lox/lox.h"
+
+namespace {
+
+constexpr uint32_t kMaxFrame = 64 << 20;
+constexpr size_t kMaxCachedPrograms = 256;
+
+bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::read(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool write_frame(int fd, char type, const char *payload, size_t size) {
+    char header[5];
+    header[0] = type;
+    uint32_t length = htonl(static_cast<uint32_t>(size));
+    std::memcpy(header + 1, &length, sizeof(length));
+    return write_all(fd, header, sizeof(header)) && write_all(fd, payload, size);
+}
+
+bool write_frame(int fd, char type, const std::string &payload) {
+    return write_frame(fd, type, payload.data(), payload.size());
+}
+
+bool read_frame(int fd, char *type, std::string *payload) {
+    char header[5];
+    if (!read_all(fd, header, sizeof(header))) {
+        return false;
+    }
+    *type = header[0];
+    uint32_t length;
+    std::memcpy(&length, header + 1, sizeof(length));
+    length = ntohl(length);
+    if (length > kMaxFrame) {
+        return false;
+    }
+    payload->resize(length);
+    return read_all(fd, &(*payload)[0], length);
+}
+
+// streams whatever a script prints to the client as 'O' frames
+class FrameBuffer : public std::streambuf {
+ public:
+    explicit FrameBuffer(int fd) : fd_(fd) {
+        setp(buffer_, buffer_ + sizeof(buffer_));
+    }
+
+ protected:
+    int_type overflow(int_type ch) override {
+        if (sync() != 0) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override {
+        size_t size = pptr() - pbase();
+        if (size > 0 && !write_frame(fd_, 'O', pbase(), size)) {
+            // the client went away, the run finishes without an audience
+            failed_ = true;
+        }
+        setp(buffer_, buffer_ + sizeof(buffer_));
+        return failed_ ? -1 : 0;
+    }
+
+ private:
+    int fd_;
+    bool failed_{false};
+    char buffer_[4096];
+};
+
+uint64_t content_hash(const std::string &source) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : source) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// the arguments of a run: a JSON object whose members are numbers, strings, booleans or null
+class GlobalsParser {
+ public:
+    explicit GlobalsParser(const std::string &json) : json_(json) {}
+
+    std::unordered_map<std::string, Value> parse() {
+        std::unordered_map<std::string, Value> globals;
+        expect('{');
+        if (!consume('}')) {
+            do {
+                std::string name = string();
+                expect(':');
+                globals[name] = value();
+            } while (consume(','));
+            expect('}');
+        }
+        skip_whitespace();
+        if (position_ != json_.size()) {
+            fail("trailing characters");
+        }
+        return globals;
+    }
+
+ private:
+    Value value() {
+        skip_whitespace();
+        if (position_ < json_.size() && json_[position_] == '"') {
+            return string();
+        }
+        for (const char *word : {"true", "false", "null"}) {
+            if (json_.compare(position_, std::strlen(word), word) == 0) {
+                position_ += std::strlen(word);
+                if (word[0] == 'n') {
+                    return nullptr;
+                }
+                return word[0] == 't';
+            }
+        }
+        const char *begin = json_.c_str() + position_;
+        char *end = nullptr;
+        double number = std::strtod(begin, &end);
+        if (end == begin) {
+            fail("arguments must be numbers, strings, booleans or null");
+        }
+        position_ += end - begin;
+        return number;
+    }
+
+    std::string string() {
+        expect('"');
+        std::string out;
+        while (position_ < json_.size() && json_[position_] != '"') {
+            char c = json_[position_++];
+            if (c == '\\' && position_ < json_.size()) {
+                char escaped = json_[position_++];
+                switch (escaped) {
+                case 'n':
+                    c = '\n';
+                    break;
+                case 't':
+                    c = '\t';
+                    break;
+                case 'r':
+                    c = '\r';
+                    break;
+                case 'u':
+                    if (position_ + 4 > json_.size()) {
+                        fail("truncated \\u escape");
+                    }
+                    // code points beyond ASCII are not needed for arguments, keep the low byte
+                    c = static_cast<char>(std::stoi(json_.substr(position_, 4), nullptr, 16));
+                    position_ += 4;
+                    break;
+                default:
+                    c = escaped;
+                }
+            }
+            out += c;
+        }
+        expect('"');
+        return out;
+    }
+
+    void skip_whitespace() {
+        while (position_ < json_.size() && std::isspace(static_cast<unsigned char>(json_[position_]))) {
+            position_++;
+        }
+    }
+
+    bool consume(char c) {
+        skip_whitespace();
+        if (position_ < json_.size() && json_[position_] == c) {
+            position_++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!consume(c)) {
+            fail(std::string("expected '") + c + "'");
+        }
+    }
+
+    [[noreturn]] void fail(const std::string &message) {
+        throw std::invalid_argument("bad arguments JSON at offset " + std::to_string(position_) + ": " + message);
+    }
+
+    const std::string &json_;
+    size_t position_{0};
+};
+
+std::string format_error(const Lox::Error &error) {
+    if (error.line > 0) {
+        return "line:" + std::to_string(error.line) + "  " + error.message;
+    }
+    return error.message;
+}
+
+char socket_path[sizeof(sockaddr_un::sun_path)];
+
+void remove_socket(int) {
+    ::unlink(socket_path);
+    ::_exit(0);
+}
+
+bool socket_address(const std::string &path, sockaddr_un *address) {
+    if (path.size() >= sizeof(address->sun_path)) {
+        std::cerr << "socket path '" << path << "' is too long" << std::endl;
+        return false;
+    }
+    std::memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    std::memcpy(address->sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+} // namespace
+
+Server::Server(Options options) : options_(std::move(options)) {}
+
+int Server::serve() {
+    sockaddr_un address;
+    if (!socket_address(options_.serve_path, &address)) {
+        return 1;
+    }
+    // a socket file left behind by a server that was killed would make bind fail, anything else at the path is kept
+    struct stat status;
+    if (::lstat(address.sun_path, &status) == 0) {
+        if (!S_ISSOCK(status.st_mode)) {
+            std::cerr << "can't listen on '" << options_.serve_path << "': the path exists and is not a socket"
+                      << std::endl;
+            return 1;
+        }
+        ::unlink(address.sun_path);
+    }
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "can't listen on '" << options_.serve_path << "': " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    std::memcpy(socket_path, address.sun_path, sizeof(socket_path));
+    std::signal(SIGINT, remove_socket);
+    std::signal(SIGTERM, remove_socket);
+
+    int workers = options_.serve_workers;
+    if (workers == 0) {
+        workers = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    for (int i = 0; i < workers; i++) {
+        std::thread(&Server::work, this).detach();
+    }
+    std::cerr << "serving on " << options_.serve_path << " with " << workers << " isolate(s)" << std::endl;
+
+    for (;;) {
+        int connection = ::accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            connections_.push(connection);
+        }
+        queue_ready_.notify_one();
+    }
+}
+
+void Server::work() {
+    // one warm isolate per worker, recycled between runs
+    Lox lox(options_.engine());
+    for (;;) {
+        int connection;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_ready_.wait(lock, [this]() { return !connections_.empty(); });
+            connection = connections_.front();
+            connections_.pop();
+        }
+        handle(connection, &lox);
+        ::close(connection);
+        lox.reset();
+    }
+}
+
+void Server::handle(int connection, Lox *lox) {
+    std::string source;
+    std::string arguments;
+    std::string error;
+    for (;;) {
+        char type;
+        std::string payload;
+        if (!read_frame(connection, &type, &payload)) {
+            return;
+        }
+        if (type == 'E') {
+            break;
+        } else if (type == 'S') {
+            source = std::move(payload);
+        } else if (type == 'A') {
+            arguments = std::move(payload);
+        } else if (type == 'P') {
+            std::ifstream file(payload, std::ios::binary);
+            if (!file.is_open()) {
+                error = "can't open file '" + payload + "': No such file or directory";
+            }
+            source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        } else {
+            error = std::string("unknown request frame '") + type + "'";
+        }
+    }
+
+    int exit_code = 0;
+    std::unordered_map<std::string, Value> globals;
+    Program::ptr program;
+    if (error.empty() && !arguments.empty()) {
+        try {
+            globals = GlobalsParser(arguments).parse();
+        } catch (const std::invalid_argument &e) {
+            error = e.what();
+        }
+    }
+    if (error.empty()) {
+        program = compile(source, &error);
+    }
+    if (program) {
+        FrameBuffer buffer(connection);
+        std::ostream out(&buffer);
+        lox->set_output(&out);
+        Lox::Result result = lox->run(program, globals);
+        out.flush();
+        lox->set_output(&std::cout);
+        error = format_error(result.error);
+        exit_code = result.exit_code < 0 ? 0 : result.exit_code;
+    }
+    if (!error.empty()) {
+        write_frame(connection, 'R', error);
+    }
+    write_frame(connection, 'X', std::to_string(exit_code));
+}
+
+Program::ptr Server::compile(const std::string &source, std::string *error) {
+    uint64_t hash = content_hash(source);
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        auto it = cache_.find(hash);
+        // the source is compared too, two scripts may share a hash
+        if (it != cache_.end() && it->second->second.first == source) {
+            cache_order_.splice(cache_order_.end(), cache_order_, it->second);
+            return it->second->second.second;
+        }
+    }
+
+    // compiled outside the lock, other workers keep running meanwhile
+    Lox::Error compile_error;
+    Program::ptr program = Lox::compile(source, &compile_error);
+    if (!program) {
+        *error = format_error(compile_error);
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto it = cache_.find(hash);
+    if (it != cache_.end()) {
+        cache_order_.erase(it->second);
+        cache_.erase(it);
+    }
+    if (cache_.size() >= kMaxCachedPrograms) {
+        cache_.erase(cache_order_.front().first);
+        cache_order_.pop_front();
+    }
+    cache_order_.emplace_back(hash, Entry(source, program));
+    cache_[hash] = std::prev(cache_order_.end());
+    return program;
+}
+
+int Server::client(const Options &options) {
+    std::ifstream file(options.script, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "can't open file '" << options.script << "': No such file or directory" << std::endl;
+        return 66;
+    }
+    std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    sockaddr_un address;
+    if (!socket_address(options.client_path, &address)) {
+        return 1;
+    }
+    int connection = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || ::connect(connection, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        std::cerr << "can't connect to '" << options.client_path << "': " << std::strerror(errno) << std::endl;
+        return 69;
+    }
+
+    bool sent = write_frame(connection, 'S', source) &&
+                (options.args_json.empty() || write_frame(connection, 'A', options.args_json)) &&
+                write_frame(connection, 'E', "");
+    char type;
+    std::string payload;
+    while (sent && read_frame(connection, &type, &payload)) {
+        if (type == 'O') {
+            std::cout.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        } else if (type == 'R') {
+            std::cout.flush();
+            std::cerr << payload << std::endl;
+        } else if (type == 'X') {
+            std::cout.flush();
+            ::close(connection);
+            return std::stoi(payload);
+        }
+    }
+    ::close(connection);
+    std::cerr << "connection to '" << options.client_path << "' closed before the run finished" << std::endl;
+    return 69;
+}
@@ -0,0 +1,63 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "lox/options.h"
+#include "lox/program.h"
+
+class Lox;
+
+/*
+ * lox --serve=SOCK keeps a pool of warm isolates behind a Unix domain socket
+ * so a run skips process start-up, builtin registration and, for a script it
+ * has seen before, lexing and parsing too. Each connection carries one run:
+ *
+ *   client -> server   'S' source | 'P' script path, then optionally 'A' a flat
+ *                      JSON object of globals to define, then 'E'
+ *   server -> client   'O' stdout, streamed as the script prints, any number
+ *                      'R' an error message, at most one
+ *                      'X' the exit code in decimal, always last
+ *
+ * Every frame is a type byte, a 4 byte big-endian payload length and the
+ * payload. A worker resets its isolate after each run, so runs see nothing of
+ * each other. What a task started with spawn() prints reaches the client
+ * when the script joins it.
+ */
+class Server {
+ public:
+    explicit Server(Options options);
+
+    // accepts connections until the process is terminated, returns an exit status on failure to listen
+    int serve();
+
+    // lox --client=SOCK: runs options.script on the server and relays its output, returns its exit code
+    static int client(const Options &options);
+
+ private:
+    void work();
+    void handle(int connection, Lox *lox);
+    Program::ptr compile(const std::string &source, std::string *error);
+
+    Options options_;
+
+    std::mutex queue_mutex_;
+    std::condition_variable queue_ready_;
+    std::queue<int> connections_;
+
+    // compiled programs by content hash, least recently used first
+    using Entry = std::pair<std::string, Program::ptr>;
+    std::mutex cache_mutex_;
+    std::list<std::pair<uint64_t, Entry>> cache_order_;
+    std::unordered_map<uint64_t, std::list<std::pair<uint64_t, Entry>>::iterator> cache_;
+};
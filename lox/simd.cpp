@@ -0,0 +1,367 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOX_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace simd {
+
+namespace scalar {
+
+double sum(const double *data, size_t n) {
+    double s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s += data[i];
+    }
+    return s;
+}
+
+double dot(const double *a, const double *b, size_t n) {
+    double s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s += a[i] * b[i];
+    }
+    return s;
+}
+
+// a NaN wins, wherever it is, so every implementation agrees on arrays holding one
+double min_of(double a, double b) {
+    return a < b || std::isnan(a) ? a : b;
+}
+
+double max_of(double a, double b) {
+    return a > b || std::isnan(a) ? a : b;
+}
+
+double min(const double *data, size_t n) {
+    double m = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < n; i++) {
+        m = min_of(m, data[i]);
+    }
+    return m;
+}
+
+double max(const double *data, size_t n) {
+    double m = -std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < n; i++) {
+        m = max_of(m, data[i]);
+    }
+    return m;
+}
+
+void scale(double *data, size_t n, double factor) {
+    for (size_t i = 0; i < n; i++) {
+        data[i] *= factor;
+    }
+}
+
+void add(double *dst, const double *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] += src[i];
+    }
+}
+
+void map_affine(double *data, size_t n, double mul, double add) {
+    for (size_t i = 0; i < n; i++) {
+        data[i] = data[i] * mul + add;
+    }
+}
+
+void prefix_sum(double *data, size_t n) {
+    double s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s += data[i];
+        data[i] = s;
+    }
+}
+
+} // namespace scalar
+
+#ifdef LOX_SIMD_X86
+
+namespace sse2 {
+
+double sum(const double *data, size_t n) {
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(data + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(data + i + 2));
+    }
+    s0 = _mm_add_pd(s0, s1);
+    double s = _mm_cvtsd_f64(_mm_add_sd(s0, _mm_unpackhi_pd(s0, s0)));
+    return s + scalar::sum(data + i, n - i);
+}
+
+double dot(const double *a, const double *b, size_t n) {
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    s0 = _mm_add_pd(s0, s1);
+    double s = _mm_cvtsd_f64(_mm_add_sd(s0, _mm_unpackhi_pd(s0, s0)));
+    return s + scalar::dot(a + i, b + i, n - i);
+}
+
+// minpd and maxpd drop a NaN in their first operand, the lanes that saw one are collected on the side
+double min(const double *data, size_t n) {
+    __m128d m = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    __m128d nan = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(data + i);
+        nan = _mm_or_pd(nan, _mm_cmpunord_pd(x, x));
+        m = _mm_min_pd(m, x);
+    }
+    if (_mm_movemask_pd(nan) != 0) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    double r = _mm_cvtsd_f64(_mm_min_sd(m, _mm_unpackhi_pd(m, m)));
+    return scalar::min_of(r, scalar::min(data + i, n - i));
+}
+
+double max(const double *data, size_t n) {
+    __m128d m = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    __m128d nan = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(data + i);
+        nan = _mm_or_pd(nan, _mm_cmpunord_pd(x, x));
+        m = _mm_max_pd(m, x);
+    }
+    if (_mm_movemask_pd(nan) != 0) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    double r = _mm_cvtsd_f64(_mm_max_sd(m, _mm_unpackhi_pd(m, m)));
+    return scalar::max_of(r, scalar::max(data + i, n - i));
+}
+
+void scale(double *data, size_t n, double factor) {
+    __m128d f = _mm_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(data + i, _mm_mul_pd(_mm_loadu_pd(data + i), f));
+    }
+    scalar::scale(data + i, n - i, factor);
+}
+
+void add(double *dst, const double *src, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+    }
+    scalar::add(dst + i, src + i, n - i);
+}
+
+void map_affine(double *data, size_t n, double mul, double add) {
+    __m128d m = _mm_set1_pd(mul);
+    __m128d a = _mm_set1_pd(add);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(data + i, _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(data + i), m), a));
+    }
+    scalar::map_affine(data + i, n - i, mul, add);
+}
+
+void prefix_sum(double *data, size_t n) {
+    // in-register scan of two lanes, then add the running total carried from the previous pair
+    __m128d carry = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(data + i);
+        x = _mm_add_pd(x, _mm_unpacklo_pd(_mm_setzero_pd(), x));
+        x = _mm_add_pd(x, carry);
+        _mm_storeu_pd(data + i, x);
+        carry = _mm_unpackhi_pd(x, x);
+    }
+    if (i < n) {
+        data[i] += _mm_cvtsd_f64(carry);
+    }
+}
+
+} // namespace sse2
+
+namespace avx {
+
+__attribute__((target("avx"))) static double horizontal_sum(__m256d v) {
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx"))) double sum(const double *data, size_t n) {
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(data + i));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(data + i + 4));
+    }
+    return horizontal_sum(_mm256_add_pd(s0, s1)) + scalar::sum(data + i, n - i);
+}
+
+__attribute__((target("avx"))) double dot(const double *a, const double *b, size_t n) {
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    return horizontal_sum(_mm256_add_pd(s0, s1)) + scalar::dot(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx"))) double min(const double *data, size_t n) {
+    __m256d m = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    __m256d nan = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(data + i);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+        m = _mm256_min_pd(m, x);
+    }
+    if (_mm256_movemask_pd(nan) != 0) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    __m128d r = _mm_min_pd(_mm256_castpd256_pd128(m), _mm256_extractf128_pd(m, 1));
+    double v = _mm_cvtsd_f64(_mm_min_sd(r, _mm_unpackhi_pd(r, r)));
+    return scalar::min_of(v, scalar::min(data + i, n - i));
+}
+
+__attribute__((target("avx"))) double max(const double *data, size_t n) {
+    __m256d m = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+    __m256d nan = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(data + i);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+        m = _mm256_max_pd(m, x);
+    }
+    if (_mm256_movemask_pd(nan) != 0) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    __m128d r = _mm_max_pd(_mm256_castpd256_pd128(m), _mm256_extractf128_pd(m, 1));
+    double v = _mm_cvtsd_f64(_mm_max_sd(r, _mm_unpackhi_pd(r, r)));
+    return scalar::max_of(v, scalar::max(data + i, n - i));
+}
+
+__attribute__((target("avx"))) void scale(double *data, size_t n, double factor) {
+    __m256d f = _mm256_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(data + i, _mm256_mul_pd(_mm256_loadu_pd(data + i), f));
+    }
+    scalar::scale(data + i, n - i, factor);
+}
+
+__attribute__((target("avx"))) void add(double *dst, const double *src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i)));
+    }
+    scalar::add(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx"))) void map_affine(double *data, size_t n, double mul, double add) {
+    __m256d m = _mm256_set1_pd(mul);
+    __m256d a = _mm256_set1_pd(add);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(data + i, _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(data + i), m), a));
+    }
+    scalar::map_affine(data + i, n - i, mul, add);
+}
+
+} // namespace avx
+
+#endif
+
+namespace {
+
+struct Kernels {
+    const char *isa;
+    double (*sum)(const double *, size_t);
+    double (*dot)(const double *, const double *, size_t);
+    double (*min)(const double *, size_t);
+    double (*max)(const double *, size_t);
+    void (*scale)(double *, size_t, double);
+    void (*add)(double *, const double *, size_t);
+    void (*map_affine)(double *, size_t, double, double);
+    void (*prefix_sum)(double *, size_t);
+};
+
+Kernels select_kernels() {
+#ifdef LOX_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        // a lane-crossing 4-wide scan needs AVX2 shuffles, the 2-wide SSE2 scan is as fast here
+        return {"avx", avx::sum, avx::dot, avx::min, avx::max, avx::scale, avx::add, avx::map_affine,
+            sse2::prefix_sum};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return {"sse2", sse2::sum, sse2::dot, sse2::min, sse2::max, sse2::scale, sse2::add, sse2::map_affine,
+            sse2::prefix_sum};
+    }
+#endif
+    return {"scalar", scalar::sum, scalar::dot, scalar::min, scalar::max, scalar::scale, scalar::add,
+        scalar::map_affine, scalar::prefix_sum};
+}
+
+const Kernels &kernels() {
+    static const Kernels k = select_kernels();
+    return k;
+}
+
+} // namespace
+
+double sum(const double *data, size_t n) {
+    return kernels().sum(data, n);
+}
+
+double dot(const double *a, const double *b, size_t n) {
+    return kernels().dot(a, b, n);
+}
+
+double min(const double *data, size_t n) {
+    return kernels().min(data, n);
+}
+
+double max(const double *data, size_t n) {
+    return kernels().max(data, n);
+}
+
+void scale(double *data, size_t n, double factor) {
+    kernels().scale(data, n, factor);
+}
+
+void add(double *dst, const double *src, size_t n) {
+    kernels().add(dst, src, n);
+}
+
+void map_affine(double *data, size_t n, double mul, double add) {
+    kernels().map_affine(data, n, mul, add);
+}
+
+void prefix_sum(double *data, size_t n) {
+    kernels().prefix_sum(data, n);
+}
+
+const char *isa() {
+    return kernels().isa;
+}
+
+} // namespace simd
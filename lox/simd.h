@@ -0,0 +1,30 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Bulk kernels over contiguous doubles. Each entry point dispatches once, at
+ * startup, to the widest implementation the CPU supports (AVX, SSE2 or plain
+ * scalar code), so callers never pay for feature checks inside a loop.
+ */
+namespace simd {
+
+double sum(const double *data, size_t n);
+double dot(const double *a, const double *b, size_t n);
+// NaN when data holds one, in every implementation
+double min(const double *data, size_t n);
+double max(const double *data, size_t n);
+
+void scale(double *data, size_t n, double factor);
+void add(double *dst, const double *src, size_t n);
+void map_affine(double *data, size_t n, double mul, double add);
+void prefix_sum(double *data, size_t n);
+
+// name of the instruction set picked by the dispatcher: "avx", "sse2" or "scalar"
+const char *isa();
+
+} // namespace simd
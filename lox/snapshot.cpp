@@ -0,0 +1,538 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/snapshot.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "lox/float64_array.h"
+#include "lox/function.h"
+#include "lox/instance.h"
+#include "lox/interpreter.h"
+#include "lox/klass.h"
+#include "lox/program_cache.h"
+
+namespace {
+
+constexpr char kMagic[4] = {'L', 'O', 'X', 'S'};
+// the programs inside are in the cache's encoding, bumped along with its kFormatVersion
+constexpr uint32_t kVersion = 3;
+
+// object 0 is the globals environment of whichever interpreter restores the image
+constexpr uint32_t kGlobals = 0;
+constexpr uint32_t kNone = UINT32_MAX;
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t program_count;
+    uint32_t object_count;
+    uint32_t fill_count;
+    uint32_t top_level;
+    // of everything after the header
+    uint64_t checksum;
+};
+
+enum Kind : uint8_t { ENVIRONMENT, FUNCTION, CLASS, INSTANCE, ARRAY };
+
+// OBJECT is an object held under its own pointer type, CALLABLE one held as Callable::ptr the way `fun` declares it
+enum Tag : uint8_t { NIL, FALSE, TRUE, NUMBER, STRING, OBJECT, CALLABLE, NATIVE };
+
+class Encoder {
+ public:
+    explicit Encoder(Interpreter &interpreter) : globals_(interpreter.globals()) {
+        const auto &programs = interpreter.programs();
+        for (uint32_t i = 0; i < programs.size(); i++) {
+            std::vector<stmt::Function *> functions;
+            programs_.push_back(encode_program(*programs[i], &functions));
+            for (uint32_t j = 0; j < functions.size(); j++) {
+                declarations_[functions[j]] = {i, j};
+            }
+        }
+        ids_[globals_.get()] = kGlobals;
+        top_level_ = id(interpreter.top_level());
+    }
+
+    std::string finish() {
+        // variables defined straight into the globals, around the builtins
+        std::string globals;
+        uint32_t count = 0;
+        for (const auto &item : globals_->values()) {
+            const auto *callable = item.second.get_if<Callable::ptr>();
+            if (callable && !dynamic_cast<LoxFunction *>(callable->get()) && !dynamic_cast<LoxClass *>(callable->get())) {
+                continue;
+            }
+            string(&globals, item.first);
+            value(&globals, item.second);
+            count++;
+        }
+        // filling a scope or an instance can reach objects nobody has filled yet
+        while (!pending_.empty()) {
+            auto fill = pending_.front();
+            pending_.pop_front();
+            fill_count_++;
+            u32(&fills_, fill.first);
+            fill.second();
+        }
+
+        std::string out;
+        Header header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.program_count = static_cast<uint32_t>(programs_.size());
+        header.object_count = next_id_ - 1;
+        header.fill_count = fill_count_;
+        header.top_level = top_level_;
+        for (const auto &program : programs_) {
+            u32(&out, static_cast<uint32_t>(program.size()));
+            out += program;
+        }
+        u32(&out, count);
+        out += objects_ + fills_ + globals;
+        header.checksum = checksum(out.data(), out.size());
+        return std::string(reinterpret_cast<const char *>(&header), sizeof(header)) + out;
+    }
+
+ private:
+    // numbers an object after everything it is constructed from, its contents are filled in later
+    uint32_t id(const Environment::ptr &env) {
+        auto it = ids_.find(env.get());
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        if (!env->enclosing()) {
+            throw std::runtime_error("an environment outside the interpreter can't be saved");
+        }
+        uint32_t enclosing = id(env->enclosing());
+        uint32_t id = add(env.get(), ENVIRONMENT);
+        u32(&objects_, enclosing);
+        pending_.emplace_back(id, [this, env]() {
+            u32(&fills_, static_cast<uint32_t>(env->values().size()));
+            for (const auto &item : env->values()) {
+                string(&fills_, item.first);
+                value(&fills_, item.second);
+            }
+        });
+        return id;
+    }
+
+    uint32_t id(const LoxFunction::ptr &function) {
+        auto it = ids_.find(function.get());
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        auto declaration = declarations_.find(function->declaration());
+        if (declaration == declarations_.end()) {
+            throw std::runtime_error("function " + function->name() + " comes from a released program");
+        }
+        uint32_t closure = id(function->closure());
+        uint32_t id = add(function.get(), FUNCTION);
+        u32(&objects_, declaration->second.first);
+        u32(&objects_, declaration->second.second);
+        u32(&objects_, closure);
+        objects_.push_back(function->is_initializer ? 1 : 0);
+        return id;
+    }
+
+    uint32_t id(const LoxClass::ptr &klass) {
+        auto it = ids_.find(klass.get());
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        uint32_t super = klass->superclass() ? id(klass->superclass()) : kNone;
+        std::vector<std::pair<std::string, uint32_t>> methods;
+        for (const auto &item : klass->methods()) {
+            methods.emplace_back(item.first, id(item.second));
+        }
+        uint32_t id = add(klass.get(), CLASS);
+        string(&objects_, klass->name());
+        u32(&objects_, super);
+        u32(&objects_, static_cast<uint32_t>(methods.size()));
+        for (const auto &method : methods) {
+            string(&objects_, method.first);
+            u32(&objects_, method.second);
+        }
+        return id;
+    }
+
+    uint32_t id(const LoxInstance::ptr &instance) {
+        auto it = ids_.find(instance.get());
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        uint32_t klass = id(instance->klass());
+        uint32_t id = add(instance.get(), INSTANCE);
+        u32(&objects_, klass);
+        pending_.emplace_back(id, [this, instance]() {
+            u32(&fills_, static_cast<uint32_t>(instance->fields().size()));
+            for (const auto &item : instance->fields()) {
+                string(&fills_, item.first);
+                value(&fills_, item.second);
+            }
+        });
+        return id;
+    }
+
+    uint32_t id(const Float64Array::ptr &array) {
+        auto it = ids_.find(array.get());
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        uint32_t id = add(array.get(), ARRAY);
+        u32(&objects_, static_cast<uint32_t>(array->size()));
+        objects_.push_back(array->frozen() ? 1 : 0);
+        objects_.append(reinterpret_cast<const char *>(array->data()), array->size() * sizeof(double));
+        return id;
+    }
+
+    uint32_t add(const void *object, Kind kind) {
+        uint32_t id = next_id_++;
+        ids_[object] = id;
+        objects_.push_back(static_cast<char>(kind));
+        return id;
+    }
+
+    void value(std::string *out, const Value &value) {
+        if (value.is<nullptr_t>()) {
+            out->push_back(NIL);
+        } else if (value.is<bool>()) {
+            out->push_back(value.as<bool>() ? TRUE : FALSE);
+        } else if (value.is<double>()) {
+            out->push_back(NUMBER);
+            double number = value.as<double>();
+            out->append(reinterpret_cast<const char *>(&number), sizeof(number));
+        } else if (value.is<std::string>()) {
+            out->push_back(STRING);
+            string(out, value.as<std::string>());
+        } else if (const auto *function = value.get_if<LoxFunction::ptr>()) {
+            object(out, OBJECT, id(*function));
+        } else if (const auto *klass = value.get_if<LoxClass::ptr>()) {
+            object(out, OBJECT, id(*klass));
+        } else if (const auto *instance = value.get_if<LoxInstance::ptr>()) {
+            object(out, OBJECT, id(*instance));
+        } else if (const auto *array = value.get_if<Float64Array::ptr>()) {
+            object(out, OBJECT, id(*array));
+        } else if (const auto *callable = value.get_if<Callable::ptr>()) {
+            if (auto function = std::dynamic_pointer_cast<LoxFunction>(*callable)) {
+                object(out, CALLABLE, id(function));
+            } else if (auto klass = std::dynamic_pointer_cast<LoxClass>(*callable)) {
+                object(out, CALLABLE, id(klass));
+            } else {
+                out->push_back(NATIVE);
+                string(out, (*callable)->name());
+            }
+        } else {
+            throw std::runtime_error("a " + value.type() + " can't be saved in a snapshot");
+        }
+    }
+
+    static void object(std::string *out, Tag tag, uint32_t id) {
+        out->push_back(tag);
+        u32(out, id);
+    }
+
+    static void string(std::string *out, const std::string &s) {
+        u32(out, static_cast<uint32_t>(s.size()));
+        out->append(s);
+    }
+
+    static void u32(std::string *out, uint32_t value) {
+        out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    Environment::ptr globals_;
+    std::vector<std::string> programs_;
+    std::unordered_map<const stmt::Function *, std::pair<uint32_t, uint32_t>> declarations_;
+    std::unordered_map<const void *, uint32_t> ids_;
+    uint32_t next_id_{1};
+    uint32_t top_level_{0};
+    std::deque<std::pair<uint32_t, std::function<void()>>> pending_;
+    uint32_t fill_count_{0};
+    std::string objects_;
+    std::string fills_;
+};
+
+class Decoder {
+ public:
+    Decoder(const char *data, size_t size) : position_(data), end_(data + size) {}
+
+    void restore(Interpreter *interpreter) {
+        Header header;
+        bytes(&header, sizeof(header));
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion) {
+            throw std::runtime_error("not a snapshot of this interpreter version");
+        }
+        if (checksum(position_, end_ - position_) != header.checksum) {
+            throw std::runtime_error("damaged snapshot");
+        }
+
+        std::vector<Program::ptr> programs;
+        for (uint32_t i = 0; i < header.program_count; i++) {
+            uint32_t size = u32();
+            check(size);
+            functions_.emplace_back();
+            programs.push_back(decode_program(position_, size, &functions_.back()));
+            position_ += size;
+        }
+        uint32_t global_count = u32();
+
+        globals_ = interpreter->globals();
+        objects_.resize(header.object_count + 1);
+        objects_[kGlobals].env = globals_;
+        for (uint32_t id = 1; id <= header.object_count; id++) {
+            create(&objects_[id]);
+        }
+        for (uint32_t i = 0; i < header.fill_count; i++) {
+            Object &object = get(u32());
+            uint32_t count = u32();
+            for (uint32_t j = 0; j < count; j++) {
+                std::string name = string();
+                if (object.kind == ENVIRONMENT && object.env) {
+                    object.env->define(name, value());
+                } else if (object.kind == INSTANCE) {
+                    object.instance->set(name, value());
+                } else {
+                    throw std::runtime_error("contents for an object that has none");
+                }
+            }
+        }
+        for (uint32_t i = 0; i < global_count; i++) {
+            std::string name = string();
+            globals_->define(name, value());
+        }
+        if (position_ != end_) {
+            throw std::runtime_error("trailing bytes");
+        }
+
+        Object &top_level = get(header.top_level);
+        if (top_level.kind != ENVIRONMENT || !top_level.env) {
+            throw std::runtime_error("the top level is not an environment");
+        }
+        interpreter->restore(std::move(programs), top_level.env);
+    }
+
+ private:
+    struct Object {
+        Kind kind{ENVIRONMENT};
+        Environment::ptr env;
+        LoxFunction::ptr function;
+        LoxClass::ptr klass;
+        LoxInstance::ptr instance;
+        Float64Array::ptr array;
+    };
+
+    void create(Object *object) {
+        object->kind = static_cast<Kind>(u8());
+        switch (object->kind) {
+        case ENVIRONMENT:
+            object->env = std::make_shared<Environment>(expect(u32(), ENVIRONMENT).env);
+            break;
+        case FUNCTION: {
+            uint32_t program = u32();
+            uint32_t index = u32();
+            if (program >= functions_.size() || index >= functions_[program].size()) {
+                throw std::runtime_error("bad function declaration");
+            }
+            object->function = std::make_shared<LoxFunction>(functions_[program][index], expect(u32(), ENVIRONMENT).env);
+            object->function->is_initializer = u8() != 0;
+            // like the resolver's annotations, the flag is checked against the declaration it describes
+            if (object->function->is_initializer && functions_[program][index]->name->lexeme != "init") {
+                throw std::runtime_error("an initializer that isn't init");
+            }
+            break;
+        }
+        case CLASS: {
+            std::string name = string();
+            uint32_t super = u32();
+            std::unordered_map<std::string, LoxFunction::ptr> methods;
+            uint32_t count = u32();
+            for (uint32_t i = 0; i < count; i++) {
+                std::string method = string();
+                methods[method] = expect(u32(), FUNCTION).function;
+            }
+            object->klass = std::make_shared<LoxClass>(
+                name, super == kNone ? nullptr : expect(super, CLASS).klass, std::move(methods));
+            break;
+        }
+        case INSTANCE:
+            object->instance = std::make_shared<LoxInstance>(expect(u32(), CLASS).klass);
+            break;
+        case ARRAY: {
+            uint32_t size = u32();
+            bool frozen = u8() != 0;
+            check(static_cast<size_t>(size) * sizeof(double));
+            object->array = std::make_shared<Float64Array>(size);
+            bytes(object->array->data(), size * sizeof(double));
+            if (frozen) {
+                object->array->freeze();
+            }
+            break;
+        }
+        default:
+            throw std::runtime_error("bad object kind");
+        }
+    }
+
+    Value value() {
+        switch (u8()) {
+        case NIL:
+            return nullptr;
+        case FALSE:
+            return false;
+        case TRUE:
+            return true;
+        case NUMBER: {
+            double number;
+            bytes(&number, sizeof(number));
+            return number;
+        }
+        case STRING:
+            return string();
+        case OBJECT: {
+            Object &object = get(u32());
+            switch (object.kind) {
+            case FUNCTION:
+                return object.function;
+            case CLASS:
+                return object.klass;
+            case INSTANCE:
+                return object.instance;
+            case ARRAY:
+                return object.array;
+            default:
+                throw std::runtime_error("an environment is not a value");
+            }
+        }
+        case CALLABLE: {
+            Object &object = get(u32());
+            if (object.kind == FUNCTION) {
+                return Callable::ptr(object.function);
+            }
+            if (object.kind == CLASS) {
+                return Callable::ptr(object.klass);
+            }
+            throw std::runtime_error("not a callable");
+        }
+        case NATIVE: {
+            std::string name = string();
+            if (!globals_->contains(name)) {
+                throw std::runtime_error("the snapshot needs a builtin " + name + "() this interpreter lacks");
+            }
+            return globals_->get(name);
+        }
+        default:
+            throw std::runtime_error("bad value tag");
+        }
+    }
+
+    // objects only refer to ones created before them, so a forward reference means a damaged image
+    Object &get(uint32_t id) {
+        if (id >= objects_.size() || (id != kGlobals && !objects_[id].env && !objects_[id].function &&
+                                      !objects_[id].klass && !objects_[id].instance && !objects_[id].array)) {
+            throw std::runtime_error("bad object reference");
+        }
+        return objects_[id];
+    }
+
+    Object &expect(uint32_t id, Kind kind) {
+        Object &object = get(id);
+        if (object.kind != kind) {
+            throw std::runtime_error("object of the wrong kind");
+        }
+        return object;
+    }
+
+    std::string string() {
+        uint32_t size = u32();
+        check(size);
+        std::string s(position_, size);
+        position_ += size;
+        return s;
+    }
+
+    uint8_t u8() {
+        uint8_t value;
+        bytes(&value, sizeof(value));
+        return value;
+    }
+
+    uint32_t u32() {
+        uint32_t value;
+        bytes(&value, sizeof(value));
+        return value;
+    }
+
+    void bytes(void *out, size_t size) {
+        check(size);
+        std::memcpy(out, position_, size);
+        position_ += size;
+    }
+
+    void check(size_t size) const {
+        if (size > static_cast<size_t>(end_ - position_)) {
+            throw std::runtime_error("truncated snapshot");
+        }
+    }
+
+    const char *position_;
+    const char *end_;
+    Environment::ptr globals_;
+    std::vector<std::vector<stmt::Function *>> functions_;
+    std::vector<Object> objects_;
+};
+
+} // namespace
+
+void Snapshot::write(Interpreter &interpreter, const std::string &path) {
+    std::string bytes = Encoder(interpreter).finish();
+    std::string temporary = path + ".tmp." + std::to_string(::getpid());
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!out.good()) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("can't write snapshot to '" + path + "'");
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("can't write snapshot to '" + path + "'");
+    }
+}
+
+void Snapshot::read(Interpreter *interpreter, const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("can't open snapshot '" + path + "'");
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("can't map snapshot '" + path + "'");
+    }
+    try {
+        Decoder(static_cast<const char *>(data), st.st_size).restore(interpreter);
+    } catch (const std::runtime_error &e) {
+        ::munmap(data, st.st_size);
+        throw std::runtime_error("snapshot '" + path + "': " + e.what());
+    }
+    ::munmap(data, st.st_size);
+}
@@ -0,0 +1,31 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <string>
+
+class Interpreter;
+
+/*
+ * Saves the heap a script has built, every top-level variable together with
+ * the environments, functions, classes, instances, strings and arrays it
+ * reaches, and brings it back in another process without running the script
+ * again. The image is relocatable: objects are numbered in an order where
+ * everything an object is created from comes first, and references are those
+ * numbers, never addresses. The programs the functions come from are embedded
+ * in the encoding of lox/program_cache.h. Builtins are saved by name and bound
+ * to the restoring interpreter's own.
+ *
+ * Channels and tasks can't be saved; both throw std::runtime_error, as do
+ * unreadable or damaged images.
+ */
+class Snapshot {
+ public:
+    // the interpreter must be between runs
+    static void write(Interpreter &interpreter, const std::string &path);
+
+    // replaces the script state of a freshly started or reset interpreter
+    static void read(Interpreter *interpreter, const std::string &path);
+};
@@ -0,0 +1,1419 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/ssa.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <unordered_set>
+#include <utility>
+
+namespace ssa {
+
+namespace {
+
+bool arithmetic(Op op) {
+    return op == Op::ADD || op == Op::SUB || op == Op::MUL || op == Op::DIV;
+}
+
+bool comparison(Op op) {
+    return op == Op::LESS || op == Op::LESS_EQUAL || op == Op::GREATER || op == Op::GREATER_EQUAL;
+}
+
+bool boolean(const Instr *instr) {
+    return instr->op == Op::NOT || instr->op == Op::EQUAL || instr->op == Op::NOT_EQUAL || comparison(instr->op) ||
+           (instr->op == Op::CONST && instr->constant.is<bool>());
+}
+
+bool number_constant(const Instr *instr, double value) {
+    return instr->op == Op::CONST && instr->constant.is<double>() && instr->constant.as<double>() == value;
+}
+
+const char *name(Op op) {
+    switch (op) {
+    case Op::CONST:
+        return "const";
+    case Op::PARAM:
+        return "param";
+    case Op::PHI:
+        return "phi";
+    case Op::ADD:
+        return "add";
+    case Op::SUB:
+        return "sub";
+    case Op::MUL:
+        return "mul";
+    case Op::DIV:
+        return "div";
+    case Op::NEG:
+        return "neg";
+    case Op::NOT:
+        return "not";
+    case Op::LESS:
+        return "less";
+    case Op::LESS_EQUAL:
+        return "less_equal";
+    case Op::GREATER:
+        return "greater";
+    case Op::GREATER_EQUAL:
+        return "greater_equal";
+    case Op::EQUAL:
+        return "equal";
+    case Op::NOT_EQUAL:
+        return "not_equal";
+    case Op::UNARY:
+        return "unary";
+    case Op::CAPTURE:
+        return "capture";
+    case Op::SET_CAPTURE:
+        return "set_capture";
+    case Op::GLOBAL:
+        return "global";
+    case Op::SET_GLOBAL:
+        return "set_global";
+    case Op::CHECK_INSTANCE:
+        return "check_instance";
+    case Op::GET:
+        return "get";
+    case Op::SET:
+        return "set";
+    case Op::SUPER:
+        return "super";
+    case Op::CALL:
+        return "call";
+    case Op::PRINT:
+        return "print";
+    case Op::IS_CLASS:
+        return "is_class";
+    case Op::GET_FIELD:
+        return "get_field";
+    case Op::CHECK_FIELD:
+        return "check_field";
+    case Op::SET_FIELD:
+        return "set_field";
+    }
+    return "?";
+}
+
+// a construct the IR doesn't model, the function keeps its closure tree
+struct Unsupported {};
+
+} // namespace
+
+/*
+ * Translates a function body to SSA in one pass over the AST, with the
+ * on-the-fly construction of Braun et al.: a local read in a block that
+ * doesn't assign it is looked up in its predecessors, through a phi where
+ * they join, and blocks whose predecessors aren't all known yet (loop
+ * headers, loop exits) are sealed once they are.
+ */
+class Builder {
+ public:
+    Builder(Function *function, Names &names) : function_(function), names_(names) {}
+
+    void build(stmt::Function *declaration) {
+        function_->name_ = declaration->name->lexeme;
+        function_->params_ = declaration->params.size();
+        const auto &statements = static_cast<stmt::Block *>(declaration->body.get())->statements;
+        find_objects(statements);
+        current_ = make_block();
+        sealed_.insert(current_);
+        for (size_t i = 0; i < declaration->params.size(); i++) {
+            Instr *param = emit(Op::PARAM, {});
+            param->index = i;
+            write(names_.parameter(i).local, current_, param);
+        }
+        // the parser always gives a function a block body
+        for (const auto &stmt : statements) {
+            statement(stmt.get());
+        }
+        ret(constant(Value()));
+    }
+
+ private:
+    // an instance a local is initialized with by a class call, replaced by the fields its init sets
+    struct Object {
+        struct Field {
+            // the argument the field is set to, -1 for a literal
+            int param;
+            Value literal;
+        };
+
+        const stmt::Class *klass;
+        const stmt::Function *initializer;
+        // the addresses of the fields, flag and real are the variables they are written to
+        std::map<std::string, Field> fields;
+        // whether the instance is replaced, what the call returned when it isn't
+        char flag;
+        char real;
+    };
+
+    // scalar replacement: finds the locals initialized with an instance that is only read and written fields of
+
+    void find_objects(const std::vector<stmt::Statement::ptr> &statements) {
+        for (const auto &stmt : statements) {
+            declare_objects(stmt.get());
+        }
+        for (const auto &stmt : statements) {
+            scan(stmt.get());
+        }
+    }
+
+    void declare_objects(const stmt::Statement *stmt) {
+        if (auto *var = dynamic_cast<const stmt::Var *>(stmt)) {
+            auto *call = dynamic_cast<const expr::Call *>(var->value.get());
+            const stmt::Class *klass = call != nullptr ? names_.constructs(call) : nullptr;
+            Names::Name name = names_.declaration(var);
+            Object object{klass, nullptr, {}, 0, 0};
+            if (klass != nullptr && name.kind == Names::LOCAL && initializes(klass, call->arguments.size(), object)) {
+                objects_.emplace(name.local, std::move(object));
+            }
+        } else if (auto *block = dynamic_cast<const stmt::Block *>(stmt)) {
+            for (const auto &item : block->statements) {
+                declare_objects(item.get());
+            }
+        } else if (auto *if_stmt = dynamic_cast<const stmt::If *>(stmt)) {
+            declare_objects(if_stmt->then_branch.get());
+            if (if_stmt->else_branch) {
+                declare_objects(if_stmt->else_branch.get());
+            }
+        } else if (auto *while_stmt = dynamic_cast<const stmt::While *>(stmt)) {
+            declare_objects(while_stmt->body.get());
+        } else if (auto *for_stmt = dynamic_cast<const stmt::For *>(stmt)) {
+            if (for_stmt->initializer) {
+                declare_objects(for_stmt->initializer.get());
+            }
+            declare_objects(for_stmt->body.get());
+        }
+    }
+
+    // whether the class's own init only sets fields of this to its parameters and literals
+    static bool initializes(const stmt::Class *klass, size_t arguments, Object &object) {
+        for (const auto &method : klass->methods) {
+            if (method->name->lexeme == "init") {
+                object.initializer = method.get();
+            }
+        }
+        if (object.initializer == nullptr || object.initializer->params.size() != arguments) {
+            return false;
+        }
+        const auto &params = object.initializer->params;
+        for (const auto &stmt : static_cast<stmt::Block *>(object.initializer->body.get())->statements) {
+            auto *expression_stmt = dynamic_cast<const stmt::Expression *>(stmt.get());
+            auto *set = expression_stmt != nullptr ? dynamic_cast<const expr::Set *>(expression_stmt->expression.get())
+                                                   : nullptr;
+            if (set == nullptr || dynamic_cast<const expr::This *>(set->object.get()) == nullptr) {
+                return false;
+            }
+            const expr::Expr *value = set->value.get();
+            while (auto *grouping = dynamic_cast<const expr::Grouping *>(value)) {
+                value = grouping->expression.get();
+            }
+            if (auto *literal = dynamic_cast<const expr::Literal *>(value)) {
+                object.fields[set->name->lexeme] = {-1, literal->value};
+                continue;
+            }
+            auto *variable = dynamic_cast<const expr::Variable *>(value);
+            auto param = std::find_if(params.begin(), params.end(), [variable](const Token::ptr &param) {
+                return variable != nullptr && param->lexeme == variable->name->lexeme;
+            });
+            if (param == params.end()) {
+                return false;
+            }
+            object.fields[set->name->lexeme] = {static_cast<int>(param - params.begin()), Value()};
+        }
+        return true;
+    }
+
+    // the replaced object whose field a Get or Set names, nullptr for any other object or name
+    Object *field_of(const expr::Expr *object, const Token::ptr &name) {
+        auto *variable = dynamic_cast<const expr::Variable *>(object);
+        if (variable == nullptr) {
+            return nullptr;
+        }
+        Object *found = local_object(names_.use(variable));
+        return found != nullptr && found->fields.count(name->lexeme) != 0 ? found : nullptr;
+    }
+
+    Object *local_object(const Names::Name &name) {
+        if (name.kind != Names::LOCAL) {
+            return nullptr;
+        }
+        auto found = objects_.find(name.local);
+        return found != objects_.end() ? &found->second : nullptr;
+    }
+
+    // drops the objects a use other than a field access of them lets escape
+    void scan(const stmt::Statement *stmt) {
+        if (auto *expression_stmt = dynamic_cast<const stmt::Expression *>(stmt)) {
+            scan(expression_stmt->expression.get());
+        } else if (auto *print = dynamic_cast<const stmt::Print *>(stmt)) {
+            scan(print->expression.get());
+        } else if (auto *var = dynamic_cast<const stmt::Var *>(stmt)) {
+            scan(var->value.get());
+        } else if (auto *block = dynamic_cast<const stmt::Block *>(stmt)) {
+            for (const auto &item : block->statements) {
+                scan(item.get());
+            }
+        } else if (auto *if_stmt = dynamic_cast<const stmt::If *>(stmt)) {
+            scan(if_stmt->condition.get());
+            scan(if_stmt->then_branch.get());
+            scan(if_stmt->else_branch.get());
+        } else if (auto *while_stmt = dynamic_cast<const stmt::While *>(stmt)) {
+            scan(while_stmt->condition.get());
+            scan(while_stmt->body.get());
+        } else if (auto *for_stmt = dynamic_cast<const stmt::For *>(stmt)) {
+            scan(for_stmt->initializer.get());
+            scan(for_stmt->condition.get());
+            scan(for_stmt->increment.get());
+            scan(for_stmt->body.get());
+        } else if (auto *return_stmt = dynamic_cast<const stmt::Return *>(stmt)) {
+            scan(return_stmt->value.get());
+        }
+    }
+
+    void scan(const expr::Expr *expr) {
+        if (auto *grouping = dynamic_cast<const expr::Grouping *>(expr)) {
+            scan(grouping->expression.get());
+        } else if (auto *unary = dynamic_cast<const expr::Unary *>(expr)) {
+            scan(unary->right.get());
+        } else if (auto *binary = dynamic_cast<const expr::Binary *>(expr)) {
+            scan(binary->left.get());
+            scan(binary->right.get());
+        } else if (auto *logical = dynamic_cast<const expr::Logical *>(expr)) {
+            scan(logical->left.get());
+            scan(logical->right.get());
+        } else if (auto *variable = dynamic_cast<const expr::Variable *>(expr)) {
+            escape(names_.use(variable));
+        } else if (auto *assign = dynamic_cast<const expr::Assign *>(expr)) {
+            escape(names_.use(assign));
+            scan(assign->value.get());
+        } else if (auto *call = dynamic_cast<const expr::Call *>(expr)) {
+            scan(call->callee.get());
+            for (const auto &argument : call->arguments) {
+                scan(argument.get());
+            }
+        } else if (auto *get = dynamic_cast<const expr::Get *>(expr)) {
+            if (field_of(get->object.get(), get->name) == nullptr) {
+                scan(get->object.get());
+            }
+        } else if (auto *set = dynamic_cast<const expr::Set *>(expr)) {
+            if (field_of(set->object.get(), set->name) == nullptr) {
+                scan(set->object.get());
+            }
+            scan(set->value.get());
+        }
+    }
+
+    void escape(const Names::Name &name) {
+        if (name.kind == Names::LOCAL) {
+            objects_.erase(name.local);
+        }
+    }
+
+    Block *make_block() {
+        Block *block = function_->make_block();
+        block->loop = loop_;
+        return block;
+    }
+
+    Instr *emit(Op op, std::vector<Instr *> args, Token::ptr token = nullptr) {
+        Instr *instr = function_->make(op, current_);
+        instr->args = std::move(args);
+        instr->token = std::move(token);
+        current_->instrs.push_back(instr);
+        return instr;
+    }
+
+    Instr *constant(Value value) {
+        Instr *instr = emit(Op::CONST, {});
+        instr->constant = std::move(value);
+        return instr;
+    }
+
+    // code after a jump or return goes to a block nothing enters, dropped once the function is built
+    void unreachable() {
+        current_ = make_block();
+        sealed_.insert(current_);
+    }
+
+    void jump(Block *target) {
+        current_->exit = Block::JUMP;
+        current_->targets[0] = target;
+        target->preds.push_back(current_);
+    }
+
+    void branch(Instr *condition, Block *then_block, Block *else_block) {
+        current_->exit = Block::BRANCH;
+        current_->operands = {condition};
+        current_->targets[0] = then_block;
+        current_->targets[1] = else_block;
+        then_block->preds.push_back(current_);
+        else_block->preds.push_back(current_);
+    }
+
+    void ret(Instr *value) {
+        current_->exit = Block::RETURN;
+        current_->operands = {value};
+        unreachable();
+    }
+
+    // SSA construction
+
+    void write(const void *variable, Block *block, Instr *value) {
+        defs_[block][variable] = value;
+    }
+
+    Instr *read(const void *variable, Block *block) {
+        auto &defs = defs_[block];
+        auto found = defs.find(variable);
+        if (found != defs.end()) {
+            return Function::resolve(found->second);
+        }
+        Instr *value;
+        if (sealed_.count(block) == 0) {
+            value = phi(block);
+            incomplete_[block].emplace_back(variable, value);
+        } else if (block->preds.size() == 1) {
+            value = read(variable, block->preds[0]);
+        } else if (block->preds.empty()) {
+            // read before any assignment reaches it, only in code nothing runs
+            value = function_->make(Op::CONST, block);
+            block->instrs.insert(block->instrs.begin(), value);
+        } else {
+            Instr *join = phi(block);
+            write(variable, block, join);
+            value = add_operands(variable, join);
+        }
+        write(variable, block, value);
+        return value;
+    }
+
+    Instr *phi(Block *block) {
+        Instr *instr = function_->make(Op::PHI, block);
+        block->phis.push_back(instr);
+        return instr;
+    }
+
+    Instr *add_operands(const void *variable, Instr *phi) {
+        for (Block *pred : phi->block->preds) {
+            phi->args.push_back(read(variable, pred));
+        }
+        return remove_trivial(phi);
+    }
+
+    // a phi of one value and itself is that value
+    static Instr *remove_trivial(Instr *phi) {
+        Instr *same = nullptr;
+        for (Instr *arg : phi->args) {
+            arg = Function::resolve(arg);
+            if (arg == same || arg == phi) {
+                continue;
+            }
+            if (same != nullptr) {
+                return phi;
+            }
+            same = arg;
+        }
+        if (same == nullptr) {
+            return phi;
+        }
+        phi->replacement = same;
+        return same;
+    }
+
+    void seal(Block *block) {
+        for (const auto &[variable, phi] : incomplete_[block]) {
+            add_operands(variable, phi);
+        }
+        incomplete_.erase(block);
+        sealed_.insert(block);
+    }
+
+    // statements
+
+    void statement(stmt::Statement *stmt) {
+        if (auto *expression_stmt = dynamic_cast<stmt::Expression *>(stmt)) {
+            if (dynamic_cast<expr::Break *>(expression_stmt->expression.get()) != nullptr) {
+                // a break outside a loop of this function leaves a loop in a caller
+                if (exits_.empty()) {
+                    throw Unsupported();
+                }
+                jump(exits_.back());
+                unreachable();
+                return;
+            }
+            expression(expression_stmt->expression.get());
+        } else if (auto *print = dynamic_cast<stmt::Print *>(stmt)) {
+            emit(Op::PRINT, {expression(print->expression.get())});
+        } else if (auto *var = dynamic_cast<stmt::Var *>(stmt)) {
+            Names::Name name = names_.declaration(var);
+            if (Object *object = local_object(name)) {
+                construct(static_cast<expr::Call *>(var->value.get()), *object);
+                return;
+            }
+            Instr *value = var->value ? expression(var->value.get()) : constant(Value());
+            if (name.kind != Names::LOCAL) {
+                throw Unsupported();
+            }
+            write(name.local, current_, value);
+        } else if (auto *block = dynamic_cast<stmt::Block *>(stmt)) {
+            for (const auto &item : block->statements) {
+                statement(item.get());
+            }
+        } else if (auto *if_stmt = dynamic_cast<stmt::If *>(stmt)) {
+            Instr *condition = expression(if_stmt->condition.get());
+            Block *then_block = make_block();
+            Block *else_block = if_stmt->else_branch ? make_block() : nullptr;
+            Block *join = make_block();
+            branch(condition, then_block, else_block != nullptr ? else_block : join);
+            seal(then_block);
+            current_ = then_block;
+            statement(if_stmt->then_branch.get());
+            jump(join);
+            if (else_block != nullptr) {
+                seal(else_block);
+                current_ = else_block;
+                statement(if_stmt->else_branch.get());
+                jump(join);
+            }
+            seal(join);
+            current_ = join;
+        } else if (auto *while_stmt = dynamic_cast<stmt::While *>(stmt)) {
+            loop(while_stmt->condition.get(), while_stmt->body.get(), nullptr);
+        } else if (auto *for_stmt = dynamic_cast<stmt::For *>(stmt)) {
+            if (for_stmt->initializer) {
+                statement(for_stmt->initializer.get());
+            }
+            loop(for_stmt->condition.get(), for_stmt->body.get(), for_stmt->increment.get());
+        } else if (auto *return_stmt = dynamic_cast<stmt::Return *>(stmt)) {
+            if (!return_stmt->value) {
+                ret(constant(Value()));
+                return;
+            }
+            if (!return_stmt->tail_call) {
+                ret(expression(return_stmt->value.get()));
+                return;
+            }
+            auto *call = static_cast<expr::Call *>(return_stmt->value.get());
+            std::vector<Instr *> operands = {expression(call->callee.get())};
+            for (const auto &argument : call->arguments) {
+                operands.push_back(expression(argument.get()));
+            }
+            current_->exit = Block::TAIL_CALL;
+            current_->operands = std::move(operands);
+            current_->token = call->paren;
+            unreachable();
+        } else {
+            // nested functions and classes need closures over cells the IR doesn't have
+            throw Unsupported();
+        }
+    }
+
+    // the fields of a replaced object are set from the arguments, unless the callee turns out to be something else
+    // than the class, then the call is made instead
+    void construct(expr::Call *call, Object &object) {
+        std::vector<Instr *> args = {expression(call->callee.get())};
+        for (const auto &argument : call->arguments) {
+            args.push_back(expression(argument.get()));
+        }
+        for (auto &[name, field] : object.fields) {
+            write(&field, current_, field.param < 0 ? constant(field.literal) : args[field.param + 1]);
+        }
+        Instr *guard = emit(Op::IS_CLASS, {args[0]}, object.klass->name);
+        guard->initializer = object.initializer;
+        Block *replaced = make_block();
+        Block *allocated = make_block();
+        Block *join = make_block();
+        branch(guard, replaced, allocated);
+        seal(replaced);
+        seal(allocated);
+        current_ = replaced;
+        Instr *none = constant(Value());
+        Instr *yes = constant(true);
+        jump(join);
+        current_ = allocated;
+        Instr *instance = emit(Op::CALL, std::move(args), call->paren);
+        Instr *no = constant(false);
+        jump(join);
+        seal(join);
+        current_ = join;
+        Instr *flag = phi(join);
+        flag->args = {yes, no};
+        Instr *real = phi(join);
+        real->args = {none, instance};
+        write(&object.flag, current_, flag);
+        write(&object.real, current_, real);
+    }
+
+    // a while or for loop; its preheader, header and body blocks are the loop's, the exit belongs to the enclosing one
+    void loop(expr::Expr *condition, stmt::Statement *body, stmt::Statement *increment) {
+        Block *preheader = make_block();
+        jump(preheader);
+        seal(preheader);
+        current_ = preheader;
+        int parent = loop_;
+        loop_ = static_cast<int>(function_->loops_.size());
+        Block *header = make_block();
+        function_->loops_.push_back({preheader, header, parent});
+        jump(header);
+        current_ = header;
+        Instr *test = expression(condition);
+        Block *body_block = make_block();
+        Block *exit = make_block();
+        exit->loop = parent;
+        branch(test, body_block, exit);
+        seal(body_block);
+        current_ = body_block;
+        exits_.push_back(exit);
+        statement(body);
+        if (increment != nullptr) {
+            statement(increment);
+        }
+        exits_.pop_back();
+        jump(header);
+        seal(header);
+        loop_ = parent;
+        seal(exit);
+        current_ = exit;
+    }
+
+    // expressions
+
+    Instr *expression(expr::Expr *expr) {
+        if (auto *literal = dynamic_cast<expr::Literal *>(expr)) {
+            return constant(literal->value);
+        } else if (auto *grouping = dynamic_cast<expr::Grouping *>(expr)) {
+            return expression(grouping->expression.get());
+        } else if (auto *unary = dynamic_cast<expr::Unary *>(expr)) {
+            Instr *right = expression(unary->right.get());
+            switch (unary->op->kind) {
+            case Token::MINUS:
+                return emit(Op::NEG, {right}, unary->op);
+            case Token::BANG:
+                return emit(Op::NOT, {right}, unary->op);
+            default:
+                return emit(Op::UNARY, {right}, unary->op);
+            }
+        } else if (auto *binary = dynamic_cast<expr::Binary *>(expr)) {
+            return binary_expression(binary);
+        } else if (auto *logical = dynamic_cast<expr::Logical *>(expr)) {
+            // the left operand is the value when it decides, the right one otherwise
+            Instr *left = expression(logical->left.get());
+            Block *right_block = make_block();
+            Block *join = make_block();
+            if (logical->op->kind == Token::OR) {
+                branch(left, join, right_block);
+            } else {
+                branch(left, right_block, join);
+            }
+            seal(right_block);
+            current_ = right_block;
+            Instr *right = expression(logical->right.get());
+            jump(join);
+            seal(join);
+            current_ = join;
+            Instr *value = phi(join);
+            value->args = {left, right};
+            return remove_trivial(value);
+        } else if (auto *variable = dynamic_cast<expr::Variable *>(expr)) {
+            return load(names_.use(variable), variable->name);
+        } else if (auto *assign = dynamic_cast<expr::Assign *>(expr)) {
+            Instr *value = expression(assign->value.get());
+            Names::Name name = names_.use(assign);
+            if (name.kind == Names::LOCAL) {
+                write(name.local, current_, value);
+            } else if (name.kind == Names::CAPTURE) {
+                emit(Op::SET_CAPTURE, {value})->index = name.capture;
+            } else {
+                emit(Op::SET_GLOBAL, {value}, assign->name);
+            }
+            return value;
+        } else if (auto *call = dynamic_cast<expr::Call *>(expr)) {
+            std::vector<Instr *> args = {expression(call->callee.get())};
+            for (const auto &argument : call->arguments) {
+                args.push_back(expression(argument.get()));
+            }
+            return emit(Op::CALL, std::move(args), call->paren);
+        } else if (auto *get = dynamic_cast<expr::Get *>(expr)) {
+            if (Object *object = field_of(get->object.get(), get->name)) {
+                Instr *flag = read(&object->flag, current_);
+                Instr *real = read(&object->real, current_);
+                Instr *value = read(&object->fields.at(get->name->lexeme), current_);
+                return emit(Op::GET_FIELD, {flag, real, value}, get->name);
+            }
+            return emit(Op::GET, {expression(get->object.get())}, get->name);
+        } else if (auto *set = dynamic_cast<expr::Set *>(expr)) {
+            if (Object *object = field_of(set->object.get(), set->name)) {
+                Instr *flag = read(&object->flag, current_);
+                Instr *real = read(&object->real, current_);
+                emit(Op::CHECK_FIELD, {flag, real}, set->name);
+                Instr *value = expression(set->value.get());
+                emit(Op::SET_FIELD, {flag, real, value}, set->name);
+                write(&object->fields.at(set->name->lexeme), current_, value);
+                return value;
+            }
+            Instr *object = emit(Op::CHECK_INSTANCE, {expression(set->object.get())}, set->name);
+            Instr *value = expression(set->value.get());
+            emit(Op::SET, {object, value}, set->name);
+            return value;
+        } else if (auto *self = dynamic_cast<expr::This *>(expr)) {
+            return load(names_.use(self), self->name);
+        } else if (auto *super = dynamic_cast<expr::Super *>(expr)) {
+            Instr *superclass = load(names_.use(super), super->keyword);
+            Instr *instance = load(names_.super_this(super), super->keyword);
+            return emit(Op::SUPER, {superclass, instance}, super->method);
+        }
+        // a break inside an expression
+        throw Unsupported();
+    }
+
+    Instr *binary_expression(expr::Binary *binary) {
+        Instr *left = expression(binary->left.get());
+        Instr *right = expression(binary->right.get());
+        Op op;
+        switch (binary->op->kind) {
+        case Token::PLUS:
+            op = Op::ADD;
+            break;
+        case Token::MINUS:
+            op = Op::SUB;
+            break;
+        case Token::STAR:
+            op = Op::MUL;
+            break;
+        case Token::SLASH:
+            op = Op::DIV;
+            break;
+        case Token::LESS:
+            op = Op::LESS;
+            break;
+        case Token::LESS_EQUAL:
+            op = Op::LESS_EQUAL;
+            break;
+        case Token::GREATER:
+            op = Op::GREATER;
+            break;
+        case Token::GREATER_EQUAL:
+            op = Op::GREATER_EQUAL;
+            break;
+        case Token::EQUAL_EQUAL:
+            op = Op::EQUAL;
+            break;
+        case Token::BANG_EQUAL:
+            op = Op::NOT_EQUAL;
+            break;
+        default:
+            throw Unsupported();
+        }
+        return emit(op, {left, right}, binary->op);
+    }
+
+    Instr *load(const Names::Name &name, const Token::ptr &token) {
+        if (name.kind == Names::LOCAL) {
+            return read(name.local, current_);
+        }
+        if (name.kind == Names::CAPTURE) {
+            Instr *instr = emit(Op::CAPTURE, {}, token);
+            instr->index = name.capture;
+            instr->immutable = name.immutable;
+            return instr;
+        }
+        return emit(Op::GLOBAL, {}, token);
+    }
+
+    Function *function_;
+    Names &names_;
+    Block *current_{nullptr};
+    int loop_{-1};
+    // where a break in each enclosing loop goes
+    std::vector<Block *> exits_;
+    std::unordered_map<Block *, std::unordered_map<const void *, Instr *>> defs_;
+    std::unordered_map<Block *, std::vector<std::pair<const void *, Instr *>>> incomplete_;
+    std::unordered_set<Block *> sealed_;
+    std::unordered_map<const void *, Object> objects_;
+};
+
+std::unique_ptr<Function> Function::build(stmt::Function *function, Names &names) {
+    auto ir = std::make_unique<Function>();
+    try {
+        Builder(ir.get(), names).build(function);
+    } catch (const Unsupported &) {
+        return nullptr;
+    }
+    ir->remove_unreachable();
+    ir->normalize();
+    return ir;
+}
+
+Instr *Function::make(Op op, Block *block) {
+    instrs_.emplace_back();
+    Instr *instr = &instrs_.back();
+    instr->op = op;
+    instr->block = block;
+    instr->id = next_id_++;
+    return instr;
+}
+
+Block *Function::make_block() {
+    block_storage_.emplace_back();
+    Block *block = &block_storage_.back();
+    block->id = static_cast<int>(block_storage_.size()) - 1;
+    return block;
+}
+
+Instr *Function::resolve(Instr *instr) {
+    while (instr->replacement != nullptr) {
+        instr = instr->replacement;
+    }
+    return instr;
+}
+
+bool Function::removable(const Instr *instr) {
+    switch (instr->op) {
+    case Op::CONST:
+    case Op::PARAM:
+    case Op::PHI:
+    case Op::NOT:
+    case Op::EQUAL:
+    case Op::NOT_EQUAL:
+    case Op::CAPTURE:
+    case Op::IS_CLASS:
+        return true;
+    case Op::ADD:
+    case Op::SUB:
+    case Op::MUL:
+    case Op::DIV:
+    case Op::LESS:
+    case Op::LESS_EQUAL:
+    case Op::GREATER:
+    case Op::GREATER_EQUAL:
+        return instr->args[0]->number && instr->args[1]->number;
+    case Op::NEG:
+        return instr->args[0]->number;
+    default:
+        return false;
+    }
+}
+
+void Function::remove_unreachable() {
+    std::unordered_set<Block *> reachable;
+    std::vector<Block *> work = {&block_storage_.front()};
+    while (!work.empty()) {
+        Block *block = work.back();
+        work.pop_back();
+        if (!reachable.insert(block).second) {
+            continue;
+        }
+        for (Block *target : block->targets) {
+            if (target != nullptr) {
+                work.push_back(target);
+            }
+        }
+    }
+    for (Block &block : block_storage_) {
+        if (reachable.count(&block) == 0) {
+            continue;
+        }
+        for (size_t i = block.preds.size(); i-- > 0;) {
+            if (reachable.count(block.preds[i]) == 0) {
+                block.preds.erase(block.preds.begin() + static_cast<long>(i));
+                for (Instr *phi : block.phis) {
+                    phi->args.erase(phi->args.begin() + static_cast<long>(i));
+                }
+            }
+        }
+    }
+    order_blocks();
+}
+
+// reverse postorder from the entry, ids follow it
+void Function::order_blocks() {
+    std::vector<Block *> postorder;
+    std::unordered_set<Block *> visited;
+    std::function<void(Block *)> visit = [&](Block *block) {
+        visited.insert(block);
+        // the fall-through successor last, so it comes first in reverse postorder
+        for (int i = 1; i >= 0; i--) {
+            Block *target = block->targets[i];
+            if (target != nullptr && visited.count(target) == 0) {
+                visit(target);
+            }
+        }
+        postorder.push_back(block);
+    };
+    for (Block &block : block_storage_) {
+        block.id = -1;
+    }
+    visit(&block_storage_.front());
+    blocks_.assign(postorder.rbegin(), postorder.rend());
+    for (size_t i = 0; i < blocks_.size(); i++) {
+        blocks_[i]->id = static_cast<int>(i);
+    }
+}
+
+// drops replaced instructions and points every use at what replaced them
+void Function::normalize() {
+    auto live = [](const Instr *instr) {
+        return instr->replacement == nullptr;
+    };
+    for (Block *block : blocks_) {
+        block->phis.erase(std::stable_partition(block->phis.begin(), block->phis.end(), live), block->phis.end());
+        block->instrs.erase(std::stable_partition(block->instrs.begin(), block->instrs.end(), live),
+                            block->instrs.end());
+        for (auto *list : {&block->phis, &block->instrs}) {
+            for (Instr *instr : *list) {
+                for (Instr *&arg : instr->args) {
+                    arg = resolve(arg);
+                }
+            }
+        }
+        for (Instr *&operand : block->operands) {
+            operand = resolve(operand);
+        }
+    }
+}
+
+// copy propagation: assignments of one local to another already vanished into their values, what is left are phis
+// that only ever see one value
+void Function::propagate_copies() {
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (Block *block : blocks_) {
+            for (Instr *phi : block->phis) {
+                if (phi->replacement != nullptr) {
+                    continue;
+                }
+                Instr *same = nullptr;
+                bool trivial = true;
+                for (Instr *arg : phi->args) {
+                    arg = resolve(arg);
+                    if (arg == phi || arg == same) {
+                        continue;
+                    }
+                    if (same != nullptr) {
+                        trivial = false;
+                        break;
+                    }
+                    same = arg;
+                }
+                if (trivial && same != nullptr) {
+                    phi->replacement = same;
+                    changed = true;
+                }
+            }
+        }
+    }
+    normalize();
+}
+
+// which values are always doubles: constants, and arithmetic and phis of them; phis and arithmetic are assumed to be
+// until an operand shows otherwise, so loop counters are
+void Function::infer_numbers() {
+    for (Block *block : blocks_) {
+        for (Instr *phi : block->phis) {
+            phi->number = true;
+        }
+        for (Instr *instr : block->instrs) {
+            instr->number = arithmetic(instr->op) || instr->op == Op::NEG;
+        }
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        auto update = [&changed](Instr *instr) {
+            bool number;
+            switch (instr->op) {
+            case Op::CONST:
+                number = instr->constant.is<double>();
+                break;
+            case Op::PHI:
+                number = std::all_of(instr->args.begin(), instr->args.end(), [](const Instr *arg) {
+                    return arg->number;
+                });
+                break;
+            case Op::ADD:
+            case Op::SUB:
+            case Op::MUL:
+            case Op::DIV:
+                number = instr->args[0]->number && instr->args[1]->number;
+                break;
+            case Op::NEG:
+                number = instr->args[0]->number;
+                break;
+            default:
+                number = false;
+            }
+            if (number != instr->number) {
+                instr->number = number;
+                changed = true;
+            }
+        };
+        for (Block *block : blocks_) {
+            std::for_each(block->phis.begin(), block->phis.end(), update);
+            std::for_each(block->instrs.begin(), block->instrs.end(), update);
+        }
+    }
+}
+
+// constant folding and strength reduction, on numbers only so nothing that would throw is folded away
+void Function::simplify() {
+    for (Block *block : blocks_) {
+        for (size_t i = 0; i < block->instrs.size(); i++) {
+            Instr *instr = block->instrs[i];
+            // blocks come in reverse postorder, what replaced an operand has been decided unless it is a phi's
+            for (Instr *&arg : instr->args) {
+                arg = resolve(arg);
+            }
+            const std::vector<Instr *> &args = instr->args;
+            auto fold = [instr](Value value) {
+                instr->op = Op::CONST;
+                instr->constant = std::move(value);
+                instr->number = instr->constant.is<double>();
+                instr->args.clear();
+            };
+            bool constants = !args.empty() && std::all_of(args.begin(), args.end(), [](const Instr *arg) {
+                return arg->op == Op::CONST;
+            });
+            if (constants && (arithmetic(instr->op) || comparison(instr->op) || instr->op == Op::NEG) &&
+                removable(instr)) {
+                double a = args[0]->constant.as<double>();
+                double b = args.size() > 1 ? args[1]->constant.as<double>() : 0;
+                switch (instr->op) {
+                case Op::ADD:
+                    fold(a + b);
+                    break;
+                case Op::SUB:
+                    fold(a - b);
+                    break;
+                case Op::MUL:
+                    fold(a * b);
+                    break;
+                case Op::DIV:
+                    fold(a / b);
+                    break;
+                case Op::NEG:
+                    fold(-a);
+                    break;
+                case Op::LESS:
+                    fold(a < b);
+                    break;
+                case Op::LESS_EQUAL:
+                    fold(a <= b);
+                    break;
+                case Op::GREATER:
+                    fold(a > b);
+                    break;
+                default:
+                    fold(a >= b);
+                }
+            } else if (constants && (instr->op == Op::EQUAL || instr->op == Op::NOT_EQUAL)) {
+                bool equal = static_cast<bool>(args[0]->constant == args[1]->constant);
+                fold(instr->op == Op::EQUAL ? equal : !equal);
+            } else if (constants && instr->op == Op::NOT) {
+                fold(!args[0]->constant);
+            } else if (instr->op == Op::MUL && removable(instr) && (number_constant(args[0], 1) || number_constant(args[1], 1))) {
+                // x * 1 is x, NaN and signed zeros included
+                instr->replacement = number_constant(args[0], 1) ? args[1] : args[0];
+            } else if (instr->op == Op::MUL && removable(instr) && (number_constant(args[0], 2) || number_constant(args[1], 2))) {
+                Instr *x = number_constant(args[0], 2) ? args[1] : args[0];
+                instr->op = Op::ADD;
+                instr->args = {x, x};
+            } else if (instr->op == Op::DIV && removable(instr) && args[1]->op == Op::CONST) {
+                // dividing by a power of two multiplies by its reciprocal exactly
+                int exponent;
+                double divisor = args[1]->constant.as<double>();
+                if (std::isfinite(divisor) && std::abs(std::frexp(divisor, &exponent)) == 0.5 && exponent > -1020 &&
+                    exponent < 1020) {
+                    Instr *reciprocal = make(Op::CONST, block);
+                    reciprocal->constant = 1 / divisor;
+                    reciprocal->number = true;
+                    block->instrs.insert(block->instrs.begin() + static_cast<long>(i), reciprocal);
+                    i++;
+                    instr->op = Op::MUL;
+                    instr->args = {args[0], reciprocal};
+                }
+            } else if (instr->op == Op::SUB && removable(instr) && number_constant(args[1], 0) &&
+                       !std::signbit(args[1]->constant.as<double>())) {
+                instr->replacement = args[0];
+            } else if (instr->op == Op::NEG && args[0]->op == Op::NEG && args[0]->args[0]->number) {
+                instr->replacement = args[0]->args[0];
+            } else if (instr->op == Op::NOT && args[0]->op == Op::NOT && boolean(args[0]->args[0])) {
+                instr->replacement = args[0]->args[0];
+            }
+        }
+    }
+    normalize();
+}
+
+namespace {
+
+// the immediate dominator of every block, by id, with the iterative algorithm of Cooper, Harvey and Kennedy
+std::vector<Block *> dominators(const std::vector<Block *> &blocks) {
+    std::vector<Block *> idom(blocks.size(), nullptr);
+    idom[0] = blocks[0];
+    auto intersect = [&idom](Block *a, Block *b) {
+        while (a != b) {
+            while (a->id > b->id) {
+                a = idom[a->id];
+            }
+            while (b->id > a->id) {
+                b = idom[b->id];
+            }
+        }
+        return a;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 1; i < blocks.size(); i++) {
+            Block *dominator = nullptr;
+            for (Block *pred : blocks[i]->preds) {
+                if (idom[pred->id] != nullptr) {
+                    dominator = dominator == nullptr ? pred : intersect(pred, dominator);
+                }
+            }
+            if (idom[i] != dominator) {
+                idom[i] = dominator;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+// what identifies the result of a pure operation, equal keys mean equal results
+std::string value_key(const Instr *instr) {
+    std::string key = std::to_string(static_cast<int>(instr->op));
+    if (instr->op == Op::CONST) {
+        const Value &value = instr->constant;
+        if (value.is<double>()) {
+            double number = value.as<double>();
+            uint64_t bits;
+            std::memcpy(&bits, &number, sizeof(bits));
+            return key + ":d" + std::to_string(bits);
+        }
+        return key + ":" + value.type() + ":" + value.str();
+    }
+    for (const Instr *arg : instr->args) {
+        key += ":" + std::to_string(arg->id);
+    }
+    if (instr->op == Op::CAPTURE) {
+        key += ":" + std::to_string(instr->index);
+    }
+    if (instr->op == Op::IS_CLASS) {
+        key += ":" + std::to_string(reinterpret_cast<uintptr_t>(instr->initializer));
+    }
+    return key;
+}
+
+// what identifies the location a read of a field, capture or global sees
+std::string location_key(const Instr *instr) {
+    switch (instr->op) {
+    case Op::GET:
+        return "f" + std::to_string(instr->args[0]->id) + "." + instr->token->lexeme;
+    case Op::SET:
+        // the object checked to be an instance
+        return "f" + std::to_string(instr->args[0]->args[0]->id) + "." + instr->token->lexeme;
+    case Op::CAPTURE:
+    case Op::SET_CAPTURE:
+        return "c" + std::to_string(instr->index);
+    default:
+        return "g" + instr->token->lexeme;
+    }
+}
+
+} // namespace
+
+// global value numbering over the dominator tree for pure operations, repeated reads of a field, capture or global
+// along a path of blocks with single predecessors share the first unless something in between may have written it
+void Function::eliminate_common_subexpressions() {
+    std::vector<Block *> idom = dominators(blocks_);
+    std::vector<std::vector<Block *>> children(blocks_.size());
+    for (size_t i = 1; i < blocks_.size(); i++) {
+        children[idom[i]->id].push_back(blocks_[i]);
+    }
+    using Table = std::unordered_map<std::string, Instr *>;
+    std::function<void(Block *, Table, Table)> visit = [&](Block *block, Table values, Table locations) {
+        for (Instr *instr : block->instrs) {
+            for (Instr *&arg : instr->args) {
+                arg = resolve(arg);
+            }
+            bool pure = removable(instr) || arithmetic(instr->op) || comparison(instr->op) || instr->op == Op::NEG ||
+                        instr->op == Op::UNARY || instr->op == Op::CHECK_INSTANCE;
+            if (instr->op == Op::CAPTURE && !instr->immutable) {
+                pure = false;
+            }
+            if (pure && instr->op != Op::PARAM) {
+                auto [found, inserted] = values.emplace(value_key(instr), instr);
+                if (!inserted) {
+                    instr->replacement = found->second;
+                }
+                continue;
+            }
+            switch (instr->op) {
+            case Op::GET:
+            case Op::CAPTURE:
+            case Op::GLOBAL: {
+                auto [found, inserted] = locations.emplace(location_key(instr), instr);
+                if (!inserted) {
+                    instr->replacement = found->second;
+                }
+                break;
+            }
+            case Op::SET:
+            case Op::SET_FIELD: {
+                // another object may be the same instance, a store kills every read of its field
+                std::string field = "." + instr->token->lexeme;
+                for (auto it = locations.begin(); it != locations.end();) {
+                    const std::string &key = it->first;
+                    bool same_field = key[0] == 'f' && key.size() >= field.size() &&
+                                      key.compare(key.size() - field.size(), field.size(), field) == 0;
+                    it = same_field ? locations.erase(it) : std::next(it);
+                }
+                if (instr->op == Op::SET) {
+                    locations[location_key(instr)] = instr->args[1];
+                }
+                break;
+            }
+            case Op::SET_CAPTURE:
+            case Op::SET_GLOBAL:
+                locations[location_key(instr)] = instr->args[0];
+                break;
+            case Op::CALL:
+                locations.clear();
+                break;
+            default:
+                break;
+            }
+        }
+        for (Block *child : children[block->id]) {
+            visit(child, values, child->preds.size() == 1 ? locations : Table());
+        }
+    };
+    visit(blocks_[0], {}, {});
+    normalize();
+}
+
+// moves pure operations whose operands come from outside a loop to its preheader, innermost loops first; reads of
+// a field, capture or global the loop never writes or calls out around move too when the header would run them first
+void Function::hoist_loop_invariants() {
+    auto in_loop = [this](const Block *block, int loop) {
+        for (int l = block->loop; l != -1; l = loops_[l].parent) {
+            if (l == loop) {
+                return true;
+            }
+        }
+        return false;
+    };
+    for (int loop = static_cast<int>(loops_.size()) - 1; loop >= 0; loop--) {
+        Block *preheader = loops_[loop].preheader;
+        Block *header = loops_[loop].header;
+        if (header->id < 0 || preheader->id < 0) {
+            continue;
+        }
+        auto invariant = [&](const Instr *instr) {
+            return std::all_of(instr->args.begin(), instr->args.end(), [&](const Instr *arg) {
+                return !in_loop(arg->block, loop);
+            });
+        };
+        // what the loop may write
+        bool calls = false;
+        std::unordered_set<std::string> written;
+        for (Block *block : blocks_) {
+            if (!in_loop(block, loop)) {
+                continue;
+            }
+            for (const Instr *instr : block->instrs) {
+                if (instr->op == Op::CALL) {
+                    calls = true;
+                } else if (instr->op == Op::SET || instr->op == Op::SET_FIELD) {
+                    written.insert("." + instr->token->lexeme);
+                } else if (instr->op == Op::SET_CAPTURE || instr->op == Op::SET_GLOBAL) {
+                    written.insert(location_key(instr));
+                }
+            }
+        }
+        auto unwritten = [&](const Instr *instr) {
+            if (calls) {
+                return false;
+            }
+            if (instr->op == Op::GET) {
+                return written.count("." + instr->token->lexeme) == 0;
+            }
+            return written.count(location_key(instr)) == 0;
+        };
+        for (Block *block : blocks_) {
+            if (!in_loop(block, loop)) {
+                continue;
+            }
+            // until the header has done something that can be observed
+            bool first = block == header;
+            std::vector<Instr *> kept;
+            for (Instr *instr : block->instrs) {
+                bool read = instr->op == Op::GET || instr->op == Op::GLOBAL || instr->op == Op::CAPTURE;
+                bool hoist = instr->op != Op::PHI && invariant(instr) &&
+                             ((removable(instr) && (instr->op != Op::CAPTURE || instr->immutable)) ||
+                              (first && read && unwritten(instr)));
+                if (hoist) {
+                    instr->block = preheader;
+                    preheader->instrs.push_back(instr);
+                    continue;
+                }
+                if (!removable(instr)) {
+                    first = false;
+                }
+                kept.push_back(instr);
+            }
+            block->instrs = std::move(kept);
+        }
+    }
+}
+
+// a store to a field or capture overwritten further down the block, with nothing in between that could read it or
+// fail, is never seen
+void Function::eliminate_dead_stores() {
+    std::unordered_set<const Instr *> dead;
+    for (Block *block : blocks_) {
+        std::vector<Instr *> &instrs = block->instrs;
+        for (size_t i = 0; i < instrs.size(); i++) {
+            Instr *store = instrs[i];
+            if (store->op != Op::SET && store->op != Op::SET_CAPTURE) {
+                continue;
+            }
+            for (size_t j = i + 1; j < instrs.size(); j++) {
+                Instr *next = instrs[j];
+                if ((next->op == Op::SET || next->op == Op::SET_CAPTURE) && next->op == store->op &&
+                    location_key(next) == location_key(store)) {
+                    dead.insert(store);
+                    break;
+                }
+                bool harmless = removable(next) && (next->op != Op::CAPTURE || next->index != store->index ||
+                                                    store->op != Op::SET_CAPTURE);
+                if (next->op == Op::CHECK_INSTANCE && store->op == Op::SET && next->args[0] == store->args[0]) {
+                    harmless = true;
+                }
+                if (!harmless) {
+                    break;
+                }
+            }
+        }
+        instrs.erase(std::remove_if(instrs.begin(), instrs.end(),
+                                    [&dead](const Instr *instr) {
+                                        return dead.count(instr) != 0;
+                                    }),
+                     instrs.end());
+    }
+}
+
+// drops pure operations nothing uses, phis that only feed each other included
+void Function::eliminate_dead_code() {
+    std::unordered_set<const Instr *> live;
+    std::vector<Instr *> work;
+    auto mark = [&](Instr *instr) {
+        if (live.insert(instr).second) {
+            work.push_back(instr);
+        }
+    };
+    for (Block *block : blocks_) {
+        for (Instr *instr : block->instrs) {
+            if (!removable(instr)) {
+                mark(instr);
+            }
+        }
+        for (Instr *operand : block->operands) {
+            mark(operand);
+        }
+    }
+    while (!work.empty()) {
+        Instr *instr = work.back();
+        work.pop_back();
+        for (Instr *arg : instr->args) {
+            mark(arg);
+        }
+    }
+    auto dead = [&live](const Instr *instr) {
+        return live.count(instr) == 0 && instr->op != Op::PARAM;
+    };
+    for (Block *block : blocks_) {
+        block->phis.erase(std::remove_if(block->phis.begin(), block->phis.end(), dead), block->phis.end());
+        block->instrs.erase(std::remove_if(block->instrs.begin(), block->instrs.end(), dead), block->instrs.end());
+    }
+}
+
+void Function::optimize() {
+    propagate_copies();
+    infer_numbers();
+    simplify();
+    propagate_copies();
+    infer_numbers();
+    eliminate_common_subexpressions();
+    propagate_copies();
+    hoist_loop_invariants();
+    eliminate_dead_stores();
+    eliminate_dead_code();
+}
+
+void Function::print(std::ostream &os) const {
+    auto value = [](const Instr *instr) {
+        return "v" + std::to_string(instr->id);
+    };
+    os << "function " << name_ << "(" << params_ << ")" << std::endl;
+    for (const Block *block : blocks_) {
+        os << "b" << block->id << ":";
+        if (!block->preds.empty()) {
+            os << "  ; preds";
+            for (const Block *pred : block->preds) {
+                os << " b" << pred->id;
+            }
+        }
+        if (block->loop >= 0) {
+            os << "  ; loop " << block->loop;
+        }
+        os << std::endl;
+        for (const auto *list : {&block->phis, &block->instrs}) {
+            for (const Instr *instr : *list) {
+                os << "    " << value(instr) << (instr->number ? ":num" : "") << " = " << name(instr->op);
+                if (instr->op == Op::CONST) {
+                    os << " " << (instr->constant.is<std::string>() ? "\"" + instr->constant.str() + "\""
+                                                                     : instr->constant.str());
+                }
+                if (instr->op == Op::PARAM || instr->op == Op::CAPTURE || instr->op == Op::SET_CAPTURE) {
+                    os << " " << instr->index;
+                }
+                if (instr->op == Op::GET || instr->op == Op::SET || instr->op == Op::GLOBAL ||
+                    instr->op == Op::SET_GLOBAL || instr->op == Op::SUPER || instr->op == Op::IS_CLASS ||
+                    instr->op == Op::GET_FIELD || instr->op == Op::CHECK_FIELD || instr->op == Op::SET_FIELD) {
+                    os << " " << instr->token->lexeme;
+                }
+                for (const Instr *arg : instr->args) {
+                    os << " " << value(arg);
+                }
+                os << std::endl;
+            }
+        }
+        switch (block->exit) {
+        case Block::JUMP:
+            os << "    jump b" << block->targets[0]->id << std::endl;
+            break;
+        case Block::BRANCH:
+            os << "    branch " << value(block->operands[0]) << " b" << block->targets[0]->id << " b"
+               << block->targets[1]->id << std::endl;
+            break;
+        case Block::RETURN:
+            os << "    return " << value(block->operands[0]) << std::endl;
+            break;
+        case Block::TAIL_CALL:
+            os << "    tail_call";
+            for (const Instr *operand : block->operands) {
+                os << " " << value(operand);
+            }
+            os << std::endl;
+            break;
+        }
+    }
+}
+
+} // namespace ssa
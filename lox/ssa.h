@@ -0,0 +1,210 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lox/expr.h"
+#include "lox/statement.h"
+#include "lox/token.h"
+#include "lox/value.h"
+
+/*
+ * A mid-level SSA form of one function, built from its resolved AST and
+ * optimized before a tier lowers it; the closure engine runs it in place of
+ * the function's closure tree.
+ *
+ * Locals become SSA values, assignments to them disappear into the values
+ * they assign and control flow joins them with phis. Everything else a
+ * function touches, captured variables, globals, fields and calls, stays an
+ * explicit operation on a Value, in evaluation order, carrying the token its
+ * errors are reported at. Passes only remove or move an operation when that
+ * can't be observed: nothing that may throw, call out or write is moved, and
+ * nothing that may throw is removed unless an identical operation that
+ * dominates it has already run.
+ *
+ * An instance the function creates and only reads and writes fields of is
+ * replaced by its fields: they become SSA values like locals, and the class
+ * call becomes a check that the callee still is the class whose init was
+ * looked at. Only when it isn't is the call made, and the field operations
+ * go to what it returned.
+ */
+namespace ssa {
+
+enum class Op {
+    CONST,
+    PARAM,
+    PHI,
+    // arithmetic, comparisons and negation, on doubles when their operands are numbers
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    NEG,
+    NOT,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL,
+    EQUAL,
+    NOT_EQUAL,
+    // any other unary operator, left to the interpreter
+    UNARY,
+    CAPTURE,
+    SET_CAPTURE,
+    GLOBAL,
+    SET_GLOBAL,
+    // throws unless its operand is an instance, before the value of a field assignment is evaluated
+    CHECK_INSTANCE,
+    GET,
+    SET,
+    SUPER,
+    CALL,
+    PRINT,
+    // true when its operand is a class with the initializer, the instance it would create is replaced
+    IS_CLASS,
+    // a field of an instance that is replaced unless the first operand is false, then the operation is made on the
+    // second: the value of the field, the check an assignment to it makes first, the assignment
+    GET_FIELD,
+    CHECK_FIELD,
+    SET_FIELD,
+};
+
+struct Block;
+
+struct Instr {
+    Op op;
+    std::vector<Instr *> args;
+    // of a CONST
+    Value constant;
+    // the parameter of a PARAM, the capture of a CAPTURE or SET_CAPTURE
+    size_t index{0};
+    // where errors are reported; the name of a global, field or super method, the paren of a call
+    Token::ptr token;
+    Block *block{nullptr};
+    // proved to always be a double
+    bool number{false};
+    // a CAPTURE of a variable nothing assigns, it reads the same value all through a call
+    bool immutable{false};
+    // of an IS_CLASS
+    const stmt::Function *initializer{nullptr};
+    // what a removed instruction's uses read instead
+    Instr *replacement{nullptr};
+    int id{0};
+};
+
+struct Block {
+    // how control leaves the block
+    enum Exit { JUMP, BRANCH, RETURN, TAIL_CALL };
+
+    int id{0};
+    std::vector<Block *> preds;
+    // phi operands are in the order of preds
+    std::vector<Instr *> phis;
+    std::vector<Instr *> instrs;
+    Exit exit{JUMP};
+    // the condition of a BRANCH, the value of a RETURN, the callee and arguments of a TAIL_CALL
+    std::vector<Instr *> operands;
+    // JUMP goes to the first, BRANCH to the first when its condition is truthy
+    Block *targets[2]{nullptr, nullptr};
+    // the paren of a TAIL_CALL
+    Token::ptr token;
+    // the innermost loop the block belongs to, -1 outside loops
+    int loop{-1};
+};
+
+struct Loop {
+    // the only block outside the loop that enters it
+    Block *preheader;
+    Block *header;
+    int parent{-1};
+};
+
+// where the builder finds the variables and classes a function names, answered by the tier that runs it
+class Names {
+ public:
+    enum Kind { LOCAL, CAPTURE, GLOBAL };
+
+    struct Name {
+        Kind kind;
+        // identifies a LOCAL
+        const void *local{nullptr};
+        // of a CAPTURE
+        size_t capture{0};
+        // a CAPTURE of a variable nothing assigns
+        bool immutable{false};
+    };
+
+    virtual ~Names() = default;
+
+    // the variable read or written by a Variable, Assign or This, or the superclass of a Super
+    virtual Name use(const expr::Expr *expr) = 0;
+    // the instance a Super binds to
+    virtual Name super_this(const expr::Super *expr) = 0;
+    virtual Name declaration(const stmt::Var *var) = 0;
+    // the local the i-th parameter of the function is bound to
+    virtual Name parameter(size_t i) = 0;
+    // the class declaration a call's callee names, when it names a global only one is known by; nullptr otherwise
+    virtual const stmt::Class *constructs(const expr::Call *call) = 0;
+};
+
+class Function {
+ public:
+    // the SSA form of function, nullptr when it declares functions or classes or breaks out of a loop in a caller
+    static std::unique_ptr<Function> build(stmt::Function *function, Names &names);
+
+    // runs the optimization pipeline: copy propagation, constant folding, strength reduction, common subexpression
+    // elimination, loop-invariant code motion, dead store and dead code elimination
+    void optimize();
+
+    void print(std::ostream &os) const;
+
+    // the blocks in reverse postorder, the entry first
+    const std::vector<Block *> &blocks() const {
+        return blocks_;
+    }
+
+    size_t params() const {
+        return params_;
+    }
+
+    // instr with the replacements made by the passes followed
+    static Instr *resolve(Instr *instr);
+
+    // a pure operation that can't throw, it can be moved or dropped when unused
+    static bool removable(const Instr *instr);
+
+ private:
+    friend class Builder;
+
+    Instr *make(Op op, Block *block);
+    Block *make_block();
+
+    void remove_unreachable();
+    void order_blocks();
+    void propagate_copies();
+    void infer_numbers();
+    void simplify();
+    void eliminate_common_subexpressions();
+    void hoist_loop_invariants();
+    void eliminate_dead_stores();
+    void eliminate_dead_code();
+    void normalize();
+
+    std::string name_;
+    size_t params_{0};
+    std::deque<Instr> instrs_;
+    std::deque<Block> block_storage_;
+    std::vector<Block *> blocks_;
+    std::vector<Loop> loops_;
+    int next_id_{0};
+};
+
+} // namespace ssa
@@ -11,6 +11,8 @@
 #include "lox/expr.h"
 #include "lox/value.h"
 
+class InlineBody;
+
 /*
  * program  ->  declaration* EOF
  *
@@ -72,13 +74,18 @@ class Statement {
     using ptr = std::shared_ptr<Statement>;
 
     virtual Value accept(Visitor *visitor) = 0;
+
+    // source line the statement starts on, for diagnostics and profiles
+    int line{0};
 };
 
 class Expression : public Statement {
  public:
     using ptr = std::shared_ptr<Expression>;
 
-    explicit Expression(expr::Expr::ptr expression) : expression(std::move(expression)) {}
+    explicit Expression(expr::Expr::ptr expression) : expression(std::move(expression)) {
+        this->line = this->expression->line;
+    }
     Value accept(Visitor *visitor) override {
         return visitor->visit_expression_stmt(this);
     }
@@ -89,7 +96,9 @@ class Expression : public Statement {
 class Print : public Statement {
  public:
     using ptr = std::shared_ptr<Print>;
-    explicit Print(expr::Expr::ptr expression) : expression(std::move(expression)) {}
+    explicit Print(expr::Expr::ptr expression) : expression(std::move(expression)) {
+        this->line = this->expression->line;
+    }
 
     Value accept(Visitor *visitor) override {
         return visitor->visit_print_stmt(this);
@@ -101,7 +110,9 @@ class Print : public Statement {
 class Var : public Statement {
  public:
     using ptr = std::shared_ptr<Var>;
-    Var(Token::ptr name, expr::Expr::ptr value) : name(std::move(name)), value(std::move(value)) {}
+    Var(Token::ptr name, expr::Expr::ptr value) : name(std::move(name)), value(std::move(value)) {
+        this->line = this->name->line;
+    }
 
     Value accept(Visitor *visitor) override {
         return visitor->visit_var_stmt(this);
@@ -122,6 +133,8 @@ class Block : public Statement {
     }
 
     std::vector<Statement::ptr> statements;
+    // cleared by the resolver when the block declares nothing, the interpreter then runs it in the enclosing scope
+    bool scoped{true};
 };
 
 class If : public Statement {
@@ -129,7 +142,9 @@ class If : public Statement {
     using ptr = std::shared_ptr<If>;
 
     If(expr::Expr::ptr condition, Statement::ptr then_branch, Statement::ptr else_branch)
-        : condition(std::move(condition)), then_branch(std::move(then_branch)), else_branch(std::move(else_branch)) {}
+        : condition(std::move(condition)), then_branch(std::move(then_branch)), else_branch(std::move(else_branch)) {
+        this->line = this->condition->line;
+    }
 
     Value accept(Visitor *visitor) override {
         return visitor->visit_if_stmt(this);
@@ -144,7 +159,9 @@ class While : public Statement {
  public:
     using ptr = std::shared_ptr<While>;
 
-    While(expr::Expr::ptr condition, Statement::ptr body) : condition(std::move(condition)), body(std::move(body)) {}
+    While(expr::Expr::ptr condition, Statement::ptr body) : condition(std::move(condition)), body(std::move(body)) {
+        this->line = this->condition->line;
+    }
 
     Value accept(Visitor *visitor) override {
         return visitor->visit_while_stmt(this);
@@ -160,7 +177,9 @@ class For : public Statement {
 
     For(Statement::ptr initializer, expr::Expr::ptr condition, Statement::ptr increment, Statement::ptr body)
         : initializer(std::move(initializer)), condition(std::move(condition)), increment(std::move(increment)),
-          body(std::move(body)) {}
+          body(std::move(body)) {
+        this->line = this->condition->line;
+    }
 
     Value accept(Visitor *visitor) override {
         return visitor->visit_for_stmt(this);
@@ -170,6 +189,9 @@ class For : public Statement {
     expr::Expr::ptr condition;
     Statement::ptr increment;
     Statement::ptr body;
+    // set by the resolver for `for (var i = start; i < bound; i = i + step)` with a literal or variable bound and a
+    // body that doesn't assign i, the interpreter then counts on a double
+    bool counted{false};
 };
 
 class Function : public Statement, public std::enable_shared_from_this<Function> {
@@ -177,6 +199,7 @@ class Function : public Statement, public std::enable_shared_from_this<Function>
     using ptr = std::shared_ptr<Function>;
 
     Function(Token::ptr name, std::vector<Token::ptr> params, Statement::ptr body) {
+        this->line = name->line;
         this->name = std::move(name);
         this->params = std::move(params);
         this->body = std::move(body);
@@ -189,6 +212,18 @@ class Function : public Statement, public std::enable_shared_from_this<Function>
     Token::ptr name;
     std::vector<Token::ptr> params;
     Statement::ptr body;
+    // set by the Inliner when the function is small enough to be evaluated in place of calling it
+    std::shared_ptr<const InlineBody> inline_body;
+    // set by the resolver for a function declared in a local scope that uses no enclosing local that is ever assigned;
+    // the interpreter then closes it over the top level and copies of the locals it uses instead of their scopes
+    bool lifted{false};
+    // those locals, its own name included when it calls itself
+    std::vector<std::string> captures;
+
+    // lifted and capturing nothing but itself: every run of the declaration yields the same function, in every engine
+    bool shared() const {
+        return lifted && (captures.empty() || (captures.size() == 1 && captures[0] == name->lexeme));
+    }
 };
 
 class Return : public Statement {
@@ -196,6 +231,7 @@ class Return : public Statement {
     using ptr = std::shared_ptr<Return>;
 
     Return(Token::ptr keyword, expr::Expr::ptr value) {
+        this->line = keyword->line;
         this->keyword = std::move(keyword);
         this->value = std::move(value);
     }
@@ -206,6 +242,8 @@ class Return : public Statement {
 
     Token::ptr keyword;
     expr::Expr::ptr value;
+    // set by the resolver when value is a call, the interpreter then reuses the caller's frame for it
+    bool tail_call{false};
 };
 
 class Class : public Statement {
@@ -213,6 +251,7 @@ class Class : public Statement {
     using ptr = std::shared_ptr<Class>;
 
     Class(Token::ptr name, expr::Variable::ptr super, std::vector<stmt::Function::ptr> methods) {
+        this->line = name->line;
         this->name = std::move(name);
         this->methods = std::move(methods);
         this->super = std::move(super);
@@ -0,0 +1,126 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#include "lox/tracer.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+bool Tracer::enabled_ = false;
+
+namespace {
+
+struct Event {
+    const char *name;
+    const char *category;
+    int line;
+    uint64_t start;
+    uint64_t duration;
+};
+
+struct Buffer {
+    std::vector<Event> events;
+    size_t next{0};
+    uint64_t overwritten{0};
+    int tid{0};
+};
+
+uint64_t min_duration_ns = 0;
+size_t buffer_capacity = 0;
+uint64_t epoch = 0;
+std::atomic<int> next_tid{1};
+
+thread_local Buffer buffer;
+
+std::mutex collected_mutex;
+std::vector<std::string> collected;
+
+std::string escape(const char *s) {
+    std::string out;
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            out += '\\';
+        }
+        if (static_cast<unsigned char>(*s) >= 0x20) {
+            out += *s;
+        }
+    }
+    return out;
+}
+
+std::string to_json(const Event &event, int tid) {
+    char timing[96];
+    std::snprintf(timing, sizeof(timing), "\"ts\":%.3f,\"dur\":%.3f", (event.start - epoch) / 1000.0,
+        event.duration / 1000.0);
+    std::string json = "{\"name\":\"" + escape(event.name) + "\",\"cat\":\"" + event.category + "\",\"ph\":\"X\"," +
+                       timing + ",\"pid\":1,\"tid\":" + std::to_string(tid);
+    if (event.line > 0) {
+        json += ",\"args\":{\"line\":" + std::to_string(event.line) + "}";
+    }
+    return json + "}";
+}
+
+} // namespace
+
+void Tracer::enable(uint64_t min_duration_us, size_t capacity) {
+    min_duration_ns = min_duration_us * 1000;
+    buffer_capacity = capacity;
+    epoch = now();
+    enabled_ = true;
+}
+
+void Tracer::complete(const char *name, const char *category, int line, uint64_t start_ns) {
+    uint64_t duration = now() - start_ns;
+    if (duration < min_duration_ns) {
+        return;
+    }
+    Event event{name, category, line, start_ns, duration};
+    if (buffer.events.size() < buffer_capacity) {
+        buffer.events.push_back(event);
+    } else {
+        buffer.events[buffer.next] = event;
+        buffer.next = (buffer.next + 1) % buffer_capacity;
+        buffer.overwritten++;
+    }
+}
+
+void Tracer::collect() {
+    if (buffer.tid == 0) {
+        buffer.tid = next_tid++;
+    }
+    std::vector<std::string> events;
+    events.reserve(buffer.events.size());
+    // oldest first: the slots after the write position were written before the ones in front of it
+    for (size_t i = 0; i < buffer.events.size(); i++) {
+        events.push_back(to_json(buffer.events[(buffer.next + i) % buffer.events.size()], buffer.tid));
+    }
+    if (buffer.overwritten > 0) {
+        events.push_back("{\"name\":\"overwritten spans\",\"ph\":\"C\",\"ts\":0,\"pid\":1,\"tid\":" +
+                         std::to_string(buffer.tid) + ",\"args\":{\"count\":" + std::to_string(buffer.overwritten) +
+                         "}}");
+    }
+    buffer.events.clear();
+    buffer.next = 0;
+    buffer.overwritten = 0;
+
+    std::lock_guard<std::mutex> lock(collected_mutex);
+    collected.insert(collected.end(), events.begin(), events.end());
+}
+
+bool Tracer::write(const std::string &path) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(collected_mutex);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"lox\"}}";
+    for (const auto &event : collected) {
+        out << ",\n" << event;
+    }
+    out << "\n]}\n";
+    return out.good();
+}
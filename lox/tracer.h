@@ -0,0 +1,63 @@
+//
+// Created by wy on 19.10.26.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Records Chrome trace events (the JSON format ui.perfetto.dev and
+ * chrome://tracing open). Finished spans go to a per-thread ring buffer of
+ * fixed records, so recording is a clock read and a store; when the buffer is
+ * full the oldest spans are overwritten. Names point into the AST until
+ * collect() turns the buffer into JSON, which must happen while the program
+ * is alive; Lox::execute does it when a run finishes.
+ */
+class Tracer {
+ public:
+    static void enable(uint64_t min_duration_us, size_t capacity);
+
+    static bool enabled() {
+        return enabled_;
+    }
+
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // a span of the given category that started at start_ns and ends now
+    static void complete(const char *name, const char *category, int line, uint64_t start_ns);
+
+    static void collect();
+    static bool write(const std::string &path);
+
+    // traces the lifetime of a scope when tracing is on
+    class Scope {
+     public:
+        Scope(const char *name, const char *category, int line)
+            : name_(name), category_(category), line_(line), start_(enabled_ ? now() : 0) {}
+        ~Scope() {
+            if (enabled_) {
+                complete(name_, category_, line_, start_);
+            }
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+     private:
+        const char *name_;
+        const char *category_;
+        int line_;
+        uint64_t start_;
+    };
+
+ private:
+    static bool enabled_;
+};
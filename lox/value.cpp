@@ -4,11 +4,16 @@
 
 #include "lox/value.h"
 
+#include <cmath>
 #include <string>
 
+#include "lox/alloc_profiler.h"
+#include "lox/channel.h"
 #include "lox/exception.h"
+#include "lox/float64_array.h"
 #include "lox/function.h"
 #include "lox/instance.h"
+#include "lox/isolate.h"
 #include "lox/klass.h"
 
 std::string Value::str() const {
@@ -20,8 +25,8 @@ std::string Value::str() const {
     }
     if (is<double>()) {
         auto decimal = as<double>();
-        double integer = round(decimal);
-        if (abs(integer - decimal) < 1e-9) {
+        double integer = std::round(decimal);
+        if (std::abs(integer - decimal) < 1e-9) {
             return std::to_string(static_cast<int64_t>(decimal));
         } else {
             return std::to_string(decimal);
@@ -42,6 +47,15 @@ std::string Value::str() const {
     if (is<LoxInstance::ptr>()) {
         return as<LoxInstance::ptr>()->str();
     }
+    if (is<Float64Array::ptr>()) {
+        return as<Float64Array::ptr>()->str();
+    }
+    if (is<Channel::ptr>()) {
+        return as<Channel::ptr>()->str();
+    }
+    if (is<Task::ptr>()) {
+        return as<Task::ptr>()->str();
+    }
     return "<unknown value type>";
 }
 
@@ -62,15 +76,23 @@ std::string format_type_error_message(const std::string &op, const std::string &
     return "unsupported operand(s) type for '" + op + "': '" + lhs_type + "' and '" + rhs_type + "'";
 }
 
+static std::string concat(const std::string &lhs, const std::string &rhs) {
+    std::string result = lhs + rhs;
+    if (result.capacity() > std::string().capacity()) {
+        AllocProfiler::record(AllocProfiler::STRING, result.capacity() + 1);
+    }
+    return result;
+}
+
 Value Value::operator+(const Value &rhs) const {
     if (is<std::string>() && rhs.is<std::string>()) {
-        return Value{as<std::string>() + rhs.as<std::string>()};
+        return Value{concat(as<std::string>(), rhs.as<std::string>())};
     }
     if (is<double>() && rhs.is<double>()) {
         return Value{as<double>() + rhs.as<double>()};
     }
     if (is<std::string>() && rhs.is<double>()) {
-        return Value{str() + rhs.str()};
+        return Value{concat(str(), rhs.str())};
     }
     throw TypeError(format_type_error_message("+", type(), rhs.type()));
 }
@@ -140,7 +162,10 @@ Value Value::operator!=(const Value &rhs) const {
     ACTION(Callable::ptr)  \
     ACTION(LoxFunction::ptr)  \
     ACTION(LoxClass::ptr)  \
-    ACTION(LoxInstance::ptr)
+    ACTION(LoxInstance::ptr)  \
+    ACTION(Float64Array::ptr)  \
+    ACTION(Channel::ptr)  \
+    ACTION(Task::ptr)
 
 Value Value::operator==(const Value &rhs) const {
 #define ACTION(type) if (is<type>() && rhs.is<type>()) return as<type>() == rhs.as<type>();
@@ -172,5 +197,14 @@ std::string Value::type() const {
     if (is<LoxInstance::ptr>()) {
         return as<LoxInstance::ptr>()->str();
     }
+    if (is<Float64Array::ptr>()) {
+        return "Float64Array";
+    }
+    if (is<Channel::ptr>()) {
+        return "Channel";
+    }
+    if (is<Task::ptr>()) {
+        return "Task";
+    }
     return value_.type().name();
 }
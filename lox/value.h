@@ -34,6 +34,11 @@ class Value {
         return value_.type() == typeid(T);
     }
 
+    // the held T without copying it, nullptr when the value holds another type
+    template <typename T> const T *get_if() const {
+        return std::any_cast<T>(&value_);
+    }
+
     operator bool() const;
 
     std::string str() const;
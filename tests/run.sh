@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+# usage: run.sh LOX SCRIPT
+#
+# Runs SCRIPT once for every "// run: FLAGS" line in it and compares what each
+# run prints, with a last "exit N" line when it fails, to the .out file next to
+# it. $CACHE in FLAGS is a directory of the script's own, and a
+# "// damage-cache: truncate" or "// damage-cache: overwrite" line spoils the
+# files the runs before it left there.
+set -u
+
+lox=$1
+script=$2
+expected=$(cat "${script%.lox}.out")
+cache=$(mktemp -d)
+trap 'rm -rf "$cache"' EXIT
+failed=0
+
+damage() {
+    local files=("$cache"/*.loxc)
+    if [ ! -e "${files[0]}" ]; then
+        echo "no cache file to damage"
+        failed=1
+        return
+    fi
+    for file in "${files[@]}"; do
+        local size
+        size=$(stat -c %s "$file")
+        case $1 in
+        truncate) truncate -s $((size / 2)) "$file" ;;
+        overwrite) printf 'garbage!' | dd of="$file" bs=1 seek=$((size / 2)) conv=notrunc status=none ;;
+        esac
+    done
+}
+
+while IFS= read -r line; do
+    case $line in
+    "// run:"*)
+        flags=${line#// run:}
+        flags=${flags//\$CACHE/$cache}
+        # shellcheck disable=SC2086
+        actual=$("$lox" $flags "$script" 2>&1 || echo "exit $?")
+        if [ "$actual" != "$expected" ]; then
+            echo "lox$flags $script:"
+            diff <(echo "$expected") <(echo "$actual")
+            failed=1
+        fi
+        ;;
+    "// damage-cache: "*)
+        damage "${line#// damage-cache: }"
+        ;;
+    esac
+done <"$script"
+
+exit $failed